@@ -0,0 +1,573 @@
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+#include "Config.h"
+#include "TestScene.h"
+#include "SceneGenerator.h"
+#include "CpuRenderer.h"
+#include "ImageIO.h"
+#include "Numa.h"
+#include "SceneReplicas.h"
+#include "SphereKernels.h"
+
+// Renders generated scenes of growing size and writes one JSON record per
+// scene, so runs on different commits and machines can be compared.
+
+struct Options
+{
+    std::vector<int> counts = { 1000, 10000, 100000, 1000000 };
+    std::vector<SceneLayout> layouts = { SceneLayout::Grid, SceneLayout::Uniform, SceneLayout::Clustered };
+    SceneDesc desc;
+    int width = 640;
+    int height = 360;
+    int frames = 8;
+    int warmup = 1;
+    int threads = 0;
+    bool pin = false;
+    TileOrder tileOrder = TileOrder::Rows;
+    // Also render every scene on 1, 2, 4... pinned threads per NUMA node and
+    // over all of them
+    bool scaling = false;
+    TraceSettings trace;
+    int rouletteDepth = kRussianRouletteDepth;
+    bool compareKernels = false;
+    // Seconds each sampler gets against the reference, 0 = no convergence runs
+    float convergence = 0;
+    int referenceFrames = 1024;
+    const char* simd = nullptr;
+    const char* label = "";
+    const char* output = "benchmark.json";
+};
+
+// One run of a scaling curve, on the processors of one NUMA node or of all
+// nodes filled one after the other
+struct ScalingPoint
+{
+    int node;   // -1 for all nodes
+    int threads;
+    double msPerFrame;
+    double mraysPerSecond;
+    // Over the single thread run of the same curve
+    double speedup;
+};
+
+struct Result
+{
+    SceneLayout layout;
+    // Instanced spheres included
+    int64_t sphereCount;
+    int materialCount;
+    int nodeCount;
+    int instanceCount;
+    int instanceNodeCount;
+    double generateMs;
+    double buildMs;
+    double msPerFrame;
+    double mraysPerSecond;
+    double mraysPerFrame;
+    double depthMraysPerFrame[kMaxDepth];
+    // Same frames with the generic trace kernel, 0 without --compare-kernels
+    double genericMsPerFrame;
+    char traceKernel[64];
+    // Frames each sampler got through in the convergence time and its RMSE
+    // against the reference, with --convergence
+    int convergenceFrames[kSamplerTypeCount];
+    double convergenceRmse[kSamplerTypeCount];
+    std::vector<ScalingPoint> scaling;
+    size_t sceneBytes;
+    size_t peakBytes;
+};
+
+static void PrintUsage()
+{
+    printf("Usage: Benchmark [options]\n"
+           "  --counts LIST   small sphere counts (default 1000,10000,100000,1000000)\n"
+           "  --layouts LIST  grid, uniform, clustered (default all)\n"
+           "  --mix D,M,G[,E] diffuse, metal, glass and emissive weights (default 0.8,0.15,0.05,0)\n"
+           "  --palette N     share N materials between the spheres, 0 = one each (default 0)\n"
+           "  --cluster N     place the small spheres as instances of one cluster of N spheres\n"
+           "  --seed N        scene seed (default 1)\n"
+           "  --width N       image width (default 640)\n"
+           "  --height N      image height (default 360)\n"
+           "  --frames N      timed frames per scene (default 8)\n"
+           "  --warmup N      untimed frames per scene (default 1)\n"
+           "  --threads N     worker threads, 0 = all cores (default 0)\n"
+           "  --pin           pin the threads to cores one NUMA node after the other, each node\n"
+           "                  tracing its own copy of the scene\n"
+           "  --tile-order O  rows, morton or hilbert order of the tiles handed to the threads (default rows)\n"
+           "  --scaling       also time every scene on 1, 2, 4... pinned threads of each NUMA node and,\n"
+           "                  with several nodes, of all nodes filled one after the other\n"
+           "  --simd NAME     sphere kernels: scalar, sse, avx2, avx512 or off (default widest)\n"
+           "  --depth N       maximum bounces per path (default %d)\n"
+           "  --spp N         samples per pixel per frame (default %d)\n"
+           "  --roulette N    Russian roulette after N bounces, 0 = off (default %d)\n"
+           "  --compare-kernels also time every scene with the generic trace kernel\n"
+           "  --convergence S render every scene for S seconds with each sampler and\n"
+           "                  measure the RMSE against a high sample count reference\n"
+           "  --reference-frames N frames of the convergence reference (default 1024)\n"
+           "  --label TEXT    stored in the output, e.g. a commit or machine name\n"
+           "  --output FILE   JSON results (default benchmark.json)\n",
+           kMaxDepth, SAMPLES_PER_PIXEL, kRussianRouletteDepth);
+}
+
+static bool ParseCounts(const char* value, std::vector<int>& counts)
+{
+    counts.clear();
+    for (const char* p = value; *p; )
+    {
+        char* end;
+        long count = strtol(p, &end, 10);
+        if (end == p || count <= 0)
+            return false;
+        counts.push_back(int(count));
+        p = *end == ',' ? end + 1 : end;
+    }
+    return !counts.empty();
+}
+
+static bool ParseLayouts(const char* value, std::vector<SceneLayout>& layouts)
+{
+    layouts.clear();
+    char name[32];
+    for (const char* p = value; *p; )
+    {
+        size_t length = strcspn(p, ",");
+        if (length == 0 || length >= sizeof(name))
+            return false;
+        memcpy(name, p, length);
+        name[length] = 0;
+        SceneLayout layout;
+        if (!FindSceneLayout(name, layout))
+            return false;
+        layouts.push_back(layout);
+        p += p[length] ? length + 1 : length;
+    }
+    return !layouts.empty();
+}
+
+static bool ParseOptions(int argc, char** argv, Options& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!strcmp(arg, "--help"))
+            return false;
+        if (!strcmp(arg, "--compare-kernels"))
+        {
+            options.compareKernels = true;
+            continue;
+        }
+        if (!strcmp(arg, "--pin"))
+        {
+            options.pin = true;
+            continue;
+        }
+        if (!strcmp(arg, "--scaling"))
+        {
+            options.scaling = true;
+            continue;
+        }
+        if (!value)
+        {
+            fprintf(stderr, "Missing value for %s\n", arg);
+            return false;
+        }
+        bool valid = true;
+        if (!strcmp(arg, "--counts")) valid = ParseCounts(value, options.counts);
+        else if (!strcmp(arg, "--layouts")) valid = ParseLayouts(value, options.layouts);
+        else if (!strcmp(arg, "--mix")) valid = sscanf(value, "%f,%f,%f,%f", &options.desc.diffuse, &options.desc.metal, &options.desc.glass,
+                                                       &options.desc.emissive) >= 3;
+        else if (!strcmp(arg, "--palette")) options.desc.paletteSize = atoi(value);
+        else if (!strcmp(arg, "--cluster")) options.desc.clusterSize = atoi(value);
+        else if (!strcmp(arg, "--seed")) options.desc.seed = strtoull(value, nullptr, 10);
+        else if (!strcmp(arg, "--width")) options.width = atoi(value);
+        else if (!strcmp(arg, "--height")) options.height = atoi(value);
+        else if (!strcmp(arg, "--frames")) options.frames = atoi(value);
+        else if (!strcmp(arg, "--warmup")) options.warmup = atoi(value);
+        else if (!strcmp(arg, "--threads")) options.threads = atoi(value);
+        else if (!strcmp(arg, "--simd")) options.simd = value;
+        else if (!strcmp(arg, "--tile-order")) valid = FindTileOrder(value, options.tileOrder);
+        else if (!strcmp(arg, "--depth")) valid = (options.trace.maxDepth = atoi(value)) > 0;
+        else if (!strcmp(arg, "--spp")) valid = (options.trace.samplesPerPixel = atoi(value)) > 0;
+        else if (!strcmp(arg, "--roulette")) valid = (options.rouletteDepth = atoi(value)) >= 0;
+        else if (!strcmp(arg, "--convergence")) valid = (options.convergence = float(atof(value))) > 0;
+        else if (!strcmp(arg, "--reference-frames")) valid = (options.referenceFrames = atoi(value)) > 0;
+        else if (!strcmp(arg, "--label")) options.label = value;
+        else if (!strcmp(arg, "--output")) options.output = value;
+        else
+        {
+            fprintf(stderr, "Unknown option %s\n", arg);
+            return false;
+        }
+        if (!valid)
+        {
+            fprintf(stderr, "Invalid value for %s: %s\n", arg, value);
+            return false;
+        }
+        ++i;
+    }
+    float weights = options.desc.diffuse + options.desc.metal + options.desc.glass + options.desc.emissive;
+    return options.width > 0 && options.height > 0 && options.frames > 0 && options.warmup >= 0 && weights > 0;
+}
+
+///////////////////////////
+// Peak memory of the process. Linux can restart the high water mark through
+// clear_refs, so every scene gets its own peak; elsewhere it only grows and the
+// numbers are a running maximum over the sweep.
+static bool ResetPeakMemory()
+{
+#if defined(__linux__)
+    FILE* file = fopen("/proc/self/clear_refs", "w");
+    if (!file)
+        return false;
+    bool reset = fputs("5", file) >= 0;
+    reset &= fclose(file) == 0;
+    return reset;
+#else
+    return false;
+#endif
+}
+
+static size_t GetPeakMemory()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize;
+    return 0;
+#else
+#if defined(__linux__)
+    // VmHWM follows clear_refs resets, ru_maxrss does not
+    if (FILE* file = fopen("/proc/self/status", "r"))
+    {
+        char line[256];
+        size_t peak = 0;
+        while (fgets(line, sizeof(line), file))
+        {
+            unsigned long long kb;
+            if (sscanf(line, "VmHWM: %llu kB", &kb) == 1)
+                peak = size_t(kb) * 1024;
+        }
+        fclose(file);
+        if (peak)
+            return peak;
+    }
+#endif
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return size_t(usage.ru_maxrss);
+#else
+    return size_t(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+///////////////////////////
+static Result RunScene(const Options& options, SceneLayout layout, int count, ThreadPool& pool, const SphereKernels* kernels)
+{
+    typedef std::chrono::high_resolution_clock Clock;
+    Result result;
+    result.layout = layout;
+
+    SceneDesc desc = options.desc;
+    desc.layout = layout;
+    desc.sphereCount = count;
+
+    auto generateBegin = Clock::now();
+    std::vector<Sphere> spheres, prototype;
+    std::vector<Material> materials;
+    std::vector<Instance> instances;
+    GenerateScene(desc, spheres, materials, prototype, instances);
+    auto buildBegin = Clock::now();
+    TestScene scene(std::move(spheres), std::move(materials), prototype, std::move(instances));
+    auto buildEnd = Clock::now();
+    result.generateMs = std::chrono::duration<double, std::milli>(buildBegin - generateBegin).count();
+    result.buildMs = std::chrono::duration<double, std::milli>(buildEnd - buildBegin).count();
+
+    SceneView view = scene.GetView();
+    view.kernels = kernels;
+    result.sphereCount = view.sphereCount + scene.GetInstancedSphereCount();
+    result.materialCount = view.materialCount;
+    result.nodeCount = view.nodeCount;
+    result.instanceCount = view.instanceCount;
+    result.instanceNodeCount = view.instanceNodeCount;
+    result.sceneBytes = scene.GetMemorySize();
+
+    ComputeParams params;
+    params.camera = MakeCamera(float3(13, 2, 3), float3(0, 0, 0), float3(0, 1, 0), 20, float(options.width) / float(options.height), 0.1, 10);
+    params.count = view.sphereCount;
+    params.rouletteDepth = options.rouletteDepth;
+
+    // Seconds and rays over the timed frames
+    auto render = [&](ThreadPool& renderPool, bool specialized, double& time, double& rays)
+    {
+        CpuRenderer renderer(renderPool, options.width, options.height);
+        renderer.SetTraceSettings(options.trace);
+        renderer.SetSpecialized(specialized);
+        renderer.SetTileOrder(options.tileOrder);
+        SceneReplicas replicas;
+        if (renderPool.IsPinned())
+        {
+            replicas.Build(renderPool, view);
+            renderer.SetSceneReplicas(&replicas);
+        }
+        time = 0;
+        rays = 0;
+        for (int depth = 0; depth < kMaxDepth; ++depth)
+            result.depthMraysPerFrame[depth] = 0;
+        for (int frame = 0; frame < options.warmup + options.frames; ++frame)
+        {
+            params.frames = frame;
+            params.lerpFactor = float(frame) / float(frame + 1);
+            auto begin = Clock::now();
+            renderer.RenderFrame(view, params);
+            auto end = Clock::now();
+            if (frame >= options.warmup)
+            {
+                time += std::chrono::duration<double>(end - begin).count();
+                rays += double(renderer.GetRayCount());
+                for (int depth = 0; depth < kMaxDepth; ++depth)
+                    result.depthMraysPerFrame[depth] += renderer.GetDepthRayCounts()[depth] * 1.0e-6 / options.frames;
+            }
+        }
+        FormatTraceKernel(renderer.GetTraceKernel(), result.traceKernel, sizeof(result.traceKernel));
+    };
+
+    double time, rays;
+    // Before the main runs, which leave their per bounce rays and kernel in
+    // the result
+    if (options.scaling)
+    {
+        std::vector<std::vector<int>> nodes = GetNumaNodes();
+        std::vector<int> all;
+        for (const std::vector<int>& cpus : nodes)
+            all.insert(all.end(), cpus.begin(), cpus.end());
+        int curves = nodes.size() > 1 ? int(nodes.size()) + 1 : 1;
+        for (int curve = 0; curve < curves; ++curve)
+        {
+            const std::vector<int>& cpus = curve < int(nodes.size()) ? nodes[curve] : all;
+            double singleMs = 0;
+            for (int threads = 1; ; threads = threads * 2 < int(cpus.size()) ? threads * 2 : int(cpus.size()))
+            {
+                ThreadPool scalingPool(std::vector<int>(cpus.begin(), cpus.begin() + threads));
+                render(scalingPool, true, time, rays);
+                ScalingPoint point;
+                point.node = curve < int(nodes.size()) ? curve : -1;
+                point.threads = threads;
+                point.msPerFrame = time * 1000.0 / options.frames;
+                point.mraysPerSecond = rays / time * 1.0e-6;
+                if (threads == 1)
+                    singleMs = point.msPerFrame;
+                point.speedup = singleMs / point.msPerFrame;
+                result.scaling.push_back(point);
+                if (threads == int(cpus.size()))
+                    break;
+            }
+        }
+    }
+
+    result.genericMsPerFrame = 0;
+    if (options.compareKernels)
+    {
+        render(pool, false, time, rays);
+        result.genericMsPerFrame = time * 1000.0 / options.frames;
+    }
+    render(pool, true, time, rays);
+    result.msPerFrame = time * 1000.0 / options.frames;
+    result.mraysPerSecond = rays / time * 1.0e-6;
+    result.mraysPerFrame = rays / options.frames * 1.0e-6;
+    result.peakBytes = GetPeakMemory();
+
+    for (int i = 0; i < kSamplerTypeCount; ++i)
+    {
+        result.convergenceFrames[i] = 0;
+        result.convergenceRmse[i] = 0;
+    }
+    if (options.convergence > 0)
+    {
+        // Random sampler reference on frame numbers no timed run uses, so its
+        // noise is independent of theirs
+        CpuRenderer reference(pool, options.width, options.height);
+        reference.SetTraceSettings(options.trace);
+        for (int frame = 0; frame < options.referenceFrames; ++frame)
+        {
+            params.frames = (1 << 24) + frame;
+            params.lerpFactor = float(frame) / float(frame + 1);
+            reference.RenderFrame(view, params);
+        }
+
+        // Equal time per sampler, so a slower sequence has to earn its cost
+        for (int i = 0; i < kSamplerTypeCount; ++i)
+        {
+            TraceSettings settings = options.trace;
+            settings.sampler = SamplerType(i);
+            CpuRenderer renderer(pool, options.width, options.height);
+            renderer.SetTraceSettings(settings);
+            double time = 0;
+            int frame = 0;
+            for (; time < options.convergence; ++frame)
+            {
+                params.frames = frame;
+                params.lerpFactor = float(frame) / float(frame + 1);
+                auto begin = Clock::now();
+                renderer.RenderFrame(view, params);
+                time += std::chrono::duration<double>(Clock::now() - begin).count();
+            }
+            result.convergenceFrames[i] = frame;
+            result.convergenceRmse[i] = ComputeRMSE(renderer.GetImage(), reference.GetImage(), size_t(options.width) * options.height);
+        }
+    }
+    return result;
+}
+
+static bool WriteJson(const char* path, const Options& options, const std::vector<Result>& results,
+                      int threads, const char* kernels, bool peakPerScene)
+{
+    FILE* file = fopen(path, "w");
+    if (!file)
+        return false;
+
+    char date[32];
+    time_t now = time(nullptr);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"label\": \"");
+    for (const char* c = options.label; *c; ++c)
+    {
+        if (*c == '"' || *c == '\\')
+            fputc('\\', file);
+        if ((unsigned char)*c >= 0x20)
+            fputc(*c, file);
+    }
+    fprintf(file, "\",\n");
+    fprintf(file, "  \"date\": \"%s\",\n", date);
+    fprintf(file, "  \"threads\": %d,\n", threads);
+    fprintf(file, "  \"pinned\": %s,\n", options.pin ? "true" : "false");
+    fprintf(file, "  \"tile_order\": \"%s\",\n", GetTileOrderName(options.tileOrder));
+    fprintf(file, "  \"kernels\": \"%s\",\n", kernels);
+    fprintf(file, "  \"width\": %d,\n", options.width);
+    fprintf(file, "  \"height\": %d,\n", options.height);
+    fprintf(file, "  \"frames\": %d,\n", options.frames);
+    fprintf(file, "  \"warmup\": %d,\n", options.warmup);
+    fprintf(file, "  \"seed\": %llu,\n", (unsigned long long)options.desc.seed);
+    fprintf(file, "  \"mix\": [%g, %g, %g, %g],\n", options.desc.diffuse, options.desc.metal, options.desc.glass, options.desc.emissive);
+    fprintf(file, "  \"palette\": %d,\n", options.desc.paletteSize);
+    fprintf(file, "  \"cluster\": %d,\n", options.desc.clusterSize);
+    fprintf(file, "  \"max_depth\": %d,\n", options.trace.maxDepth);
+    fprintf(file, "  \"samples_per_pixel\": %d,\n", options.trace.samplesPerPixel);
+    fprintf(file, "  \"roulette_depth\": %d,\n", options.rouletteDepth);
+    fprintf(file, "  \"convergence_seconds\": %g,\n", options.convergence);
+    fprintf(file, "  \"reference_frames\": %d,\n", options.referenceFrames);
+    fprintf(file, "  \"peak_memory_per_scene\": %s,\n", peakPerScene ? "true" : "false");
+    fprintf(file, "  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const Result& r = results[i];
+        fprintf(file, "    { \"layout\": \"%s\", \"spheres\": %lld, \"materials\": %d, \"bvh_nodes\": %d, "
+                      "\"instances\": %d, \"instance_bvh_nodes\": %d, "
+                      "\"generate_ms\": %.3f, \"build_ms\": %.3f, \"ms_per_frame\": %.3f, "
+                      "\"mrays_per_s\": %.3f, \"mrays_per_frame\": %.4f, \"mrays_per_bounce\": [",
+                GetSceneLayoutName(r.layout), (long long)r.sphereCount, r.materialCount, r.nodeCount,
+                r.instanceCount, r.instanceNodeCount, r.generateMs, r.buildMs, r.msPerFrame,
+                r.mraysPerSecond, r.mraysPerFrame);
+        for (int depth = 0; depth < kMaxDepth; ++depth)
+            fprintf(file, "%s%.4f", depth ? ", " : "", r.depthMraysPerFrame[depth]);
+        fprintf(file, "], \"trace_kernel\": \"%s\", \"generic_ms_per_frame\": %.3f, \"convergence\": [",
+                r.traceKernel, r.genericMsPerFrame);
+        for (int s = 0; options.convergence > 0 && s < kSamplerTypeCount; ++s)
+            fprintf(file, "%s{ \"sampler\": \"%s\", \"frames\": %d, \"rmse\": %.6f }", s ? ", " : "",
+                    GetSamplerName(SamplerType(s)), r.convergenceFrames[s], r.convergenceRmse[s]);
+        fprintf(file, "], \"scaling\": [");
+        for (size_t p = 0; p < r.scaling.size(); ++p)
+        {
+            const ScalingPoint& point = r.scaling[p];
+            fprintf(file, "%s{ \"node\": %d, \"threads\": %d, \"ms_per_frame\": %.3f, \"mrays_per_s\": %.3f, \"speedup\": %.3f }",
+                    p ? ", " : "", point.node, point.threads, point.msPerFrame, point.mraysPerSecond, point.speedup);
+        }
+        fprintf(file, "], \"scene_bytes\": %llu, \"peak_memory_bytes\": %llu }%s\n",
+                (unsigned long long)r.sceneBytes, (unsigned long long)r.peakBytes,
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n");
+    fprintf(file, "}\n");
+    return fclose(file) == 0;
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    const SphereKernels* kernels = &GetSphereKernels();
+    if (options.simd)
+    {
+        kernels = strcmp(options.simd, "off") ? FindSphereKernels(options.simd) : nullptr;
+        if (!kernels && strcmp(options.simd, "off"))
+        {
+            fprintf(stderr, "Sphere kernels %s are not supported\n", options.simd);
+            return 1;
+        }
+    }
+
+    ThreadPool pool(options.threads, options.pin);
+    const char* kernelName = kernels ? kernels->name : "off";
+    printf("%dx%d, %d+%d frames, %d threads, %s sphere kernels, seed %llu\n",
+           options.width, options.height, options.warmup, options.frames, pool.GetThreadCount(),
+           kernelName, (unsigned long long)options.desc.seed);
+
+    std::vector<Result> results;
+    bool peakPerScene = true;
+    for (SceneLayout layout : options.layouts)
+    {
+        for (int count : options.counts)
+        {
+            peakPerScene &= ResetPeakMemory();
+            Result r = RunScene(options, layout, count, pool, kernels);
+            printf("%-9s %9lld spheres: build %.2fms (generate %.2fms), %.2fms/frame, %.1fMrays/s, scene %.1fMB, peak %.1fMB\n",
+                   GetSceneLayoutName(layout), (long long)r.sphereCount, r.buildMs, r.generateMs, r.msPerFrame, r.mraysPerSecond,
+                   r.sceneBytes / 1048576.0, r.peakBytes / 1048576.0);
+            if (options.compareKernels)
+                printf("          trace kernel %s: %.2fms/frame, generic %.2fms/frame, %.2fx\n",
+                       r.traceKernel, r.msPerFrame, r.genericMsPerFrame, r.genericMsPerFrame / r.msPerFrame);
+            for (const ScalingPoint& point : r.scaling)
+            {
+                char curve[16] = "all nodes";
+                if (point.node >= 0)
+                    snprintf(curve, sizeof(curve), "node %d", point.node);
+                printf("          %-9s %3d threads: %.2fms/frame, %.1fMrays/s, %.2fx, %.0f%% efficiency\n", curve, point.threads,
+                       point.msPerFrame, point.mraysPerSecond, point.speedup, point.speedup * 100.0 / point.threads);
+            }
+            for (int s = 0; options.convergence > 0 && s < kSamplerTypeCount; ++s)
+                printf("          %-9s sampler: RMSE %.5f after %d frames\n", GetSamplerName(SamplerType(s)),
+                       r.convergenceRmse[s], r.convergenceFrames[s]);
+            results.push_back(r);
+        }
+    }
+
+    if (!WriteJson(options.output, options, results, pool.GetThreadCount(), kernelName, peakPerScene))
+    {
+        fprintf(stderr, "Failed to write %s\n", options.output);
+        return 1;
+    }
+    return 0;
+}
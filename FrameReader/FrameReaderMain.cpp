@@ -0,0 +1,191 @@
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "SharedFrameRing.h"
+
+// Reads the frames Headless --shm puts into a shared memory ring and streams
+// them on as raw RGBA, the way an encoder wrapper would:
+//
+//   FrameReader --name toy --raw | ffmpeg -f rawvideo -pix_fmt rgba -s 1280x720 -i - out.mp4
+//
+// The pixels are written straight from the ring, and every frame is released
+// as soon as it is out, so the renderer can reuse its slot.
+
+struct Options
+{
+    const char* name = nullptr;
+    const char* output = nullptr;
+    bool raw = false;
+    int frames = 0;
+    float wait = 10;
+    float timeout = 10;
+    int delayMs = 0;
+};
+
+static void PrintUsage()
+{
+    fprintf(stderr, "Usage: FrameReader --name NAME [options]\n"
+                    "  --name NAME     shared frame ring given to Headless --shm\n"
+                    "  --raw           write every frame as raw RGBA to stdout\n"
+                    "  --output FILE   write every frame as raw RGBA to FILE\n"
+                    "  --frames N      stop after N frames, 0 = until the renderer is done (default 0)\n"
+                    "  --wait S        seconds to wait for the ring to appear (default 10)\n"
+                    "  --timeout S     seconds to wait for a frame before giving up (default 10)\n"
+                    "  --delay-ms N    hold every frame for N more milliseconds, to act as a slow reader\n");
+}
+
+static bool ParseOptions(int argc, char** argv, Options& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!strcmp(arg, "--help"))
+            return false;
+        if (!strcmp(arg, "--raw"))
+        {
+            options.raw = true;
+            continue;
+        }
+        if (!value)
+        {
+            fprintf(stderr, "Missing value for %s\n", arg);
+            return false;
+        }
+        if (!strcmp(arg, "--name")) options.name = value;
+        else if (!strcmp(arg, "--output")) options.output = value;
+        else if (!strcmp(arg, "--frames")) options.frames = atoi(value);
+        else if (!strcmp(arg, "--wait")) options.wait = float(atof(value));
+        else if (!strcmp(arg, "--timeout")) options.timeout = float(atof(value));
+        else if (!strcmp(arg, "--delay-ms")) options.delayMs = atoi(value);
+        else
+        {
+            fprintf(stderr, "Unknown option %s\n", arg);
+            return false;
+        }
+        ++i;
+    }
+    if (!options.name)
+    {
+        fprintf(stderr, "--name is required\n");
+        return false;
+    }
+    if (options.raw && options.output)
+    {
+        fprintf(stderr, "--raw and --output both write the stream; pick one\n");
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    // Polls quietly while the renderer starts, then reports why on the last try
+    SharedFrameReader reader;
+    auto openBegin = std::chrono::high_resolution_clock::now();
+    while (!reader.Open(options.name, false))
+    {
+        if (std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - openBegin).count() >= options.wait)
+        {
+            if (!reader.Open(options.name))
+                return 1;
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    fprintf(stderr, "Reading %dx%d RGBA frames from %s\n", reader.GetWidth(), reader.GetHeight(), options.name);
+
+    FILE* file = nullptr;
+    if (options.raw)
+    {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        file = stdout;
+    }
+    else if (options.output)
+    {
+        file = fopen(options.output, "wb");
+        if (!file)
+        {
+            fprintf(stderr, "Failed to open %s\n", options.output);
+            return 1;
+        }
+    }
+
+    // Frame numbers are consecutive unless the writer dropped some
+    int frames = 0, gaps = 0;
+    int64_t firstFrame = 0, lastFrame = 0;
+    bool ok = true;
+    auto begin = std::chrono::high_resolution_clock::now();
+    SharedFrame frame;
+    while (options.frames <= 0 || frames < options.frames)
+    {
+        if (!reader.Acquire(frame, int(options.timeout * 1000.0f)))
+        {
+            if (!reader.IsFinished())
+            {
+                fprintf(stderr, "No frame within %.1fs\n", options.timeout);
+                ok = false;
+            }
+            break;
+        }
+        if (frames == 0)
+            firstFrame = frame.frame;
+        else if (frame.frame != lastFrame + 1)
+            ++gaps;
+        lastFrame = frame.frame;
+        ++frames;
+
+        if (file)
+        {
+            // Rows are tightly packed, so a frame goes out in one write
+            size_t rowBytes = size_t(frame.width) * 4;
+            bool written = true;
+            if (size_t(frame.stride) == rowBytes)
+                written = fwrite(frame.pixels, rowBytes, size_t(frame.height), file) == size_t(frame.height);
+            else
+            {
+                for (int y = 0; y < frame.height && written; ++y)
+                    written = fwrite(frame.pixels + size_t(y) * frame.stride, 1, rowBytes, file) == rowBytes;
+            }
+            if (!written)
+            {
+                fprintf(stderr, "Failed to write frame %lld\n", (long long)frame.frame);
+                ok = false;
+                break;
+            }
+        }
+        if (options.delayMs > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(options.delayMs));
+        reader.Release();
+    }
+    double time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - begin).count();
+    if (file && file != stdout && fclose(file) != 0)
+    {
+        fprintf(stderr, "Failed to write %s\n", options.output);
+        ok = false;
+    }
+
+    fprintf(stderr, "Read %d frames", frames);
+    if (frames > 0)
+        fprintf(stderr, " (%lld to %lld)", (long long)firstFrame, (long long)lastFrame);
+    fprintf(stderr, " in %.2fs, %d gaps, %llu frames dropped by the renderer\n",
+            time, gaps, (unsigned long long)reader.GetDroppedCount());
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,895 @@
+#include <chrono>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "Config.h"
+#include "AccumFormat.h"
+#include "BatchRender.h"
+#include "TestScene.h"
+#include "CpuRenderer.h"
+#include "Denoiser.h"
+#include "Distributed.h"
+#include "FramePipeline.h"
+#include "ImageIO.h"
+#include "Profiler.h"
+#include "SphereKernels.h"
+#include "SceneFile.h"
+#include "SceneReplicas.h"
+#include "SharedFrameRing.h"
+#include "TiledRender.h"
+
+struct Options
+{
+    int width = kBackbufferWidth;
+    int height = kBackbufferHeight;
+    int frames = 150;
+    int threads = 0;
+    bool pin = false;
+    TileOrder tileOrder = TileOrder::Rows;
+    int reportInterval = 150;
+    const char* output = nullptr;
+    const char* simd = nullptr;
+    const char* scene = nullptr;
+    const char* reference = nullptr;
+    const char* tiled = nullptr;
+    const char* profileTrace = nullptr;
+    const char* profileCsv = nullptr;
+    const char* worker = nullptr;
+    const char* batch = nullptr;
+    const char* aovs = nullptr;
+    const char* frameOutput = nullptr;
+    const char* sharedName = nullptr;
+    int coordinatorPort = 0;
+    int unitFrames = 16;
+    int bands = 1;
+    float timeout = 120;
+    float memory = 256;
+    float adaptive = 0;
+    float targetRmse = 0;
+    float progressive = -1;
+    TraceSettings trace;
+    SceneDesc desc;
+    int rouletteDepth = kRussianRouletteDepth;
+    int animate = 0;
+    int framesInFlight = kFramesInFlight;
+    int sharedSlots = kFramesInFlight;
+    SharedFrameOverrun sharedOverrun = SharedFrameOverrun::Drop;
+    int accumFormat = kAccumFormatFp32;
+    bool generic = false;
+    bool verifySimd = false;
+    bool wavefront = false;
+    bool denoise = false;
+    bool ioCheck = false;
+    bool noNee = false;
+    bool clampRmse = false;
+};
+
+static void PrintUsage()
+{
+    printf("Usage: Headless [options]\n"
+           "  --width N       image width (default %d)\n"
+           "  --height N      image height (default %d)\n"
+           "  --frames N      frames to accumulate (default 150)\n"
+           "  --threads N     worker threads, 0 = all cores (default 0)\n"
+           "  --pin           pin the threads to cores one NUMA node after the other, each node\n"
+           "                  tracing its own copy of the scene\n"
+           "  --tile-order O  rows, morton or hilbert order of the tiles handed to the threads (default rows)\n"
+           "  --report N      print stats every N frames (default 150)\n"
+           "  --output FILE   write the final image, as PFM if FILE ends in .pfm, else as PPM\n"
+           "  --frame-out P   write every frame, with the run of '#' in P replaced by the frame number;\n"
+           "                  frames are encoded and written on their own threads while the next ones render\n"
+           "  --in-flight N   frames --frame-out may have queued before rendering waits (default %d)\n"
+           "  --io-check      fail when rendering ever waited for --frame-out or --shm\n"
+           "  --shm NAME      put every frame as 8 bit RGBA into a shared memory ring that FrameReader\n"
+           "                  or another process maps; tonemapped on the --frame-out encode thread\n"
+           "  --shm-slots N   frames the ring holds before the reader has to catch up (default %d)\n"
+           "  --shm-overrun P drop frames or block when the reader is behind (default drop)\n"
+           "  --scene FILE    map a scene file written by SceneConvert instead of building the test scene\n"
+           "  --spheres N     small spheres of the test scene, 0 = the classic 22x22 grid (default 0)\n"
+           "  --cluster N     place the small spheres as instances of one cluster of N spheres\n"
+           "  --emissive W    weight of small spheres that give off light, against 0.8 diffuse,\n"
+           "                  0.15 metal and 0.05 glass (default 0)\n"
+           "  --no-nee        find emitters only by scattering into them, without sampling them as lights\n"
+           "  --animate N     move the small spheres for the first N frames, refitting the BVH\n"
+           "                  every frame; accumulation restarts on every frame that moved them\n"
+           "  --simd NAME     sphere kernels: scalar, sse, avx2, avx512 or off (default widest)\n"
+           "  --verify-simd   check every supported kernel set against the per-sphere path\n"
+           "  --wavefront     trace in material sorted wavefronts instead of per pixel\n"
+           "  --depth N       maximum bounces per path (default %d)\n"
+           "  --spp N         samples per pixel per frame (default %d)\n"
+           "  --roulette N    Russian roulette after N bounces, 0 = off (default %d)\n"
+           "  --generic       trace with the generic kernel instead of one specialized for the scene\n"
+           "  --sampler NAME  random, sobol, r2 or bluenoise sample sequences (default random)\n"
+           "  --tiled FILE    render in bands that fit --memory straight into a PFM file,\n"
+           "                  resuming a killed render of the same image\n"
+           "  --memory MB     memory budget of a tiled render (default 256)\n"
+           "  --progressive MS trace the first frame after a restart at 1/16, 1/4 and then full\n"
+           "                  resolution, showing an image every MS milliseconds or after every pass if 0\n"
+           "  --adaptive T    stop sampling tiles whose RMS standard error is below T\n"
+           "  --denoise       filter the image guided by first-hit albedo, normal and depth;\n"
+           "                  --output and the RMSE against --reference use the filtered image\n"
+           "  --accum FORMAT  round the accumulated image through the GPU buffer format fp32, fp16\n"
+           "                  or rgb9e5 after every frame, to measure the error it adds (default fp32)\n"
+           "  --aovs PREFIX   write the first-hit AOVs to PREFIX_albedo.pfm, _normal.pfm and _depth.pfm\n"
+           "  --reference F   PFM image to measure RMSE against after every frame\n"
+           "  --target-rmse X stop once the RMSE against the reference drops to X\n"
+           "  --clamp-rmse    measure the RMSE on values clamped to [0, 1], as the image shows them\n"
+           "  --trace FILE    write a Chrome trace of the profiled scopes (needs kProfilerEnabled)\n"
+           "  --csv FILE      write per-frame profiler counters and zone times (needs kProfilerEnabled)\n"
+           "  --coordinator P serve the render to worker processes on TCP port P and write --output\n"
+           "  --worker H:P    render units for the coordinator at host H, port P (default %d)\n"
+           "  --unit-frames N frames per unit handed to a worker (default 16)\n"
+           "  --bands N       bands of scanlines the coordinator splits the image into (default 1)\n"
+           "  --timeout S     seconds before a worker's unit is given to another (default 120)\n"
+           "  --batch FILE    render every camera view listed in FILE, writing the images as they finish\n",
+           kBackbufferWidth, kBackbufferHeight, kFramesInFlight, kFramesInFlight, kMaxDepth, SAMPLES_PER_PIXEL, kRussianRouletteDepth, kDistributedPort);
+}
+
+static bool ParseOptions(int argc, char** argv, Options& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!strcmp(arg, "--help"))
+            return false;
+        if (!strcmp(arg, "--verify-simd"))
+        {
+            options.verifySimd = true;
+            continue;
+        }
+        if (!strcmp(arg, "--wavefront"))
+        {
+            options.wavefront = true;
+            continue;
+        }
+        if (!strcmp(arg, "--generic"))
+        {
+            options.generic = true;
+            continue;
+        }
+        if (!strcmp(arg, "--denoise"))
+        {
+            options.denoise = true;
+            continue;
+        }
+        if (!strcmp(arg, "--io-check"))
+        {
+            options.ioCheck = true;
+            continue;
+        }
+        if (!strcmp(arg, "--no-nee"))
+        {
+            options.noNee = true;
+            continue;
+        }
+        if (!strcmp(arg, "--clamp-rmse"))
+        {
+            options.clampRmse = true;
+            continue;
+        }
+        if (!strcmp(arg, "--pin"))
+        {
+            options.pin = true;
+            continue;
+        }
+        if (!value)
+        {
+            fprintf(stderr, "Missing value for %s\n", arg);
+            return false;
+        }
+        if (!strcmp(arg, "--width")) options.width = atoi(value);
+        else if (!strcmp(arg, "--height")) options.height = atoi(value);
+        else if (!strcmp(arg, "--frames")) options.frames = atoi(value);
+        else if (!strcmp(arg, "--threads")) options.threads = atoi(value);
+        else if (!strcmp(arg, "--report")) options.reportInterval = atoi(value);
+        else if (!strcmp(arg, "--output")) options.output = value;
+        else if (!strcmp(arg, "--simd")) options.simd = value;
+        else if (!strcmp(arg, "--scene")) options.scene = value;
+        else if (!strcmp(arg, "--spheres")) options.desc.sphereCount = atoi(value);
+        else if (!strcmp(arg, "--cluster")) options.desc.clusterSize = atoi(value);
+        else if (!strcmp(arg, "--emissive")) options.desc.emissive = float(atof(value));
+        else if (!strcmp(arg, "--animate")) options.animate = atoi(value);
+        else if (!strcmp(arg, "--tiled")) options.tiled = value;
+        else if (!strcmp(arg, "--memory")) options.memory = float(atof(value));
+        else if (!strcmp(arg, "--adaptive")) options.adaptive = float(atof(value));
+        else if (!strcmp(arg, "--reference")) options.reference = value;
+        else if (!strcmp(arg, "--target-rmse")) options.targetRmse = float(atof(value));
+        else if (!strcmp(arg, "--depth")) options.trace.maxDepth = atoi(value);
+        else if (!strcmp(arg, "--spp")) options.trace.samplesPerPixel = atoi(value);
+        else if (!strcmp(arg, "--roulette")) options.rouletteDepth = atoi(value);
+        else if (!strcmp(arg, "--tile-order"))
+        {
+            if (!FindTileOrder(value, options.tileOrder))
+            {
+                fprintf(stderr, "Unknown tile order %s\n", value);
+                return false;
+            }
+        }
+        else if (!strcmp(arg, "--sampler"))
+        {
+            if (!FindSampler(value, options.trace.sampler))
+            {
+                fprintf(stderr, "Unknown sampler %s\n", value);
+                return false;
+            }
+        }
+        else if (!strcmp(arg, "--trace")) options.profileTrace = value;
+        else if (!strcmp(arg, "--csv")) options.profileCsv = value;
+        else if (!strcmp(arg, "--coordinator")) options.coordinatorPort = atoi(value);
+        else if (!strcmp(arg, "--worker")) options.worker = value;
+        else if (!strcmp(arg, "--unit-frames")) options.unitFrames = atoi(value);
+        else if (!strcmp(arg, "--bands")) options.bands = atoi(value);
+        else if (!strcmp(arg, "--timeout")) options.timeout = float(atof(value));
+        else if (!strcmp(arg, "--batch")) options.batch = value;
+        else if (!strcmp(arg, "--aovs")) options.aovs = value;
+        else if (!strcmp(arg, "--progressive")) options.progressive = float(atof(value));
+        else if (!strcmp(arg, "--accum"))
+        {
+            if (!FindAccumFormat(value, options.accumFormat))
+            {
+                fprintf(stderr, "Unknown accumulation format %s\n", value);
+                return false;
+            }
+        }
+        else if (!strcmp(arg, "--frame-out")) options.frameOutput = value;
+        else if (!strcmp(arg, "--in-flight")) options.framesInFlight = atoi(value);
+        else if (!strcmp(arg, "--shm")) options.sharedName = value;
+        else if (!strcmp(arg, "--shm-slots")) options.sharedSlots = atoi(value);
+        else if (!strcmp(arg, "--shm-overrun"))
+        {
+            if (!FindSharedFrameOverrun(value, options.sharedOverrun))
+            {
+                fprintf(stderr, "Unknown overrun policy %s\n", value);
+                return false;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option %s\n", arg);
+            return false;
+        }
+        ++i;
+    }
+    if (options.adaptive > 0 && options.wavefront)
+    {
+        fprintf(stderr, "--adaptive does not work with --wavefront\n");
+        return false;
+    }
+    if (options.trace.maxDepth <= 0 || options.trace.samplesPerPixel <= 0)
+    {
+        fprintf(stderr, "--depth and --spp must be positive\n");
+        return false;
+    }
+    if (options.wavefront && (options.trace.maxDepth != kMaxDepth || options.trace.samplesPerPixel != SAMPLES_PER_PIXEL
+        || options.trace.sampler != kSamplerRandom))
+    {
+        fprintf(stderr, "--depth, --spp and --sampler do not work with --wavefront\n");
+        return false;
+    }
+    if (options.tiled && (options.wavefront || options.verifySimd || options.reference || options.memory <= 0))
+    {
+        fprintf(stderr, "--tiled does not work with --wavefront, --verify-simd or --reference\n");
+        return false;
+    }
+    if ((options.coordinatorPort > 0 || options.worker) && (options.wavefront || options.adaptive > 0 || options.tiled
+        || options.verifySimd || options.reference || options.unitFrames <= 0 || options.bands <= 0 || options.timeout <= 0))
+    {
+        fprintf(stderr, "--coordinator and --worker do not work with --wavefront, --adaptive, --tiled, --verify-simd or --reference\n");
+        return false;
+    }
+    if (options.batch && (options.tiled || options.verifySimd || options.reference || options.coordinatorPort > 0 || options.worker))
+    {
+        fprintf(stderr, "--batch does not work with --tiled, --verify-simd, --reference, --coordinator or --worker\n");
+        return false;
+    }
+    if (options.scene && (options.desc.sphereCount > 0 || options.desc.clusterSize > 0 || options.desc.emissive > 0))
+    {
+        fprintf(stderr, "--spheres, --cluster and --emissive describe a generated scene, not a --scene file\n");
+        return false;
+    }
+    if (options.animate > 0 && (options.scene || options.tiled || options.batch || options.coordinatorPort > 0 || options.worker
+        || options.verifySimd))
+    {
+        fprintf(stderr, "--animate does not work with --scene, --tiled, --batch, --coordinator, --worker or --verify-simd\n");
+        return false;
+    }
+    if (options.progressive >= 0 && (options.wavefront || options.adaptive > 0 || options.tiled || options.batch
+        || options.coordinatorPort > 0 || options.worker || options.verifySimd))
+    {
+        fprintf(stderr, "--progressive does not work with --wavefront, --adaptive, --tiled, --batch, --coordinator, --worker or --verify-simd\n");
+        return false;
+    }
+    if (options.accumFormat != kAccumFormatFp32 && (options.wavefront || options.adaptive > 0 || options.tiled || options.batch
+        || options.coordinatorPort > 0 || options.worker || options.verifySimd))
+    {
+        fprintf(stderr, "--accum does not work with --wavefront, --adaptive, --tiled, --batch, --coordinator, --worker or --verify-simd\n");
+        return false;
+    }
+    if ((options.denoise || options.aovs) && (options.wavefront || options.tiled || options.batch || options.coordinatorPort > 0
+        || options.worker || options.verifySimd))
+    {
+        fprintf(stderr, "--denoise and --aovs do not work with --wavefront, --tiled, --batch, --coordinator, --worker or --verify-simd\n");
+        return false;
+    }
+    std::string framePath;
+    if (options.frameOutput && (options.tiled || options.batch || options.coordinatorPort > 0 || options.worker || options.verifySimd
+        || options.framesInFlight <= 0 || !FormatImagePath(options.frameOutput, 0, 2, framePath)))
+    {
+        fprintf(stderr, "--frame-out needs a '#' in its path and does not work with --tiled, --batch, --coordinator, --worker or --verify-simd\n");
+        return false;
+    }
+    if (options.sharedName && (options.tiled || options.batch || options.coordinatorPort > 0 || options.worker || options.verifySimd
+        || options.framesInFlight <= 0 || options.sharedSlots <= 0))
+    {
+        fprintf(stderr, "--shm needs positive --shm-slots and does not work with --tiled, --batch, --coordinator, --worker or --verify-simd\n");
+        return false;
+    }
+    if (options.ioCheck && !options.frameOutput && !options.sharedName)
+    {
+        fprintf(stderr, "--io-check needs --frame-out or --shm\n");
+        return false;
+    }
+    if (options.coordinatorPort > 0 && options.worker)
+    {
+        fprintf(stderr, "A process is either the coordinator or a worker\n");
+        return false;
+    }
+    if ((options.profileTrace || options.profileCsv) && !IsProfilerEnabled())
+    {
+        fprintf(stderr, "--trace and --csv need a build with kProfilerEnabled 1\n");
+        return false;
+    }
+    if ((options.targetRmse > 0 || options.clampRmse) && !options.reference)
+    {
+        fprintf(stderr, "--target-rmse and --clamp-rmse need --reference\n");
+        return false;
+    }
+    return options.width > 0 && options.height > 0 && options.reportInterval > 0;
+}
+
+static void PrintStats(float time, float rayCount, int count, int frames)
+{
+    float avgTime = time / count;
+    float avgRayCounter = rayCount / count;
+    printf("%.2fms (%.1f FPS) %.1fMrays/s %.2fMrays/frame frames %i\n",
+           avgTime * 1000.0f,
+           1.f / avgTime,
+           avgRayCounter / avgTime * 1.0e-6f,
+           avgRayCounter * 1.0e-6f,
+           frames);
+}
+
+// Mrays/frame of each bounce and its share of the primary rays
+static void PrintDepthRays(const double* depthRays, int frames)
+{
+    printf("Rays per bounce:");
+    for (int depth = 0; depth < kMaxDepth && depthRays[depth] > 0; ++depth)
+        printf(" %d:%.3fM(%.0f%%)", depth, depthRays[depth] / frames * 1.0e-6, depthRays[depth] / depthRays[0] * 100.0);
+    printf("\n");
+}
+
+// Time step of an animated frame, and how fast the small spheres circle the
+// origin at most, in radians per second
+#define kAnimateStep (1.0f / 30.0f)
+#define kAnimateTurnSpeed 0.5f
+
+// Small spheres circle the origin at speeds of their own, bounce and pulse,
+// so neighbors drift apart and the BVH stretches until it gets rebuilt. The
+// ground and feature spheres stay put.
+static void AnimateSpheres(TestScene& scene, const std::vector<Sphere>& initial, float time)
+{
+    for (int i = 0; i < int(initial.size()); ++i)
+    {
+        Sphere sphere = initial[i];
+        if (sphere.radius >= 1.0f)
+            continue;
+        uint32_t hash = HashUint(uint32_t(i));
+        float speed = (float(hash & 0xffff) / 65535.0f * 2.0f - 1.0f) * kAnimateTurnSpeed;
+        float phase = float(hash >> 16) / 65535.0f * 2.0f * float(PI);
+        float c = cosf(time * speed), s = sinf(time * speed);
+        sphere.radius *= 1.0f + 0.25f * sinf(time * 3.0f + phase);
+        float bounce = fabsf(sinf(time * 4.0f + phase)) * 0.5f;
+        sphere.center = float3(c * sphere.center.x + s * sphere.center.z, sphere.radius + bounce, c * sphere.center.z - s * sphere.center.x);
+        scene.SetSphere(i, sphere);
+    }
+}
+
+// Renders the same frames with the per-sphere HitSphere loop and with every
+// kernel set the CPU supports, and compares the images bit for bit
+static int VerifySimd(const Options& options, const SceneView& sceneView, ThreadPool& pool, const ComputeParams& baseParams)
+{
+    auto render = [&](const SphereKernels* kernels, std::vector<float3>& image)
+    {
+        SceneView view = sceneView;
+        view.kernels = kernels;
+        CpuRenderer renderer(pool, options.width, options.height);
+        renderer.SetTraceSettings(options.trace);
+        renderer.SetSpecialized(!options.generic);
+        ComputeParams params = baseParams;
+        for (int frame = 0; frame < options.frames; ++frame)
+        {
+            params.frames = frame;
+            params.lerpFactor = float(frame) / float(frame + 1);
+            renderer.RenderFrame(view, params);
+        }
+        image.assign(renderer.GetImage(), renderer.GetImage() + size_t(options.width) * options.height);
+    };
+
+    std::vector<float3> reference, image;
+    render(nullptr, reference);
+
+    int failures = 0;
+    const char* names[] = { "scalar", "sse", "avx2", "avx512" };
+    for (const char* name : names)
+    {
+        const SphereKernels* kernels = FindSphereKernels(name);
+        if (!kernels)
+        {
+            printf("%-7s unsupported\n", name);
+            continue;
+        }
+        render(kernels, image);
+        bool match = memcmp(reference.data(), image.data(), reference.size() * sizeof(float3)) == 0;
+        printf("%-7s %s\n", name, match ? "match" : "MISMATCH");
+        failures += match ? 0 : 1;
+    }
+    return failures ? 1 : 0;
+}
+
+static bool WriteProfile(const Options& options)
+{
+    bool ok = true;
+    if (options.profileTrace && !WriteProfileTrace(options.profileTrace))
+    {
+        fprintf(stderr, "Failed to write %s\n", options.profileTrace);
+        ok = false;
+    }
+    if (options.profileCsv && !WriteProfileCsv(options.profileCsv))
+    {
+        fprintf(stderr, "Failed to write %s\n", options.profileCsv);
+        ok = false;
+    }
+    return ok;
+}
+
+static bool WriteAovs(const char* prefix, int width, int height, const PixelAovs* aovs)
+{
+    size_t count = size_t(width) * height;
+    std::vector<float3> albedo(count), normal(count), depth(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        albedo[i] = aovs[i].albedo;
+        normal[i] = aovs[i].normal;
+        depth[i] = float3(aovs[i].depth, aovs[i].depth, aovs[i].depth);
+    }
+    std::string path = prefix;
+    return WritePFM((path + "_albedo.pfm").c_str(), width, height, albedo.data())
+        && WritePFM((path + "_normal.pfm").c_str(), width, height, normal.data())
+        && WritePFM((path + "_depth.pfm").c_str(), width, height, depth.data());
+}
+
+static int RenderBatchJobs(const Options& options, const SceneView& view, ThreadPool& pool, const ComputeParams& params)
+{
+    std::vector<BatchJob> jobs;
+    if (!LoadBatchJobs(options.batch, jobs))
+        return 1;
+
+    CpuRenderer renderer(pool, options.width, options.height);
+    renderer.SetWavefront(options.wavefront);
+    renderer.SetAdaptive(options.adaptive);
+    renderer.SetTraceSettings(options.trace);
+    renderer.SetSpecialized(!options.generic);
+    renderer.SetTileOrder(options.tileOrder);
+    BatchStats stats;
+    bool ok = RenderBatch(renderer, view, params, jobs, stats, [&](int job, double time)
+    {
+        printf("%d/%d %s, %d samples in %.2fs\n", job + 1, int(jobs.size()), jobs[job].output.c_str(), jobs[job].samples, time);
+    });
+    printf("%d images in %.2fs, %.1f frames/hour, %.1fMrays/s, encoding %.2fs (%.2fs waited on)\n",
+           stats.images, stats.seconds, stats.seconds > 0 ? stats.images / stats.seconds * 3600.0 : 0.0,
+           stats.seconds > 0 ? stats.rayCount / stats.seconds * 1.0e-6 : 0.0, stats.encodeSeconds, stats.waitSeconds);
+    return WriteProfile(options) && ok ? 0 : 1;
+}
+
+static int RenderCoordinator(const Options& options, const SceneView& view, const ComputeParams& params)
+{
+    DistributedJob job;
+    job.width = options.width;
+    job.height = options.height;
+    job.passes = options.frames;
+    job.passesPerUnit = options.unitFrames;
+    job.bands = options.bands;
+    job.trace = options.trace;
+    job.params = params;
+    job.sampleLights = view.lightCount > 0;
+    job.timeout = options.timeout;
+
+    auto begin = std::chrono::high_resolution_clock::now();
+    std::vector<float3> image;
+    DistributedStats stats;
+    uint64_t sceneHash = HashSceneView(view);
+    if (!RunCoordinator(options.coordinatorPort, job, sceneHash, image, stats))
+    {
+        fprintf(stderr, "The distributed render did not finish\n");
+        return 1;
+    }
+    float time = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - begin).count();
+    printf("%dx%d from %d units on %d workers (%d reassigned), %.2fs, %.1f samples/pixel\n",
+           options.width, options.height, stats.unitCount, stats.workerCount, stats.reassignedUnits, time,
+           double(stats.samples) / (double(options.width) * options.height));
+
+    if (options.output && !WriteImage(options.output, options.width, options.height, image.data()))
+    {
+        fprintf(stderr, "Failed to write %s\n", options.output);
+        return 1;
+    }
+    return 0;
+}
+
+static int RenderTiledImage(const Options& options, const SceneView& view, ThreadPool& pool, const ComputeParams& params)
+{
+    TiledRenderDesc desc;
+    desc.width = options.width;
+    desc.height = options.height;
+    desc.frames = options.frames;
+    desc.memoryBudget = size_t(double(options.memory) * 1048576.0);
+    desc.adaptive = options.adaptive;
+    desc.trace = options.trace;
+    desc.output = options.tiled;
+
+    auto begin = std::chrono::high_resolution_clock::now();
+    TiledRenderStats stats;
+    bool ok = RenderTiled(pool, view, params, desc, stats, [&](int band, int bandCount)
+    {
+        float time = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - begin).count();
+        printf("band %d/%d done, %.1fs\n", band + 1, bandCount, time);
+    });
+    float time = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - begin).count();
+    if (!ok)
+        return 1;
+    printf("%dx%d in %d bands of %d rows (%d resumed), %.2fs, %.1fMrays/s\n",
+           options.width, options.height, stats.bandCount, stats.bandHeight, stats.resumedBands,
+           time, time > 0 ? stats.rayCount / time * 1.0e-6f : 0.0f);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    // A mapped scene file is used in place; otherwise the test scene is built
+    auto buildBegin = std::chrono::high_resolution_clock::now();
+    std::unique_ptr<TestScene> scene;
+    SceneFile sceneFile;
+    if (options.scene)
+    {
+        if (!sceneFile.Open(options.scene))
+            return 1;
+    }
+    else
+    {
+        scene.reset(new TestScene(options.desc));
+    }
+    SceneView view = scene ? scene->GetView() : sceneFile.GetView();
+    auto buildEnd = std::chrono::high_resolution_clock::now();
+    int lightCount = view.lightCount;
+    if (options.noNee)
+        view.lightCount = 0;
+    if (options.simd)
+    {
+        view.kernels = strcmp(options.simd, "off") ? FindSphereKernels(options.simd) : nullptr;
+        if (!view.kernels && strcmp(options.simd, "off"))
+        {
+            fprintf(stderr, "Sphere kernels %s are not supported\n", options.simd);
+            return 1;
+        }
+    }
+    ThreadPool pool(options.threads, options.pin);
+    ComputeParams params;
+    params.camera = MakeCamera(float3(13, 2, 3), float3(0, 0, 0), float3(0, 1, 0), 20, float(options.width) / float(options.height), 0.1, 10);
+    params.count = view.sphereCount;
+    params.rouletteDepth = options.rouletteDepth;
+    if (options.batch)
+        return RenderBatchJobs(options, view, pool, params);
+    if (options.coordinatorPort > 0)
+        return RenderCoordinator(options, view, params);
+    if (options.worker)
+    {
+        // HOST:PORT, or just HOST for the default port
+        std::string host = options.worker;
+        int port = kDistributedPort;
+        size_t colon = host.rfind(':');
+        if (colon != std::string::npos)
+        {
+            port = atoi(host.c_str() + colon + 1);
+            host.resize(colon);
+        }
+        bool ok = RunWorker(host.c_str(), port, pool, view, !options.generic);
+        return WriteProfile(options) && ok ? 0 : 1;
+    }
+    if (options.tiled)
+    {
+        int result = RenderTiledImage(options, view, pool, params);
+        return WriteProfile(options) ? result : 1;
+    }
+
+    CpuRenderer renderer(pool, options.width, options.height);
+    renderer.SetWavefront(options.wavefront);
+    renderer.SetAdaptive(options.adaptive);
+    renderer.SetTraceSettings(options.trace);
+    renderer.SetSpecialized(!options.generic);
+    renderer.SetAovs(options.denoise || options.aovs);
+    renderer.SetAccumFormat(options.accumFormat);
+    renderer.SetProgressive(options.progressive >= 0, options.progressive);
+    renderer.SetTileOrder(options.tileOrder);
+    // Pinned threads trace a copy of the scene made on their own node
+    SceneReplicas replicas;
+    if (pool.IsPinned())
+    {
+        replicas.Build(pool, view);
+        renderer.SetSceneReplicas(&replicas);
+    }
+    printf("%d spheres, %d BVH nodes %s in %.2fms, %dx%d, %d threads, %s sphere kernels%s%s\n",
+           view.sphereCount, view.nodeCount, scene ? "built" : "mapped", std::chrono::duration<float, std::milli>(buildEnd - buildBegin).count(),
+           options.width, options.height, pool.GetThreadCount(), view.kernels ? view.kernels->name : "no",
+           options.wavefront ? ", wavefront" : "", options.adaptive > 0 ? ", adaptive" : "");
+    if (view.instanceCount > 0)
+        printf("%d instances with %lld spheres, %d top-level nodes, %.1fMB of scene data\n", view.instanceCount,
+               (long long)scene->GetInstancedSphereCount(), view.instanceNodeCount, scene->GetMemorySize() / (1024.0 * 1024.0));
+    if (pool.IsPinned())
+    {
+        std::vector<int> nodeThreads(pool.GetNodeCount(), 0);
+        for (int i = 0; i < pool.GetThreadCount(); ++i)
+            ++nodeThreads[pool.GetThreadNode(i)];
+        printf("Threads pinned on %d NUMA nodes (", pool.GetNodeCount());
+        for (int node = 0; node < pool.GetNodeCount(); ++node)
+            printf("%s%d", node ? " + " : "", nodeThreads[node]);
+        printf("), %.1fMB of scene copies\n", replicas.GetMemorySize() / (1024.0 * 1024.0));
+    }
+    if (lightCount > 0)
+        printf("%d emissive spheres, %s\n", lightCount,
+               options.noNee || options.wavefront ? "found by scattering only" : "sampled as lights at diffuse and fuzzy metal hits");
+    if (!options.wavefront)
+    {
+        char kernelName[128];
+        const TraceKernel& kernel = options.generic ? GetGenericTraceKernel() : SelectTraceKernel(view.materialTypes, options.trace);
+        FormatTraceKernel(kernel, kernelName, sizeof(kernelName));
+        printf("Trace kernel: %s, %s sampler\n", kernelName, GetSamplerName(options.trace.sampler));
+    }
+    if (options.accumFormat != kAccumFormatFp32)
+    {
+        // The GPU reads and writes the buffer once per frame and draws from it once
+        double pixels = double(options.width) * options.height;
+        int bytes = GetAccumPixelBytes(options.accumFormat);
+        printf("Accumulating as %s: %d bytes/pixel, %.1fMB buffer, %.1fMB/frame of GPU buffer traffic\n",
+               GetAccumFormatName(options.accumFormat), bytes, pixels * bytes / 1048576.0, 3.0 * pixels * bytes / 1048576.0);
+    }
+
+    std::vector<float3> reference;
+    if (options.reference)
+    {
+        int width, height;
+        if (!ReadPFM(options.reference, width, height, reference) || width != options.width || height != options.height)
+        {
+            fprintf(stderr, "%s is not a %dx%d PFM image\n", options.reference, options.width, options.height);
+            return 1;
+        }
+    }
+
+    if (options.verifySimd)
+        return VerifySimd(options, view, pool, params);
+
+    float totalTime = 0, intervalTime = 0;
+    double totalRays = 0, intervalRays = 0;
+    double depthRays[kMaxDepth] = {};
+    int intervalCount = 0;
+    int frames = 0;
+    // Frames in the image since the scene last changed
+    int accumulated = 0;
+    std::vector<Sphere> initialSpheres;
+    float commitTime = 0;
+    // Time from a restart to the first, coarse image and to the full one
+    int restarts = 0;
+    float firstImageTime = 0, fullImageTime = 0, firstImageRmse = 0;
+    auto countRays = [&]()
+    {
+        totalRays += double(renderer.GetRayCount());
+        intervalRays += double(renderer.GetRayCount());
+        for (int depth = 0; depth < kMaxDepth; ++depth)
+            depthRays[depth] += double(renderer.GetDepthRayCounts()[depth]);
+    };
+    if (options.animate > 0)
+        initialSpheres = scene->GetSpheres();
+    float rmse = 0;
+    bool reachedTarget = false;
+    auto measureRmse = [&](const float3* image)
+    {
+        return options.clampRmse ? ComputeClampedRMSE(image, reference.data(), reference.size())
+                                 : ComputeRMSE(image, reference.data(), reference.size());
+    };
+    SharedFrameWriter sharedOutput;
+    if (options.sharedName)
+    {
+        if (!sharedOutput.Create(options.sharedName, options.width, options.height, options.sharedSlots, options.sharedOverrun))
+            return 1;
+        printf("Shared frame ring %s: %d slots of %dx%d RGBA, %s on overrun\n", options.sharedName, options.sharedSlots,
+               options.width, options.height, GetSharedFrameOverrunName(options.sharedOverrun));
+    }
+    std::unique_ptr<FramePipeline> framePipeline;
+    if (options.frameOutput || options.sharedName)
+        framePipeline.reset(new FramePipeline(options.width, options.height, options.framesInFlight, options.frameOutput ? options.frameOutput : "",
+                                              options.sharedName ? &sharedOutput : nullptr));
+    Denoiser denoiser(pool);
+    DenoiseSettings denoiseSettings;
+    std::vector<float3> denoised;
+    float denoiseTime = 0;
+    auto denoise = [&]()
+    {
+        denoised.resize(size_t(options.width) * options.height);
+        auto begin = std::chrono::high_resolution_clock::now();
+        denoiser.Run(options.width, options.height, accumulated, renderer.GetImage(), renderer.GetAovs(), denoiseSettings, denoised.data());
+        denoiseTime = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - begin).count();
+    };
+    for (int frame = 0; frame < options.frames && !reachedTarget; ++frame)
+    {
+        if (frame < options.animate)
+        {
+            auto commitBegin = std::chrono::high_resolution_clock::now();
+            AnimateSpheres(*scene, initialSpheres, float(frame) * kAnimateStep);
+            scene->Commit(&pool);
+            const SphereKernels* kernels = view.kernels;
+            view = scene->GetView();
+            view.kernels = kernels;
+            if (options.noNee)
+                view.lightCount = 0;
+            if (pool.IsPinned())
+                replicas.Build(pool, view);
+            commitTime += std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - commitBegin).count();
+        }
+        // Accumulated frames are stale once the scene changed
+        if (scene && !scene->GetChanges().IsEmpty())
+        {
+            accumulated = 0;
+            scene->ClearChanges();
+        }
+        params.frames = accumulated;
+        params.lerpFactor = float(accumulated) / float(accumulated + 1);
+
+        ProfilerBeginFrame();
+        auto begin = std::chrono::high_resolution_clock::now();
+        renderer.RenderFrame(view, params);
+        if (options.progressive >= 0 && accumulated == 0)
+        {
+            // Progressive passes all belong to this frame; the RMSE of the
+            // first one is not part of the timing
+            auto first = std::chrono::high_resolution_clock::now();
+            firstImageTime += std::chrono::duration<float>(first - begin).count();
+            if (!reference.empty())
+                firstImageRmse += measureRmse(renderer.GetImage());
+            auto resume = std::chrono::high_resolution_clock::now();
+            while (!renderer.IsFrameComplete())
+            {
+                countRays();
+                renderer.RenderFrame(view, params);
+            }
+            begin += resume - first;
+            fullImageTime += std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - begin).count();
+            ++restarts;
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        ProfilerEndFrame();
+
+        float time = std::chrono::duration<float>(end - begin).count();
+        totalTime += time;
+        intervalTime += time;
+        countRays();
+        ++frames;
+        ++accumulated;
+
+        // Only the copy into a free slot is on this thread; encoding and
+        // writing overlap the frames after it
+        if (framePipeline)
+            framePipeline->Submit(renderer.GetImage(), frame);
+
+        // Not part of the timing; a denoised image counts from when its
+        // filter is done
+        if (!reference.empty())
+        {
+            if (options.denoise)
+                denoise();
+            rmse = measureRmse(options.denoise ? denoised.data() : renderer.GetImage());
+            reachedTarget = rmse <= options.targetRmse;
+        }
+
+        if (++intervalCount >= options.reportInterval || reachedTarget)
+        {
+            PrintStats(intervalTime, float(intervalRays), intervalCount, frame + 1);
+            if (renderer.IsAdaptive())
+                printf("  %d/%d tiles active\n", renderer.GetActiveTileCount(), renderer.GetTileCount());
+            if (!reference.empty() && options.denoise)
+                printf("  RMSE %.5f denoised after %.2fs (%.1fms filter)\n", rmse, totalTime + denoiseTime, denoiseTime * 1000.0f);
+            else if (!reference.empty())
+                printf("  RMSE %.5f after %.2fs\n", rmse, totalTime);
+            intervalTime = 0;
+            intervalRays = 0;
+            intervalCount = 0;
+        }
+    }
+    if (frames > 0)
+    {
+        printf("Total: ");
+        PrintStats(totalTime, float(totalRays), frames, frames);
+        PrintDepthRays(depthRays, frames);
+    }
+    if (options.animate > 0)
+        printf("Animated %d frames: %.2fms/frame to move and refit, %d background rebuilds, BVH cost %.1f, %d frames accumulated since\n",
+               options.animate < frames ? options.animate : frames, commitTime * 1000.0f / float(options.animate < frames ? options.animate : frames),
+               scene->GetBackgroundRebuildCount(), scene->GetBVHCost(), accumulated);
+    if (restarts > 0)
+    {
+        printf("Progressive: first image after %.2fms, full resolution after %.2fms, averaged over %d restarts\n",
+               firstImageTime * 1000.0f / restarts, fullImageTime * 1000.0f / restarts, restarts);
+        if (!reference.empty())
+            printf("  first image RMSE %.5f\n", firstImageRmse / restarts);
+    }
+    bool ioWaited = false;
+    if (framePipeline)
+    {
+        bool written = framePipeline->Finish();
+        const FramePipelineStats& stats = framePipeline->GetStats();
+        double perFrame = 1000.0 / (stats.frames > 0 ? stats.frames : 1);
+        printf("Frame output: %d frames, %d in flight, %.2fms/frame to submit, %.2fms/frame to encode and %.2fms/frame to write on their own threads\n",
+               stats.frames, options.framesInFlight, stats.submitSeconds * perFrame, stats.encodeSeconds * perFrame, stats.writeSeconds * perFrame);
+        printf("  rendering waited for a free slot %d times, %.2fms in all, %.2fms at most\n",
+               stats.waits, stats.waitSeconds * 1000.0, stats.maxWaitSeconds * 1000.0);
+        if (options.sharedName)
+        {
+            // Closed now, so a reader sees the end of the stream
+            const SharedFrameStats& shared = sharedOutput.GetStats();
+            sharedOutput.Close();
+            printf("  shared ring: %d frames, %d dropped, %.2fms/frame to tonemap or wait, the reader held it up %d times for %.2fms\n",
+                   shared.frames, shared.dropped, stats.sharedSeconds * perFrame, shared.waits, shared.waitSeconds * 1000.0);
+        }
+        if (!written)
+            return 1;
+        ioWaited = stats.waits > 0;
+        if (options.ioCheck)
+            printf("I/O check %s: rendering %s on encoding or writing\n", ioWaited ? "FAILED" : "passed", ioWaited ? "waited" : "never waited");
+    }
+    if (options.targetRmse > 0)
+    {
+        if (reachedTarget)
+            printf("Reached RMSE %.5f in %.2fs after %d frames\n", rmse, totalTime + denoiseTime, frames);
+        else
+            printf("Did not reach RMSE %.5f, got %.5f in %.2fs\n", options.targetRmse, rmse, totalTime + denoiseTime);
+    }
+
+    if (options.denoise && accumulated > 0 && reference.empty())
+    {
+        denoise();
+        printf("Denoised in %.1fms\n", denoiseTime * 1000.0f);
+    }
+    const float3* image = options.denoise && frames > 0 ? denoised.data() : renderer.GetImage();
+    if (options.output && !WriteImage(options.output, options.width, options.height, image))
+    {
+        fprintf(stderr, "Failed to write %s\n", options.output);
+        return 1;
+    }
+    if (options.aovs && !WriteAovs(options.aovs, options.width, options.height, renderer.GetAovs()))
+    {
+        fprintf(stderr, "Failed to write the AOVs to %s_*.pfm\n", options.aovs);
+        return 1;
+    }
+    if (!WriteProfile(options))
+        return 1;
+    return options.ioCheck && ioWaited ? 1 : 0;
+}
@@ -0,0 +1,553 @@
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "Config.h"
+#include "CpuTracer.h"
+#include "SphereKernels.h"
+#include "SphereSoA.h"
+
+// Times the building blocks of the CPU tracer one at a time: sphere tests,
+// the scatter functions, random numbers, camera rays and vector maths. Every
+// case is warmed up until its timings settle, then timed over many batches and
+// reported as percentiles in ns per call. The JSON it writes can be passed
+// back as --baseline, and the run fails when a case got slower than that by
+// more than the threshold.
+
+typedef std::chrono::high_resolution_clock Clock;
+
+// Where the results of every batch go, so none of their work can be dropped
+static volatile float s_Sink;
+
+// Inputs of every case cycle through this many entries, small enough to stay
+// in the L2 cache so the timings are about the code and not the memory
+#define kInputCount 4096
+#define kInputMask (kInputCount - 1)
+
+// Stop warming up once the median of a window of batches is this close to the
+// one of the window before
+#define kWarmupWindow 16
+#define kWarmupTolerance 0.02
+
+struct Options
+{
+    int samples = 200;
+    int sampleMicroseconds = 500;
+    int warmupMs = 200;
+    float threshold = 10;
+    const char* filter = nullptr;
+    const char* simd = nullptr;
+    const char* baseline = nullptr;
+    const char* label = "";
+    const char* output = "microbenchmark.json";
+};
+
+struct Inputs
+{
+    std::vector<Sphere> spheres;
+    // Rays that hit or just miss spheres[i], from outside of it
+    std::vector<Ray> hitRays, missRays;
+    // Where hitRays[i] hits spheres[i]
+    std::vector<HitRecord> records;
+    std::vector<float3> vectors;
+    std::vector<float> u, v;
+    Material lambertian, metal, fuzzyMetal, dielectric;
+    Camera camera;
+    SphereSoA soa;
+    SphereSoAView soaView;
+    const SphereKernels* kernels;
+};
+
+// Runs a case for iterations calls and returns the sum of their results
+typedef float (*CaseFunc)(const Inputs& inputs, int iterations, uint32_t& seed);
+
+struct Case
+{
+    const char* name;
+    CaseFunc run;
+};
+
+struct Result
+{
+    const char* name;
+    int iterations;
+    int warmupBatches;
+    bool stable;
+    double minNs, p50Ns, p90Ns, p99Ns;
+};
+
+struct Baseline
+{
+    char name[64];
+    double p50Ns;
+};
+
+///////////////////////////
+static float RunSphereHit(const Inputs& in, int iterations, uint32_t& seed)
+{
+    float sum = 0;
+    for (int i = 0; i < iterations; ++i)
+    {
+        int j = i & kInputMask;
+        float t = kMaxT;
+        HitRecord record;
+        if (HitSphere(in.spheres[j], in.hitRays[j], kMinT, t, record))
+            sum += t;
+    }
+    return sum;
+}
+
+static float RunSphereMiss(const Inputs& in, int iterations, uint32_t& seed)
+{
+    float sum = 0;
+    for (int i = 0; i < iterations; ++i)
+    {
+        int j = i & kInputMask;
+        float t = kMaxT;
+        HitRecord record;
+        if (HitSphere(in.spheres[j], in.missRays[j], kMinT, t, record))
+            sum += t;
+    }
+    return sum;
+}
+
+// One BVH leaf through the SoA kernels, the ray aimed at its first sphere
+static float RunLeaf(const Inputs& in, const std::vector<Ray>& rays, int iterations)
+{
+    float sum = 0;
+    for (int i = 0; i < iterations; ++i)
+    {
+        int first = (i * kBVHMaxLeafSize) & kInputMask;
+        const Ray& ray = rays[first];
+        float t;
+        if (in.kernels->intersect(in.soaView, first, kBVHMaxLeafSize, ray.origin, ray.dir, kMinT, kMaxT, t) >= 0)
+            sum += t;
+    }
+    return sum;
+}
+
+static float RunLeafHit(const Inputs& in, int iterations, uint32_t& seed) { return RunLeaf(in, in.hitRays, iterations); }
+static float RunLeafMiss(const Inputs& in, int iterations, uint32_t& seed) { return RunLeaf(in, in.missRays, iterations); }
+
+template <bool (*ScatterFunc)(const Material&, const HitRecord&, float3&, Ray&, uint32_t&)>
+static float RunScatter(const Material& material, const Inputs& in, int iterations, uint32_t& seed)
+{
+    float sum = 0;
+    for (int i = 0; i < iterations; ++i)
+    {
+        int j = i & kInputMask;
+        float3 color(1, 1, 1);
+        Ray ray = in.hitRays[j];
+        if (ScatterFunc(material, in.records[j], color, ray, seed))
+            sum += ray.dir.x + color.x;
+    }
+    return sum;
+}
+
+static float RunScatterLambertian(const Inputs& in, int iterations, uint32_t& seed)
+{
+    return RunScatter<ScatterLambertian<uint32_t>>(in.lambertian, in, iterations, seed);
+}
+
+static float RunScatterMetal(const Inputs& in, int iterations, uint32_t& seed)
+{
+    return RunScatter<ScatterMetal<uint32_t>>(in.metal, in, iterations, seed);
+}
+
+static float RunScatterFuzzyMetal(const Inputs& in, int iterations, uint32_t& seed)
+{
+    return RunScatter<ScatterMetal<uint32_t>>(in.fuzzyMetal, in, iterations, seed);
+}
+
+static float RunScatterDielectric(const Inputs& in, int iterations, uint32_t& seed)
+{
+    return RunScatter<ScatterDielectric<uint32_t>>(in.dielectric, in, iterations, seed);
+}
+
+static float RunRNG(const Inputs& in, int iterations, uint32_t& seed)
+{
+    uint32_t sum = 0;
+    for (int i = 0; i < iterations; ++i)
+        sum += RNG(seed);
+    return float(sum);
+}
+
+static float RunRandomFloat01(const Inputs& in, int iterations, uint32_t& seed)
+{
+    float sum = 0;
+    for (int i = 0; i < iterations; ++i)
+        sum += RandomFloat01(seed);
+    return sum;
+}
+
+static float RunRandomUnitVector(const Inputs& in, int iterations, uint32_t& seed)
+{
+    float sum = 0;
+    for (int i = 0; i < iterations; ++i)
+        sum += RandomUnitVector(seed).x;
+    return sum;
+}
+
+static float RunRandomInUnitSphere(const Inputs& in, int iterations, uint32_t& seed)
+{
+    float sum = 0;
+    for (int i = 0; i < iterations; ++i)
+        sum += RandomInUnitSphere(seed).x;
+    return sum;
+}
+
+static float RunCameraGetRay(const Inputs& in, int iterations, uint32_t& seed)
+{
+    float sum = 0;
+    for (int i = 0; i < iterations; ++i)
+    {
+        int j = i & kInputMask;
+        sum += CameraGetRay(in.camera, in.u[j], in.v[j], seed).dir.x;
+    }
+    return sum;
+}
+
+static float RunNormalize(const Inputs& in, int iterations, uint32_t& seed)
+{
+    float sum = 0;
+    for (int i = 0; i < iterations; ++i)
+        sum += normalize(in.vectors[i & kInputMask]).x;
+    return sum;
+}
+
+static float RunCross(const Inputs& in, int iterations, uint32_t& seed)
+{
+    float sum = 0;
+    for (int i = 0; i < iterations; ++i)
+        sum += cross(in.vectors[i & kInputMask], in.vectors[(i + 1) & kInputMask]).y;
+    return sum;
+}
+
+static const Case s_Cases[] =
+{
+    { "sphere_hit", RunSphereHit },
+    { "sphere_miss", RunSphereMiss },
+    { "leaf_hit", RunLeafHit },
+    { "leaf_miss", RunLeafMiss },
+    { "scatter_lambertian", RunScatterLambertian },
+    { "scatter_metal", RunScatterMetal },
+    { "scatter_metal_fuzzy", RunScatterFuzzyMetal },
+    { "scatter_dielectric", RunScatterDielectric },
+    { "rng", RunRNG },
+    { "random_float01", RunRandomFloat01 },
+    { "random_unit_vector", RunRandomUnitVector },
+    { "random_in_unit_sphere", RunRandomInUnitSphere },
+    { "camera_get_ray", RunCameraGetRay },
+    { "normalize", RunNormalize },
+    { "cross", RunCross },
+};
+
+///////////////////////////
+// Spheres spread over a box, each with a ray from a few radii away that hits
+// it near its center and one that passes just outside of it
+static void MakeInputs(Inputs& in)
+{
+    uint32_t seed = 0x2545F491;
+    in.spheres.resize(kInputCount);
+    in.hitRays.resize(kInputCount);
+    in.missRays.resize(kInputCount);
+    in.records.resize(kInputCount);
+    in.vectors.resize(kInputCount);
+    in.u.resize(kInputCount);
+    in.v.resize(kInputCount);
+    for (int i = 0; i < kInputCount; ++i)
+    {
+        Sphere& sphere = in.spheres[i];
+        sphere.center = float3(RandomFloat01(seed), RandomFloat01(seed), RandomFloat01(seed)) * 20.0f - float3(10, 10, 10);
+        sphere.radius = 0.2f + RandomFloat01(seed) * 0.8f;
+        sphere.material = 0;
+
+        float3 origin = sphere.center + RandomUnitVector(seed) * sphere.radius * (4.0f + RandomFloat01(seed) * 4.0f);
+        float3 dir = normalize(sphere.center + RandomInUnitSphere(seed) * sphere.radius * 0.5f - origin);
+        in.hitRays[i] = MakeRay(origin, dir);
+        float t = kMaxT;
+        HitSphere(sphere, in.hitRays[i], kMinT, t, in.records[i]);
+
+        float3 side = normalize(cross(normalize(sphere.center - origin), RandomUnitVector(seed)));
+        in.missRays[i] = MakeRay(origin, normalize(sphere.center + side * sphere.radius * 1.5f - origin));
+
+        in.vectors[i] = RandomInUnitSphere(seed) * 10.0f + float3(0.01f, 0.01f, 0.01f);
+        in.u[i] = RandomFloat01(seed);
+        in.v[i] = RandomFloat01(seed);
+    }
+
+    in.lambertian = { 0, float3(0.8f, 0.8f, 0.8f) };
+    in.metal = { 1, float3(0.8f, 0.8f, 0.8f) };
+    in.fuzzyMetal = in.metal;
+    in.fuzzyMetal.fuzziness = 0.3f;
+    in.dielectric = { 2, float3(1, 1, 1) };
+    in.dielectric.refraction = 1.5f;
+    in.camera = MakeCamera(float3(13, 2, 3), float3(0, 0, 0), float3(0, 1, 0), 20, 16.0f / 9.0f, 0.1f, 10);
+
+    in.soa.Build(in.spheres.data(), nullptr, kInputCount);
+    in.soaView = in.soa.GetView();
+}
+
+static double TimeBatch(const Case& c, const Inputs& in, int iterations, uint32_t& seed)
+{
+    auto begin = Clock::now();
+    s_Sink = c.run(in, iterations, seed);
+    auto end = Clock::now();
+    return std::chrono::duration<double, std::nano>(end - begin).count() / iterations;
+}
+
+static double Median(std::vector<double> values)
+{
+    std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+    return values[values.size() / 2];
+}
+
+// Nearest rank percentile of sorted values
+static double Percentile(const std::vector<double>& sorted, double p)
+{
+    size_t rank = size_t(p * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+static Result RunCase(const Options& options, const Case& c, const Inputs& in)
+{
+    Result result;
+    result.name = c.name;
+    uint32_t seed = 0x9E3779B9;
+
+    // Grow the batch until one takes the sample time, so the clock resolution
+    // and the call are lost in it
+    double sampleNs = options.sampleMicroseconds * 1000.0;
+    int iterations = 64;
+    while (iterations < (1 << 26) && TimeBatch(c, in, iterations, seed) * iterations < sampleNs)
+        iterations *= 2;
+    result.iterations = iterations;
+
+    // Warm up for at least warmupMs, then until two windows in a row agree on
+    // their median or ten times that has passed
+    auto warmupBegin = Clock::now();
+    std::vector<double> window;
+    double lastMedian = 0;
+    result.warmupBatches = 0;
+    result.stable = false;
+    for (;;)
+    {
+        window.push_back(TimeBatch(c, in, iterations, seed));
+        ++result.warmupBatches;
+        if (window.size() < kWarmupWindow)
+            continue;
+        double median = Median(window);
+        double elapsedMs = std::chrono::duration<double, std::milli>(Clock::now() - warmupBegin).count();
+        if (elapsedMs >= options.warmupMs && lastMedian > 0 && fabs(median - lastMedian) <= kWarmupTolerance * lastMedian)
+        {
+            result.stable = true;
+            break;
+        }
+        if (elapsedMs >= options.warmupMs * 10.0)
+            break;
+        lastMedian = median;
+        window.clear();
+    }
+
+    std::vector<double> samples(options.samples);
+    for (double& sample : samples)
+        sample = TimeBatch(c, in, iterations, seed);
+    std::sort(samples.begin(), samples.end());
+    result.minNs = samples.front();
+    result.p50Ns = Percentile(samples, 0.5);
+    result.p90Ns = Percentile(samples, 0.9);
+    result.p99Ns = Percentile(samples, 0.99);
+    return result;
+}
+
+///////////////////////////
+static void PrintUsage()
+{
+    printf("Usage: MicroBenchmark [options]\n"
+           "  --filter TEXT   only run the cases whose name contains TEXT\n"
+           "  --list          print the case names and exit\n"
+           "  --samples N     timed batches per case (default 200)\n"
+           "  --sample-us N   length of a batch in microseconds (default 500)\n"
+           "  --warmup-ms N   least warmup per case, it goes on until the timings settle (default 200)\n"
+           "  --simd NAME     sphere kernels of the leaf cases: scalar, sse, avx2 or avx512 (default widest)\n"
+           "  --baseline FILE compare with the output of an earlier run and fail on regressions\n"
+           "  --threshold PCT slowdown of the median that counts as a regression (default 10)\n"
+           "  --label TEXT    stored in the output, e.g. a commit or machine name\n"
+           "  --output FILE   JSON results (default microbenchmark.json)\n");
+}
+
+static bool ParseOptions(int argc, char** argv, Options& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!strcmp(arg, "--help"))
+            return false;
+        if (!strcmp(arg, "--list"))
+        {
+            for (const Case& c : s_Cases)
+                printf("%s\n", c.name);
+            exit(0);
+        }
+        if (!value)
+        {
+            fprintf(stderr, "Missing value for %s\n", arg);
+            return false;
+        }
+        bool valid = true;
+        if (!strcmp(arg, "--filter")) options.filter = value;
+        else if (!strcmp(arg, "--samples")) valid = (options.samples = atoi(value)) > 0;
+        else if (!strcmp(arg, "--sample-us")) valid = (options.sampleMicroseconds = atoi(value)) > 0;
+        else if (!strcmp(arg, "--warmup-ms")) valid = (options.warmupMs = atoi(value)) >= 0;
+        else if (!strcmp(arg, "--simd")) options.simd = value;
+        else if (!strcmp(arg, "--baseline")) options.baseline = value;
+        else if (!strcmp(arg, "--threshold")) valid = (options.threshold = float(atof(value))) > 0;
+        else if (!strcmp(arg, "--label")) options.label = value;
+        else if (!strcmp(arg, "--output")) options.output = value;
+        else
+        {
+            fprintf(stderr, "Unknown option %s\n", arg);
+            return false;
+        }
+        if (!valid)
+        {
+            fprintf(stderr, "Invalid value for %s: %s\n", arg, value);
+            return false;
+        }
+        ++i;
+    }
+    return true;
+}
+
+// Reads the name and p50 of every case line written by WriteJson
+static bool ReadBaseline(const char* path, std::vector<Baseline>& baseline)
+{
+    FILE* file = fopen(path, "r");
+    if (!file)
+        return false;
+    char line[1024];
+    while (fgets(line, sizeof(line), file))
+    {
+        const char* name = strstr(line, "\"name\": \"");
+        const char* p50 = strstr(line, "\"p50_ns\": ");
+        Baseline entry;
+        if (!name || !p50 || sscanf(name + 9, "%63[^\"]", entry.name) != 1)
+            continue;
+        entry.p50Ns = atof(p50 + 10);
+        if (entry.p50Ns > 0)
+            baseline.push_back(entry);
+    }
+    fclose(file);
+    return !baseline.empty();
+}
+
+static bool WriteJson(const char* path, const Options& options, const std::vector<Result>& results, const char* kernels)
+{
+    FILE* file = fopen(path, "w");
+    if (!file)
+        return false;
+
+    char date[32];
+    time_t now = time(nullptr);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"label\": \"");
+    for (const char* c = options.label; *c; ++c)
+    {
+        if (*c == '"' || *c == '\\')
+            fputc('\\', file);
+        if ((unsigned char)*c >= 0x20)
+            fputc(*c, file);
+    }
+    fprintf(file, "\",\n");
+    fprintf(file, "  \"date\": \"%s\",\n", date);
+    fprintf(file, "  \"kernels\": \"%s\",\n", kernels);
+    fprintf(file, "  \"samples\": %d,\n", options.samples);
+    fprintf(file, "  \"sample_us\": %d,\n", options.sampleMicroseconds);
+    fprintf(file, "  \"cases\": [\n");
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const Result& r = results[i];
+        fprintf(file, "    { \"name\": \"%s\", \"iterations\": %d, \"warmup_batches\": %d, \"stable\": %s, "
+                      "\"min_ns\": %.4f, \"p50_ns\": %.4f, \"p90_ns\": %.4f, \"p99_ns\": %.4f }%s\n",
+                r.name, r.iterations, r.warmupBatches, r.stable ? "true" : "false",
+                r.minNs, r.p50Ns, r.p90Ns, r.p99Ns, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n");
+    fprintf(file, "}\n");
+    return fclose(file) == 0;
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    Inputs inputs;
+    inputs.kernels = options.simd ? FindSphereKernels(options.simd) : &GetSphereKernels();
+    if (!inputs.kernels)
+    {
+        fprintf(stderr, "Sphere kernels %s are not supported\n", options.simd);
+        return 1;
+    }
+
+    // Read before running, so the output may replace the baseline file
+    std::vector<Baseline> baseline;
+    if (options.baseline && !ReadBaseline(options.baseline, baseline))
+    {
+        fprintf(stderr, "Failed to read a baseline from %s\n", options.baseline);
+        return 1;
+    }
+
+    MakeInputs(inputs);
+    printf("%d samples of %dus per case, %s sphere kernels\n", options.samples, options.sampleMicroseconds, inputs.kernels->name);
+
+    std::vector<Result> results;
+    int regressions = 0;
+    for (const Case& c : s_Cases)
+    {
+        if (options.filter && !strstr(c.name, options.filter))
+            continue;
+        Result r = RunCase(options, c, inputs);
+        printf("%-22s p50 %8.3fns  p90 %8.3fns  p99 %8.3fns  min %8.3fns%s", r.name, r.p50Ns, r.p90Ns, r.p99Ns, r.minNs,
+               r.stable ? "" : "  (unsettled)");
+        for (const Baseline& b : baseline)
+        {
+            if (strcmp(b.name, r.name))
+                continue;
+            double change = (r.p50Ns / b.p50Ns - 1.0) * 100.0;
+            bool regressed = change > options.threshold;
+            regressions += regressed;
+            printf("  %+6.1f%%%s", change, regressed ? " REGRESSION" : "");
+        }
+        printf("\n");
+        results.push_back(r);
+    }
+    if (results.empty())
+    {
+        fprintf(stderr, "No case matches %s\n", options.filter);
+        return 1;
+    }
+    if (!WriteJson(options.output, options, results, inputs.kernels->name))
+    {
+        fprintf(stderr, "Failed to write %s\n", options.output);
+        return 1;
+    }
+    if (regressions)
+    {
+        fprintf(stderr, "%d cases are more than %g%% slower than %s\n", regressions, options.threshold, options.baseline);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,155 @@
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "TestScene.h"
+#include "SceneGenerator.h"
+#include "SceneFile.h"
+
+// Generates a scene, builds its BVH and SoA data and stores everything in a
+// scene file that Headless can map with --scene. A file whose content hash
+// still matches the generated scene is left alone.
+
+struct Options
+{
+    SceneDesc desc;
+    const char* output = nullptr;
+    const char* info = nullptr;
+    const char* verify = nullptr;
+    bool force = false;
+};
+
+static void PrintUsage()
+{
+    printf("Usage: SceneConvert [options] --output FILE\n"
+           "       SceneConvert --info FILE | --verify FILE\n"
+           "  --count N       small spheres, 0 = the original 22x22 grid (default 0)\n"
+           "  --layout NAME   grid, uniform or clustered (default grid)\n"
+           "  --mix D,M,G[,E] diffuse, metal, glass and emissive weights (default 0.8,0.15,0.05,0)\n"
+           "  --palette N     share N materials between the spheres, 0 = one each (default 0)\n"
+           "  --seed N        scene seed (default 1)\n"
+           "  --force         rebuild even when FILE is up to date\n"
+           "  --info FILE     print the header of a scene file\n"
+           "  --verify FILE   map a scene file and check its content hash\n");
+}
+
+static bool ParseOptions(int argc, char** argv, Options& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!strcmp(arg, "--help"))
+            return false;
+        if (!strcmp(arg, "--force"))
+        {
+            options.force = true;
+            continue;
+        }
+        if (!value)
+        {
+            fprintf(stderr, "Missing value for %s\n", arg);
+            return false;
+        }
+        bool valid = true;
+        if (!strcmp(arg, "--count")) options.desc.sphereCount = atoi(value);
+        else if (!strcmp(arg, "--layout")) valid = FindSceneLayout(value, options.desc.layout);
+        else if (!strcmp(arg, "--mix")) valid = sscanf(value, "%f,%f,%f,%f", &options.desc.diffuse, &options.desc.metal, &options.desc.glass,
+                                                       &options.desc.emissive) >= 3;
+        else if (!strcmp(arg, "--palette")) options.desc.paletteSize = atoi(value);
+        else if (!strcmp(arg, "--seed")) options.desc.seed = strtoull(value, nullptr, 10);
+        else if (!strcmp(arg, "--output")) options.output = value;
+        else if (!strcmp(arg, "--info")) options.info = value;
+        else if (!strcmp(arg, "--verify")) options.verify = value;
+        else
+        {
+            fprintf(stderr, "Unknown option %s\n", arg);
+            return false;
+        }
+        if (!valid)
+        {
+            fprintf(stderr, "Invalid value for %s: %s\n", arg, value);
+            return false;
+        }
+        ++i;
+    }
+    return (options.output || options.info || options.verify) && options.desc.sphereCount >= 0;
+}
+
+static void PrintHeader(const SceneFileHeader& header)
+{
+    printf("version %u, %d spheres, %d materials, %d BVH nodes, %.1fMB, content hash %016llx\n",
+           header.version, header.sphereCount, header.materialCount, header.nodeCount,
+           header.fileSize / 1048576.0, (unsigned long long)header.contentHash);
+}
+
+int main(int argc, char** argv)
+{
+    typedef std::chrono::high_resolution_clock Clock;
+    Options options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    if (options.info)
+    {
+        SceneFileHeader header;
+        if (!ReadSceneFileHeader(options.info, header))
+        {
+            fprintf(stderr, "%s: not a scene file of version %d\n", options.info, kSceneFileVersion);
+            return 1;
+        }
+        PrintHeader(header);
+        return 0;
+    }
+
+    if (options.verify)
+    {
+        SceneFile file;
+        if (!file.Open(options.verify))
+            return 1;
+        PrintHeader(file.GetHeader());
+        bool match = file.VerifyContent();
+        printf("content %s\n", match ? "matches" : "DOES NOT MATCH its hash");
+        return match ? 0 : 1;
+    }
+
+    auto generateBegin = Clock::now();
+    std::vector<Sphere> spheres;
+    std::vector<Material> materials;
+    GenerateScene(options.desc, spheres, materials);
+    uint64_t hash = HashSceneContent(spheres.data(), int(spheres.size()), materials.data(), int(materials.size()));
+    auto generateEnd = Clock::now();
+    printf("%d spheres generated and hashed in %.2fms, content hash %016llx\n", int(spheres.size()),
+           std::chrono::duration<float, std::milli>(generateEnd - generateBegin).count(), (unsigned long long)hash);
+
+    SceneFileHeader header;
+    // A file of the same scene built with other settings or for another
+    // platform would only be rejected when it is opened
+    if (!options.force && ReadSceneFileHeader(options.output, header) && header.contentHash == hash
+        && CheckSceneFileHeader(options.output, header))
+    {
+        printf("%s is up to date\n", options.output);
+        return 0;
+    }
+
+    auto buildBegin = Clock::now();
+    TestScene scene(std::move(spheres), std::move(materials));
+    auto buildEnd = Clock::now();
+    if (!WriteSceneFile(options.output, scene, hash))
+    {
+        fprintf(stderr, "Failed to write %s\n", options.output);
+        return 1;
+    }
+    auto writeEnd = Clock::now();
+    printf("built in %.2fms, written in %.2fms\n",
+           std::chrono::duration<float, std::milli>(buildEnd - buildBegin).count(),
+           std::chrono::duration<float, std::milli>(writeEnd - buildEnd).count());
+    if (ReadSceneFileHeader(options.output, header))
+        PrintHeader(header);
+    return 0;
+}
@@ -0,0 +1,130 @@
+#include <math.h>
+#include <string.h>
+
+#include "AccumFormat.h"
+
+// Largest value RGB9E5 holds, (511 / 512) * 2^16
+#define kRGB9E5Max 65408.0f
+
+static const char* s_AccumFormatNames[] = { "fp32", "fp16", "rgb9e5" };
+
+int GetAccumPixelBytes(int format)
+{
+    // Halves are stored as two uints, so the buffer stays 4 byte addressable
+    return format == kAccumFormatFp16 ? 8 : format == kAccumFormatRGB9E5 ? 4 : 12;
+}
+
+bool FindAccumFormat(const char* name, int& format)
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        if (!strcmp(name, s_AccumFormatNames[i]))
+        {
+            format = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* GetAccumFormatName(int format)
+{
+    return format >= 0 && format < 3 ? s_AccumFormatNames[format] : "unknown";
+}
+
+uint16_t FloatToHalf(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t magnitude = bits & 0x7fffffff;
+    if (magnitude >= 0x7f800000)
+        return uint16_t(sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0));
+    // 65520 and up round to infinity
+    if (magnitude >= 0x477ff000)
+        return uint16_t(sign | 0x7c00);
+    if (magnitude < 0x38800000)
+    {
+        // Subnormal half: shift the mantissa with its implicit bit into place
+        // and round to nearest even
+        if (magnitude < 0x33000000)
+            return uint16_t(sign);
+        uint32_t exponent = magnitude >> 23;
+        uint32_t mantissa = (magnitude & 0x7fffff) | 0x800000;
+        uint32_t shift = 126 - exponent;
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1)))
+            ++half;
+        return uint16_t(sign | half);
+    }
+    // Rebias the exponent and round the mantissa to 10 bits, nearest even;
+    // a carry out of the mantissa correctly bumps the exponent
+    uint32_t half = (magnitude - 0x38000000) >> 13;
+    uint32_t rest = magnitude & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        ++half;
+    return uint16_t(sign | half);
+}
+
+float HalfToFloat(uint16_t half)
+{
+    uint32_t sign = uint32_t(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+    uint32_t bits;
+    if (exponent == 0x1f)
+    {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else if (exponent == 0)
+    {
+        // Zero or subnormal, 2^-24 per step
+        float value = float(mantissa) * (1.0f / 16777216.0f);
+        return sign ? -value : value;
+    }
+    else
+    {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+uint32_t PackRGB9E5(const float3& rgb)
+{
+    float r = minf(maxf(rgb.x, 0.0f), kRGB9E5Max);
+    float g = minf(maxf(rgb.y, 0.0f), kRGB9E5Max);
+    float b = minf(maxf(rgb.z, 0.0f), kRGB9E5Max);
+    float maxChannel = maxf(r, maxf(g, b));
+    // The exponent of the largest channel, biased by 15, sets the shared scale
+    int exponent = (maxChannel > 1.0e-30f ? int(floorf(log2f(maxChannel))) : -16);
+    exponent = (exponent > -16 ? exponent : -16) + 16;
+    float scale = exp2f(float(exponent - 24));
+    if (floorf(maxChannel / scale + 0.5f) >= 512)
+    {
+        scale *= 2;
+        ++exponent;
+    }
+    uint32_t mr = uint32_t(floorf(r / scale + 0.5f));
+    uint32_t mg = uint32_t(floorf(g / scale + 0.5f));
+    uint32_t mb = uint32_t(floorf(b / scale + 0.5f));
+    return mr | (mg << 9) | (mb << 18) | (uint32_t(exponent) << 27);
+}
+
+float3 UnpackRGB9E5(uint32_t packed)
+{
+    float scale = exp2f(float(int(packed >> 27) - 24));
+    return float3(float(packed & 511), float((packed >> 9) & 511), float((packed >> 18) & 511)) * scale;
+}
+
+float3 RoundToAccumFormat(const float3& rgb, int format)
+{
+    if (format == kAccumFormatFp16)
+        return float3(HalfToFloat(FloatToHalf(rgb.x)), HalfToFloat(FloatToHalf(rgb.y)), HalfToFloat(FloatToHalf(rgb.z)));
+    if (format == kAccumFormatRGB9E5)
+        return UnpackRGB9E5(PackRGB9E5(rgb));
+    return rgb;
+}
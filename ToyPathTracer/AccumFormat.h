@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "Config.h"
+#include "Maths.h"
+
+// The kAccumFormat storage of the GPU accumulation buffer, on the CPU. The
+// CPU image stays float RGB; rounding it through a format after every frame
+// shows the error that format adds to the same render.
+
+// Bytes one pixel takes in the accumulation buffer
+int GetAccumPixelBytes(int format);
+
+// "fp32", "fp16" or "rgb9e5"
+bool FindAccumFormat(const char* name, int& format);
+const char* GetAccumFormatName(int format);
+
+// What storing rgb in format and loading it back gives, as Accumulation.hlsli
+// does it: halves round to nearest even, RGB9E5 clamps to [0, 65408] and
+// rounds every channel to 9 bits of the largest one's exponent
+float3 RoundToAccumFormat(const float3& rgb, int format);
+
+uint16_t FloatToHalf(float value);
+float HalfToFloat(uint16_t half);
+uint32_t PackRGB9E5(const float3& rgb);
+float3 UnpackRGB9E5(uint32_t packed);
@@ -0,0 +1,78 @@
+// The accumulation buffer: one running mean per pixel, read and written in
+// place by the compute shader and read by the pixel shader. Every pixel has
+// seen the same number of frames, so the count is the frame number in
+// ComputeParams rather than per pixel.
+
+#if kAccumFormat == kAccumFormatFp16
+#define kAccumPixelBytes 8
+#elif kAccumFormat == kAccumFormatRGB9E5
+#define kAccumPixelBytes 4
+#else
+#define kAccumPixelBytes 12
+#endif
+
+// Largest value RGB9E5 holds, (511 / 512) * 2^16
+#define kRGB9E5Max 65408.0
+
+uint PackRGB9E5(float3 rgb)
+{
+    rgb = clamp(rgb, 0, kRGB9E5Max);
+    float maxChannel = max(rgb.r, max(rgb.g, rgb.b));
+    // The exponent of the largest channel, biased by 15, sets the shared scale
+    int exponent = max(-16, int(floor(log2(max(maxChannel, 1.0e-30))))) + 16;
+    float scale = exp2(float(exponent - 24));
+    if (floor(maxChannel / scale + 0.5) >= 512)
+    {
+        scale *= 2;
+        ++exponent;
+    }
+    uint3 mantissa = uint3(floor(rgb / scale + 0.5));
+    return mantissa.r | (mantissa.g << 9) | (mantissa.b << 18) | (uint(exponent) << 27);
+}
+
+float3 UnpackRGB9E5(uint packed)
+{
+    float scale = exp2(float(int(packed >> 27) - 24));
+    return float3(packed & 511, (packed >> 9) & 511, (packed >> 18) & 511) * scale;
+}
+
+uint AccumAddress(uint2 pixel)
+{
+    return (pixel.y * kBackbufferWidth + pixel.x) * kAccumPixelBytes;
+}
+
+float3 LoadAccum(ByteAddressBuffer buffer, uint2 pixel)
+{
+#if kAccumFormat == kAccumFormatFp16
+    uint2 halves = buffer.Load2(AccumAddress(pixel));
+    return f16tof32(uint3(halves.x, halves.x >> 16, halves.y));
+#elif kAccumFormat == kAccumFormatRGB9E5
+    return UnpackRGB9E5(buffer.Load(AccumAddress(pixel)));
+#else
+    return asfloat(buffer.Load3(AccumAddress(pixel)));
+#endif
+}
+
+float3 LoadAccum(RWByteAddressBuffer buffer, uint2 pixel)
+{
+#if kAccumFormat == kAccumFormatFp16
+    uint2 halves = buffer.Load2(AccumAddress(pixel));
+    return f16tof32(uint3(halves.x, halves.x >> 16, halves.y));
+#elif kAccumFormat == kAccumFormatRGB9E5
+    return UnpackRGB9E5(buffer.Load(AccumAddress(pixel)));
+#else
+    return asfloat(buffer.Load3(AccumAddress(pixel)));
+#endif
+}
+
+void StoreAccum(RWByteAddressBuffer buffer, uint2 pixel, float3 rgb)
+{
+#if kAccumFormat == kAccumFormatFp16
+    uint3 halves = f32tof16(rgb);
+    buffer.Store2(AccumAddress(pixel), uint2(halves.x | (halves.y << 16), halves.z));
+#elif kAccumFormat == kAccumFormatRGB9E5
+    buffer.Store(AccumAddress(pixel), PackRGB9E5(rgb));
+#else
+    buffer.Store3(AccumAddress(pixel), asuint(rgb));
+#endif
+}
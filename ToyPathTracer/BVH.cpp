@@ -0,0 +1,331 @@
+#include <algorithm>
+#include <float.h>
+
+#include "Config.h"
+#include "BVH.h"
+#include "ThreadPool.h"
+
+#define kSAHBins 16
+#define kSAHTraversalCost 1.0f
+// Below this depth the builder only uses median splits, which halve the node
+// every level and keep the tree shallower than the traversal stack.
+#define kSAHMaxDepth (kBVHStackSize - 24)
+// Subtrees per thread a parallel refit splits the tree into
+#define kRefitTasksPerThread 4
+
+static inline float Axis(const float3& v, int axis) { return axis == 0 ? v.x : axis == 1 ? v.y : v.z; }
+static inline float3 Min(const float3& a, const float3& b) { return float3(minf(a.x, b.x), minf(a.y, b.y), minf(a.z, b.z)); }
+static inline float3 Max(const float3& a, const float3& b) { return float3(maxf(a.x, b.x), maxf(a.y, b.y), maxf(a.z, b.z)); }
+static inline float HalfArea(const float3& mn, const float3& mx)
+{
+    float3 e = mx - mn;
+    return e.x * e.y + e.y * e.z + e.z * e.x;
+}
+
+void BVH::Build(const Sphere* spheres, int count)
+{
+    nodes.clear();
+    indices.resize(count);
+    primBounds.resize(count);
+    primCentroids.resize(count);
+    if (count == 0)
+        return;
+
+    for (int i = 0; i < count; ++i)
+    {
+        float r = fabsf(spheres[i].radius);
+        primBounds[i].min = spheres[i].center - float3(r, r, r);
+        primBounds[i].max = spheres[i].center + float3(r, r, r);
+        primCentroids[i] = spheres[i].center;
+        indices[i] = uint32_t(i);
+    }
+    BuildNodes(count);
+}
+
+void BVH::Build(const float3* boundsMin, const float3* boundsMax, int count)
+{
+    nodes.clear();
+    indices.resize(count);
+    primBounds.resize(count);
+    primCentroids.resize(count);
+    if (count == 0)
+        return;
+
+    for (int i = 0; i < count; ++i)
+    {
+        primBounds[i].min = boundsMin[i];
+        primBounds[i].max = boundsMax[i];
+        primCentroids[i] = (boundsMin[i] + boundsMax[i]) * 0.5f;
+        indices[i] = uint32_t(i);
+    }
+    BuildNodes(count);
+}
+
+void BVH::BuildNodes(int count)
+{
+    nodes.reserve(size_t(count) * 2 - 1);
+    BVHNode root;
+    root.leftFirst = 0;
+    root.count = count;
+    nodes.push_back(root);
+
+    // Pairs of (node, depth)
+    std::vector<int> stack;
+    stack.push_back(0);
+    stack.push_back(0);
+    while (!stack.empty())
+    {
+        int depth = stack.back(); stack.pop_back();
+        int nodeIndex = stack.back(); stack.pop_back();
+        Subdivide(nodeIndex, depth, stack);
+    }
+
+    std::vector<Bounds>().swap(primBounds);
+    std::vector<float3>().swap(primCentroids);
+}
+
+void BVH::Refit(const Sphere* spheres, ThreadPool* pool)
+{
+    if (nodes.empty())
+        return;
+
+    // Children always come after their parent, so any order that visits a
+    // node's subtree before the node itself works
+    auto refitNode = [&](int nodeIndex)
+    {
+        BVHNode& node = nodes[nodeIndex];
+        float3 mn(FLT_MAX, FLT_MAX, FLT_MAX), mx(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+        if (node.count > 0)
+        {
+            for (int i = node.leftFirst; i < node.leftFirst + node.count; ++i)
+            {
+                const Sphere& sphere = spheres[indices[i]];
+                float r = fabsf(sphere.radius);
+                mn = Min(mn, sphere.center - float3(r, r, r));
+                mx = Max(mx, sphere.center + float3(r, r, r));
+            }
+        }
+        else
+        {
+            const BVHNode& left = nodes[node.leftFirst];
+            const BVHNode& right = nodes[node.leftFirst + 1];
+            mn = Min(left.boundsMin, right.boundsMin);
+            mx = Max(left.boundsMax, right.boundsMax);
+        }
+        node.boundsMin = mn;
+        node.boundsMax = mx;
+    };
+
+    int taskCount = pool ? pool->GetThreadCount() * kRefitTasksPerThread : 1;
+    if (!pool || pool->GetThreadCount() == 1 || int(nodes.size()) < taskCount * 64)
+    {
+        for (int i = int(nodes.size()) - 1; i >= 0; --i)
+            refitNode(i);
+        return;
+    }
+
+    // Split off the widest subtrees breadth first until there are enough to
+    // go around; the nodes above the cut are refit last, deepest first
+    std::vector<int> top, roots;
+    roots.push_back(0);
+    for (size_t next = 0; next < roots.size() && int(roots.size()) < taskCount; )
+    {
+        int nodeIndex = roots[next];
+        const BVHNode& node = nodes[nodeIndex];
+        if (node.count > 0)
+        {
+            ++next;
+            continue;
+        }
+        roots.erase(roots.begin() + next);
+        top.push_back(nodeIndex);
+        roots.push_back(node.leftFirst);
+        roots.push_back(node.leftFirst + 1);
+    }
+
+    std::vector<std::vector<int>> order(pool->GetThreadCount());
+    pool->ParallelFor(int(roots.size()), [&](int index, int threadIndex)
+    {
+        // Parents before children, then back to front
+        std::vector<int>& subtree = order[threadIndex];
+        subtree.clear();
+        subtree.push_back(roots[index]);
+        for (size_t i = 0; i < subtree.size(); ++i)
+        {
+            const BVHNode& node = nodes[subtree[i]];
+            if (node.count == 0)
+            {
+                subtree.push_back(node.leftFirst);
+                subtree.push_back(node.leftFirst + 1);
+            }
+        }
+        for (size_t i = subtree.size(); i-- > 0; )
+            refitNode(subtree[i]);
+    });
+    for (size_t i = top.size(); i-- > 0; )
+        refitNode(top[i]);
+}
+
+float BVH::GetCost() const
+{
+    if (nodes.empty())
+        return 0;
+    float cost = 0;
+    for (const BVHNode& node : nodes)
+        cost += HalfArea(node.boundsMin, node.boundsMax) * (node.count > 0 ? float(node.count) : kSAHTraversalCost);
+    float rootArea = HalfArea(nodes[0].boundsMin, nodes[0].boundsMax);
+    return rootArea > 0 ? cost / rootArea : 0;
+}
+
+size_t BVH::GetMemorySize() const
+{
+    return nodes.capacity() * sizeof(BVHNode) + indices.capacity() * sizeof(uint32_t);
+}
+
+void BVH::Subdivide(int nodeIndex, int depth, std::vector<int>& stack)
+{
+    int first = nodes[nodeIndex].leftFirst;
+    int count = nodes[nodeIndex].count;
+
+    Bounds bounds = { float3(FLT_MAX, FLT_MAX, FLT_MAX), float3(-FLT_MAX, -FLT_MAX, -FLT_MAX) };
+    Bounds centroidBounds = bounds;
+    for (int i = first; i < first + count; ++i)
+    {
+        const Bounds& b = primBounds[indices[i]];
+        const float3& c = primCentroids[indices[i]];
+        bounds.min = Min(bounds.min, b.min);
+        bounds.max = Max(bounds.max, b.max);
+        centroidBounds.min = Min(centroidBounds.min, c);
+        centroidBounds.max = Max(centroidBounds.max, c);
+    }
+    nodes[nodeIndex].boundsMin = bounds.min;
+    nodes[nodeIndex].boundsMax = bounds.max;
+
+    if (count <= 1)
+        return;
+
+    int bestAxis = -1;
+    int bestPlane = 0;
+    float bestCost = FLT_MAX;
+    if (depth < kSAHMaxDepth)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            float cmin = Axis(centroidBounds.min, axis);
+            float extent = Axis(centroidBounds.max, axis) - cmin;
+            if (extent <= 0)
+                continue;
+
+            Bounds binBounds[kSAHBins];
+            int binCounts[kSAHBins] = {};
+            for (int b = 0; b < kSAHBins; ++b)
+                binBounds[b] = { float3(FLT_MAX, FLT_MAX, FLT_MAX), float3(-FLT_MAX, -FLT_MAX, -FLT_MAX) };
+
+            float scale = kSAHBins / extent;
+            for (int i = first; i < first + count; ++i)
+            {
+                int b = std::min(kSAHBins - 1, int((Axis(primCentroids[indices[i]], axis) - cmin) * scale));
+                const Bounds& pb = primBounds[indices[i]];
+                binBounds[b].min = Min(binBounds[b].min, pb.min);
+                binBounds[b].max = Max(binBounds[b].max, pb.max);
+                ++binCounts[b];
+            }
+
+            // Sweep from both sides, plane k splits bins [0, k] | [k + 1, kSAHBins)
+            float leftArea[kSAHBins - 1], rightArea[kSAHBins - 1];
+            int leftCount[kSAHBins - 1], rightCount[kSAHBins - 1];
+            Bounds left = binBounds[0], right = binBounds[kSAHBins - 1];
+            int leftSum = 0, rightSum = 0;
+            for (int k = 0; k < kSAHBins - 1; ++k)
+            {
+                left.min = Min(left.min, binBounds[k].min);
+                left.max = Max(left.max, binBounds[k].max);
+                leftSum += binCounts[k];
+                leftCount[k] = leftSum;
+                leftArea[k] = leftSum ? HalfArea(left.min, left.max) : 0;
+
+                int r = kSAHBins - 1 - k;
+                right.min = Min(right.min, binBounds[r].min);
+                right.max = Max(right.max, binBounds[r].max);
+                rightSum += binCounts[r];
+                rightCount[r - 1] = rightSum;
+                rightArea[r - 1] = rightSum ? HalfArea(right.min, right.max) : 0;
+            }
+            for (int k = 0; k < kSAHBins - 1; ++k)
+            {
+                if (leftCount[k] == 0 || rightCount[k] == 0)
+                    continue;
+                float cost = leftArea[k] * leftCount[k] + rightArea[k] * rightCount[k];
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestPlane = k;
+                }
+            }
+        }
+    }
+
+    int mid = -1;
+    float area = HalfArea(bounds.min, bounds.max);
+    if (bestAxis >= 0)
+    {
+        float leafCost = count * area;
+        float splitCost = kSAHTraversalCost * area + bestCost;
+        if (splitCost >= leafCost && count <= kBVHMaxLeafSize)
+            return;
+        mid = Partition(first, count, bestAxis, bestPlane, centroidBounds);
+    }
+    else if (count <= kBVHMaxLeafSize)
+    {
+        return;
+    }
+
+    if (mid <= first || mid >= first + count)
+    {
+        float3 extent = centroidBounds.max - centroidBounds.min;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        MedianSplit(first, count, axis);
+        mid = first + count / 2;
+    }
+
+    int leftIndex = int(nodes.size());
+    BVHNode child;
+    child.leftFirst = first;
+    child.count = mid - first;
+    nodes.push_back(child);
+    child.leftFirst = mid;
+    child.count = first + count - mid;
+    nodes.push_back(child);
+
+    nodes[nodeIndex].leftFirst = leftIndex;
+    nodes[nodeIndex].count = 0;
+
+    // Right child first so the left subtree is laid out right after its parent
+    stack.push_back(leftIndex + 1);
+    stack.push_back(depth + 1);
+    stack.push_back(leftIndex);
+    stack.push_back(depth + 1);
+}
+
+int BVH::Partition(int first, int count, int axis, int plane, const Bounds& centroidBounds)
+{
+    float cmin = Axis(centroidBounds.min, axis);
+    float scale = kSAHBins / (Axis(centroidBounds.max, axis) - cmin);
+    auto begin = indices.begin() + first;
+    auto it = std::partition(begin, begin + count, [&](uint32_t index)
+    {
+        int b = std::min(kSAHBins - 1, int((Axis(primCentroids[index], axis) - cmin) * scale));
+        return b <= plane;
+    });
+    return first + int(it - begin);
+}
+
+void BVH::MedianSplit(int first, int count, int axis)
+{
+    auto begin = indices.begin() + first;
+    std::nth_element(begin, begin + count / 2, begin + count, [&](uint32_t a, uint32_t b)
+    {
+        return Axis(primCentroids[a], axis) < Axis(primCentroids[b], axis);
+    });
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "Maths.h"
+#include "SharedDataStruct.h"
+
+class ThreadPool;
+
+// Binned SAH bounding volume hierarchy over spheres. Nodes are stored depth
+// first in a flat array with siblings next to each other, so the same array can
+// be uploaded as a StructuredBuffer and traversed from HLSL and C++.
+class BVH
+{
+public:
+    void Build(const Sphere* spheres, int count);
+    // Same over arbitrary boxes, e.g. the instances of a top-level BVH
+    void Build(const float3* boundsMin, const float3* boundsMax, int count);
+    // Recomputes every node's bounds bottom-up for spheres that moved or
+    // changed size, keeping the tree. Independent subtrees run in parallel on
+    // pool when given. The spheres have to be the ones the tree was built for.
+    void Refit(const Sphere* spheres, ThreadPool* pool = nullptr);
+    // SAH cost of the tree relative to a single leaf the size of its root,
+    // which grows as refits stretch nodes over spheres that drifted apart
+    float GetCost() const;
+
+    const std::vector<BVHNode>& GetNodes() const { return nodes; }
+    const std::vector<uint32_t>& GetIndices() const { return indices; }
+    int GetNodeSize() const { return int(nodes.size()); }
+    int GetIndexSize() const { return int(indices.size()); }
+    size_t GetMemorySize() const;
+
+private:
+    struct Bounds
+    {
+        float3 min;
+        float3 max;
+    };
+
+    void BuildNodes(int count);
+    void Subdivide(int nodeIndex, int depth, std::vector<int>& stack);
+    int Partition(int first, int count, int axis, int plane, const Bounds& centroidBounds);
+    void MedianSplit(int first, int count, int axis);
+
+    std::vector<BVHNode> nodes;
+    std::vector<uint32_t> indices;
+    std::vector<Bounds> primBounds;
+    std::vector<float3> primCentroids;
+};
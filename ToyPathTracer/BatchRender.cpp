@@ -0,0 +1,250 @@
+#include <chrono>
+#include <condition_variable>
+#include <math.h>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+
+#include "BatchRender.h"
+#include "CpuRenderer.h"
+#include "ImageIO.h"
+#include "Profiler.h"
+
+static bool ParseView(const char* text, CameraView& view)
+{
+    return sscanf(text, "%f %f %f %f %f %f %f %f %f", &view.origin.x, &view.origin.y, &view.origin.z,
+                  &view.lookAt.x, &view.lookAt.y, &view.lookAt.z, &view.fov, &view.aperture, &view.focusDist) == 9;
+}
+
+static float3 CatmullRom(const float3& p0, const float3& p1, const float3& p2, const float3& p3, float t)
+{
+    float t2 = t * t, t3 = t2 * t;
+    return 0.5f * ((2 * p1) + (p2 - p0) * t + (2 * p0 - 5 * p1 + 4 * p2 - p3) * t2 + (3 * p1 - p0 - 3 * p2 + p3) * t3);
+}
+
+static float CatmullRom(float p0, float p1, float p2, float p3, float t)
+{
+    return CatmullRom(float3(p0, 0, 0), float3(p1, 0, 0), float3(p2, 0, 0), float3(p3, 0, 0), t).x;
+}
+
+static CameraView InterpolateKeys(const std::vector<CameraView>& keys, float u)
+{
+    int last = int(keys.size()) - 1;
+    if (last == 0)
+        return keys[0];
+    int segment = int(u) < last - 1 ? int(u) : last - 1;
+    float t = u - segment;
+    const CameraView& k0 = keys[segment > 0 ? segment - 1 : 0];
+    const CameraView& k1 = keys[segment];
+    const CameraView& k2 = keys[segment + 1];
+    const CameraView& k3 = keys[segment + 2 <= last ? segment + 2 : last];
+    CameraView view;
+    view.origin = CatmullRom(k0.origin, k1.origin, k2.origin, k3.origin, t);
+    view.lookAt = CatmullRom(k0.lookAt, k1.lookAt, k2.lookAt, k3.lookAt, t);
+    view.fov = CatmullRom(k0.fov, k1.fov, k2.fov, k3.fov, t);
+    view.aperture = maxf(CatmullRom(k0.aperture, k1.aperture, k2.aperture, k3.aperture, t), 0);
+    view.focusDist = CatmullRom(k0.focusDist, k1.focusDist, k2.focusDist, k3.focusDist, t);
+    return view;
+}
+
+bool LoadBatchJobs(const char* path, std::vector<BatchJob>& jobs)
+{
+    FILE* file = fopen(path, "r");
+    if (!file)
+    {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return false;
+    }
+
+    // A path line collects the key lines that follow it
+    struct Path
+    {
+        int samples = 0;
+        int count = 0;
+        std::string output;
+        std::vector<CameraView> keys;
+    } pending;
+    auto flushPath = [&]() -> bool
+    {
+        if (pending.count == 0)
+            return true;
+        bool ok = !pending.keys.empty();
+        for (int i = 0; ok && i < pending.count; ++i)
+        {
+            BatchJob job;
+            job.samples = pending.samples;
+            float u = pending.count > 1 ? float(i) / float(pending.count - 1) * float(pending.keys.size() - 1) : 0;
+            job.view = InterpolateKeys(pending.keys, u);
+            ok = FormatImagePath(pending.output, i, pending.count, job.output);
+            jobs.push_back(job);
+        }
+        pending = Path();
+        return ok;
+    };
+
+    char line[1024];
+    int lineNumber = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file))
+    {
+        ++lineNumber;
+        char kind[16], output[512];
+        int offset = 0, samples = 0, count = 0;
+        if (sscanf(line, " %15s%n", kind, &offset) != 1 || kind[0] == '#')
+            continue;
+        const char* rest = line + offset;
+
+        if (!strcmp(kind, "key"))
+        {
+            CameraView view;
+            ok = pending.count > 0 && ParseView(rest, view);
+            pending.keys.push_back(view);
+            continue;
+        }
+        ok = flushPath();
+        if (!ok)
+            break;
+
+        if (!strcmp(kind, "view"))
+        {
+            BatchJob job;
+            ok = sscanf(rest, "%d %511s%n", &samples, output, &offset) == 2 && ParseView(rest + offset, job.view);
+            job.samples = samples;
+            job.output = output;
+            jobs.push_back(job);
+        }
+        else if (!strcmp(kind, "orbit"))
+        {
+            CameraView view;
+            ok = sscanf(rest, "%d %d %511s%n", &samples, &count, output, &offset) == 3 && count > 0 && ParseView(rest + offset, view);
+            float3 arm = view.origin - view.lookAt;
+            for (int i = 0; ok && i < count; ++i)
+            {
+                float angle = float(2 * PI) * float(i) / float(count);
+                float c = cosf(angle), s = sinf(angle);
+                BatchJob job;
+                job.samples = samples;
+                job.view = view;
+                job.view.origin = view.lookAt + float3(c * arm.x + s * arm.z, arm.y, c * arm.z - s * arm.x);
+                ok = FormatImagePath(output, i, count, job.output);
+                jobs.push_back(job);
+            }
+        }
+        else if (!strcmp(kind, "path"))
+        {
+            ok = sscanf(rest, "%d %d %511s", &samples, &count, output) == 3 && count > 0;
+            pending.samples = samples;
+            pending.count = count;
+            pending.output = output;
+        }
+        else
+        {
+            ok = false;
+        }
+        ok = ok && samples > 0;
+    }
+    ok = ok && flushPath();
+    fclose(file);
+    if (!ok)
+        fprintf(stderr, "%s:%d: bad job (several images need a '#' in their output)\n", path, lineNumber);
+    return ok;
+}
+
+bool RenderBatch(CpuRenderer& renderer, const SceneView& scene, const ComputeParams& baseParams, const std::vector<BatchJob>& jobs,
+                 BatchStats& stats, const std::function<void(int, double)>& progress)
+{
+    stats = BatchStats();
+    int width = renderer.GetWidth(), height = renderer.GetHeight();
+    size_t pixelCount = size_t(width) * height;
+
+    // One image waits for the encoder while it writes the one before, so
+    // rendering only stalls when writing an image takes longer than rendering one
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<float3> queued;
+    std::string queuedPath;
+    bool hasQueued = false, finished = false, failed = false;
+    double encodeSeconds = 0;
+
+    std::thread encoder([&]()
+    {
+        ProfilerMarkAsyncThread();
+        std::vector<float3> pixels;
+        std::string path;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&]() { return hasQueued || finished; });
+                if (!hasQueued)
+                    return;
+                pixels.swap(queued);
+                path.swap(queuedPath);
+                hasQueued = false;
+            }
+            changed.notify_all();
+
+            auto begin = std::chrono::high_resolution_clock::now();
+            bool ok;
+            {
+                PROFILE_SCOPE(kZoneEncode);
+                ok = WriteImage(path.c_str(), width, height, pixels.data());
+            }
+            double time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - begin).count();
+            if (!ok)
+                fprintf(stderr, "Failed to write %s\n", path.c_str());
+
+            std::lock_guard<std::mutex> lock(mutex);
+            encodeSeconds += time;
+            failed = failed || !ok;
+        }
+    });
+
+    auto start = std::chrono::high_resolution_clock::now();
+    float aspect = float(width) / float(height);
+    int samplesPerFrame = renderer.GetTraceSettings().samplesPerPixel;
+    for (size_t index = 0; index < jobs.size(); ++index)
+    {
+        const BatchJob& job = jobs[index];
+        ComputeParams params = baseParams;
+        params.camera = MakeCamera(job.view.origin, job.view.lookAt, float3(0, 1, 0), job.view.fov, aspect, job.view.aperture, job.view.focusDist);
+
+        auto begin = std::chrono::high_resolution_clock::now();
+        int frames = (job.samples + samplesPerFrame - 1) / samplesPerFrame;
+        for (int frame = 0; frame < frames; ++frame)
+        {
+            params.frames = frame;
+            params.lerpFactor = float(frame) / float(frame + 1);
+            ProfilerBeginFrame();
+            renderer.RenderFrame(scene, params);
+            ProfilerEndFrame();
+            stats.rayCount += renderer.GetRayCount();
+        }
+
+        auto waitBegin = std::chrono::high_resolution_clock::now();
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&]() { return !hasQueued; });
+            queued.assign(renderer.GetImage(), renderer.GetImage() + pixelCount);
+            queuedPath = job.output;
+            hasQueued = true;
+        }
+        changed.notify_all();
+        auto end = std::chrono::high_resolution_clock::now();
+        stats.waitSeconds += std::chrono::duration<double>(end - waitBegin).count();
+        ++stats.images;
+        progress(int(index), std::chrono::duration<double>(end - begin).count());
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished = true;
+    }
+    changed.notify_all();
+    encoder.join();
+
+    stats.seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    stats.encodeSeconds = encodeSeconds;
+    return !failed;
+}
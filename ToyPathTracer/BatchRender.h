@@ -0,0 +1,61 @@
+#pragma once
+
+#include <functional>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "Maths.h"
+#include "SharedDataStruct.h"
+#include "SceneView.h"
+
+class CpuRenderer;
+
+// Many camera views of one scene in a single process. The scene and its BVH
+// are built once; each job accumulates its own image and hands it to an
+// encoder thread, so writing image N overlaps rendering image N + 1.
+struct CameraView
+{
+    float3 origin = float3(13, 2, 3);
+    float3 lookAt = float3(0, 0, 0);
+    float fov = 20;
+    float aperture = 0.1f;
+    float focusDist = 10;
+};
+
+struct BatchJob
+{
+    std::string output;
+    CameraView view;
+    // Samples per pixel to accumulate, rounded up to whole frames
+    int samples = 64;
+};
+
+struct BatchStats
+{
+    int images = 0;
+    double seconds = 0;
+    // Time the encoder thread spent writing, and the renderer spent waiting for it
+    double encodeSeconds = 0;
+    double waitSeconds = 0;
+    uint64_t rayCount = 0;
+};
+
+// Reads a job list. Each line is one of
+//   view SAMPLES OUTPUT ox oy oz lx ly lz FOV APERTURE FOCUS
+//   orbit SAMPLES COUNT OUTPUT ox oy oz lx ly lz FOV APERTURE FOCUS
+//   path SAMPLES COUNT OUTPUT
+//   key ox oy oz lx ly lz FOV APERTURE FOCUS
+// orbit turns the view COUNT times around the vertical axis through lookAt,
+// path spreads COUNT images over the key lines after it (a Catmull-Rom
+// spline through the keys). In their outputs a run of '#' is replaced by
+// the zero padded image number. Blank lines and lines starting with '#'
+// are skipped.
+bool LoadBatchJobs(const char* path, std::vector<BatchJob>& jobs);
+
+// Renders every job with renderer, whose size, trace settings and modes are
+// used as they are. params supplies everything but the camera and the
+// frame. progress(job, seconds) is called once the job's image is queued for
+// writing.
+bool RenderBatch(CpuRenderer& renderer, const SceneView& scene, const ComputeParams& params, const std::vector<BatchJob>& jobs,
+                 BatchStats& stats, const std::function<void(int, double)>& progress);
@@ -1,15 +1,22 @@
 #include "Config.h"
 #include "SharedDataStruct.h"
+#include "Accumulation.hlsli"
 
 // SRV
-Texture2D srcImage : register(t0);
-StructuredBuffer<ComputeParams> g_Params : register(t1);
-StructuredBuffer<Sphere> g_Spheres : register(t2);
-StructuredBuffer<Material> g_Materials : register(t3);
+StructuredBuffer<ComputeParams> g_Params : register(t0);
+StructuredBuffer<Sphere> g_Spheres : register(t1);
+StructuredBuffer<Material> g_Materials : register(t2);
+StructuredBuffer<BVHNode> g_BVHNodes : register(t3);
+StructuredBuffer<uint> g_BVHIndices : register(t4);
 // UAV
-RWTexture2D<float4> dstImage : register(u0);
+// Running mean of every pixel, updated in place in kAccumFormat
+RWByteAddressBuffer g_Accum : register(u0);
+// Rays traced per bounce, kMaxDepth uints
 RWByteAddressBuffer g_RayCounter : register(u1);
 
+// Per group ray counts, flushed to g_RayCounter once at the end of main()
+groupshared uint s_RayCounts[kMaxDepth];
+
 ///////////////////////////
 struct Ray
 {
@@ -97,39 +104,110 @@ Ray CameraGetRay(Camera cam, float u, float v, inout uint seed)
     return MakeRay(cam.origin + offset, dir);
 }
 
-bool HitWorld(Ray ray, float tMin, float tMax, int count, inout HitRecord record)
+bool HitSphere(Sphere sphere, Ray ray, float tMin, inout float tMax, inout HitRecord record)
 {
-    bool hit = false;
-    for (int i = 0; i < count; ++i)
+    float3 oc = ray.origin - sphere.center;
+    float b = dot(oc, ray.dir);
+    float c = dot(oc, oc) - sphere.radius * sphere.radius;
+    float discriminant = b * b - c;
+
+    if (discriminant > 0)
     {
-        Sphere sphere = g_Spheres[i];
-        float3 oc = ray.origin - sphere.center;
-        float b = dot(oc, ray.dir);
-        float c = dot(oc, oc) - sphere.radius * sphere.radius;
-        float discriminant = b * b - c;
+        float sqrtd = sqrt(discriminant);
+        float step = -b - sqrtd;
+        if (step <= tMin)
+        {
+            step = -b + sqrtd;
+        }
+        if (step > tMin && step < tMax)
+        {
+            record.position = RayPointAt(ray, step);
+            float3 normal = (record.position - sphere.center) / sphere.radius;
+            record.isFrontFace = dot(ray.dir, normal) < 0;
+            if (record.isFrontFace)
+                record.normal = normal;
+            else
+                record.normal = -normal;
+            record.material = sphere.material;
+            tMax = step;
+            return true;
+        }
+    }
+    return false;
+}
 
-        if (discriminant > 0)
+// Entry distance of the ray into the node bounds, or kMaxT when it misses
+// them or they lie outside (tMin, tMax).
+float IntersectBounds(BVHNode node, Ray ray, float3 invDir, float tMin, float tMax)
+{
+    float3 t1 = (node.boundsMin - ray.origin) * invDir;
+    float3 t2 = (node.boundsMax - ray.origin) * invDir;
+    float3 tSmall = min(t1, t2);
+    float3 tBig = max(t1, t2);
+    float tNear = max(max(tSmall.x, tSmall.y), max(tSmall.z, tMin));
+    float tFar = min(min(tBig.x, tBig.y), min(tBig.z, tMax));
+    return tNear <= tFar ? tNear : kMaxT;
+}
+
+bool HitWorld(Ray ray, float tMin, float tMax, inout HitRecord record)
+{
+    bool hit = false;
+    float3 invDir = 1.0 / ray.dir;
+    int stackNode[kBVHStackSize];
+    float stackDist[kBVHStackSize];
+    int stackSize = 0;
+
+    int nodeIndex = 0;
+    if (IntersectBounds(g_BVHNodes[0], ray, invDir, tMin, tMax) >= kMaxT)
+        return false;
+
+    [loop]
+    for (;;)
+    {
+        BVHNode node = g_BVHNodes[nodeIndex];
+        if (node.count > 0)
         {
-            float sqrtd = sqrt(discriminant);
-            float step = -b - sqrtd;
-            if (step <= tMin)
+            for (int i = node.leftFirst; i < node.leftFirst + node.count; ++i)
             {
-                step = -b + sqrtd;
+                if (HitSphere(g_Spheres[g_BVHIndices[i]], ray, tMin, tMax, record))
+                    hit = true;
             }
-            if (step > tMin && step < tMax)
+        }
+        else
+        {
+            // Visit the nearer child first and keep the other one for later
+            int nearIndex = node.leftFirst;
+            int farIndex = node.leftFirst + 1;
+            float nearDist = IntersectBounds(g_BVHNodes[nearIndex], ray, invDir, tMin, tMax);
+            float farDist = IntersectBounds(g_BVHNodes[farIndex], ray, invDir, tMin, tMax);
+            if (farDist < nearDist)
+            {
+                int index = nearIndex; nearIndex = farIndex; farIndex = index;
+                float dist = nearDist; nearDist = farDist; farDist = dist;
+            }
+            if (nearDist < kMaxT)
             {
-                hit = true;
-                record.position = RayPointAt(ray, step);
-                float3 normal = (record.position - sphere.center) / sphere.radius;
-                record.isFrontFace = dot(ray.dir, normal) < 0;
-                if (record.isFrontFace)
-                    record.normal = normal;
-                else
-                    record.normal = -normal;
-                record.material = sphere.material;
-                tMax = step;
+                if (farDist < kMaxT)
+                {
+                    stackNode[stackSize] = farIndex;
+                    stackDist[stackSize] = farDist;
+                    ++stackSize;
+                }
+                nodeIndex = nearIndex;
+                continue;
             }
         }
+
+        // Pop the next node that can still hold a closer hit
+        bool found = false;
+        while (stackSize > 0 && !found)
+        {
+            --stackSize;
+            found = stackDist[stackSize] < tMax;
+        }
+        if (!found)
+            break;
+        nodeIndex = stackNode[stackSize];
     }
     return hit;
 }
@@ -186,19 +264,41 @@ bool Scatter(in HitRecord record, inout float3 color, inout Ray ray, inout uint
     return false;
 }
 
-float3 Trace(Ray ray, int count, inout uint rayCount, inout uint seed)
+// Unbiased Russian roulette: once a path has scattered rouletteDepth times it
+// survives each further bounce with a probability of its largest throughput
+// channel, and survivors are scaled up by the inverse of it
+bool RussianRoulette(inout float3 color, int bounces, int rouletteDepth, inout uint seed)
+{
+    if (rouletteDepth <= 0 || bounces < rouletteDepth)
+        return true;
+    float survival = min(max(color.x, max(color.y, color.z)), 1.0);
+    if (RandomFloat01(seed) >= survival)
+        return false;
+    color /= survival;
+    return true;
+}
+
+float3 Trace(Ray ray, int rouletteDepth, inout uint seed)
 {
     float3 color = 1;
-    for (int depth = kMaxDepth; depth > 0; --depth)
+    for (int depth = 0; depth < kMaxDepth; ++depth)
     {
-        ++rayCount;
+        InterlockedAdd(s_RayCounts[depth], 1);
         HitRecord record;
-        if (HitWorld(ray, kMinT, kMaxT, count, record))
+        if (HitWorld(ray, kMinT, kMaxT, record))
         {
+            // Emissive: the path ends on the light
+            Material material = g_Materials[record.material];
+            if (material.type == 3)
+                return color * material.albedo;
             if (!Scatter(record, color, ray, seed))
             {
                 return float3(0, 0, 0);
             }
+            if (depth + 1 < kMaxDepth && !RussianRoulette(color, depth + 1, rouletteDepth, seed))
+            {
+                return float3(0, 0, 0);
+            }
         }
         else
         {
@@ -217,22 +317,28 @@ void main(uint3 gid : SV_DispatchThreadID, uint3 tid : SV_GroupThreadID)
 {
     ComputeParams params = g_Params[0];
 
+    // One thread per depth bin clears and later flushes the group counts
+    uint threadIndex = tid.y * kCSGroupSizeX + tid.x;
+    if (threadIndex < kMaxDepth)
+        s_RayCounts[threadIndex] = 0;
+    GroupMemoryBarrierWithGroupSync();
+
     float3 color = 0;
-    uint rayCount = 0;
     uint seed = (gid.x * 1973 + gid.y * 9277 + params.frames * 26699) | 1;
     for (int i = 0; i < SAMPLES_PER_PIXEL; ++i)
     {
         float u = float(gid.x + RandomFloat01(seed)) / kBackbufferWidth;
         float v = float(gid.y + RandomFloat01(seed)) / kBackbufferHeight;
         Ray ray = CameraGetRay(params.camera, u, v, seed);
-        color += Trace(ray, params.count, rayCount, seed);
+        color += Trace(ray, params.rouletteDepth, seed);
     }
     color /= float(SAMPLES_PER_PIXEL);
 
-    float3 prev = srcImage.Load(int3(gid.xy, 0)).rgb;
-    float3 curr = lerp(color, prev, params.lerpFactor);
-
-    dstImage[gid.xy] = float4(curr, 1.0);
+    // The first frame must not read what was there before; it may be NaN
+    float3 prev = params.frames > 0 ? LoadAccum(g_Accum, gid.xy) : color;
+    StoreAccum(g_Accum, gid.xy, lerp(color, prev, params.lerpFactor));
 
-    g_RayCounter.InterlockedAdd(0, rayCount);
+    GroupMemoryBarrierWithGroupSync();
+    if (threadIndex < kMaxDepth)
+        g_RayCounter.InterlockedAdd(threadIndex * 4, s_RayCounts[threadIndex]);
 }
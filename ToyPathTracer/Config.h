@@ -2,6 +2,20 @@
 #define kBackbufferWidth 1280
 #define kBackbufferHeight 720
 
+// Frames the GPU timing queries and ray counters, and the CPU frame output,
+// may be behind rendering before it waits for them
+#define kFramesInFlight 3
+
+// How the GPU accumulation buffer stores each pixel's running mean: 12 bytes
+// of float RGB, 8 bytes of half RGB, or 4 bytes of shared exponent RGB9E5,
+// which is only good enough for previews
+#define kAccumFormatFp32 0
+#define kAccumFormatFp16 1
+#define kAccumFormatRGB9E5 2
+#ifndef kAccumFormat
+#define kAccumFormat kAccumFormatFp32
+#endif
+
 #define kCSGroupSizeX 8
 #define kCSGroupSizeY 8
 
@@ -10,3 +24,13 @@
 #define kMinT 0.001f
 #define kMaxT 1.0e7f
 #define kMaxDepth 10
+// Bounces after which Russian roulette may end a path, 0 = never
+#define kRussianRouletteDepth 3
+
+#define kBVHStackSize 64
+#define kBVHMaxLeafSize 4
+
+// Thread-local counters and scoped timers of Profiler.h; 0 compiles them out
+#ifndef kProfilerEnabled
+#define kProfilerEnabled 0
+#endif
@@ -0,0 +1,445 @@
+#include <algorithm>
+#include <chrono>
+#include <float.h>
+#include <string.h>
+
+#include "AccumFormat.h"
+#include "CpuRenderer.h"
+#include "SceneReplicas.h"
+
+// Frames every pixel takes before its variance estimate is trusted
+#define kAdaptiveMinFrames 16
+// Fraction of the threshold a single pixel has to reach to stop sampling
+#define kAdaptivePixelScale 0.5f
+
+// The progressive pass that traces a pixel: the corner of its 4x4 block,
+// the corner of its 2x2 block, or the rest
+static int GetPreviewPass(int x, int y)
+{
+    if ((x & 3) == 0 && (y & 3) == 0)
+        return 0;
+    return (x & 1) == 0 && (y & 1) == 0 ? 1 : 2;
+}
+
+static const char* s_TileOrderNames[] = { "rows", "morton", "hilbert" };
+
+const char* GetTileOrderName(TileOrder order)
+{
+    return s_TileOrderNames[int(order)];
+}
+
+bool FindTileOrder(const char* name, TileOrder& order)
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        if (!strcmp(name, s_TileOrderNames[i]))
+        {
+            order = TileOrder(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint32_t GetMortonIndex(uint32_t x, uint32_t y)
+{
+    uint32_t index = 0;
+    for (int bit = 0; bit < 16; ++bit)
+        index |= ((x >> bit) & 1) << (2 * bit) | ((y >> bit) & 1) << (2 * bit + 1);
+    return index;
+}
+
+// Distance of (x, y) along the Hilbert curve over a size x size grid, size a
+// power of two
+static uint32_t GetHilbertIndex(uint32_t size, uint32_t x, uint32_t y)
+{
+    uint32_t index = 0;
+    for (uint32_t s = size / 2; s > 0; s /= 2)
+    {
+        uint32_t rx = (x & s) ? 1 : 0;
+        uint32_t ry = (y & s) ? 1 : 0;
+        index += s * s * ((3 * rx) ^ ry);
+        // Turn the quadrant so the curve in it starts where the last one ended
+        if (ry == 0)
+        {
+            if (rx == 1)
+            {
+                x = size - 1 - x;
+                y = size - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return index;
+}
+
+CpuRenderer::CpuRenderer(ThreadPool& pool, int width, int height)
+    : pool(pool), width(width), height(height), fullWidth(width), fullHeight(height)
+{
+    tilesX = (width + kCSGroupSizeX - 1) / kCSGroupSizeX;
+    tilesY = (height + kCSGroupSizeY - 1) / kCSGroupSizeY;
+    BuildTileOrder();
+    FirstTouch(image);
+    rayCounters.resize(pool.GetThreadCount());
+}
+
+void CpuRenderer::BuildTileOrder()
+{
+    int tileCount = tilesX * tilesY;
+    tiles.resize(tileCount);
+    for (int i = 0; i < tileCount; ++i)
+        tiles[i] = i;
+    if (tileOrder == TileOrder::Rows)
+        return;
+
+    // Each node's band starts at the tile row of its first thread's share
+    int threads = pool.GetThreadCount();
+    std::vector<int> bandStarts(pool.GetNodeCount(), 0);
+    for (int i = threads - 1; i >= 0; --i)
+        bandStarts[pool.GetThreadNode(i)] = int((long long)tilesY * i / threads);
+
+    uint32_t size = 1;
+    while (size < uint32_t(tilesX) || size < uint32_t(tilesY))
+        size *= 2;
+    std::vector<uint64_t> keys(tileCount);
+    for (int y = 0; y < tilesY; ++y)
+    {
+        int bandStart = 0;
+        for (int start : bandStarts)
+            bandStart = start <= y ? std::max(bandStart, start) : bandStart;
+        for (int x = 0; x < tilesX; ++x)
+        {
+            uint32_t bandY = uint32_t(y - bandStart);
+            uint32_t index = tileOrder == TileOrder::Morton ? GetMortonIndex(x, bandY) : GetHilbertIndex(size, x, bandY);
+            keys[y * tilesX + x] = uint64_t(bandStart) << 32 | index;
+        }
+    }
+    std::sort(tiles.begin(), tiles.end(), [&](int a, int b) { return keys[a] < keys[b]; });
+}
+
+template <typename T>
+void CpuRenderer::FirstTouch(FirstTouchArray<T>& pixels)
+{
+    pixels.Allocate(size_t(width) * height);
+    int tileCount = tilesX * tilesY;
+    pool.RunOnEveryThread([&](int threadIndex)
+    {
+        int begin, end;
+        pool.GetThreadRange(tileCount, threadIndex, begin, end);
+        for (int i = begin; i < end; ++i)
+        {
+            int x0 = (tiles[i] % tilesX) * kCSGroupSizeX;
+            int y0 = (tiles[i] / tilesX) * kCSGroupSizeY;
+            int x1 = x0 + kCSGroupSizeX < width ? x0 + kCSGroupSizeX : width;
+            int y1 = y0 + kCSGroupSizeY < height ? y0 + kCSGroupSizeY : height;
+            for (int y = y0; y < y1; ++y)
+            {
+                for (int x = x0; x < x1; ++x)
+                    pixels.Construct(size_t(y) * width + x);
+            }
+        }
+    });
+}
+
+void CpuRenderer::SetTileOrder(TileOrder order)
+{
+    tileOrder = order;
+    BuildTileOrder();
+    FirstTouch(image);
+    if (!aovImage.empty())
+        FirstTouch(aovImage);
+    pixelStats.Reset();
+}
+
+const SceneView& CpuRenderer::GetThreadScene(const SceneView& scene, int threadIndex) const
+{
+    return sceneReplicas ? sceneReplicas->GetView(pool.GetThreadNode(threadIndex)) : scene;
+}
+
+void CpuRenderer::SetRegion(int fullWidth_, int fullHeight_, int x, int y, int width_, int height_)
+{
+    fullWidth = fullWidth_;
+    fullHeight = fullHeight_;
+    regionX = x;
+    regionY = y;
+    width = width_;
+    height = height_;
+    tilesX = (width + kCSGroupSizeX - 1) / kCSGroupSizeX;
+    tilesY = (height + kCSGroupSizeY - 1) / kCSGroupSizeY;
+    BuildTileOrder();
+    FirstTouch(image);
+    if (!aovImage.empty())
+        FirstTouch(aovImage);
+    pixelStats.Reset();
+}
+
+void CpuRenderer::SetWavefront(bool enable)
+{
+    if (enable && !wavefront)
+        wavefront.reset(new WavefrontRenderer(pool));
+    else if (!enable)
+        wavefront.reset();
+}
+
+void CpuRenderer::SetAovs(bool enable)
+{
+    if (enable && aovImage.empty())
+        FirstTouch(aovImage);
+    else if (!enable)
+        aovImage.Reset();
+}
+
+void CpuRenderer::SetAdaptive(float threshold)
+{
+    adaptiveThreshold = threshold > 0 ? threshold : 0;
+    pixelStats.Reset();
+    activeTiles.clear();
+}
+
+void CpuRenderer::SetProgressive(bool enable, float budgetMs)
+{
+    progressive = enable;
+    previewBudget = budgetMs > 0 ? budgetMs : 0;
+    previewPass = kPreviewPasses;
+}
+
+void CpuRenderer::RenderFrame(const SceneView& scene, const ComputeParams& params)
+{
+    PROFILE_SCOPE(kZoneRenderFrame);
+    if (wavefront)
+    {
+        rayCount = wavefront->RenderFrame(scene, params, width, height, image.data(), depthRayCounts);
+        return;
+    }
+
+    for (auto& counter : rayCounters)
+        memset(counter.count, 0, sizeof(counter.count));
+
+    traceKernel = specialized ? &SelectTraceKernel(scene.materialTypes, traceSettings) : &GetGenericTraceKernel();
+
+    if (IsAdaptive())
+    {
+        if (params.frames == 0 || pixelStats.empty())
+        {
+            FirstTouch(pixelStats);
+            tileConverged.assign(tilesX * tilesY, 0);
+            activeTiles = tiles;
+        }
+
+        pool.ParallelFor(int(activeTiles.size()), [&](int index, int threadIndex)
+        {
+            RenderTileAdaptive(GetThreadScene(scene, threadIndex), params, activeTiles[index], threadIndex);
+        });
+
+        // Retire finished tiles so later frames do not even dispatch them
+        size_t count = 0;
+        for (int tileIndex : activeTiles)
+        {
+            if (!tileConverged[tileIndex])
+                activeTiles[count++] = tileIndex;
+        }
+        activeTiles.resize(count);
+    }
+    else if (progressive && (params.frames == 0 || previewPass < kPreviewPasses))
+    {
+        if (previewPass == kPreviewPasses)
+            previewPass = 0;
+        auto begin = std::chrono::high_resolution_clock::now();
+        for (;;)
+        {
+            auto passBegin = std::chrono::high_resolution_clock::now();
+            int pass = previewPass;
+            pool.ParallelFor(tilesX * tilesY, [&](int index, int threadIndex)
+            {
+                RenderTilePreview(GetThreadScene(scene, threadIndex), params, pass, tiles[index], threadIndex);
+            });
+            if (++previewPass == kPreviewPasses)
+                break;
+
+            // The next pass traces 3, then 4 times the pixels of this one
+            auto end = std::chrono::high_resolution_clock::now();
+            float passTime = std::chrono::duration<float, std::milli>(end - passBegin).count();
+            float elapsed = std::chrono::duration<float, std::milli>(end - begin).count();
+            if (elapsed + passTime * (previewPass == 1 ? 3.0f : 4.0f) > previewBudget)
+                break;
+        }
+    }
+    else
+    {
+        pool.ParallelFor(tilesX * tilesY, [&](int index, int threadIndex)
+        {
+            RenderTile(GetThreadScene(scene, threadIndex), params, tiles[index], threadIndex);
+        });
+    }
+
+    rayCount = 0;
+    for (int depth = 0; depth < kMaxDepth; ++depth)
+    {
+        depthRayCounts[depth] = 0;
+        for (auto& counter : rayCounters)
+            depthRayCounts[depth] += counter.count[depth];
+        rayCount += depthRayCounts[depth];
+    }
+}
+
+float3 CpuRenderer::TracePixel(const SceneView& scene, const ComputeParams& params, int x, int y, uint32_t* rayCounts, PixelAovs* aovs) const
+{
+    // Seeds and camera coordinates come from the position in the full frame
+    return traceKernel->tracePixel(scene, traceSettings, params, x + regionX, y + regionY, fullWidth, fullHeight, rayCounts, aovs);
+}
+
+void CpuRenderer::AccumulateAovs(size_t index, const PixelAovs& aovs, float lerpFactor)
+{
+    PixelAovs& pixel = aovImage[index];
+    pixel.albedo = lerp(aovs.albedo, pixel.albedo, lerpFactor);
+    pixel.normal = lerp(aovs.normal, pixel.normal, lerpFactor);
+    pixel.depth = aovs.depth + (pixel.depth - aovs.depth) * lerpFactor;
+}
+
+void CpuRenderer::AddRayCounts(int threadIndex, const uint32_t* rayCounts)
+{
+    for (int depth = 0; depth < kMaxDepth; ++depth)
+        rayCounters[threadIndex].count[depth] += rayCounts[depth];
+}
+
+void CpuRenderer::RenderTile(const SceneView& scene, const ComputeParams& params, int tileIndex, int threadIndex)
+{
+    PROFILE_SCOPE(kZoneTile);
+    int x0 = (tileIndex % tilesX) * kCSGroupSizeX;
+    int y0 = (tileIndex / tilesX) * kCSGroupSizeY;
+    int x1 = x0 + kCSGroupSizeX < width ? x0 + kCSGroupSizeX : width;
+    int y1 = y0 + kCSGroupSizeY < height ? y0 + kCSGroupSizeY : height;
+
+    uint32_t rayCounts[kMaxDepth] = {};
+    PixelAovs aovs;
+    PixelAovs* pixelAovs = aovImage.empty() ? nullptr : &aovs;
+    for (int y = y0; y < y1; ++y)
+    {
+        for (int x = x0; x < x1; ++x)
+        {
+            float3 color = TracePixel(scene, params, x, y, rayCounts, pixelAovs);
+
+            size_t index = size_t(y) * width + x;
+            float3& pixel = image[index];
+            pixel = lerp(color, pixel, params.lerpFactor);
+            if (accumFormat != kAccumFormatFp32)
+                pixel = RoundToAccumFormat(pixel, accumFormat);
+            if (pixelAovs)
+                AccumulateAovs(index, aovs, params.lerpFactor);
+        }
+    }
+    AddRayCounts(threadIndex, rayCounts);
+}
+
+void CpuRenderer::RenderTilePreview(const SceneView& scene, const ComputeParams& params, int pass, int tileIndex, int threadIndex)
+{
+    PROFILE_SCOPE(kZoneTile);
+    int x0 = (tileIndex % tilesX) * kCSGroupSizeX;
+    int y0 = (tileIndex / tilesX) * kCSGroupSizeY;
+    int x1 = x0 + kCSGroupSizeX < width ? x0 + kCSGroupSizeX : width;
+    int y1 = y0 + kCSGroupSizeY < height ? y0 + kCSGroupSizeY : height;
+
+    uint32_t rayCounts[kMaxDepth] = {};
+    PixelAovs aovs;
+    PixelAovs* pixelAovs = aovImage.empty() ? nullptr : &aovs;
+    for (int y = y0; y < y1; ++y)
+    {
+        for (int x = x0; x < x1; ++x)
+        {
+            if (GetPreviewPass(x, y) != pass)
+                continue;
+            float3 color = TracePixel(scene, params, x, y, rayCounts, pixelAovs);
+
+            size_t index = size_t(y) * width + x;
+            float3& pixel = image[index];
+            pixel = lerp(color, pixel, params.lerpFactor);
+            if (accumFormat != kAccumFormatFp32)
+                pixel = RoundToAccumFormat(pixel, accumFormat);
+            if (pixelAovs)
+                AccumulateAovs(index, aovs, params.lerpFactor);
+        }
+    }
+
+    // Pixels of later passes show the traced corner of their block until
+    // their own turn; tiles are a multiple of the blocks, so it is in this one
+    if (pass < kPreviewPasses - 1)
+    {
+        int mask = ~((4 >> pass) - 1);
+        for (int y = y0; y < y1; ++y)
+        {
+            for (int x = x0; x < x1; ++x)
+            {
+                if (GetPreviewPass(x, y) <= pass)
+                    continue;
+                size_t index = size_t(y) * width + x;
+                size_t corner = size_t(y & mask) * width + (x & mask);
+                image[index] = image[corner];
+                if (pixelAovs)
+                    aovImage[index] = aovImage[corner];
+            }
+        }
+    }
+    AddRayCounts(threadIndex, rayCounts);
+}
+
+// Squared standard error of the pixel mean, averaged over the channels
+float CpuRenderer::GetErrorSq(const PixelStats& stats) const
+{
+    if (stats.count < 2)
+        return FLT_MAX;
+    float variance = (stats.m2.x + stats.m2.y + stats.m2.z) / (3.0f * float(stats.count - 1));
+    return variance / float(stats.count);
+}
+
+void CpuRenderer::RenderTileAdaptive(const SceneView& scene, const ComputeParams& params, int tileIndex, int threadIndex)
+{
+    PROFILE_SCOPE(kZoneTile);
+    int x0 = (tileIndex % tilesX) * kCSGroupSizeX;
+    int y0 = (tileIndex / tilesX) * kCSGroupSizeY;
+    int x1 = x0 + kCSGroupSizeX < width ? x0 + kCSGroupSizeX : width;
+    int y1 = y0 + kCSGroupSizeY < height ? y0 + kCSGroupSizeY : height;
+
+    // A single pixel's variance is a poor estimate when rare paths carry most
+    // of the energy, so pixels only drop out well below the threshold and the
+    // tile as a whole has to meet it on average before it retires
+    float thresholdSq = adaptiveThreshold * adaptiveThreshold;
+    float pixelThresholdSq = thresholdSq * kAdaptivePixelScale * kAdaptivePixelScale;
+    uint32_t rayCounts[kMaxDepth] = {};
+    PixelAovs aovs;
+    PixelAovs* pixelAovs = aovImage.empty() ? nullptr : &aovs;
+    float tileErrorSq = 0;
+    bool warm = true;
+    for (int y = y0; y < y1; ++y)
+    {
+        for (int x = x0; x < x1; ++x)
+        {
+            PixelStats& stats = pixelStats[size_t(y) * width + x];
+            float errorSq = GetErrorSq(stats);
+            if (stats.count >= kAdaptiveMinFrames && errorSq <= pixelThresholdSq)
+            {
+                tileErrorSq += errorSq;
+                continue;
+            }
+
+            float3 color = TracePixel(scene, params, x, y, rayCounts, pixelAovs);
+
+            // Pixels take different numbers of frames, so each one blends by
+            // its own count. The image doubles as the running mean.
+            ++stats.count;
+            size_t index = size_t(y) * width + x;
+            float3& pixel = image[index];
+            float3 delta = color - pixel;
+            float lerpFactor = float(stats.count - 1) / float(stats.count);
+            pixel = lerp(color, pixel, lerpFactor);
+            stats.m2 += delta * (color - pixel);
+            if (pixelAovs)
+                AccumulateAovs(index, aovs, lerpFactor);
+
+            tileErrorSq += GetErrorSq(stats);
+            warm &= stats.count >= kAdaptiveMinFrames;
+        }
+    }
+    int pixelCount = (x1 - x0) * (y1 - y0);
+    tileConverged[tileIndex] = warm && tileErrorSq <= thresholdSq * float(pixelCount);
+    AddRayCounts(threadIndex, rayCounts);
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include "CpuTracer.h"
+#include "Numa.h"
+#include "ThreadPool.h"
+#include "TraceKernels.h"
+#include "Wavefront.h"
+
+// Passes of a progressive first frame: a pixel in every 4x4 block, then in
+// every 2x2 block, then all the others
+#define kPreviewPasses 3
+
+class SceneReplicas;
+
+// Order the tiles are handed to the threads in. Each thread starts on a
+// contiguous run of it, so along a curve every thread works on a compact patch
+// of the image whose rays share BVH nodes and cache lines.
+enum class TileOrder
+{
+    Rows,       // row after row, like the compute shader dispatch
+    Morton,     // Z-order curve
+    Hilbert,    // Hilbert curve, which never jumps between tiles that are not neighbours
+};
+
+const char* GetTileOrderName(TileOrder order);
+bool FindTileOrder(const char* name, TileOrder& order);
+
+// Runs the ComputeShader.hlsl main() over the frame on the CPU, one
+// kCSGroupSizeX x kCSGroupSizeY tile per task.
+class CpuRenderer
+{
+public:
+    CpuRenderer(ThreadPool& pool, int width, int height);
+
+    void RenderFrame(const SceneView& scene, const ComputeParams& params);
+    // Switches between the per-pixel bounce loop and WavefrontRenderer
+    void SetWavefront(bool enable);
+    bool IsWavefront() const { return wavefront != nullptr; }
+    // Adaptive sampling: a tile stops being dispatched once the RMS standard
+    // error of its pixel means drops below threshold, and pixels well below it
+    // stop sampling early. 0 turns it off. Only applies to the per-pixel path;
+    // accumulation restarts at frame 0.
+    void SetAdaptive(float threshold);
+    bool IsAdaptive() const { return adaptiveThreshold > 0; }
+    int GetActiveTileCount() const { return IsAdaptive() ? int(activeTiles.size()) : tilesX * tilesY; }
+    int GetTileCount() const { return tilesX * tilesY; }
+
+    // On a pool spread over several NUMA nodes the tile rows are cut into one
+    // band per node, sized by its threads, and the curve runs within each
+    // band, so the threads of a node start on its own band. The image is
+    // cleared by the threads that start on each tile, which puts its pages on
+    // their node under a first touch policy; call this before rendering.
+    void SetTileOrder(TileOrder order);
+    TileOrder GetTileOrder() const { return tileOrder; }
+    // Per-node copies of the scene that each thread traces instead of the
+    // view RenderFrame gets, the one of its node; null uses that view again.
+    // They have to be rebuilt whenever the scene changes. Only applies to the
+    // per-pixel path.
+    void SetSceneReplicas(const SceneReplicas* replicas) { sceneReplicas = replicas; }
+
+    // Progressive preview: the first frame after a restart (params.frames 0)
+    // is traced in kPreviewPasses passes of 1/16, 3/16 and 3/4 of the pixels,
+    // each filling the pixels still to come from the traced one of their
+    // block, so a coarse image is there after 1/16 of the frame's work. The
+    // passes trace the same samples a full frame 0 would, and nothing is
+    // thrown away. Each RenderFrame runs passes until the next one would not
+    // fit in budgetMs (at least one); call it with the same params until
+    // IsFrameComplete(). Only applies to the per-pixel path without adaptive
+    // sampling.
+    void SetProgressive(bool enable, float budgetMs);
+    bool IsFrameComplete() const { return previewPass == kPreviewPasses; }
+    // Size of the blocks the image is in, 4, 2 or 1 for full resolution
+    int GetPreviewBlockSize() const { return IsFrameComplete() ? 1 : 8 >> previewPass; }
+
+    // Renders only the width x height window at (x, y) of a fullWidth x
+    // fullHeight frame, so a big image can be done a band at a time with the
+    // same pixels it would get in one go. Only applies to the per-pixel path.
+    void SetRegion(int fullWidth, int fullHeight, int x, int y, int width, int height);
+
+    // Bounce limit and samples per pixel. Each frame runs the TraceKernel
+    // specialized for the scene's material types and these settings, or the
+    // generic one when specialization is off. Only applies to the per-pixel path.
+    void SetTraceSettings(const TraceSettings& settings) { traceSettings = settings; }
+    const TraceSettings& GetTraceSettings() const { return traceSettings; }
+    void SetSpecialized(bool enable) { specialized = enable; }
+    // The kernel the last frame ran
+    const TraceKernel& GetTraceKernel() const { return *traceKernel; }
+
+    // Accumulates the first-hit albedo, normal and depth of every pixel next
+    // to the image, for the denoiser. Only applies to the per-pixel path.
+    void SetAovs(bool enable);
+    // width * height entries, null while AOVs are off
+    const PixelAovs* GetAovs() const { return aovImage.empty() ? nullptr : aovImage.data(); }
+
+    // Rounds every pixel through a kAccumFormat after it is accumulated, so
+    // the image carries the error the GPU buffer in that format would. Only
+    // applies to the per-pixel path.
+    void SetAccumFormat(int format) { accumFormat = format; }
+    int GetAccumFormat() const { return accumFormat; }
+
+    int GetWidth() const { return width; }
+    int GetHeight() const { return height; }
+    const float3* GetImage() const { return image.data(); }
+    uint64_t GetRayCount() const { return rayCount; }
+    // Rays of the last frame per bounce, kMaxDepth entries
+    const uint64_t* GetDepthRayCounts() const { return depthRayCounts; }
+
+private:
+    struct alignas(64) RayCounter
+    {
+        uint64_t count[kMaxDepth];
+    };
+
+    // Welford sum of squared deviations of each pixel's per-frame color; the
+    // running mean is the image itself
+    struct PixelStats
+    {
+        float3 m2;
+        uint32_t count = 0;
+    };
+
+    void BuildTileOrder();
+    // Allocates pixels for the image and clears every tile on the thread a
+    // ParallelFor over the tiles starts it on
+    template <typename T>
+    void FirstTouch(FirstTouchArray<T>& pixels);
+    const SceneView& GetThreadScene(const SceneView& scene, int threadIndex) const;
+    float3 TracePixel(const SceneView& scene, const ComputeParams& params, int x, int y, uint32_t* rayCounts, PixelAovs* aovs) const;
+    void AccumulateAovs(size_t index, const PixelAovs& aovs, float lerpFactor);
+    void AddRayCounts(int threadIndex, const uint32_t* rayCounts);
+    void RenderTile(const SceneView& scene, const ComputeParams& params, int tileIndex, int threadIndex);
+    void RenderTilePreview(const SceneView& scene, const ComputeParams& params, int pass, int tileIndex, int threadIndex);
+    void RenderTileAdaptive(const SceneView& scene, const ComputeParams& params, int tileIndex, int threadIndex);
+    float GetErrorSq(const PixelStats& stats) const;
+
+    ThreadPool& pool;
+    int width, height;
+    int fullWidth, fullHeight;
+    int regionX = 0, regionY = 0;
+    int tilesX, tilesY;
+    TileOrder tileOrder = TileOrder::Rows;
+    // Tile indices in dispatch order
+    std::vector<int> tiles;
+    const SceneReplicas* sceneReplicas = nullptr;
+    FirstTouchArray<float3> image;
+    FirstTouchArray<PixelAovs> aovImage;
+    std::vector<RayCounter> rayCounters;
+    uint64_t rayCount = 0;
+    uint64_t depthRayCounts[kMaxDepth] = {};
+    std::unique_ptr<WavefrontRenderer> wavefront;
+
+    TraceSettings traceSettings;
+    bool specialized = true;
+    int accumFormat = kAccumFormatFp32;
+
+    bool progressive = false;
+    float previewBudget = 0;
+    // Passes of the current preview done so far, kPreviewPasses when none is under way
+    int previewPass = kPreviewPasses;
+    const TraceKernel* traceKernel = &GetGenericTraceKernel();
+
+    float adaptiveThreshold = 0;
+    FirstTouchArray<PixelStats> pixelStats;
+    std::vector<int> activeTiles;
+    std::vector<uint8_t> tileConverged;
+};
@@ -0,0 +1,780 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "Config.h"
+#include "Maths.h"
+#include "LightTree.h"
+#include "Profiler.h"
+#include "Sampler.h"
+#include "SharedDataStruct.h"
+#include "SceneView.h"
+#include "SphereKernels.h"
+
+// C++ port of the tracing functions in ComputeShader.hlsl. Keep the two in sync:
+// the CPU backend is expected to produce the same images as the GPU one.
+
+///////////////////////////
+struct Ray
+{
+    float3 origin;
+    float3 dir;
+};
+inline Ray MakeRay(float3 origin, float3 dir)
+{
+    Ray r;
+    r.origin = origin;
+    r.dir = dir;
+    return r;
+}
+inline float3 RayPointAt(const Ray& r, float t)
+{
+    return r.origin + r.dir * t;
+}
+inline float3 Refract(float3 dir, float3 normal, float refraction)
+{
+    float theta = minf(dot(-dir, normal), 1.0f);
+    float3 perp = refraction * (dir + theta * normal);
+    float3 parallel = -sqrtf(fabsf(1.0f - dot(perp, perp))) * normal;
+    return perp + parallel;
+}
+
+struct HitRecord
+{
+    float3 position;
+    float3 normal;
+    bool isFrontFace;
+    int material;
+    // Index into SceneView::lights of the sphere hit, or -1 when it is none
+    int light;
+};
+
+// What the camera rays of a pixel hit first, averaged over its samples: the
+// albedo of the material (white for glass and emitters, the sky color for
+// misses), the normal and the distance, both 0 for misses. Guides the denoiser.
+struct PixelAovs
+{
+    float3 albedo;
+    float3 normal;
+    float depth = 0;
+};
+
+///////////////////////////
+inline uint32_t RNG(uint32_t& seed)
+{
+    uint32_t x = seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 15;
+    seed = x;
+    return x;
+}
+
+inline float RandomFloat01(uint32_t& seed)
+{
+    return (RNG(seed) & 0xFFFFFF) / 16777216.0f;
+}
+
+// Next dimension of a path sample; kSamplerRandom keeps drawing from the
+// xorshift stream like ComputeShader.hlsl
+inline float RandomFloat01(PathSampler& sampler)
+{
+    if (sampler.type == kSamplerRandom)
+        return RandomFloat01(sampler.seed);
+    return SampleDimension(sampler, sampler.dimension++);
+}
+
+template <typename Rng>
+inline float3 RandomInUnitDisk(Rng& seed)
+{
+    float a = RandomFloat01(seed) * 2.0f * float(PI);
+    float s = sqrtf(RandomFloat01(seed));
+    return float3(cosf(a) * s, sinf(a) * s, 0);
+}
+
+template <typename Rng>
+inline float3 RandomInUnitSphere(Rng& seed)
+{
+    float z = RandomFloat01(seed) * 2.0f - 1.0f;
+    float t = RandomFloat01(seed) * 2.0f * float(PI);
+    float r = sqrtf(maxf(0.0f, 1.0f - z * z));
+    float x = r * cosf(t);
+    float y = r * sinf(t);
+    float3 res = float3(x, y, z);
+    res *= powf(RandomFloat01(seed), 1.0f / 3.0f);
+    return res;
+}
+
+template <typename Rng>
+inline float3 RandomUnitVector(Rng& seed)
+{
+    float z = RandomFloat01(seed) * 2.0f - 1.0f;
+    float a = RandomFloat01(seed) * 2.0f * float(PI);
+    float r = sqrtf(1.0f - z * z);
+    float x = r * cosf(a);
+    float y = r * sinf(a);
+    return float3(x, y, z);
+}
+
+template <typename Rng>
+inline Ray CameraGetRay(const Camera& cam, float u, float v, Rng& seed)
+{
+    PROFILE_COUNT(kCounterCameraRays, 1);
+    float3 rd = cam.lensRadius * RandomInUnitDisk(seed);
+    float3 offset = cam.u * rd.x + cam.v * rd.y;
+    float3 dir = normalize(cam.lowerLeftCorner + u * cam.horizontal + v * cam.vertical - cam.origin - offset);
+    return MakeRay(cam.origin + offset, dir);
+}
+
+inline bool HitSphere(const Sphere& sphere, const Ray& ray, float tMin, float& tMax, HitRecord& record)
+{
+    float3 oc = ray.origin - sphere.center;
+    float b = dot(oc, ray.dir);
+    float c = dot(oc, oc) - sphere.radius * sphere.radius;
+    float discriminant = b * b - c;
+
+    if (discriminant > 0)
+    {
+        float sqrtd = sqrtf(discriminant);
+        float step = -b - sqrtd;
+        if (step <= tMin)
+        {
+            step = -b + sqrtd;
+        }
+        if (step > tMin && step < tMax)
+        {
+            record.position = RayPointAt(ray, step);
+            float3 normal = (record.position - sphere.center) / sphere.radius;
+            record.isFrontFace = dot(ray.dir, normal) < 0;
+            if (record.isFrontFace)
+                record.normal = normal;
+            else
+                record.normal = -normal;
+            record.material = sphere.material;
+            tMax = step;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Entry distance of the ray into the node bounds, or kMaxT when it misses
+// them or they lie outside (tMin, tMax).
+inline float IntersectBounds(const BVHNode& node, const Ray& ray, const float3& invDir, float tMin, float tMax)
+{
+    float tx1 = (node.boundsMin.x - ray.origin.x) * invDir.x;
+    float tx2 = (node.boundsMax.x - ray.origin.x) * invDir.x;
+    float ty1 = (node.boundsMin.y - ray.origin.y) * invDir.y;
+    float ty2 = (node.boundsMax.y - ray.origin.y) * invDir.y;
+    float tz1 = (node.boundsMin.z - ray.origin.z) * invDir.z;
+    float tz2 = (node.boundsMax.z - ray.origin.z) * invDir.z;
+    float tNear = maxf(maxf(minf(tx1, tx2), minf(ty1, ty2)), maxf(minf(tz1, tz2), tMin));
+    float tFar = minf(minf(maxf(tx1, tx2), maxf(ty1, ty2)), minf(maxf(tz1, tz2), tMax));
+    return tNear <= tFar ? tNear : kMaxT;
+}
+
+// Walks the BVH rooted at nodes[root] front to back and calls leaf(node) for
+// every leaf the ray reaches before tMax. leaf lowers tMax on a closer hit, so
+// subtrees behind it are skipped.
+template <typename LeafFunc>
+inline void TraverseBVH(const BVHNode* nodes, int root, const Ray& ray, float tMin, float& tMax, int& nodeVisits, LeafFunc leaf)
+{
+    float3 invDir(1.0f / ray.dir.x, 1.0f / ray.dir.y, 1.0f / ray.dir.z);
+    int stackNode[kBVHStackSize];
+    float stackDist[kBVHStackSize];
+    int stackSize = 0;
+
+    int nodeIndex = root;
+    if (IntersectBounds(nodes[root], ray, invDir, tMin, tMax) >= kMaxT)
+        return;
+
+    for (;;)
+    {
+        const BVHNode& node = nodes[nodeIndex];
+        ++nodeVisits;
+        if (node.count > 0)
+        {
+            leaf(node);
+        }
+        else
+        {
+            // Visit the nearer child first and keep the other one for later
+            int nearIndex = node.leftFirst;
+            int farIndex = node.leftFirst + 1;
+            float nearDist = IntersectBounds(nodes[nearIndex], ray, invDir, tMin, tMax);
+            float farDist = IntersectBounds(nodes[farIndex], ray, invDir, tMin, tMax);
+            if (farDist < nearDist)
+            {
+                int index = nearIndex; nearIndex = farIndex; farIndex = index;
+                float dist = nearDist; nearDist = farDist; farDist = dist;
+            }
+            if (nearDist < kMaxT)
+            {
+                if (farDist < kMaxT)
+                {
+                    stackNode[stackSize] = farIndex;
+                    stackDist[stackSize] = farDist;
+                    ++stackSize;
+                }
+                nodeIndex = nearIndex;
+                continue;
+            }
+        }
+
+        // Pop the next node that can still hold a closer hit
+        bool found = false;
+        while (stackSize > 0 && !found)
+        {
+            --stackSize;
+            found = stackDist[stackSize] < tMax;
+        }
+        if (!found)
+            break;
+        nodeIndex = stackNode[stackSize];
+    }
+}
+
+// Closest instanced sphere in (tMin, tMax). Each instance the top-level BVH
+// reaches takes the ray into its object space, where the direction keeps unit
+// length and distances shrink by its scale, and walks its prototype's BVH.
+inline bool HitInstances(const SceneView& scene, const Ray& ray, float tMin, float tMax, HitRecord& record)
+{
+    IntersectSpheresFunc intersect = scene.kernels ? scene.kernels->intersect : IntersectSpheresScalar;
+    const SphereSoAView& soa = scene.prototypeSoa;
+    int hitInstance = -1;
+    int soaIndex = -1;
+    Ray hitRay;
+    float hitT = 0;
+    int nodeVisits = 0, sphereTests = 0, instanceTests = 0;
+    TraverseBVH(scene.instanceNodes, 0, ray, tMin, tMax, nodeVisits, [&](const BVHNode& leaf)
+    {
+        instanceTests += leaf.count;
+        for (int i = leaf.leftFirst; i < leaf.leftFirst + leaf.count; ++i)
+        {
+            const Instance& instance = scene.instances[scene.instanceIndices[i]];
+            float invScale = 1.0f / instance.scale;
+            float3 offset = ray.origin - instance.translation;
+            Ray local = MakeRay(float3(dot(offset, instance.axisX), dot(offset, instance.axisY), dot(offset, instance.axisZ)) * invScale,
+                                float3(dot(ray.dir, instance.axisX), dot(ray.dir, instance.axisY), dot(ray.dir, instance.axisZ)));
+            float localMin = tMin * invScale;
+            float localMax = tMax * invScale;
+            int localIndex = -1;
+            TraverseBVH(scene.prototypeNodes, scene.prototypeRoots[instance.prototype], local, localMin, localMax, nodeVisits, [&](const BVHNode& node)
+            {
+                sphereTests += node.count;
+                float t;
+                int index = intersect(soa, node.leftFirst, node.count, local.origin, local.dir, localMin, localMax, t);
+                if (index >= 0)
+                {
+                    localMax = t;
+                    localIndex = index;
+                }
+            });
+            if (localIndex >= 0)
+            {
+                tMax = localMax * instance.scale;
+                hitInstance = int(scene.instanceIndices[i]);
+                soaIndex = localIndex;
+                hitRay = local;
+                hitT = localMax;
+            }
+        }
+    });
+    PROFILE_COUNT(kCounterNodeVisits, nodeVisits);
+    PROFILE_COUNT(kCounterSphereTests, sphereTests);
+    PROFILE_COUNT(kCounterInstanceTests, instanceTests);
+    if (soaIndex < 0)
+        return false;
+
+    const Instance& instance = scene.instances[hitInstance];
+    float3 center(soa.centerX[soaIndex], soa.centerY[soaIndex], soa.centerZ[soaIndex]);
+    float3 localNormal = (RayPointAt(hitRay, hitT) - center) / soa.radius[soaIndex];
+    float3 normal = localNormal.x * instance.axisX + localNormal.y * instance.axisY + localNormal.z * instance.axisZ;
+    record.position = RayPointAt(ray, tMax);
+    record.isFrontFace = dot(ray.dir, normal) < 0;
+    if (record.isFrontFace)
+        record.normal = normal;
+    else
+        record.normal = -normal;
+    record.material = instance.materialOverride >= 0 ? instance.materialOverride : soa.material[soaIndex];
+    record.light = -1;
+    return true;
+}
+
+inline bool HitWorld(const SceneView& scene, const Ray& ray, float tMin, float tMax, HitRecord& record)
+{
+    bool hit = false;
+    PROFILE_COUNT(kCounterRays, 1);
+
+    int soaIndex = -1;
+    int nodeVisits = 0, sphereTests = 0;
+    if (scene.nodeCount > 0)
+    {
+        TraverseBVH(scene.nodes, 0, ray, tMin, tMax, nodeVisits, [&](const BVHNode& node)
+        {
+            sphereTests += node.count;
+            if (scene.kernels)
+            {
+                float t;
+                int index = scene.kernels->intersect(scene.soa, node.leftFirst, node.count, ray.origin, ray.dir, tMin, tMax, t);
+                if (index >= 0)
+                {
+                    tMax = t;
+                    soaIndex = index;
+                }
+            }
+            else
+            {
+                for (int i = node.leftFirst; i < node.leftFirst + node.count; ++i)
+                {
+                    if (HitSphere(scene.spheres[scene.indices[i]], ray, tMin, tMax, record))
+                    {
+                        record.light = scene.lightCount > 0 ? scene.sphereLights[scene.indices[i]] : -1;
+                        hit = true;
+                    }
+                }
+            }
+        });
+    }
+    PROFILE_COUNT(kCounterNodeVisits, nodeVisits);
+    PROFILE_COUNT(kCounterSphereTests, sphereTests);
+
+    if (soaIndex >= 0)
+    {
+        const SphereSoAView& soa = scene.soa;
+        float3 center(soa.centerX[soaIndex], soa.centerY[soaIndex], soa.centerZ[soaIndex]);
+        record.position = RayPointAt(ray, tMax);
+        float3 normal = (record.position - center) / soa.radius[soaIndex];
+        record.isFrontFace = dot(ray.dir, normal) < 0;
+        if (record.isFrontFace)
+            record.normal = normal;
+        else
+            record.normal = -normal;
+        record.material = soa.material[soaIndex];
+        record.light = scene.lightCount > 0 ? scene.sphereLights[scene.indices[soaIndex]] : -1;
+        hit = true;
+    }
+    // Instances behind the closest sphere are culled by the lowered tMax
+    if (scene.instanceCount > 0 && HitInstances(scene, ray, tMin, tMax, record))
+        hit = true;
+    return hit;
+}
+
+// Lambertian
+template <typename Rng>
+inline bool ScatterLambertian(const Material& material, const HitRecord& record, float3& color, Ray& ray, Rng& seed)
+{
+    PROFILE_COUNT(kCounterScatterLambertian, 1);
+    color *= material.albedo;
+    ray.origin = record.position;
+    ray.dir = normalize(record.normal + RandomUnitVector(seed));
+    return true;
+}
+
+// Metal
+template <typename Rng>
+inline bool ScatterMetal(const Material& material, const HitRecord& record, float3& color, Ray& ray, Rng& seed)
+{
+    PROFILE_COUNT(kCounterScatterMetal, 1);
+    color *= material.albedo;
+    ray.origin = record.position;
+    ray.dir = reflect(ray.dir, record.normal);
+    ray.dir += material.fuzziness * RandomInUnitSphere(seed);
+    ray.dir = normalize(ray.dir);
+    return dot(ray.dir, record.normal) > 0;
+}
+
+// Dielectric
+template <typename Rng>
+inline bool ScatterDielectric(const Material& material, const HitRecord& record, float3& color, Ray& ray, Rng& seed)
+{
+    PROFILE_COUNT(kCounterScatterDielectric, 1);
+    ray.origin = record.position;
+    float refraction = material.refraction;
+    if (record.isFrontFace)
+    {
+        refraction = 1.0f / refraction;
+    }
+    // Total Internal Reflection
+    double cosTheta = fmin(dot(-ray.dir, record.normal), 1.0);
+    double sinTheta = sqrt(1.0 - cosTheta * cosTheta);
+    bool cannotRefract = refraction * sinTheta > 1.0;
+
+    // Use Schlick's approximation for reflectance
+    float r0 = (1 - refraction) / (1 + refraction);
+    r0 = r0 * r0;
+    float reflectance = float(r0 + (1 - r0) * pow((1 - cosTheta), 5));
+
+    if (cannotRefract || reflectance > RandomFloat01(seed))
+        ray.dir = reflect(ray.dir, record.normal);
+    else
+        ray.dir = normalize(Refract(ray.dir, record.normal, refraction));
+
+    return true;
+}
+
+// Material type bits, as in SceneView::materialTypes
+enum
+{
+    kMaterialTypeLambertian = 1 << 0,
+    kMaterialTypeMetal = 1 << 1,
+    kMaterialTypeDielectric = 1 << 2,
+    kMaterialTypeEmissive = 1 << kMaterialEmissive,
+    kMaterialTypeAll = kMaterialTypeLambertian | kMaterialTypeMetal | kMaterialTypeDielectric | kMaterialTypeEmissive
+};
+
+template <typename Rng>
+inline bool Scatter(const SceneView& scene, const HitRecord& record, float3& color, Ray& ray, Rng& seed)
+{
+    const Material& material = scene.materials[record.material];
+    int type = material.type;
+
+    if (type == 0)
+        return ScatterLambertian(material, record, color, ray, seed);
+    else if (type == 1)
+        return ScatterMetal(material, record, color, ray, seed);
+    else if (type == 2)
+        return ScatterDielectric(material, record, color, ray, seed);
+    return false;
+}
+
+// Sky gradient returned for rays that leave the scene
+inline float3 BackgroundColor(const Ray& ray)
+{
+    float t = (ray.dir.y + 1.0f) / 2.0f;
+    return lerp(float3(1.0f, 1.0f, 1.0f), float3(0.5f, 0.7f, 1.0f), t);
+}
+
+// Unbiased Russian roulette: once a path has scattered rouletteDepth times it
+// survives each further bounce with a probability of its largest throughput
+// channel, and survivors are scaled up by the inverse of it
+template <typename Rng>
+inline bool RussianRoulette(float3& color, int bounces, int rouletteDepth, Rng& seed)
+{
+    if (rouletteDepth <= 0 || bounces < rouletteDepth)
+        return true;
+    float survival = minf(maxf(color.x, maxf(color.y, color.z)), 1.0f);
+    if (RandomFloat01(seed) >= survival)
+        return false;
+    color = color / survival;
+    return true;
+}
+
+// rayCounts has kMaxDepth bins, one per bounce. Each bounce draws from its
+// own sampler dimensions.
+inline float3 Trace(const SceneView& scene, Ray ray, int rouletteDepth, uint32_t* rayCounts, PathSampler& sampler)
+{
+    float3 color(1, 1, 1);
+    for (int depth = 0; depth < kMaxDepth; ++depth)
+    {
+        ++rayCounts[depth];
+        HitRecord record;
+        if (HitWorld(scene, ray, kMinT, kMaxT, record))
+        {
+            // Emissive: the path ends on the light
+            const Material& material = scene.materials[record.material];
+            if (material.type == kMaterialEmissive)
+                return color * material.albedo;
+            uint32_t dimension = kSamplerDimensionBounce + uint32_t(depth) * kSamplerBounceDimensions;
+            SetSamplerDimension(sampler, dimension);
+            if (!Scatter(scene, record, color, ray, sampler))
+            {
+                return float3(0, 0, 0);
+            }
+            SetSamplerDimension(sampler, dimension + kSamplerDimensionRoulette);
+            if (depth + 1 < kMaxDepth && !RussianRoulette(color, depth + 1, rouletteDepth, sampler))
+            {
+                return float3(0, 0, 0);
+            }
+        }
+        else
+        {
+            color *= BackgroundColor(ray);
+            break;
+        }
+    }
+    return color;
+}
+
+// Scatter with only the branches for the material types in MaterialTypes
+// compiled in. With a single type the type is not even looked at.
+template <uint32_t MaterialTypes, typename Rng>
+inline bool ScatterTypes(const SceneView& scene, const HitRecord& record, float3& color, Ray& ray, Rng& seed)
+{
+    const Material& material = scene.materials[record.material];
+    int type = material.type;
+
+    if constexpr ((MaterialTypes & kMaterialTypeLambertian) != 0)
+    {
+        if (MaterialTypes == kMaterialTypeLambertian || type == 0)
+            return ScatterLambertian(material, record, color, ray, seed);
+    }
+    if constexpr ((MaterialTypes & kMaterialTypeMetal) != 0)
+    {
+        if (MaterialTypes == kMaterialTypeMetal || type == 1)
+            return ScatterMetal(material, record, color, ray, seed);
+    }
+    if constexpr ((MaterialTypes & kMaterialTypeDielectric) != 0)
+    {
+        if (MaterialTypes == kMaterialTypeDielectric || type == 2)
+            return ScatterDielectric(material, record, color, ray, seed);
+    }
+    return false;
+}
+
+// Next-event estimation. Diffuse and fuzzy metal vertices send a shadow ray to
+// a point on one light picked through the light tree, and both that sample
+// and a scattered ray that hits a light are weighted by the power heuristic,
+// so neither small bright lights nor large dim ones add much noise.
+inline float PowerHeuristic(float pdf, float otherPdf)
+{
+    return pdf * pdf / (pdf * pdf + otherPdf * otherPdf);
+}
+
+// Two unit vectors completing n to an orthonormal basis (Duff et al. 2017)
+inline void MakeBasis(const float3& n, float3& tangent, float3& bitangent)
+{
+    float sign = n.z >= 0 ? 1.0f : -1.0f;
+    float a = -1.0f / (sign + n.z);
+    float b = n.x * n.y * a;
+    tangent = float3(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+    bitangent = float3(b, sign + n.y * n.y * a, -n.y);
+}
+
+// 1 - cos of the half angle of the cone a sphere fills, from the squared ratio
+// of its radius to its distance; without the cancellation for far spheres
+inline float GetConeOneMinusCos(float sinSq)
+{
+    return sinSq / (1.0f + sqrtf(1.0f - sinSq));
+}
+
+// Probability of each child of an interior light node being picked from
+// position, in proportion to its importance
+inline void GetLightChildPicks(const SceneView& scene, const LightNode& node, const float3& position, float& left, float& right)
+{
+    float leftImportance = GetLightImportance(scene.lightNodes[node.child], position);
+    float rightImportance = GetLightImportance(scene.lightNodes[node.child + 1], position);
+    float total = leftImportance + rightImportance;
+    left = leftImportance / total;
+    right = rightImportance / total;
+}
+
+// Solid angle density of SampleLight going toward light from position, the
+// pick included, or 0 from inside it. Walks up from the light's leaf.
+inline float GetLightPdf(const SceneView& scene, int light, const float3& position)
+{
+    const Light& sphere = scene.lights[light];
+    float3 toCenter = sphere.center - position;
+    float distSq = dot(toCenter, toCenter);
+    float radiusSq = sphere.radius * sphere.radius;
+    if (distSq <= radiusSq)
+        return 0;
+    float pick = 1;
+    for (int index = sphere.node; index != 0; )
+    {
+        const LightNode& parent = scene.lightNodes[scene.lightNodes[index].parent];
+        float left, right;
+        GetLightChildPicks(scene, parent, position, left, right);
+        pick *= index == parent.child ? left : right;
+        index = scene.lightNodes[index].parent;
+    }
+    return pick / (2.0f * float(PI) * GetConeOneMinusCos(radiusSq / distSq));
+}
+
+// Picks a light down the light tree and a direction uniform over the cone its
+// sphere fills as seen from position, returning the distance to the sphere
+// along it. False from inside the light.
+template <typename Rng>
+inline bool SampleLight(const SceneView& scene, const float3& position, float3& dir, float& distance, float3& emission, float& pdf,
+                        Rng& seed)
+{
+    // One number picks every child on the way down, rescaled to [0, 1) at each step
+    float u = RandomFloat01(seed);
+    float pick = 1;
+    int index = 0;
+    while (scene.lightNodes[index].child >= 0)
+    {
+        const LightNode& node = scene.lightNodes[index];
+        float left, right;
+        GetLightChildPicks(scene, node, position, left, right);
+        if (u < left)
+        {
+            u = minf(u / left, 0.99999994f);
+            pick *= left;
+            index = node.child;
+        }
+        else
+        {
+            u = minf((u - left) / right, 0.99999994f);
+            pick *= right;
+            index = node.child + 1;
+        }
+    }
+    const Light& light = scene.lights[-1 - scene.lightNodes[index].child];
+
+    float3 toCenter = light.center - position;
+    float distSq = dot(toCenter, toCenter);
+    float radiusSq = light.radius * light.radius;
+    if (distSq <= radiusSq)
+        return false;
+    float oneMinusCosMax = GetConeOneMinusCos(radiusSq / distSq);
+    float oneMinusCos = RandomFloat01(seed) * oneMinusCosMax;
+    float phi = RandomFloat01(seed) * 2.0f * float(PI);
+    float cosTheta = 1.0f - oneMinusCos;
+    float sinTheta = sqrtf(maxf(oneMinusCos * (2.0f - oneMinusCos), 0.0f));
+
+    float dist = sqrtf(distSq);
+    float3 axis = toCenter / dist;
+    float3 tangent, bitangent;
+    MakeBasis(axis, tangent, bitangent);
+    dir = (cosf(phi) * sinTheta) * tangent + (sinf(phi) * sinTheta) * bitangent + cosTheta * axis;
+    distance = dist * cosTheta - sqrtf(maxf(radiusSq - distSq * sinTheta * sinTheta, 0.0f));
+    emission = light.emission;
+    pdf = pick / (2.0f * float(PI) * oneMinusCosMax);
+    return true;
+}
+
+// Solid angle density of ScatterLambertian or a fuzzy ScatterMetal sending the
+// ray that came in along inDir out along dir. 0 for the scatters light
+// sampling cannot pick the direction of: glass and smooth metal.
+inline float ScatterPdf(const Material& material, const HitRecord& record, const float3& inDir, const float3& dir)
+{
+    if (material.type == 0)
+        return maxf(dot(dir, record.normal), 0.0f) * float(1.0 / PI);
+    if (material.type == 1 && material.fuzziness > 0)
+    {
+        // Metal adds a point uniform in a ball of radius fuzziness to the
+        // mirror direction; a direction gets the ball's volume along it
+        float3 mirror = reflect(inDir, record.normal);
+        float fuzz = material.fuzziness;
+        float b = dot(dir, mirror);
+        float discriminant = b * b - dot(mirror, mirror) + fuzz * fuzz;
+        if (discriminant <= 0)
+            return 0;
+        float root = sqrtf(discriminant);
+        float tFar = b + root;
+        float tNear = maxf(b - root, 0.0f);
+        if (tFar <= 0)
+            return 0;
+        return (tFar * tFar * tFar - tNear * tNear * tNear) / (4.0f * float(PI) * fuzz * fuzz * fuzz);
+    }
+    return 0;
+}
+
+inline bool HasLightSampling(const Material& material)
+{
+    return material.type == 0 || (material.type == 1 && material.fuzziness > 0);
+}
+
+// Light sampling half of the estimate at a diffuse or fuzzy metal vertex: the
+// radiance the picked light sends back along inDir, unless a shadow ray finds
+// something in between. The shadow ray is added to rayCount.
+template <typename Rng>
+inline float3 SampleDirectLight(const SceneView& scene, const Material& material, const HitRecord& record, const float3& inDir,
+                                uint32_t& rayCount, Rng& seed)
+{
+    float3 dir, emission;
+    float distance, lightPdf;
+    if (!SampleLight(scene, record.position, dir, distance, emission, lightPdf, seed) || dot(dir, record.normal) <= 0)
+        return float3(0, 0, 0);
+    float scatterPdf = ScatterPdf(material, record, inDir, dir);
+    if (scatterPdf <= 0)
+        return float3(0, 0, 0);
+
+    ++rayCount;
+    HitRecord blocker;
+    if (HitWorld(scene, MakeRay(record.position, dir), kMinT, distance - kMinT, blocker))
+        return float3(0, 0, 0);
+    // Scatters weigh their rays by the albedo alone, so the BSDF times the
+    // cosine is albedo * scatterPdf
+    return material.albedo * emission * (PowerHeuristic(lightPdf, scatterPdf) * scatterPdf / lightPdf);
+}
+
+// Scatter half: the weight of an emitter a ray scattered from origin with
+// scatterPdf hit. Camera rays, rays off glass or smooth metal and emitters
+// that are not lights count in full.
+inline float GetEmitterWeight(const SceneView& scene, const HitRecord& record, const float3& origin, float scatterPdf)
+{
+    if (scatterPdf <= 0 || record.light < 0)
+        return 1;
+    return PowerHeuristic(scatterPdf, GetLightPdf(scene, record.light, origin));
+}
+
+inline void AddFirstHit(const SceneView& scene, const Ray& ray, const HitRecord* record, PixelAovs& aovs)
+{
+    if (!record)
+    {
+        aovs.albedo += BackgroundColor(ray);
+        return;
+    }
+    const Material& material = scene.materials[record->material];
+    aovs.albedo += material.type == 2 || material.type == kMaterialEmissive ? float3(1, 1, 1) : material.albedo;
+    aovs.normal += record->normal;
+    aovs.depth += length(record->position - ray.origin);
+}
+
+// Trace for a fixed set of material types and a bounce limit of MaxDepth, or
+// of maxDepth when MaxDepth is 0. Bounces past kMaxDepth count in the last
+// rayCounts bin, shadow rays in that of their bounce. The first hit is added
+// to aovs unless it is null. Kernels with emissive materials sample the
+// scene's lights at every diffuse and fuzzy metal vertex.
+template <uint32_t MaterialTypes, int MaxDepth>
+inline float3 TraceTypes(const SceneView& scene, Ray ray, int maxDepth, int rouletteDepth, uint32_t* rayCounts, PixelAovs* aovs,
+                         PathSampler& sampler)
+{
+    constexpr bool hasEmitters = (MaterialTypes & kMaterialTypeEmissive) != 0;
+    const int depthLimit = MaxDepth > 0 ? MaxDepth : maxDepth;
+    float3 color(1, 1, 1);
+    // Light from emitters so far, and where the last scatter left from with
+    // what density, for weighing the emitter it may hit
+    float3 radiance(0, 0, 0);
+    float3 scatterOrigin;
+    float scatterPdf = 0;
+    for (int depth = 0; depth < depthLimit; ++depth)
+    {
+        uint32_t& rayCount = rayCounts[depth < kMaxDepth ? depth : kMaxDepth - 1];
+        ++rayCount;
+        HitRecord record;
+        if (HitWorld(scene, ray, kMinT, kMaxT, record))
+        {
+            if (aovs && depth == 0)
+                AddFirstHit(scene, ray, &record, *aovs);
+            uint32_t dimension = kSamplerDimensionBounce + uint32_t(depth) * kSamplerBounceDimensions;
+            float3 inDir = ray.dir;
+            if constexpr (hasEmitters)
+            {
+                const Material& material = scene.materials[record.material];
+                if (material.type == kMaterialEmissive)
+                    return radiance + color * material.albedo * GetEmitterWeight(scene, record, scatterOrigin, scatterPdf);
+                if (scene.lightCount > 0 && HasLightSampling(material))
+                {
+                    SetSamplerDimension(sampler, dimension + kSamplerDimensionLight);
+                    radiance += color * SampleDirectLight(scene, material, record, inDir, rayCount, sampler);
+                }
+            }
+            SetSamplerDimension(sampler, dimension);
+            if (!ScatterTypes<MaterialTypes>(scene, record, color, ray, sampler))
+            {
+                return radiance;
+            }
+            if constexpr (hasEmitters)
+            {
+                scatterOrigin = record.position;
+                scatterPdf = scene.lightCount > 0 ? ScatterPdf(scene.materials[record.material], record, inDir, ray.dir) : 0.0f;
+            }
+            SetSamplerDimension(sampler, dimension + kSamplerDimensionRoulette);
+            if (depth + 1 < depthLimit && !RussianRoulette(color, depth + 1, rouletteDepth, sampler))
+            {
+                return radiance;
+            }
+        }
+        else
+        {
+            if (aovs && depth == 0)
+                AddFirstHit(scene, ray, nullptr, *aovs);
+            color *= BackgroundColor(ray);
+            break;
+        }
+    }
+    return radiance + color;
+}
@@ -0,0 +1,207 @@
+#include <math.h>
+
+#include "Denoiser.h"
+#include "MathsSIMD.h"
+#include "Profiler.h"
+
+// Albedo the lighting is divided by at least, so black surfaces stay finite
+#define kDenoiseMinAlbedo 0.01f
+// Depth below which the relative depth weight stops growing; misses are 0
+#define kDenoiseMinDepth 0.01f
+
+enum
+{
+    kPlaneLight0 = 0,
+    kPlaneLight1 = 3,
+    kPlaneNormal = 6,
+    kPlaneAlbedo = 9,
+    kPlaneDepth = 12,
+    kPlaneCount = 13
+};
+
+// B3 spline
+static const float s_Kernel[5] = { 1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16 };
+
+void Denoiser::FilterPixel(const Pass& pass, int x, int y)
+{
+    size_t center = size_t(y) * width + x;
+    float3 light(pass.light[0][center], pass.light[1][center], pass.light[2][center]);
+    float3 n(normal[0][center], normal[1][center], normal[2][center]);
+    float3 a(albedo[0][center], albedo[1][center], albedo[2][center]);
+    float z = depth[center];
+    float depthWeight = pass.depthWeight / maxf(z, kDenoiseMinDepth);
+
+    float3 sum(0, 0, 0);
+    float weightSum = 0;
+    for (int ty = 0; ty < 5; ++ty)
+    {
+        int qy = y + (ty - 2) * pass.step;
+        if (qy < 0 || qy >= height)
+            continue;
+        for (int tx = 0; tx < 5; ++tx)
+        {
+            int qx = x + (tx - 2) * pass.step;
+            if (qx < 0 || qx >= width)
+                continue;
+            size_t q = size_t(qy) * width + qx;
+            float3 ql(pass.light[0][q], pass.light[1][q], pass.light[2][q]);
+            float3 dl = ql - light;
+            float3 dn = float3(normal[0][q], normal[1][q], normal[2][q]) - n;
+            float3 da = float3(albedo[0][q], albedo[1][q], albedo[2][q]) - a;
+            float distance = dot(dl, dl) * pass.colorWeight + dot(dn, dn) * pass.normalWeight
+                           + dot(da, da) * pass.albedoWeight + fabsf(depth[q] - z) * depthWeight;
+            float weight = s_Kernel[ty] * s_Kernel[tx] * expf(-distance);
+            sum += ql * weight;
+            weightSum += weight;
+        }
+    }
+    // The center tap always has weight
+    sum *= 1.0f / weightSum;
+    pass.output[0][center] = sum.x;
+    pass.output[1][center] = sum.y;
+    pass.output[2][center] = sum.z;
+}
+
+#if defined(SIMD_SSE2)
+// exp(x) for x <= 0 through 2^i * 2^f with a degree 5 polynomial for 2^f,
+// relative error below 1e-5
+static inline __m128 ExpNegative(__m128 x)
+{
+    __m128 t = _mm_mul_ps(_mm_max_ps(x, _mm_set1_ps(-80.0f)), _mm_set1_ps(1.44269504f));
+    __m128i i = _mm_cvtps_epi32(t);
+    __m128 f = _mm_sub_ps(t, _mm_cvtepi32_ps(i));
+    __m128 p = _mm_set1_ps(1.33335581e-3f);
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(9.61812911e-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(5.55041087e-2f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(2.40226507e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(6.93147181e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.0f));
+    __m128i exponent = _mm_slli_epi32(_mm_add_epi32(i, _mm_set1_epi32(127)), 23);
+    return _mm_mul_ps(p, _mm_castsi128_ps(exponent));
+}
+
+static inline __m128 Load(const float* plane, size_t index) { return _mm_loadu_ps(plane + index); }
+#endif
+
+void Denoiser::FilterRow(const Pass& pass, int y)
+{
+    int x = 0;
+#if defined(SIMD_SSE2)
+    // Four pixels at a time wherever all their horizontal taps are inside
+    int reach = 2 * pass.step;
+    for (x = 0; x < reach && x < width; ++x)
+        FilterPixel(pass, x, y);
+    for (; x + 4 + reach <= width; x += 4)
+    {
+        size_t center = size_t(y) * width + x;
+        float3x4 light(Load(pass.light[0], center), Load(pass.light[1], center), Load(pass.light[2], center));
+        float3x4 n(Load(normal[0], center), Load(normal[1], center), Load(normal[2], center));
+        float3x4 a(Load(albedo[0], center), Load(albedo[1], center), Load(albedo[2], center));
+        __m128 z = Load(depth, center);
+        __m128 depthWeight = _mm_div_ps(_mm_set1_ps(pass.depthWeight), _mm_max_ps(z, _mm_set1_ps(kDenoiseMinDepth)));
+        __m128 colorWeight = _mm_set1_ps(pass.colorWeight);
+        __m128 normalWeight = _mm_set1_ps(pass.normalWeight);
+        __m128 albedoWeight = _mm_set1_ps(pass.albedoWeight);
+        __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+        float3x4 sum(_mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps());
+        __m128 weightSum = _mm_setzero_ps();
+        for (int ty = 0; ty < 5; ++ty)
+        {
+            int qy = y + (ty - 2) * pass.step;
+            if (qy < 0 || qy >= height)
+                continue;
+            for (int tx = 0; tx < 5; ++tx)
+            {
+                size_t q = size_t(qy) * width + x + (tx - 2) * pass.step;
+                float3x4 ql(Load(pass.light[0], q), Load(pass.light[1], q), Load(pass.light[2], q));
+                float3x4 dl = ql - light;
+                float3x4 dn = float3x4(Load(normal[0], q), Load(normal[1], q), Load(normal[2], q)) - n;
+                float3x4 da = float3x4(Load(albedo[0], q), Load(albedo[1], q), Load(albedo[2], q)) - a;
+                __m128 dz = _mm_and_ps(_mm_sub_ps(Load(depth, q), z), absMask);
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dot(dl, dl), colorWeight), _mm_mul_ps(dot(dn, dn), normalWeight)),
+                                             _mm_add_ps(_mm_mul_ps(dot(da, da), albedoWeight), _mm_mul_ps(dz, depthWeight)));
+                __m128 weight = _mm_mul_ps(_mm_set1_ps(s_Kernel[ty] * s_Kernel[tx]), ExpNegative(_mm_sub_ps(_mm_setzero_ps(), distance)));
+                sum = sum + ql * weight;
+                weightSum = _mm_add_ps(weightSum, weight);
+            }
+        }
+        sum = sum * _mm_div_ps(_mm_set1_ps(1.0f), weightSum);
+        _mm_storeu_ps(pass.output[0] + center, sum.x);
+        _mm_storeu_ps(pass.output[1] + center, sum.y);
+        _mm_storeu_ps(pass.output[2] + center, sum.z);
+    }
+#endif
+    for (; x < width; ++x)
+        FilterPixel(pass, x, y);
+}
+
+void Denoiser::Run(int width_, int height_, int frames, const float3* color, const PixelAovs* aovs, const DenoiseSettings& settings, float3* output)
+{
+    PROFILE_SCOPE(kZoneDenoise);
+    width = width_;
+    height = height_;
+    planes.resize(size_t(kPlaneCount) * width * height);
+    for (int i = 0; i < 3; ++i)
+    {
+        normal[i] = GetPlane(kPlaneNormal + i);
+        albedo[i] = GetPlane(kPlaneAlbedo + i);
+    }
+    depth = GetPlane(kPlaneDepth);
+
+    // Split into planes and divide out the albedo
+    float* light[3] = { GetPlane(kPlaneLight0), GetPlane(kPlaneLight0 + 1), GetPlane(kPlaneLight0 + 2) };
+    float* n[3] = { GetPlane(kPlaneNormal), GetPlane(kPlaneNormal + 1), GetPlane(kPlaneNormal + 2) };
+    float* a[3] = { GetPlane(kPlaneAlbedo), GetPlane(kPlaneAlbedo + 1), GetPlane(kPlaneAlbedo + 2) };
+    float* z = GetPlane(kPlaneDepth);
+    pool.ParallelFor(height, [&](int y, int)
+    {
+        for (size_t i = size_t(y) * width; i < size_t(y + 1) * width; ++i)
+        {
+            const PixelAovs& aov = aovs[i];
+            n[0][i] = aov.normal.x;
+            n[1][i] = aov.normal.y;
+            n[2][i] = aov.normal.z;
+            a[0][i] = aov.albedo.x;
+            a[1][i] = aov.albedo.y;
+            a[2][i] = aov.albedo.z;
+            z[i] = aov.depth;
+            light[0][i] = color[i].x / maxf(aov.albedo.x, kDenoiseMinAlbedo);
+            light[1][i] = color[i].y / maxf(aov.albedo.y, kDenoiseMinAlbedo);
+            light[2][i] = color[i].z / maxf(aov.albedo.z, kDenoiseMinAlbedo);
+        }
+    });
+
+    int source = kPlaneLight0;
+    for (int iteration = 0; iteration < settings.iterations; ++iteration)
+    {
+        int target = source == kPlaneLight0 ? kPlaneLight1 : kPlaneLight0;
+        Pass pass;
+        for (int i = 0; i < 3; ++i)
+        {
+            pass.light[i] = GetPlane(source + i);
+            pass.output[i] = GetPlane(target + i);
+        }
+        pass.step = 1 << iteration;
+        pass.colorWeight = float(1 << iteration) * float(frames > 1 ? frames : 1) / (settings.colorSigma * settings.colorSigma);
+        pass.normalWeight = 1.0f / (settings.normalSigma * settings.normalSigma);
+        pass.albedoWeight = 1.0f / (settings.albedoSigma * settings.albedoSigma);
+        pass.depthWeight = 1.0f / settings.depthSigma;
+        pool.ParallelFor(height, [&](int y, int)
+        {
+            FilterRow(pass, y);
+        });
+        source = target;
+    }
+
+    const float* filtered[3] = { GetPlane(source), GetPlane(source + 1), GetPlane(source + 2) };
+    pool.ParallelFor(height, [&](int y, int)
+    {
+        for (size_t i = size_t(y) * width; i < size_t(y + 1) * width; ++i)
+        {
+            const float3& aov = aovs[i].albedo;
+            output[i] = float3(filtered[0][i] * maxf(aov.x, kDenoiseMinAlbedo), filtered[1][i] * maxf(aov.y, kDenoiseMinAlbedo),
+                               filtered[2][i] * maxf(aov.z, kDenoiseMinAlbedo));
+        }
+    });
+}
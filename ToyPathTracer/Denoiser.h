@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+
+#include "CpuTracer.h"
+#include "ThreadPool.h"
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) over an
+// accumulated image. The color is divided by the first-hit albedo so only the
+// lighting gets smoothed, blurred by a 5x5 B3 spline kernel whose taps spread
+// twice as far every pass, and multiplied back. Taps across differences in
+// lighting, normal, albedo or depth get little weight, so edges stay sharp.
+struct DenoiseSettings
+{
+    int iterations = 3;
+    // Standard deviations of the edge-stopping weights. The lighting one is
+    // for a single frame and shrinks with the noise as 1 / sqrt(frames), and
+    // again every pass as the image gets smoother.
+    float colorSigma = 0.8f;
+    float normalSigma = 0.2f;
+    float albedoSigma = 0.1f;
+    // Relative to the depth of the pixel being filtered
+    float depthSigma = 0.05f;
+};
+
+class Denoiser
+{
+public:
+    explicit Denoiser(ThreadPool& pool) : pool(pool) {}
+
+    // Filters a width x height image of frames accumulated frames with its
+    // AOVs into output, which may be the color buffer itself
+    void Run(int width, int height, int frames, const float3* color, const PixelAovs* aovs, const DenoiseSettings& settings, float3* output);
+
+private:
+    struct Pass
+    {
+        const float* light[3];
+        float* output[3];
+        int step;
+        float colorWeight;
+        float normalWeight;
+        float albedoWeight;
+        float depthWeight;
+    };
+
+    float* GetPlane(int plane) { return planes.data() + size_t(plane) * width * height; }
+    void FilterPixel(const Pass& pass, int x, int y);
+    void FilterRow(const Pass& pass, int y);
+
+    ThreadPool& pool;
+    int width = 0, height = 0;
+    // Lighting twice over for ping-ponging, then normal, albedo and depth,
+    // one plane per channel so a row of taps is a vector load
+    std::vector<float> planes;
+    const float* normal[3] = {};
+    const float* albedo[3] = {};
+    const float* depth = nullptr;
+};
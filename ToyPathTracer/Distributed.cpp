@@ -0,0 +1,604 @@
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+typedef SOCKET Socket;
+#define kInvalidSocket INVALID_SOCKET
+#define CloseSocket closesocket
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+typedef int Socket;
+#define kInvalidSocket (-1)
+#define CloseSocket close
+#endif
+
+#include "Distributed.h"
+#include "CpuRenderer.h"
+#include "SceneFile.h"
+
+#define kDistributedMagic 0x44545054u // "TPTD"
+#define kDistributedVersion 3
+// How long a worker keeps trying to reach the coordinator
+#define kConnectRetrySeconds 30
+
+#ifdef MSG_NOSIGNAL
+#define kSendFlags MSG_NOSIGNAL
+#else
+#define kSendFlags 0
+#endif
+
+enum MessageType
+{
+    kMessageJob = 1,
+    kMessageReady,
+    kMessageUnit,
+    kMessageResult,
+    kMessageDone
+};
+
+// Messages are these structs sent as they are; coordinator and workers are
+// expected to be the same build on the same kind of machine
+struct MessageHeader
+{
+    uint32_t magic;
+    uint32_t type;
+    uint64_t size;
+};
+
+struct JobMessage
+{
+    uint32_t version;
+    int32_t width;
+    int32_t height;
+    int32_t samplesPerPixel;
+    int32_t maxDepth;
+    int32_t rouletteDepth;
+    int32_t sampler;
+    int32_t sampleLights;
+    Camera camera;
+    uint64_t sceneHash;
+};
+
+struct ReadyMessage
+{
+    int32_t accepted;
+};
+
+struct UnitMessage
+{
+    int32_t unit;
+    int32_t firstPass;
+    int32_t passCount;
+    int32_t y0;
+    int32_t rowCount;
+};
+
+// Followed by rowCount * width float3 means and as many uint32_t sample counts
+struct ResultMessage
+{
+    int32_t unit;
+    int32_t y0;
+    int32_t rowCount;
+    int32_t width;
+};
+
+///////////////////////////
+static bool InitSockets()
+{
+#ifdef _WIN32
+    static bool s_Initialized = false;
+    if (!s_Initialized)
+    {
+        WSADATA data;
+        s_Initialized = WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }
+    return s_Initialized;
+#else
+    return true;
+#endif
+}
+
+static bool SendAll(Socket socket, const void* data, size_t size)
+{
+    const char* bytes = (const char*)data;
+    while (size > 0)
+    {
+        int chunk = size < (1u << 30) ? int(size) : (1 << 30);
+        int sent = int(send(socket, bytes, chunk, kSendFlags));
+        if (sent <= 0)
+            return false;
+        bytes += sent;
+        size -= size_t(sent);
+    }
+    return true;
+}
+
+static bool RecvAll(Socket socket, void* data, size_t size)
+{
+    char* bytes = (char*)data;
+    while (size > 0)
+    {
+        int chunk = size < (1u << 30) ? int(size) : (1 << 30);
+        int received = int(recv(socket, bytes, chunk, 0));
+        if (received <= 0)
+            return false;
+        bytes += received;
+        size -= size_t(received);
+    }
+    return true;
+}
+
+static bool SendMessage(Socket socket, uint32_t type, const void* payload, size_t size)
+{
+    MessageHeader header = { kDistributedMagic, type, size };
+    return SendAll(socket, &header, sizeof(header)) && (size == 0 || SendAll(socket, payload, size));
+}
+
+// Blocking receive of a whole message, for the worker side
+static bool RecvMessage(Socket socket, MessageHeader& header, std::vector<uint8_t>& payload, size_t maxSize)
+{
+    if (!RecvAll(socket, &header, sizeof(header)) || header.magic != kDistributedMagic || header.size > maxSize)
+        return false;
+    payload.resize(size_t(header.size));
+    return header.size == 0 || RecvAll(socket, payload.data(), payload.size());
+}
+
+static void SetNoDelay(Socket socket)
+{
+    int enable = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, (const char*)&enable, sizeof(enable));
+}
+
+///////////////////////////
+namespace
+{
+    struct Unit
+    {
+        int firstPass;
+        int passCount;
+        int y0;
+        int rowCount;
+        // Connection working on it, -1 while queued
+        int connection;
+        bool done;
+        // Its worker was lost before it was done
+        bool lost;
+    };
+
+    struct Connection
+    {
+        Socket socket;
+        int id;
+        bool ready;
+        int unit;
+        std::chrono::steady_clock::time_point assigned;
+        // Message being received
+        MessageHeader header;
+        size_t received;
+        std::vector<uint8_t> payload;
+    };
+}
+
+static double SecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool RunCoordinator(int port, const DistributedJob& job, uint64_t sceneHash, std::vector<float3>& image,
+                    DistributedStats& stats)
+{
+    stats = DistributedStats();
+    if (job.width <= 0 || job.height <= 0 || job.passes <= 0 || job.passesPerUnit <= 0 || job.bands <= 0 || !InitSockets())
+        return false;
+
+    Socket listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listener == kInvalidSocket)
+        return false;
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(uint16_t(port));
+    if (bind(listener, (const sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 16) != 0)
+    {
+        fprintf(stderr, "Cannot listen on port %d\n", port);
+        CloseSocket(listener);
+        return false;
+    }
+
+    // Bands are whole tile rows so workers split the frame like one process does
+    int bandHeight = (job.height + job.bands - 1) / job.bands;
+    bandHeight = (bandHeight + kCSGroupSizeY - 1) / kCSGroupSizeY * kCSGroupSizeY;
+    std::vector<Unit> units;
+    for (int y0 = 0; y0 < job.height; y0 += bandHeight)
+    {
+        for (int pass = 0; pass < job.passes; pass += job.passesPerUnit)
+        {
+            Unit unit;
+            unit.firstPass = pass;
+            unit.passCount = pass + job.passesPerUnit < job.passes ? job.passesPerUnit : job.passes - pass;
+            unit.y0 = y0;
+            unit.rowCount = y0 + bandHeight < job.height ? bandHeight : job.height - y0;
+            unit.connection = -1;
+            unit.done = false;
+            unit.lost = false;
+            units.push_back(unit);
+        }
+    }
+    stats.unitCount = int(units.size());
+
+    JobMessage jobMessage = {};
+    jobMessage.version = kDistributedVersion;
+    jobMessage.width = job.width;
+    jobMessage.height = job.height;
+    jobMessage.samplesPerPixel = job.trace.samplesPerPixel;
+    jobMessage.maxDepth = job.trace.maxDepth;
+    jobMessage.rouletteDepth = job.params.rouletteDepth;
+    jobMessage.sampler = job.trace.sampler;
+    jobMessage.sampleLights = job.sampleLights ? 1 : 0;
+    jobMessage.camera = job.params.camera;
+    jobMessage.sceneHash = sceneHash;
+
+    image.assign(size_t(job.width) * job.height, float3(0, 0, 0));
+    std::vector<uint32_t> counts(image.size(), 0);
+    size_t maxPayload = sizeof(ResultMessage) + size_t(bandHeight) * job.width * (sizeof(float3) + sizeof(uint32_t));
+
+    std::vector<Connection> connections;
+    int nextId = 0;
+    int doneUnits = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    auto drop = [&](size_t index, const char* reason)
+    {
+        Connection& connection = connections[index];
+        if (connection.unit >= 0 && !units[connection.unit].done)
+        {
+            units[connection.unit].connection = -1;
+            units[connection.unit].lost = true;
+        }
+        printf("worker %d %s%s\n", connection.id, reason, connection.unit >= 0 ? ", its unit goes back in the queue" : "");
+        CloseSocket(connection.socket);
+        connections.erase(connections.begin() + index);
+    };
+
+    // Checks and merges a result; false drops the worker
+    auto merge = [&](Connection& connection) -> bool
+    {
+        if (connection.payload.size() < sizeof(ResultMessage) || connection.unit < 0)
+            return false;
+        ResultMessage result;
+        memcpy(&result, connection.payload.data(), sizeof(result));
+        Unit& unit = units[connection.unit];
+        size_t pixels = size_t(unit.rowCount) * job.width;
+        if (result.unit != connection.unit || result.y0 != unit.y0 || result.rowCount != unit.rowCount || result.width != job.width
+            || connection.payload.size() != sizeof(ResultMessage) + pixels * (sizeof(float3) + sizeof(uint32_t)))
+            return false;
+
+        const uint8_t* data = connection.payload.data() + sizeof(ResultMessage);
+        float3* target = image.data() + size_t(unit.y0) * job.width;
+        uint32_t* targetCounts = counts.data() + size_t(unit.y0) * job.width;
+        for (size_t i = 0; i < pixels; ++i)
+        {
+            float3 mean;
+            uint32_t count;
+            memcpy(&mean, data + i * sizeof(float3), sizeof(float3));
+            memcpy(&count, data + pixels * sizeof(float3) + i * sizeof(uint32_t), sizeof(uint32_t));
+            if (count == 0)
+                continue;
+            // Weighted by samples, so units of any size and order merge alike
+            uint32_t total = targetCounts[i] + count;
+            target[i] = lerp(mean, target[i], float(targetCounts[i]) / float(total));
+            targetCounts[i] = total;
+            stats.samples += count;
+        }
+        unit.done = true;
+        connection.unit = -1;
+        ++doneUnits;
+        printf("unit %d/%d (passes %d-%d, rows %d-%d) from worker %d, %.1fs\n", doneUnits, stats.unitCount,
+               unit.firstPass, unit.firstPass + unit.passCount - 1, unit.y0, unit.y0 + unit.rowCount - 1,
+               connection.id, SecondsSince(start));
+        return true;
+    };
+
+    printf("Coordinator on port %d: %d units of %d passes over %d bands\n", port, stats.unitCount, job.passesPerUnit,
+           (job.height + bandHeight - 1) / bandHeight);
+    while (doneUnits < stats.unitCount)
+    {
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(listener, &readable);
+        Socket maxSocket = listener;
+        for (const Connection& connection : connections)
+        {
+            FD_SET(connection.socket, &readable);
+            if (connection.socket > maxSocket)
+                maxSocket = connection.socket;
+        }
+        timeval wait = { 1, 0 };
+        if (select(int(maxSocket + 1), &readable, nullptr, nullptr, &wait) < 0)
+            break;
+
+        if (FD_ISSET(listener, &readable))
+        {
+            Socket socket = accept(listener, nullptr, nullptr);
+            if (socket != kInvalidSocket)
+            {
+                SetNoDelay(socket);
+                Connection connection;
+                connection.socket = socket;
+                connection.id = nextId++;
+                connection.ready = false;
+                connection.unit = -1;
+                connection.received = 0;
+                if (SendMessage(socket, kMessageJob, &jobMessage, sizeof(jobMessage)))
+                {
+                    connections.push_back(connection);
+                    ++stats.workerCount;
+                }
+                else
+                {
+                    CloseSocket(socket);
+                }
+            }
+        }
+
+        for (size_t i = 0; i < connections.size(); )
+        {
+            Connection& connection = connections[i];
+            if (!FD_ISSET(connection.socket, &readable))
+            {
+                ++i;
+                continue;
+            }
+
+            // Header first, then the payload it announces
+            bool ok = true;
+            size_t headerSize = sizeof(MessageHeader);
+            if (connection.received < headerSize)
+            {
+                int received = int(recv(connection.socket, (char*)&connection.header + connection.received, int(headerSize - connection.received), 0));
+                ok = received > 0;
+                connection.received += ok ? size_t(received) : 0;
+                if (ok && connection.received == headerSize)
+                {
+                    ok = connection.header.magic == kDistributedMagic && connection.header.size <= maxPayload;
+                    connection.payload.resize(ok ? size_t(connection.header.size) : 0);
+                }
+            }
+            else
+            {
+                size_t offset = connection.received - headerSize;
+                size_t remaining = connection.payload.size() - offset;
+                int chunk = remaining < (1u << 30) ? int(remaining) : (1 << 30);
+                int received = int(recv(connection.socket, (char*)connection.payload.data() + offset, chunk, 0));
+                ok = received > 0;
+                connection.received += ok ? size_t(received) : 0;
+            }
+
+            if (ok && connection.received >= headerSize && connection.received == headerSize + connection.payload.size())
+            {
+                connection.received = 0;
+                if (connection.header.type == kMessageReady && connection.payload.size() == sizeof(ReadyMessage))
+                {
+                    ReadyMessage ready;
+                    memcpy(&ready, connection.payload.data(), sizeof(ready));
+                    connection.ready = ready.accepted != 0;
+                    if (connection.ready)
+                        printf("worker %d ready\n", connection.id);
+                    else
+                        ok = false;
+                }
+                else if (connection.header.type == kMessageResult)
+                {
+                    ok = merge(connection);
+                }
+                else
+                {
+                    ok = false;
+                }
+            }
+
+            if (ok)
+                ++i;
+            else
+                drop(i, connection.ready ? "lost" : "turned away (another scene, light sampling or version)");
+        }
+
+        for (size_t i = 0; i < connections.size(); )
+        {
+            if (connections[i].unit >= 0 && SecondsSince(connections[i].assigned) > job.timeout)
+                drop(i, "timed out");
+            else
+                ++i;
+        }
+
+        // Hand out queued units, one per idle worker
+        for (size_t i = 0; i < connections.size(); )
+        {
+            Connection& connection = connections[i];
+            if (!connection.ready || connection.unit >= 0)
+            {
+                ++i;
+                continue;
+            }
+            int next = -1;
+            for (int u = 0; u < stats.unitCount && next < 0; ++u)
+            {
+                if (!units[u].done && units[u].connection < 0)
+                    next = u;
+            }
+            if (next < 0)
+                break;
+
+            UnitMessage message = { next, units[next].firstPass, units[next].passCount, units[next].y0, units[next].rowCount };
+            if (SendMessage(connection.socket, kMessageUnit, &message, sizeof(message)))
+            {
+                units[next].connection = connection.id;
+                if (units[next].lost)
+                    ++stats.reassignedUnits;
+                units[next].lost = false;
+                connection.unit = next;
+                connection.assigned = std::chrono::steady_clock::now();
+                ++i;
+            }
+            else
+            {
+                drop(i, "lost");
+            }
+        }
+    }
+
+    for (Connection& connection : connections)
+    {
+        SendMessage(connection.socket, kMessageDone, nullptr, 0);
+        CloseSocket(connection.socket);
+    }
+    CloseSocket(listener);
+    return doneUnits == stats.unitCount;
+}
+
+///////////////////////////
+static Socket Connect(const char* host, int port)
+{
+    char service[16];
+    snprintf(service, sizeof(service), "%d", port);
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    auto start = std::chrono::steady_clock::now();
+    for (;;)
+    {
+        addrinfo* addresses = nullptr;
+        if (getaddrinfo(host, service, &hints, &addresses) == 0)
+        {
+            for (addrinfo* a = addresses; a; a = a->ai_next)
+            {
+                Socket socket = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+                if (socket == kInvalidSocket)
+                    continue;
+                if (connect(socket, a->ai_addr, int(a->ai_addrlen)) == 0)
+                {
+                    freeaddrinfo(addresses);
+                    SetNoDelay(socket);
+                    return socket;
+                }
+                CloseSocket(socket);
+            }
+            freeaddrinfo(addresses);
+        }
+        // The coordinator may not be up yet
+        if (SecondsSince(start) > kConnectRetrySeconds)
+            return kInvalidSocket;
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    }
+}
+
+bool RunWorker(const char* host, int port, ThreadPool& pool, const SceneView& scene, bool specialized)
+{
+    if (!InitSockets())
+        return false;
+    Socket socket = Connect(host, port);
+    if (socket == kInvalidSocket)
+    {
+        fprintf(stderr, "Cannot reach a coordinator at %s:%d\n", host, port);
+        return false;
+    }
+
+    MessageHeader header;
+    std::vector<uint8_t> payload;
+    JobMessage job;
+    if (!RecvMessage(socket, header, payload, sizeof(JobMessage)) || header.type != kMessageJob || payload.size() != sizeof(job))
+    {
+        fprintf(stderr, "%s:%d is not a coordinator\n", host, port);
+        CloseSocket(socket);
+        return false;
+    }
+    memcpy(&job, payload.data(), sizeof(job));
+
+    uint64_t sceneHash = HashSceneView(scene);
+    ReadyMessage ready = { job.version == kDistributedVersion && job.sceneHash == sceneHash && job.width > 0 && job.height > 0
+                           && job.samplesPerPixel > 0 && job.maxDepth > 0 && job.sampler >= 0 && job.sampler < kSamplerTypeCount
+                           && (job.sampleLights != 0) == (scene.lightCount > 0) };
+    if (!SendMessage(socket, kMessageReady, &ready, sizeof(ready)) || !ready.accepted)
+    {
+        fprintf(stderr, "The coordinator renders another scene, light sampling or protocol version\n");
+        CloseSocket(socket);
+        return false;
+    }
+    printf("Rendering %dx%d for %s:%d\n", job.width, job.height, host, port);
+
+    TraceSettings settings;
+    settings.maxDepth = job.maxDepth;
+    settings.samplesPerPixel = job.samplesPerPixel;
+    settings.sampler = SamplerType(job.sampler);
+    settings.hashFrameSeed = true;
+    ComputeParams params = {};
+    params.camera = job.camera;
+    params.count = scene.sphereCount;
+    params.rouletteDepth = job.rouletteDepth;
+
+    std::vector<uint8_t> result;
+    bool done = false;
+    while (!done)
+    {
+        if (!RecvMessage(socket, header, payload, sizeof(UnitMessage)))
+            break;
+        if (header.type == kMessageDone)
+        {
+            done = true;
+            break;
+        }
+        UnitMessage unit;
+        if (header.type != kMessageUnit || payload.size() != sizeof(unit))
+            break;
+        memcpy(&unit, payload.data(), sizeof(unit));
+        if (unit.y0 < 0 || unit.rowCount <= 0 || unit.y0 + unit.rowCount > job.height || unit.passCount <= 0)
+            break;
+
+        auto start = std::chrono::steady_clock::now();
+        CpuRenderer renderer(pool, job.width, unit.rowCount);
+        renderer.SetRegion(job.width, job.height, 0, unit.y0, job.width, unit.rowCount);
+        renderer.SetTraceSettings(settings);
+        renderer.SetSpecialized(specialized);
+        for (int i = 0; i < unit.passCount; ++i)
+        {
+            params.frames = unit.firstPass + i;
+            params.lerpFactor = float(i) / float(i + 1);
+            renderer.RenderFrame(scene, params);
+        }
+
+        size_t pixels = size_t(unit.rowCount) * job.width;
+        ResultMessage message = { unit.unit, unit.y0, unit.rowCount, job.width };
+        uint32_t count = uint32_t(unit.passCount) * uint32_t(job.samplesPerPixel);
+        result.resize(sizeof(message) + pixels * (sizeof(float3) + sizeof(uint32_t)));
+        memcpy(result.data(), &message, sizeof(message));
+        memcpy(result.data() + sizeof(message), renderer.GetImage(), pixels * sizeof(float3));
+        uint8_t* countData = result.data() + sizeof(message) + pixels * sizeof(float3);
+        for (size_t i = 0; i < pixels; ++i)
+            memcpy(countData + i * sizeof(uint32_t), &count, sizeof(count));
+        if (!SendMessage(socket, kMessageResult, result.data(), result.size()))
+            break;
+        printf("unit %d (passes %d-%d, rows %d-%d) in %.2fs\n", unit.unit, unit.firstPass, unit.firstPass + unit.passCount - 1,
+               unit.y0, unit.y0 + unit.rowCount - 1, SecondsSince(start));
+    }
+
+    CloseSocket(socket);
+    if (!done)
+        fprintf(stderr, "Lost the coordinator\n");
+    return done;
+}
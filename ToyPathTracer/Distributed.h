@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "Maths.h"
+#include "SharedDataStruct.h"
+#include "SceneView.h"
+#include "ThreadPool.h"
+#include "TraceKernels.h"
+
+// Multi-process rendering over TCP. A coordinator cuts the render into units
+// of passes over a band of scanlines and hands them to whatever workers
+// connect. Each worker renders its unit with CpuRenderer and sends back the
+// band's mean and per-pixel sample counts, which the coordinator merges by
+// count. A unit whose worker disconnects or times out goes back in the queue.
+#define kDistributedPort 7411
+
+struct DistributedJob
+{
+    int width = 0;
+    int height = 0;
+    // Passes of SAMPLES_PER_PIXEL (or trace.samplesPerPixel) samples per pixel
+    int passes = 1;
+    int passesPerUnit = 16;
+    // Horizontal bands the image is split into
+    int bands = 1;
+    TraceSettings trace;
+    ComputeParams params;
+    // Whether paths sample the scene's lights; workers must agree
+    bool sampleLights = true;
+    // Seconds a worker may take for one unit before it counts as lost
+    float timeout = 120;
+};
+
+struct DistributedStats
+{
+    int unitCount = 0;
+    int workerCount = 0;
+    // Units given to another worker after theirs was lost
+    int reassignedUnits = 0;
+    uint64_t samples = 0;
+};
+
+// Serves job on port until every unit is merged into image (width * height,
+// bottom-up rows like CpuRenderer). sceneHash is HashSceneView of the
+// scene; workers with another scene are turned away.
+bool RunCoordinator(int port, const DistributedJob& job, uint64_t sceneHash, std::vector<float3>& image,
+                    DistributedStats& stats);
+
+// Connects to a coordinator at host:port, retrying for a while, and renders
+// units until it is told the job is done. specialized picks the trace kernel
+// as CpuRenderer::SetSpecialized does.
+bool RunWorker(const char* host, int port, ThreadPool& pool, const SceneView& scene, bool specialized);
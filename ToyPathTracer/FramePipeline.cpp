@@ -0,0 +1,150 @@
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+
+#include "FramePipeline.h"
+#include "ImageIO.h"
+#include "Profiler.h"
+#include "SharedFrameRing.h"
+
+FramePipeline::FramePipeline(int width_, int height_, int framesInFlight, const std::string& pattern_, SharedFrameWriter* sharedOutput_)
+    : width(width_), height(height_), pattern(pattern_), sharedOutput(sharedOutput_), slots(framesInFlight > 0 ? framesInFlight : 1)
+{
+    for (Slot& slot : slots)
+        slot.pixels.resize(size_t(width) * height);
+    encoder = std::thread([this]() { EncodeLoop(); });
+    writer = std::thread([this]() { WriteLoop(); });
+}
+
+FramePipeline::~FramePipeline()
+{
+    Finish();
+}
+
+void FramePipeline::Submit(const float3* pixels, int frame)
+{
+    auto begin = std::chrono::high_resolution_clock::now();
+    Slot& slot = slots[submitted % slots.size()];
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (slot.state != kSlotFree)
+        {
+            changed.wait(lock, [&]() { return slot.state == kSlotFree; });
+            double wait = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - begin).count();
+            ++stats.waits;
+            stats.waitSeconds += wait;
+            stats.maxWaitSeconds = wait > stats.maxWaitSeconds ? wait : stats.maxWaitSeconds;
+        }
+    }
+
+    // A free slot belongs to this thread until it is marked rendered
+    memcpy(slot.pixels.data(), pixels, slot.pixels.size() * sizeof(float3));
+    slot.frame = frame;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        slot.state = kSlotRendered;
+        ++submitted;
+        ++stats.frames;
+        stats.submitSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - begin).count();
+    }
+    changed.notify_all();
+}
+
+void FramePipeline::EncodeLoop()
+{
+    ProfilerMarkAsyncThread();
+    std::string path;
+    for (;;)
+    {
+        Slot* slot;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&]() { return encoded < submitted || finished; });
+            if (encoded == submitted)
+                return;
+            slot = &slots[encoded % slots.size()];
+        }
+
+        auto begin = std::chrono::high_resolution_clock::now();
+        if (!pattern.empty())
+        {
+            PROFILE_SCOPE(kZoneEncode);
+            FormatImagePath(pattern, slot->frame, 2, path);
+            EncodeImage(path.c_str(), width, height, slot->pixels.data(), slot->bytes);
+        }
+        auto encodeEnd = std::chrono::high_resolution_clock::now();
+        if (sharedOutput)
+        {
+            // Straight into the ring; a dropped frame costs nothing
+            PROFILE_SCOPE(kZoneSharedFrame);
+            if (uint8_t* target = sharedOutput->BeginFrame())
+            {
+                TonemapRGBA8(width, height, slot->pixels.data(), target, size_t(sharedOutput->GetStride()));
+                sharedOutput->EndFrame(slot->frame);
+            }
+        }
+        double time = std::chrono::duration<double>(encodeEnd - begin).count();
+        double sharedTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - encodeEnd).count();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            slot->state = kSlotEncoded;
+            ++encoded;
+            stats.encodeSeconds += time;
+            stats.sharedSeconds += sharedTime;
+        }
+        changed.notify_all();
+    }
+}
+
+void FramePipeline::WriteLoop()
+{
+    ProfilerMarkAsyncThread();
+    std::string path;
+    for (;;)
+    {
+        Slot* slot;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&]() { return written < encoded || (finished && written == submitted); });
+            if (written == encoded)
+                return;
+            slot = &slots[written % slots.size()];
+        }
+
+        auto begin = std::chrono::high_resolution_clock::now();
+        bool ok = true;
+        if (!pattern.empty())
+        {
+            PROFILE_SCOPE(kZoneWriteFrame);
+            FormatImagePath(pattern, slot->frame, 2, path);
+            ok = WriteEncodedImage(path.c_str(), slot->bytes);
+        }
+        double time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - begin).count();
+        if (!ok)
+            fprintf(stderr, "Failed to write %s\n", path.c_str());
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            slot->state = kSlotFree;
+            ++written;
+            stats.writeSeconds += time;
+            stats.failed = stats.failed || !ok;
+        }
+        changed.notify_all();
+    }
+}
+
+bool FramePipeline::Finish()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished = true;
+    }
+    changed.notify_all();
+    if (encoder.joinable())
+        encoder.join();
+    if (writer.joinable())
+        writer.join();
+    return !stats.failed;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Maths.h"
+
+class SharedFrameWriter;
+
+// Writes every accumulated frame of a render without the render thread
+// touching the disk. Submit copies the frame into a ring of slots; an encode
+// thread tonemaps and encodes the slots in order and a writer thread writes
+// them, so frame N is encoded and written while frames N + 1 and later
+// render. The render thread only waits when every slot is still in flight.
+// With a SharedFrameWriter the encode thread also tonemaps every frame into
+// its shared memory ring, so its overrun policy never holds up rendering
+// beyond that.
+struct FramePipelineStats
+{
+    int frames = 0;
+    // Submits that found the ring full, and how long they waited for a slot
+    int waits = 0;
+    double waitSeconds = 0;
+    double maxWaitSeconds = 0;
+    // Time the render thread spent in Submit, waits included
+    double submitSeconds = 0;
+    double encodeSeconds = 0;
+    double writeSeconds = 0;
+    // Tonemapping into the shared ring, waits for its reader included
+    double sharedSeconds = 0;
+    bool failed = false;
+};
+
+class FramePipeline
+{
+public:
+    // Frames are named by replacing the run of '#' in pattern with their number;
+    // an empty pattern writes no files. sharedOutput may be null.
+    FramePipeline(int width, int height, int framesInFlight, const std::string& pattern, SharedFrameWriter* sharedOutput = nullptr);
+    ~FramePipeline();
+
+    void Submit(const float3* pixels, int frame);
+    // Waits until everything submitted is written; false when a write failed
+    bool Finish();
+    const FramePipelineStats& GetStats() const { return stats; }
+
+private:
+    enum SlotState
+    {
+        kSlotFree,
+        kSlotRendered,
+        kSlotEncoded
+    };
+
+    struct Slot
+    {
+        std::vector<float3> pixels;
+        std::vector<unsigned char> bytes;
+        int frame = 0;
+        SlotState state = kSlotFree;
+    };
+
+    void EncodeLoop();
+    void WriteLoop();
+
+    int width, height;
+    std::string pattern;
+    SharedFrameWriter* sharedOutput;
+    std::vector<Slot> slots;
+    // Frames submitted, encoded and written so far; slot i % size holds frame i
+    int submitted = 0, encoded = 0, written = 0;
+    bool finished = false;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::thread encoder, writer;
+    FramePipelineStats stats;
+};
@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "ImageIO.h"
+
+static unsigned char ToByte(float x)
+{
+    x = LinearToSRGB(x) * 255.0f + 0.5f;
+    return (unsigned char)(x < 255.0f ? x : 255.0f);
+}
+
+// Writes the file in one go, so the caller's only I/O is this call
+static bool WriteFile(const char* path, const std::vector<unsigned char>& bytes)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file)
+        return false;
+    bool ok = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    return fclose(file) == 0 && ok;
+}
+
+static void EncodePPM(int width, int height, const float3* pixels, std::vector<unsigned char>& bytes)
+{
+    char header[64];
+    int headerSize = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+    bytes.resize(size_t(headerSize) + size_t(width) * height * 3);
+    memcpy(bytes.data(), header, headerSize);
+    unsigned char* row = bytes.data() + headerSize;
+    for (int y = height - 1; y >= 0; --y, row += size_t(width) * 3)
+    {
+        const float3* src = pixels + size_t(y) * width;
+        for (int x = 0; x < width; ++x)
+        {
+            row[x * 3 + 0] = ToByte(src[x].x);
+            row[x * 3 + 1] = ToByte(src[x].y);
+            row[x * 3 + 2] = ToByte(src[x].z);
+        }
+    }
+}
+
+static void EncodePFM(int width, int height, const float3* pixels, std::vector<unsigned char>& bytes)
+{
+    // PFM rows already go bottom-up
+    char header[64];
+    int headerSize = snprintf(header, sizeof(header), "PF\n%d %d\n-1.0\n", width, height);
+    size_t pixelBytes = size_t(width) * height * 3 * sizeof(float);
+    bytes.resize(size_t(headerSize) + pixelBytes);
+    memcpy(bytes.data(), header, headerSize);
+    float* dst = (float*)(bytes.data() + headerSize);
+    for (size_t i = 0; i < size_t(width) * height; ++i)
+    {
+        float channels[3] = { pixels[i].x, pixels[i].y, pixels[i].z };
+        memcpy(dst + i * 3, channels, sizeof(channels));
+    }
+}
+
+bool WritePPM(const char* path, int width, int height, const float3* pixels)
+{
+    std::vector<unsigned char> bytes;
+    EncodePPM(width, height, pixels, bytes);
+    return WriteFile(path, bytes);
+}
+
+bool WritePFM(const char* path, int width, int height, const float3* pixels)
+{
+    std::vector<unsigned char> bytes;
+    EncodePFM(width, height, pixels, bytes);
+    return WriteFile(path, bytes);
+}
+
+bool ReadPFM(const char* path, int& width, int& height, std::vector<float3>& pixels)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return false;
+
+    float scale;
+    char magic[3] = {};
+    bool ok = fscanf(file, "%2s %d %d %f", magic, &width, &height, &scale) == 4
+        && !strcmp(magic, "PF") && width > 0 && height > 0 && scale < 0 && fgetc(file) != EOF;
+    if (ok)
+    {
+        pixels.resize(size_t(width) * height);
+        std::vector<float> row(size_t(width) * 3);
+        for (int y = 0; y < height && ok; ++y)
+        {
+            ok = fread(row.data(), sizeof(float), row.size(), file) == row.size();
+            for (int x = 0; x < width && ok; ++x)
+                pixels[size_t(y) * width + x] = float3(row[x * 3 + 0], row[x * 3 + 1], row[x * 3 + 2]);
+        }
+    }
+    fclose(file);
+    return ok;
+}
+
+static bool IsPFMPath(const char* path)
+{
+    size_t length = strlen(path);
+    return length >= 4 && !strcmp(path + length - 4, ".pfm");
+}
+
+bool WriteImage(const char* path, int width, int height, const float3* pixels)
+{
+    if (IsPFMPath(path))
+        return WritePFM(path, width, height, pixels);
+    return WritePPM(path, width, height, pixels);
+}
+
+void EncodeImage(const char* path, int width, int height, const float3* pixels, std::vector<unsigned char>& bytes)
+{
+    if (IsPFMPath(path))
+        EncodePFM(width, height, pixels, bytes);
+    else
+        EncodePPM(width, height, pixels, bytes);
+}
+
+bool WriteEncodedImage(const char* path, const std::vector<unsigned char>& bytes)
+{
+    return WriteFile(path, bytes);
+}
+
+void TonemapRGBA8(int width, int height, const float3* pixels, unsigned char* output, size_t stride)
+{
+    for (int y = height - 1; y >= 0; --y, output += stride)
+    {
+        const float3* src = pixels + size_t(y) * width;
+        for (int x = 0; x < width; ++x)
+        {
+            output[x * 4 + 0] = ToByte(src[x].x);
+            output[x * 4 + 1] = ToByte(src[x].y);
+            output[x * 4 + 2] = ToByte(src[x].z);
+            output[x * 4 + 3] = 255;
+        }
+    }
+}
+
+bool FormatImagePath(const std::string& pattern, int index, int count, std::string& output)
+{
+    size_t first = pattern.find('#');
+    if (first == std::string::npos)
+    {
+        output = pattern;
+        return count == 1;
+    }
+    size_t last = pattern.find_first_not_of('#', first);
+    size_t digits = (last == std::string::npos ? pattern.size() : last) - first;
+    char number[32];
+    snprintf(number, sizeof(number), "%0*d", int(digits), index);
+    output = pattern.substr(0, first) + number + pattern.substr(first + digits);
+    return true;
+}
+
+float ComputeRMSE(const float3* a, const float3* b, size_t count)
+{
+    double sum = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        float3 d = a[i] - b[i];
+        sum += double(dot(d, d));
+    }
+    return count ? float(sqrt(sum / (double(count) * 3))) : 0.0f;
+}
+
+static float3 Saturate(const float3& v)
+{
+    return float3(minf(maxf(v.x, 0.0f), 1.0f), minf(maxf(v.y, 0.0f), 1.0f), minf(maxf(v.z, 0.0f), 1.0f));
+}
+
+float ComputeClampedRMSE(const float3* a, const float3* b, size_t count)
+{
+    double sum = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        float3 d = Saturate(a[i]) - Saturate(b[i]);
+        sum += double(dot(d, d));
+    }
+    return count ? float(sqrt(sum / (double(count) * 3))) : 0.0f;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "Maths.h"
+
+// Same curve as LinearToSRGB in PixelShader.hlsl
+inline float LinearToSRGB(float x)
+{
+    x = x > 0 ? x : 0;
+    x = 1.055f * powf(x, 0.416666667f) - 0.055f;
+    return x > 0 ? x : 0;
+}
+
+// Rows are stored bottom-up, as the accumulation textures are
+bool WritePPM(const char* path, int width, int height, const float3* pixels);
+
+// Linear float PFM, little endian
+bool WritePFM(const char* path, int width, int height, const float3* pixels);
+bool ReadPFM(const char* path, int& width, int& height, std::vector<float3>& pixels);
+
+// PFM when the path ends in .pfm, PPM otherwise
+bool WriteImage(const char* path, int width, int height, const float3* pixels);
+
+// The bytes WriteImage would write to path, so encoding and writing can run
+// on different threads
+void EncodeImage(const char* path, int width, int height, const float3* pixels, std::vector<unsigned char>& bytes);
+bool WriteEncodedImage(const char* path, const std::vector<unsigned char>& bytes);
+
+// 8 bit sRGB RGBA with opaque alpha, rows top-down and stride bytes apart, the
+// layout video encoders take as raw input
+void TonemapRGBA8(int width, int height, const float3* pixels, unsigned char* output, size_t stride);
+
+// Replaces the first run of '#' in pattern with index, zero padded to its
+// length. Fails when there is no '#' and count images need names.
+bool FormatImagePath(const std::string& pattern, int index, int count, std::string& output);
+
+// Root mean square difference over all channels, in linear space
+float ComputeRMSE(const float3* a, const float3* b, size_t count);
+// Same on values clamped to [0, 1], the range the image shows, so a few pixels
+// far brighter than white, such as the edges of emitters, do not outweigh the rest
+float ComputeClampedRMSE(const float3* a, const float3* b, size_t count);
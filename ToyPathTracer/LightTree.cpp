@@ -0,0 +1,95 @@
+#include <algorithm>
+
+#include "Config.h"
+#include "LightTree.h"
+
+static inline float Axis(const float3& v, int axis) { return axis == 0 ? v.x : axis == 1 ? v.y : v.z; }
+static inline float3 Min(const float3& a, const float3& b) { return float3(minf(a.x, b.x), minf(a.y, b.y), minf(a.z, b.z)); }
+static inline float3 Max(const float3& a, const float3& b) { return float3(maxf(a.x, b.x), maxf(a.y, b.y), maxf(a.z, b.z)); }
+
+void LightTree::Build(const Sphere* spheres, int count, const Material* materials, uint32_t materialTypes)
+{
+    lights.clear();
+    nodes.clear();
+    sphereLights.clear();
+    if (!(materialTypes & (1u << kMaterialEmissive)))
+        return;
+
+    for (int i = 0; i < count; ++i)
+    {
+        const Material& material = materials[spheres[i].material];
+        if (material.type != kMaterialEmissive || GetLightWeight(material.albedo, spheres[i].radius) <= 0)
+            continue;
+        Light light;
+        light.center = spheres[i].center;
+        light.radius = spheres[i].radius;
+        light.emission = material.albedo;
+        light.node = i;
+        lights.push_back(light);
+    }
+    if (lights.empty())
+        return;
+
+    nodes.reserve(lights.size() * 2 - 1);
+    nodes.resize(1);
+    nodes[0].parent = -1;
+    BuildNode(0, 0, int(lights.size()));
+
+    // node held the sphere index until the build put every light in its leaf
+    sphereLights.assign(count, -1);
+    for (int i = 0; i < int(nodes.size()); ++i)
+    {
+        if (nodes[i].child < 0)
+        {
+            int light = -1 - nodes[i].child;
+            sphereLights[lights[light].node] = light;
+            lights[light].node = i;
+        }
+    }
+}
+
+// Fills nodes[index], whose parent is already set, with lights [first, first
+// + count), splitting at the median of the longest axis of their centers
+void LightTree::BuildNode(int index, int first, int count)
+{
+    float3 boundsMin(kMaxT, kMaxT, kMaxT), boundsMax(-kMaxT, -kMaxT, -kMaxT);
+    float3 centerMin = boundsMin, centerMax = boundsMax;
+    float weight = 0;
+    for (int i = first; i < first + count; ++i)
+    {
+        const Light& light = lights[i];
+        float3 extent(light.radius, light.radius, light.radius);
+        boundsMin = Min(boundsMin, light.center - extent);
+        boundsMax = Max(boundsMax, light.center + extent);
+        centerMin = Min(centerMin, light.center);
+        centerMax = Max(centerMax, light.center);
+        weight += GetLightWeight(light.emission, light.radius);
+    }
+    nodes[index].boundsMin = boundsMin;
+    nodes[index].boundsMax = boundsMax;
+    nodes[index].weight = weight;
+    if (count == 1)
+    {
+        nodes[index].child = -1 - first;
+        return;
+    }
+
+    float3 size = centerMax - centerMin;
+    int axis = size.x > size.y && size.x > size.z ? 0 : (size.y > size.z ? 1 : 2);
+    int half = count / 2;
+    std::nth_element(lights.begin() + first, lights.begin() + first + half, lights.begin() + first + count,
+                     [axis](const Light& a, const Light& b) { return Axis(a.center, axis) < Axis(b.center, axis); });
+
+    int child = int(nodes.size());
+    nodes[index].child = child;
+    nodes.resize(nodes.size() + 2);
+    nodes[child].parent = index;
+    nodes[child + 1].parent = index;
+    BuildNode(child, first, half);
+    BuildNode(child + 1, first + half, count - half);
+}
+
+size_t LightTree::GetMemorySize() const
+{
+    return lights.capacity() * sizeof(Light) + nodes.capacity() * sizeof(LightNode) + sphereLights.capacity() * sizeof(int);
+}
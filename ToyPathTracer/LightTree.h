@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "Maths.h"
+#include "SharedDataStruct.h"
+
+// Material::type of emitters: albedo is the radiance they give off, and paths
+// end on them
+#define kMaterialEmissive 3
+
+// One emissive sphere and the leaf of the light tree that holds it
+struct Light
+{
+    float3 center;
+    float radius;
+    float3 emission;
+    int node;
+};
+
+// Interior nodes store the index of their left child in child, the right child
+// follows it. Leaves hold a single light, as child = -1 - its index. weight is
+// the sum of GetLightWeight over the lights below.
+struct LightNode
+{
+    float3 boundsMin;
+    int child;
+    float3 boundsMax;
+    float weight;
+    int parent;
+};
+
+// Lights are picked in proportion to their power, the luminance of their
+// emission times their surface area up to a constant
+inline float GetLightWeight(const float3& emission, float radius)
+{
+    return (0.2126f * emission.x + 0.7152f * emission.y + 0.0722f * emission.z) * radius * radius;
+}
+
+// How much light a subtree may send to position: its power over the squared
+// distance to its center, which never gets below its own half diagonal
+inline float GetLightImportance(const LightNode& node, const float3& position)
+{
+    float3 halfSize = (node.boundsMax - node.boundsMin) * 0.5f;
+    float3 offset = node.boundsMin + halfSize - position;
+    return node.weight / maxf(dot(offset, offset), dot(halfSize, halfSize));
+}
+
+// BVH over the emissive spheres of a scene for next-event estimation. A pick
+// walks down from the root choosing each child in proportion to its
+// importance, so nearby and bright lights get most of the shadow rays and a
+// scene with thousands of lights costs a few dozen node reads per pick.
+// Spheres of the instances are not in it; paths only find those by hitting
+// them.
+class LightTree
+{
+public:
+    // Collects the spheres with an emissive material of non-zero weight, and
+    // skips the scan when materialTypes has no emitters
+    void Build(const Sphere* spheres, int count, const Material* materials, uint32_t materialTypes);
+
+    const std::vector<Light>& GetLights() const { return lights; }
+    const std::vector<LightNode>& GetNodes() const { return nodes; }
+    // Index into the lights of every sphere, -1 for those that are not one;
+    // empty when there are no lights
+    const std::vector<int>& GetSphereLights() const { return sphereLights; }
+    int GetSize() const { return int(lights.size()); }
+    size_t GetMemorySize() const;
+
+private:
+    void BuildNode(int index, int first, int count);
+
+    std::vector<Light> lights;
+    std::vector<LightNode> nodes;
+    std::vector<int> sphereLights;
+};
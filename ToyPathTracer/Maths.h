@@ -1,7 +1,7 @@
 #pragma once
 
 #include <math.h>
-#include <random>
+#include <stdint.h>
 
 struct float3
 {
@@ -31,6 +31,7 @@ inline float3 operator-(const float3& a, const float3& b) { return float3(a.x -
 inline float3 operator*(const float3& a, const float3& b) { return float3(a.x * b.x, a.y * b.y, a.z * b.z); }
 inline float3 operator*(const float3& a, float b) { return float3(a.x * b, a.y * b, a.z * b); }
 inline float3 operator*(float a, const float3& b) { return float3(a * b.x, a * b.y, a * b.z); }
+inline float3 operator/(const float3& a, float b) { return float3(a.x / b, a.y / b, a.z / b); }
 inline float dot(const float3& a, const float3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
 inline float3 cross(const float3& a, const float3& b)
 {
@@ -41,10 +42,32 @@ inline float3 cross(const float3& a, const float3& b)
     );
 }
 
+inline float minf(float a, float b) { return a < b ? a : b; }
+inline float maxf(float a, float b) { return a > b ? a : b; }
+
 inline float length(float3 v) { return sqrtf(dot(v, v)); }
 inline float sqLength(float3 v) { return dot(v, v); }
 inline float3 normalize(float3 v) { return v * (1.0f / length(v)); }
 inline float3 lerp(float3 a, float3 b, float t) { return a + (b - a) * t; }
+inline float3 reflect(float3 v, float3 n) { return v - 2 * dot(v, n) * n; }
+
+// Seeded PCG32 generator, so anything built from random numbers is the same on
+// every run and every C runtime
+struct RandomSequence
+{
+    explicit RandomSequence(uint64_t seed) : state(0), inc((seed << 1) | 1) { nextUInt(); state += seed; nextUInt(); }
 
-inline float random() { return rand() / (RAND_MAX + 1.0); }
-inline float3 randomFloat3() { return float3(random(), random(), random()); }
+    uint32_t nextUInt()
+    {
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + inc;
+        uint32_t xorshifted = uint32_t(((old >> 18) ^ old) >> 27);
+        uint32_t rot = uint32_t(old >> 59);
+        return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+    }
+    float nextFloat() { return (nextUInt() >> 8) * (1.0f / 16777216.0f); }
+    float3 nextFloat3() { float x = nextFloat(); float y = nextFloat(); return float3(x, y, nextFloat()); }
+
+    uint64_t state;
+    uint64_t inc;
+};
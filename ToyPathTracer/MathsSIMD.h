@@ -0,0 +1,85 @@
+#pragma once
+
+// Wide counterparts of float3 holding 4, 8 or 16 vectors in SoA form, one
+// register per component. Functions using a width beyond SSE2 must be marked
+// with its SIMD_TARGET_* and only run after the CPU check in SphereKernels.
+
+#include "Maths.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+// GCC and clang build every file for the baseline target and only use wider
+// instructions inside functions marked for them, so no inline function shared
+// with other files picks up AVX. MSVC takes /arch per file instead.
+#if defined(SIMD_X86) && defined(__GNUC__)
+#define SIMD_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+#define SIMD_TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#define SIMD_TARGET_SSE41
+#define SIMD_TARGET_AVX2
+#define SIMD_TARGET_AVX512
+#endif
+
+#if defined(SIMD_X86) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+// SSE2 is part of every x64 target, so code outside the per-ISA files can use it
+#define SIMD_SSE2 1
+
+struct float3x4
+{
+    float3x4() {}
+    float3x4(__m128 x_, __m128 y_, __m128 z_) : x(x_), y(y_), z(z_) {}
+    explicit float3x4(const float3& v) : x(_mm_set1_ps(v.x)), y(_mm_set1_ps(v.y)), z(_mm_set1_ps(v.z)) {}
+
+    static float3x4 load(const float* px, const float* py, const float* pz) { return float3x4(_mm_loadu_ps(px), _mm_loadu_ps(py), _mm_loadu_ps(pz)); }
+
+    __m128 x, y, z;
+};
+
+inline float3x4 operator+(const float3x4& a, const float3x4& b) { return float3x4(_mm_add_ps(a.x, b.x), _mm_add_ps(a.y, b.y), _mm_add_ps(a.z, b.z)); }
+inline float3x4 operator-(const float3x4& a, const float3x4& b) { return float3x4(_mm_sub_ps(a.x, b.x), _mm_sub_ps(a.y, b.y), _mm_sub_ps(a.z, b.z)); }
+inline float3x4 operator*(const float3x4& a, const float3x4& b) { return float3x4(_mm_mul_ps(a.x, b.x), _mm_mul_ps(a.y, b.y), _mm_mul_ps(a.z, b.z)); }
+inline float3x4 operator*(const float3x4& a, __m128 b) { return float3x4(_mm_mul_ps(a.x, b), _mm_mul_ps(a.y, b), _mm_mul_ps(a.z, b)); }
+inline __m128 dot(const float3x4& a, const float3x4& b) { return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a.x, b.x), _mm_mul_ps(a.y, b.y)), _mm_mul_ps(a.z, b.z)); }
+#endif
+
+#if defined(SIMD_X86)
+struct float3x8
+{
+    SIMD_TARGET_AVX2 float3x8() {}
+    SIMD_TARGET_AVX2 float3x8(__m256 x_, __m256 y_, __m256 z_) : x(x_), y(y_), z(z_) {}
+    SIMD_TARGET_AVX2 explicit float3x8(const float3& v) : x(_mm256_set1_ps(v.x)), y(_mm256_set1_ps(v.y)), z(_mm256_set1_ps(v.z)) {}
+
+    SIMD_TARGET_AVX2 static float3x8 load(const float* px, const float* py, const float* pz) { return float3x8(_mm256_loadu_ps(px), _mm256_loadu_ps(py), _mm256_loadu_ps(pz)); }
+
+    __m256 x, y, z;
+};
+
+SIMD_TARGET_AVX2 inline float3x8 operator+(const float3x8& a, const float3x8& b) { return float3x8(_mm256_add_ps(a.x, b.x), _mm256_add_ps(a.y, b.y), _mm256_add_ps(a.z, b.z)); }
+SIMD_TARGET_AVX2 inline float3x8 operator-(const float3x8& a, const float3x8& b) { return float3x8(_mm256_sub_ps(a.x, b.x), _mm256_sub_ps(a.y, b.y), _mm256_sub_ps(a.z, b.z)); }
+SIMD_TARGET_AVX2 inline float3x8 operator*(const float3x8& a, const float3x8& b) { return float3x8(_mm256_mul_ps(a.x, b.x), _mm256_mul_ps(a.y, b.y), _mm256_mul_ps(a.z, b.z)); }
+SIMD_TARGET_AVX2 inline float3x8 operator*(const float3x8& a, __m256 b) { return float3x8(_mm256_mul_ps(a.x, b), _mm256_mul_ps(a.y, b), _mm256_mul_ps(a.z, b)); }
+SIMD_TARGET_AVX2 inline __m256 dot(const float3x8& a, const float3x8& b) { return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a.x, b.x), _mm256_mul_ps(a.y, b.y)), _mm256_mul_ps(a.z, b.z)); }
+#endif
+
+#if defined(SIMD_X86)
+struct float3x16
+{
+    SIMD_TARGET_AVX512 float3x16() {}
+    SIMD_TARGET_AVX512 float3x16(__m512 x_, __m512 y_, __m512 z_) : x(x_), y(y_), z(z_) {}
+    SIMD_TARGET_AVX512 explicit float3x16(const float3& v) : x(_mm512_set1_ps(v.x)), y(_mm512_set1_ps(v.y)), z(_mm512_set1_ps(v.z)) {}
+
+    SIMD_TARGET_AVX512 static float3x16 load(const float* px, const float* py, const float* pz) { return float3x16(_mm512_loadu_ps(px), _mm512_loadu_ps(py), _mm512_loadu_ps(pz)); }
+
+    __m512 x, y, z;
+};
+
+SIMD_TARGET_AVX512 inline float3x16 operator+(const float3x16& a, const float3x16& b) { return float3x16(_mm512_add_ps(a.x, b.x), _mm512_add_ps(a.y, b.y), _mm512_add_ps(a.z, b.z)); }
+SIMD_TARGET_AVX512 inline float3x16 operator-(const float3x16& a, const float3x16& b) { return float3x16(_mm512_sub_ps(a.x, b.x), _mm512_sub_ps(a.y, b.y), _mm512_sub_ps(a.z, b.z)); }
+SIMD_TARGET_AVX512 inline float3x16 operator*(const float3x16& a, const float3x16& b) { return float3x16(_mm512_mul_ps(a.x, b.x), _mm512_mul_ps(a.y, b.y), _mm512_mul_ps(a.z, b.z)); }
+SIMD_TARGET_AVX512 inline float3x16 operator*(const float3x16& a, __m512 b) { return float3x16(_mm512_mul_ps(a.x, b), _mm512_mul_ps(a.y, b), _mm512_mul_ps(a.z, b)); }
+SIMD_TARGET_AVX512 inline __m512 dot(const float3x16& a, const float3x16& b) { return _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(a.x, b.x), _mm512_mul_ps(a.y, b.y)), _mm512_mul_ps(a.z, b.z)); }
+#endif
@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "Numa.h"
+
+#ifdef _WIN32
+// Processors are numbered group * 64 + bit, as GROUP_AFFINITY has them
+std::vector<std::vector<int>> GetNumaNodes()
+{
+    std::vector<std::vector<int>> nodes;
+    ULONG highest = 0;
+    if (GetNumaHighestNodeNumber(&highest))
+    {
+        for (ULONG node = 0; node <= highest; ++node)
+        {
+            GROUP_AFFINITY affinity;
+            if (!GetNumaNodeProcessorMaskEx(USHORT(node), &affinity))
+                continue;
+            std::vector<int> cpus;
+            for (int bit = 0; bit < 64; ++bit)
+            {
+                if (affinity.Mask & (KAFFINITY(1) << bit))
+                    cpus.push_back(affinity.Group * 64 + bit);
+            }
+            if (!cpus.empty())
+                nodes.push_back(cpus);
+        }
+    }
+    if (nodes.empty())
+    {
+        nodes.resize(1);
+        for (int cpu = 0; cpu < int(std::thread::hardware_concurrency()); ++cpu)
+            nodes[0].push_back(cpu);
+        if (nodes[0].empty())
+            nodes[0].push_back(0);
+    }
+    return nodes;
+}
+
+bool PinThread(int cpu)
+{
+    GROUP_AFFINITY affinity = {};
+    affinity.Group = WORD(cpu / 64);
+    affinity.Mask = KAFFINITY(1) << (cpu % 64);
+    return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+}
+
+std::vector<int> GetThreadCpus()
+{
+    std::vector<int> cpus;
+    GROUP_AFFINITY affinity;
+    if (GetThreadGroupAffinity(GetCurrentThread(), &affinity))
+    {
+        for (int bit = 0; bit < 64; ++bit)
+        {
+            if (affinity.Mask & (KAFFINITY(1) << bit))
+                cpus.push_back(affinity.Group * 64 + bit);
+        }
+    }
+    return cpus;
+}
+
+bool SetThreadCpus(const std::vector<int>& cpus)
+{
+    if (cpus.empty())
+        return false;
+    GROUP_AFFINITY affinity = {};
+    affinity.Group = WORD(cpus[0] / 64);
+    for (int cpu : cpus)
+    {
+        if (cpu / 64 == affinity.Group)
+            affinity.Mask |= KAFFINITY(1) << (cpu % 64);
+    }
+    return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+}
+
+#elif defined(__linux__)
+// Processors are numbered as the kernel does, and only those in the affinity
+// mask the process started with are listed
+std::vector<std::vector<int>> GetNumaNodes()
+{
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool restricted = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+    std::vector<std::vector<int>> nodes;
+    for (int node = 0; ; ++node)
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE* file = fopen(path, "r");
+        if (!file)
+            break;
+        // A list of ranges like 0-15,32-47
+        std::vector<int> cpus;
+        int first, last;
+        while (fscanf(file, "%d", &first) == 1)
+        {
+            last = first;
+            int c = fgetc(file);
+            if (c == '-' && fscanf(file, "%d", &last) == 1)
+                c = fgetc(file);
+            for (int cpu = first; cpu <= last; ++cpu)
+            {
+                if (!restricted || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)))
+                    cpus.push_back(cpu);
+            }
+            if (c != ',')
+                break;
+        }
+        fclose(file);
+        if (!cpus.empty())
+            nodes.push_back(cpus);
+    }
+    if (nodes.empty())
+    {
+        nodes.resize(1);
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (restricted ? CPU_ISSET(cpu, &allowed) : cpu < int(std::thread::hardware_concurrency()))
+                nodes[0].push_back(cpu);
+        }
+    }
+    return nodes;
+}
+
+bool PinThread(int cpu)
+{
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+        return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+std::vector<int> GetThreadCpus()
+{
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0)
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (CPU_ISSET(cpu, &set))
+                cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+bool SetThreadCpus(const std::vector<int>& cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+    {
+        if (cpu >= 0 && cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    }
+    return !cpus.empty() && pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+#else
+// No NUMA information or pinning, e.g. on macOS
+std::vector<std::vector<int>> GetNumaNodes()
+{
+    std::vector<std::vector<int>> nodes(1);
+    for (int cpu = 0; cpu < int(std::thread::hardware_concurrency()); ++cpu)
+        nodes[0].push_back(cpu);
+    if (nodes[0].empty())
+        nodes[0].push_back(0);
+    return nodes;
+}
+
+bool PinThread(int cpu)
+{
+    return false;
+}
+
+std::vector<int> GetThreadCpus()
+{
+    return std::vector<int>();
+}
+
+bool SetThreadCpus(const std::vector<int>& cpus)
+{
+    return false;
+}
+#endif
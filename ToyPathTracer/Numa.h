@@ -0,0 +1,50 @@
+#pragma once
+
+#include <memory>
+#include <new>
+#include <stddef.h>
+#include <vector>
+
+// Logical processors of every NUMA node the process may run on, in the
+// numbering PinThread takes. A single node with all of them when the platform
+// does not tell.
+std::vector<std::vector<int>> GetNumaNodes();
+// Restricts the calling thread to one logical processor
+bool PinThread(int cpu);
+// Logical processors the calling thread may run on, and back again; on
+// Windows they all have to be in one processor group
+std::vector<int> GetThreadCpus();
+bool SetThreadCpus(const std::vector<int>& cpus);
+
+// Array whose elements are only written when Construct runs for them, so with
+// a first touch NUMA policy each page lands on the node of the thread that
+// constructs the first element in it. Every element has to be constructed
+// before it is read. T must be trivially destructible.
+template <typename T>
+class FirstTouchArray
+{
+public:
+    void Allocate(size_t count)
+    {
+        elements.reset(static_cast<T*>(::operator new(count * sizeof(T))));
+        elementCount = count;
+    }
+    void Reset() { elements.reset(); elementCount = 0; }
+    void Construct(size_t index) { new (&elements[index]) T(); }
+
+    T* data() { return elements.get(); }
+    const T* data() const { return elements.get(); }
+    size_t size() const { return elementCount; }
+    bool empty() const { return elementCount == 0; }
+    T& operator[](size_t index) { return elements[index]; }
+    const T& operator[](size_t index) const { return elements[index]; }
+
+private:
+    struct Free
+    {
+        void operator()(T* p) const { ::operator delete(p); }
+    };
+
+    std::unique_ptr<T[], Free> elements;
+    size_t elementCount = 0;
+};
@@ -0,0 +1,197 @@
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+
+#include "Profiler.h"
+
+// Trace events kept per thread, about 24MB each
+#define kProfilerMaxEvents (1 << 20)
+
+#if kProfilerEnabled
+
+static const char* s_CounterNames[kCounterCount] = {
+    "camera_rays", "rays", "node_visits", "sphere_tests", "instance_tests",
+    "scatter_lambertian", "scatter_metal", "scatter_dielectric", "upload_bytes"
+};
+static const char* s_ZoneNames[kZoneCount] = {
+    "Frame", "RenderFrame", "Tile", "Generate", "Extend", "Sort", "Shade", "Compact", "Accumulate", "Upload", "WriteBand", "Encode", "Denoise", "Refit", "WriteFrame", "SharedFrame"
+};
+
+struct ProfileFrame
+{
+    uint64_t start;
+    uint64_t end;
+    uint64_t counters[kCounterCount];
+    uint64_t zoneTime[kZoneCount];
+};
+
+// Threads register once and are never removed, so their data outlives them
+// and can still be exported after a ThreadPool is gone
+static std::mutex s_ThreadsLock;
+static std::vector<std::unique_ptr<ProfileThread>> s_Threads;
+static std::vector<ProfileFrame> s_Frames;
+static uint64_t s_FrameStart;
+static const std::chrono::steady_clock::time_point s_ProfileEpoch = std::chrono::steady_clock::now();
+
+thread_local ProfileThread* t_ProfileThread = nullptr;
+
+ProfileThread* RegisterProfileThread(bool async)
+{
+    std::lock_guard<std::mutex> lock(s_ThreadsLock);
+    s_Threads.emplace_back(new ProfileThread());
+    ProfileThread* thread = s_Threads.back().get();
+    thread->index = int(s_Threads.size()) - 1;
+    // Set before other threads can see the block, so they never read it unlocked
+    thread->async = async;
+    t_ProfileThread = thread;
+    return thread;
+}
+
+uint64_t GetProfileTime()
+{
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - s_ProfileEpoch).count());
+}
+
+void ProfilerMarkAsyncThread()
+{
+    // Only new threads are marked; one that already recorded keeps its block
+    if (!t_ProfileThread)
+        RegisterProfileThread(true);
+}
+
+ProfileScope::~ProfileScope()
+{
+    uint64_t duration = GetProfileTime() - start;
+    ProfileThread* thread = GetProfileThread();
+    std::unique_lock<std::mutex> lock(thread->lock, std::defer_lock);
+    if (thread->async)
+        lock.lock();
+    thread->zoneTime[zone] += duration;
+    if (thread->events.size() < kProfilerMaxEvents)
+        thread->events.push_back({ start, duration, int(zone) });
+    else
+        ++thread->droppedEvents;
+}
+
+void ProfilerBeginFrame()
+{
+    GetProfileThread();
+    s_FrameStart = GetProfileTime();
+}
+
+void ProfilerEndFrame()
+{
+    ProfileFrame frame = {};
+    frame.start = s_FrameStart;
+    frame.end = GetProfileTime();
+
+    ProfileThread* caller = GetProfileThread();
+    caller->zoneTime[kZoneFrame] += frame.end - frame.start;
+    if (caller->events.size() < kProfilerMaxEvents)
+        caller->events.push_back({ frame.start, frame.end - frame.start, int(kZoneFrame) });
+
+    // Pool workers are idle between frames, and ParallelFor's join orders
+    // their writes before these reads. Encoders and writers keep recording,
+    // so their blocks are read under their lock.
+    std::lock_guard<std::mutex> lock(s_ThreadsLock);
+    for (auto& thread : s_Threads)
+    {
+        std::unique_lock<std::mutex> threadLock(thread->lock, std::defer_lock);
+        if (thread->async)
+            threadLock.lock();
+        for (int i = 0; i < kCounterCount; ++i)
+        {
+            frame.counters[i] += thread->counters[i] - thread->frameCounters[i];
+            thread->frameCounters[i] = thread->counters[i];
+        }
+        for (int i = 0; i < kZoneCount; ++i)
+        {
+            frame.zoneTime[i] += thread->zoneTime[i] - thread->frameZoneTime[i];
+            thread->frameZoneTime[i] = thread->zoneTime[i];
+        }
+    }
+    s_Frames.push_back(frame);
+}
+
+bool IsProfilerEnabled()
+{
+    return true;
+}
+
+bool WriteProfileTrace(const char* path)
+{
+    FILE* file = fopen(path, "w");
+    if (!file)
+        return false;
+
+    std::lock_guard<std::mutex> lock(s_ThreadsLock);
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    bool first = true;
+    uint64_t dropped = 0;
+    for (auto& thread : s_Threads)
+    {
+        fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"thread %d\"}}",
+                first ? "" : ",\n", thread->index, thread->index);
+        first = false;
+        std::unique_lock<std::mutex> threadLock(thread->lock, std::defer_lock);
+        if (thread->async)
+            threadLock.lock();
+        for (const ProfileThread::Event& event : thread->events)
+        {
+            // Microseconds, as the format wants
+            fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                    s_ZoneNames[event.zone], thread->index, event.start * 1.0e-3, event.duration * 1.0e-3);
+        }
+        dropped += thread->droppedEvents;
+    }
+    for (const ProfileFrame& frame : s_Frames)
+    {
+        fprintf(file, "%s{\"name\": \"counters\", \"ph\": \"C\", \"pid\": 1, \"ts\": %.3f, \"args\": {",
+                first ? "" : ",\n", frame.end * 1.0e-3);
+        first = false;
+        for (int i = 0; i < kCounterCount; ++i)
+            fprintf(file, "%s\"%s\": %llu", i ? ", " : "", s_CounterNames[i], (unsigned long long)frame.counters[i]);
+        fprintf(file, "}}");
+    }
+    fprintf(file, "\n], \"otherData\": {\"dropped_events\": %llu}}\n", (unsigned long long)dropped);
+    return fclose(file) == 0;
+}
+
+bool WriteProfileCsv(const char* path)
+{
+    FILE* file = fopen(path, "w");
+    if (!file)
+        return false;
+
+    fprintf(file, "frame,ms");
+    for (int i = 0; i < kCounterCount; ++i)
+        fprintf(file, ",%s", s_CounterNames[i]);
+    // Zone times are summed over threads, so they can exceed the frame time
+    for (int i = 0; i < kZoneCount; ++i)
+        fprintf(file, ",%s_ms", s_ZoneNames[i]);
+    fprintf(file, "\n");
+
+    for (size_t f = 0; f < s_Frames.size(); ++f)
+    {
+        const ProfileFrame& frame = s_Frames[f];
+        fprintf(file, "%zu,%.4f", f, (frame.end - frame.start) * 1.0e-6);
+        for (int i = 0; i < kCounterCount; ++i)
+            fprintf(file, ",%llu", (unsigned long long)frame.counters[i]);
+        for (int i = 0; i < kZoneCount; ++i)
+            fprintf(file, ",%.4f", frame.zoneTime[i] * 1.0e-6);
+        fprintf(file, "\n");
+    }
+    return fclose(file) == 0;
+}
+
+#else
+
+void ProfilerBeginFrame() {}
+void ProfilerEndFrame() {}
+void ProfilerMarkAsyncThread() {}
+bool IsProfilerEnabled() { return false; }
+bool WriteProfileTrace(const char*) { return false; }
+bool WriteProfileCsv(const char*) { return false; }
+
+#endif
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+#include "Config.h"
+
+// Hot path instrumentation. Every thread counts into and times into its own
+// block, so nothing on the hot path is shared or atomic; blocks are summed by
+// ProfilerEndFrame once the frame's parallel work has joined. Threads that
+// record while frames go on, like encoders and writers, call
+// ProfilerMarkAsyncThread first and lock their block instead. With
+// kProfilerEnabled 0 the macros expand to nothing.
+
+enum ProfileCounter
+{
+    kCounterCameraRays,
+    kCounterRays,
+    kCounterNodeVisits,
+    kCounterSphereTests,
+    kCounterInstanceTests,
+    kCounterScatterLambertian,
+    kCounterScatterMetal,
+    kCounterScatterDielectric,
+    kCounterUploadBytes,
+    kCounterCount
+};
+
+enum ProfileZone
+{
+    kZoneFrame,
+    kZoneRenderFrame,
+    kZoneTile,
+    kZoneGenerate,
+    kZoneExtend,
+    kZoneSort,
+    kZoneShade,
+    kZoneCompact,
+    kZoneAccumulate,
+    kZoneUpload,
+    kZoneWriteBand,
+    kZoneEncode,
+    kZoneDenoise,
+    kZoneRefit,
+    kZoneWriteFrame,
+    kZoneSharedFrame,
+    kZoneCount
+};
+
+#if kProfilerEnabled
+
+struct ProfileThread;
+extern thread_local ProfileThread* t_ProfileThread;
+ProfileThread* RegisterProfileThread(bool async = false);
+
+struct ProfileThread
+{
+    struct Event
+    {
+        uint64_t start;
+        uint64_t duration;
+        int zone;
+    };
+
+    uint64_t counters[kCounterCount] = {};
+    uint64_t zoneTime[kZoneCount] = {};
+    // Totals at the end of the previous frame
+    uint64_t frameCounters[kCounterCount] = {};
+    uint64_t frameZoneTime[kZoneCount] = {};
+    // Trace events; past kProfilerMaxEvents only zoneTime keeps counting
+    std::vector<Event> events;
+    uint64_t droppedEvents = 0;
+    int index = 0;
+    // Set for threads outside the frame's parallel work; everything above is
+    // then only touched under lock
+    bool async = false;
+    std::mutex lock;
+};
+
+inline ProfileThread* GetProfileThread()
+{
+    ProfileThread* thread = t_ProfileThread;
+    return thread ? thread : RegisterProfileThread();
+}
+
+inline void ProfileCount(ProfileCounter counter, uint64_t count)
+{
+    ProfileThread* thread = GetProfileThread();
+    if (thread->async)
+    {
+        std::lock_guard<std::mutex> lock(thread->lock);
+        thread->counters[counter] += count;
+    }
+    else
+        thread->counters[counter] += count;
+}
+
+// Nanoseconds since the profiler started
+uint64_t GetProfileTime();
+
+class ProfileScope
+{
+public:
+    explicit ProfileScope(ProfileZone zone) : zone(zone), start(GetProfileTime()) {}
+    ~ProfileScope();
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    ProfileZone zone;
+    uint64_t start;
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE_SCOPE(zone) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(zone)
+#define PROFILE_COUNT(counter, count) ProfileCount(counter, uint64_t(count))
+
+#else
+
+#define PROFILE_SCOPE(zone) ((void)0)
+#define PROFILE_COUNT(counter, count) ((void)sizeof(count))
+
+#endif
+
+// Frame boundaries, called from the main thread while no parallel work runs.
+// EndFrame sums every thread's counters and zone times into one CSV row.
+// All of these do nothing when the profiler is compiled out.
+void ProfilerBeginFrame();
+void ProfilerEndFrame();
+// Called first by a thread that records scopes or counts while the render
+// thread may be ending a frame, before it records anything
+void ProfilerMarkAsyncThread();
+
+bool IsProfilerEnabled();
+// Chrome trace JSON (chrome://tracing, Perfetto) of every recorded scope
+bool WriteProfileTrace(const char* path);
+// One row per frame: wall time, counters and summed zone times
+bool WriteProfileCsv(const char* path);
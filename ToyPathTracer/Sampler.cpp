@@ -0,0 +1,254 @@
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+#include "Sampler.h"
+
+#define kBlueNoiseSize 64
+#define kBlueNoiseSigma 1.5f
+// R2 steps of the two dimensions of a pair in 0.32 fixed point
+#define kR2Step0 0xC13FA9A9u
+#define kR2Step1 0x91E10DA5u
+// Golden ratio in 0.32 fixed point
+#define kGoldenStep 0x9E3779B9u
+
+static const char* s_SamplerNames[kSamplerTypeCount] = { "random", "sobol", "r2", "bluenoise" };
+
+bool FindSampler(const char* name, SamplerType& type)
+{
+    for (int i = 0; i < kSamplerTypeCount; ++i)
+    {
+        if (!strcmp(name, s_SamplerNames[i]))
+        {
+            type = SamplerType(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* GetSamplerName(SamplerType type)
+{
+    return type < kSamplerTypeCount ? s_SamplerNames[type] : "unknown";
+}
+
+///////////////////////////
+static uint32_t ReverseBits(uint32_t x)
+{
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+// Burley, "Practical Hash-based Owen Scrambling": the permutation only lets
+// higher bits depend on lower ones, so on reversed bits it is an Owen scramble
+static uint32_t LaineKarrasPermutation(uint32_t x, uint32_t seed)
+{
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+static uint32_t NestedUniformScramble(uint32_t x, uint32_t seed)
+{
+    return ReverseBits(LaineKarrasPermutation(ReverseBits(x), seed));
+}
+
+// Second Sobol dimension, the first is the bit reversed index. The generator
+// matrix is linear over xor, so it is applied a byte of the index at a time.
+struct SobolTables
+{
+    uint32_t bytes[4][256];
+};
+
+static SobolTables BuildSobolTables()
+{
+    uint32_t directions[32];
+    uint32_t v = 1u << 31;
+    for (int bit = 0; bit < 32; ++bit, v ^= v >> 1)
+        directions[bit] = v;
+
+    SobolTables tables;
+    for (int byte = 0; byte < 4; ++byte)
+    {
+        for (int value = 0; value < 256; ++value)
+        {
+            uint32_t result = 0;
+            for (int bit = 0; bit < 8; ++bit)
+            {
+                if (value & (1 << bit))
+                    result ^= directions[byte * 8 + bit];
+            }
+            tables.bytes[byte][value] = result;
+        }
+    }
+    return tables;
+}
+
+static const SobolTables s_SobolTables = BuildSobolTables();
+
+static uint32_t SobolSecond(uint32_t index)
+{
+    return s_SobolTables.bytes[0][index & 0xff] ^ s_SobolTables.bytes[1][(index >> 8) & 0xff]
+         ^ s_SobolTables.bytes[2][(index >> 16) & 0xff] ^ s_SobolTables.bytes[3][index >> 24];
+}
+
+///////////////////////////
+// Void and cluster (Ulichney 1993) on a toroidal tile. Returns every pixel's
+// rank as the middle of its 1 / (size * size) bin in 0.32 fixed point.
+static std::vector<uint32_t> BuildBlueNoiseTile()
+{
+    const int size = kBlueNoiseSize;
+    const int count = size * size;
+
+    // Gaussian of the wrapped distance, indexed by offset
+    std::vector<float> kernel(count);
+    for (int y = 0; y < size; ++y)
+    {
+        for (int x = 0; x < size; ++x)
+        {
+            int dx = x < size / 2 ? x : size - x;
+            int dy = y < size / 2 ? y : size - y;
+            kernel[y * size + x] = expf(-float(dx * dx + dy * dy) / (2 * kBlueNoiseSigma * kBlueNoiseSigma));
+        }
+    }
+
+    std::vector<char> pattern(count, 0);
+    std::vector<float> energy(count, 0.0f);
+    auto toggle = [&](int index, float sign)
+    {
+        pattern[index] = sign > 0;
+        int px = index % size, py = index / size;
+        for (int y = 0; y < size; ++y)
+        {
+            const float* row = &kernel[((y - py + size) % size) * size];
+            for (int x = 0; x < size; ++x)
+                energy[y * size + x] += sign * row[(x - px + size) % size];
+        }
+    };
+    auto tightestCluster = [&]()
+    {
+        int best = -1;
+        for (int i = 0; i < count; ++i)
+        {
+            if (pattern[i] && (best < 0 || energy[i] > energy[best]))
+                best = i;
+        }
+        return best;
+    };
+    auto largestVoid = [&]()
+    {
+        int best = -1;
+        for (int i = 0; i < count; ++i)
+        {
+            if (!pattern[i] && (best < 0 || energy[i] < energy[best]))
+                best = i;
+        }
+        return best;
+    };
+
+    // Random initial tenth, then move points from clusters to voids until
+    // the point removed is the one put back
+    uint32_t seed = 0x2545f491u;
+    int initial = count / 10;
+    for (int placed = 0; placed < initial; )
+    {
+        seed = HashUint(seed);
+        int index = int(seed % uint32_t(count));
+        if (!pattern[index])
+        {
+            toggle(index, 1);
+            ++placed;
+        }
+    }
+    for (;;)
+    {
+        int cluster = tightestCluster();
+        toggle(cluster, -1);
+        int hole = largestVoid();
+        toggle(hole, 1);
+        if (hole == cluster)
+            break;
+    }
+    std::vector<char> prototype = pattern;
+    std::vector<float> prototypeEnergy = energy;
+
+    std::vector<int> rank(count);
+    for (int r = initial - 1; r >= 0; --r)
+    {
+        int cluster = tightestCluster();
+        toggle(cluster, -1);
+        rank[cluster] = r;
+    }
+    // Filling the largest void is the same as taking the tightest cluster of
+    // the empty pixels, so one loop covers both remaining phases
+    pattern = prototype;
+    energy = prototypeEnergy;
+    for (int r = initial; r < count; ++r)
+    {
+        int hole = largestVoid();
+        toggle(hole, 1);
+        rank[hole] = r;
+    }
+
+    std::vector<uint32_t> tile(count);
+    for (int i = 0; i < count; ++i)
+        tile[i] = uint32_t((uint64_t(rank[i]) * 2 + 1) * (uint64_t(1) << 31) / uint64_t(count));
+    return tile;
+}
+
+static const uint32_t* GetBlueNoiseTile()
+{
+    static const std::vector<uint32_t> s_Tile = BuildBlueNoiseTile();
+    return s_Tile.data();
+}
+
+float SampleDimension(const PathSampler& sampler, uint32_t dimension)
+{
+    // Dimensions go in pairs that share a stratification
+    uint32_t pair = dimension >> 1;
+    uint32_t component = dimension & 1;
+    uint32_t pairHash = HashUint(sampler.pixelHash ^ HashUint(pair * kGoldenStep + 1));
+
+    // Every pair walks its sequence in its own order, or the pairs of a path
+    // would be the same points shifted and correlate the bounces. Owen
+    // scrambling the index maps the first 2^k samples to an aligned run of
+    // 2^k points, which for all three is as well spread as the first 2^k.
+    uint32_t value;
+    switch (sampler.type)
+    {
+    case kSamplerSobol:
+    {
+        uint32_t index = NestedUniformScramble(sampler.index, pairHash);
+        value = component ? SobolSecond(index) : ReverseBits(index);
+        value = NestedUniformScramble(value, HashUint(pairHash + component + 1));
+        break;
+    }
+    case kSamplerR2:
+    {
+        uint32_t index = NestedUniformScramble(sampler.index, pairHash);
+        value = HashUint(pairHash + component + 1) + index * (component ? kR2Step1 : kR2Step0);
+        break;
+    }
+    case kSamplerBlueNoise:
+    {
+        // The same offset and order on every pixel keeps the tile's spectrum
+        uint32_t dimensionHash = HashUint(dimension * kGoldenStep + 0x632be59bu);
+        uint32_t x = (sampler.x + dimensionHash) % kBlueNoiseSize;
+        uint32_t y = (sampler.y + (dimensionHash >> 16)) % kBlueNoiseSize;
+        uint32_t index = NestedUniformScramble(sampler.index, dimensionHash);
+        value = GetBlueNoiseTile()[y * kBlueNoiseSize + x] + index * kGoldenStep;
+        break;
+    }
+    default:
+        value = HashUint(pairHash ^ HashUint(sampler.index * 2 + component));
+        break;
+    }
+    return float(value >> 8) * (1.0f / 16777216.0f);
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+
+// Where the per-pixel CPU tracer gets its random numbers from. kSamplerRandom
+// is the xorshift stream of ComputeShader.hlsl and renders the same images as
+// before; the others are low discrepancy or blue noise sequences that need
+// fewer samples for the same error. They only apply to the per-pixel path.
+enum SamplerType
+{
+    kSamplerRandom,
+    // Sobol (0, 2) pairs, Owen scrambled and shuffled per pixel and per pair
+    kSamplerSobol,
+    // Roberts' R2 sequence, rotated per pixel and per pair
+    kSamplerR2,
+    // A 64x64 blue noise tile, offset per dimension and advanced by the golden
+    // ratio per sample
+    kSamplerBlueNoise,
+    kSamplerTypeCount
+};
+
+// Dimensions of a path sample: pixel jitter and lens take two each, then
+// every bounce gets kSamplerBounceDimensions, three for its scatter, one for
+// Russian roulette and a pair each for picking a light and a point on it
+#define kSamplerDimensionPixel 0
+#define kSamplerDimensionLens 2
+#define kSamplerDimensionBounce 4
+#define kSamplerBounceDimensions 8
+#define kSamplerDimensionRoulette 3
+#define kSamplerDimensionLight 4
+
+struct PathSampler
+{
+    // xorshift state of kSamplerRandom
+    uint32_t seed;
+    uint32_t type;
+    // Sample number within the pixel, across frames
+    uint32_t index;
+    uint32_t dimension;
+    uint32_t pixelHash;
+    uint32_t x, y;
+};
+
+inline uint32_t HashUint(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+inline PathSampler MakePathSampler(SamplerType type, uint32_t x, uint32_t y, uint32_t seed)
+{
+    PathSampler sampler;
+    sampler.seed = seed;
+    sampler.type = uint32_t(type);
+    sampler.index = 0;
+    sampler.dimension = 0;
+    sampler.pixelHash = HashUint(x ^ HashUint(y ^ 0x5bd1e995u));
+    sampler.x = x;
+    sampler.y = y;
+    return sampler;
+}
+
+// Starts sample index of the pixel at its first dimension
+inline void StartPathSample(PathSampler& sampler, uint32_t index)
+{
+    sampler.index = index;
+    sampler.dimension = 0;
+}
+
+inline void SetSamplerDimension(PathSampler& sampler, uint32_t dimension)
+{
+    sampler.dimension = dimension;
+}
+
+// Value in [0, 1) of one dimension of the current sample, for the samplers
+// other than kSamplerRandom
+float SampleDimension(const PathSampler& sampler, uint32_t dimension);
+
+// "random", "sobol", "r2" or "bluenoise"
+bool FindSampler(const char* name, SamplerType& type);
+const char* GetSamplerName(SamplerType type);
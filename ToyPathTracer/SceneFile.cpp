@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "Config.h"
+#include "SceneFile.h"
+#include "SphereKernels.h"
+#include "TestScene.h"
+
+#define kSceneFileByteOrder 0x01020304u
+
+uint64_t HashBytes(uint64_t hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+uint64_t HashSceneContent(const Sphere* spheres, int sphereCount, const Material* materials, int materialCount)
+{
+    uint64_t hash = kHashSeed;
+    hash = HashBytes(hash, &sphereCount, sizeof(sphereCount));
+    hash = HashBytes(hash, spheres, size_t(sphereCount) * sizeof(Sphere));
+    hash = HashBytes(hash, &materialCount, sizeof(materialCount));
+    hash = HashBytes(hash, materials, size_t(materialCount) * sizeof(Material));
+    return hash;
+}
+
+uint64_t HashSceneView(const SceneView& view)
+{
+    uint64_t hash = HashSceneContent(view.spheres, view.sphereCount, view.materials, view.materialCount);
+    if (view.instanceCount == 0)
+        return hash;
+    const SphereSoAView& soa = view.prototypeSoa;
+    size_t size = size_t(soa.count) * sizeof(float);
+    hash = HashBytes(hash, &view.instanceCount, sizeof(view.instanceCount));
+    hash = HashBytes(hash, view.instances, size_t(view.instanceCount) * sizeof(Instance));
+    hash = HashBytes(hash, &soa.count, sizeof(soa.count));
+    hash = HashBytes(hash, soa.centerX, size);
+    hash = HashBytes(hash, soa.centerY, size);
+    hash = HashBytes(hash, soa.centerZ, size);
+    hash = HashBytes(hash, soa.radius, size);
+    hash = HashBytes(hash, soa.material, size_t(soa.count) * sizeof(int));
+    return hash;
+}
+
+static uint64_t AlignOffset(uint64_t offset)
+{
+    return (offset + kSceneFileAlignment - 1) & ~uint64_t(kSceneFileAlignment - 1);
+}
+
+bool WriteSceneFile(const char* path, const TestScene& scene, uint64_t contentHash)
+{
+    SceneView view = scene.GetView();
+    if (view.instanceCount > 0)
+    {
+        fprintf(stderr, "Scene files do not hold instances\n");
+        return false;
+    }
+    size_t soaSize = size_t(view.soa.count) + kSphereSoAPadding;
+    const void* sections[kSceneSectionCount] = {
+        view.spheres, view.materials, view.nodes, view.indices,
+        view.soa.centerX, view.soa.centerY, view.soa.centerZ, view.soa.radiusSq, view.soa.radius, view.soa.material
+    };
+
+    SceneFileHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = kSceneFileMagic;
+    header.version = kSceneFileVersion;
+    header.byteOrder = kSceneFileByteOrder;
+    header.headerSize = sizeof(SceneFileHeader);
+    header.sphereSize = sizeof(Sphere);
+    header.materialSize = sizeof(Material);
+    header.nodeSize = sizeof(BVHNode);
+    header.soaPadding = kSphereSoAPadding;
+    header.maxLeafSize = kBVHMaxLeafSize;
+    header.sphereCount = view.sphereCount;
+    header.materialCount = view.materialCount;
+    header.nodeCount = view.nodeCount;
+    header.materialTypes = view.materialTypes;
+    header.contentHash = contentHash;
+    header.sectionSize[kSceneSectionSpheres] = uint64_t(view.sphereCount) * sizeof(Sphere);
+    header.sectionSize[kSceneSectionMaterials] = uint64_t(view.materialCount) * sizeof(Material);
+    header.sectionSize[kSceneSectionNodes] = uint64_t(view.nodeCount) * sizeof(BVHNode);
+    header.sectionSize[kSceneSectionIndices] = uint64_t(view.sphereCount) * sizeof(uint32_t);
+    for (int i = kSceneSectionCenterX; i < kSceneSectionCount; ++i)
+        header.sectionSize[i] = soaSize * 4;
+
+    uint64_t offset = AlignOffset(sizeof(SceneFileHeader));
+    for (int i = 0; i < kSceneSectionCount; ++i)
+    {
+        header.sectionOffset[i] = offset;
+        offset = AlignOffset(offset + header.sectionSize[i]);
+    }
+    header.fileSize = offset;
+
+    FILE* file = fopen(path, "wb");
+    if (!file)
+        return false;
+
+    static const char s_Zeros[kSceneFileAlignment] = {};
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    uint64_t written = sizeof(header);
+    for (int i = 0; i < kSceneSectionCount && ok; ++i)
+    {
+        ok &= fwrite(s_Zeros, 1, size_t(header.sectionOffset[i] - written), file) == header.sectionOffset[i] - written;
+        if (header.sectionSize[i])
+            ok &= fwrite(sections[i], size_t(header.sectionSize[i]), 1, file) == 1;
+        written = header.sectionOffset[i] + header.sectionSize[i];
+    }
+    ok = ok && fwrite(s_Zeros, 1, size_t(header.fileSize - written), file) == header.fileSize - written;
+    ok &= fclose(file) == 0;
+    if (!ok)
+        remove(path);
+    return ok;
+}
+
+static bool CheckHeader(const SceneFileHeader& header, uint64_t fileSize, const char* path)
+{
+    const char* error = nullptr;
+    if (header.magic != kSceneFileMagic)
+        error = "not a scene file";
+    else if (header.version != kSceneFileVersion)
+        error = "written by another version";
+    else if (header.byteOrder != kSceneFileByteOrder || header.headerSize != sizeof(SceneFileHeader)
+             || header.sphereSize != sizeof(Sphere) || header.materialSize != sizeof(Material) || header.nodeSize != sizeof(BVHNode))
+        error = "written for another platform";
+    else if (header.soaPadding != kSphereSoAPadding || header.maxLeafSize != kBVHMaxLeafSize)
+        error = "built with other BVH settings";
+    else if (header.fileSize != fileSize || header.sphereCount < 0 || header.materialCount < 0 || header.nodeCount < 0)
+        error = "truncated";
+    else
+    {
+        uint64_t soaSize = (uint64_t(header.sphereCount) + kSphereSoAPadding) * 4;
+        uint64_t expected[kSceneSectionCount] = {
+            uint64_t(header.sphereCount) * sizeof(Sphere), uint64_t(header.materialCount) * sizeof(Material),
+            uint64_t(header.nodeCount) * sizeof(BVHNode), uint64_t(header.sphereCount) * sizeof(uint32_t),
+            soaSize, soaSize, soaSize, soaSize, soaSize, soaSize
+        };
+        for (int i = 0; i < kSceneSectionCount && !error; ++i)
+        {
+            if (header.sectionSize[i] != expected[i] || header.sectionOffset[i] % kSceneFileAlignment
+                || header.sectionOffset[i] > fileSize || header.sectionSize[i] > fileSize - header.sectionOffset[i])
+                error = "corrupt section table";
+        }
+    }
+    if (error)
+        fprintf(stderr, "%s: %s\n", path, error);
+    return !error;
+}
+
+bool ReadSceneFileHeader(const char* path, SceneFileHeader& header)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return false;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1;
+    fclose(file);
+    return ok && header.magic == kSceneFileMagic && header.version == kSceneFileVersion;
+}
+
+bool CheckSceneFileHeader(const char* path, const SceneFileHeader& header)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return false;
+    bool sized = fseek(file, 0, SEEK_END) == 0;
+#ifdef _WIN32
+    long long fileSize = sized ? _ftelli64(file) : -1;
+#else
+    long long fileSize = sized ? (long long)ftello(file) : -1;
+#endif
+    fclose(file);
+    if (fileSize < 0)
+    {
+        fprintf(stderr, "%s: cannot read its size\n", path);
+        return false;
+    }
+    return CheckHeader(header, uint64_t(fileSize), path);
+}
+
+SceneFile::~SceneFile()
+{
+    Close();
+}
+
+bool SceneFile::Open(const char* path)
+{
+    Close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "%s: cannot open\n", path);
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    HANDLE mapping = NULL;
+    if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart >= LONGLONG(sizeof(SceneFileHeader)))
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    fileHandle = file;
+    mappingHandle = mapping;
+    size = data ? size_t(fileSize.QuadPart) : 0;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "%s: cannot open\n", path);
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size >= off_t(sizeof(SceneFileHeader)))
+    {
+        void* mapped = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED)
+        {
+            data = mapped;
+            size = size_t(info.st_size);
+        }
+    }
+    // The mapping keeps the file alive
+    close(fd);
+#endif
+    if (!data)
+    {
+        fprintf(stderr, "%s: cannot map\n", path);
+        Close();
+        return false;
+    }
+
+    header = (const SceneFileHeader*)data;
+    if (!CheckHeader(*header, size, path))
+    {
+        Close();
+        return false;
+    }
+    // Only scenes with emitters read their spheres here
+    lightTree.Build((const Sphere*)GetSection(kSceneSectionSpheres), header->sphereCount,
+                 (const Material*)GetSection(kSceneSectionMaterials), header->materialTypes);
+    return true;
+}
+
+void SceneFile::Close()
+{
+#ifdef _WIN32
+    if (data) UnmapViewOfFile(data);
+    if (mappingHandle) CloseHandle(mappingHandle);
+    if (fileHandle) CloseHandle(fileHandle);
+    fileHandle = nullptr;
+    mappingHandle = nullptr;
+#else
+    if (data) munmap((void*)data, size);
+#endif
+    data = nullptr;
+    size = 0;
+    header = nullptr;
+    lightTree = LightTree();
+}
+
+SceneView SceneFile::GetView() const
+{
+    // Scene files hold no instances
+    SceneView view = {};
+    view.spheres = (const Sphere*)GetSection(kSceneSectionSpheres);
+    view.sphereCount = header->sphereCount;
+    view.materials = (const Material*)GetSection(kSceneSectionMaterials);
+    view.materialCount = header->materialCount;
+    view.nodes = (const BVHNode*)GetSection(kSceneSectionNodes);
+    view.nodeCount = header->nodeCount;
+    view.indices = (const uint32_t*)GetSection(kSceneSectionIndices);
+    view.soa.centerX = (const float*)GetSection(kSceneSectionCenterX);
+    view.soa.centerY = (const float*)GetSection(kSceneSectionCenterY);
+    view.soa.centerZ = (const float*)GetSection(kSceneSectionCenterZ);
+    view.soa.radiusSq = (const float*)GetSection(kSceneSectionRadiusSq);
+    view.soa.radius = (const float*)GetSection(kSceneSectionRadius);
+    view.soa.material = (const int*)GetSection(kSceneSectionMaterialIds);
+    view.soa.count = header->sphereCount;
+    view.kernels = &GetSphereKernels();
+    view.materialTypes = header->materialTypes;
+    view.lights = lightTree.GetLights().data();
+    view.lightCount = lightTree.GetSize();
+    view.lightNodes = lightTree.GetNodes().data();
+    view.sphereLights = lightTree.GetSphereLights().data();
+    return view;
+}
+
+bool SceneFile::VerifyContent() const
+{
+    SceneView view = GetView();
+    return HashSceneContent(view.spheres, view.sphereCount, view.materials, view.materialCount) == header->contentHash;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Maths.h"
+#include "SharedDataStruct.h"
+#include "SceneView.h"
+#include "LightTree.h"
+
+class TestScene;
+
+// Binary scene cache: the sphere and material arrays plus the BVH and SoA data
+// built from them, each section 64 byte aligned so a read-only mapping of the
+// file can be traced in place. Bump the version whenever the layout or the BVH
+// builder changes.
+#define kSceneFileMagic 0x53505454u // "TTPS"
+#define kSceneFileVersion 2
+#define kSceneFileAlignment 64
+
+enum SceneFileSection
+{
+    kSceneSectionSpheres,
+    kSceneSectionMaterials,
+    kSceneSectionNodes,
+    kSceneSectionIndices,
+    kSceneSectionCenterX,
+    kSceneSectionCenterY,
+    kSceneSectionCenterZ,
+    kSceneSectionRadiusSq,
+    kSceneSectionRadius,
+    kSceneSectionMaterialIds,
+    kSceneSectionCount
+};
+
+struct SceneFileHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    // Catch files written on a machine with other sizes or byte order
+    uint32_t byteOrder;
+    uint32_t headerSize;
+    uint32_t sphereSize;
+    uint32_t materialSize;
+    uint32_t nodeSize;
+    uint32_t soaPadding;
+    uint32_t maxLeafSize;
+    int32_t sphereCount;
+    int32_t materialCount;
+    int32_t nodeCount;
+    // GetMaterialTypes of the materials, so loading never scans them
+    uint32_t materialTypes;
+    // HashSceneContent of the spheres and materials the file was built from
+    uint64_t contentHash;
+    uint64_t fileSize;
+    uint64_t sectionOffset[kSceneSectionCount];
+    uint64_t sectionSize[kSceneSectionCount];
+};
+
+// FNV-1a, start from kHashSeed and feed data in any number of steps
+#define kHashSeed 0xcbf29ce484222325ULL
+uint64_t HashBytes(uint64_t hash, const void* data, size_t size);
+
+// FNV-1a over the sphere and material arrays. Builders compare it against a
+// file's header to tell whether the cached BVH still matches its source.
+uint64_t HashSceneContent(const Sphere* spheres, int sphereCount, const Material* materials, int materialCount);
+
+// HashSceneContent of the view's spheres and materials, plus its instances and
+// prototype spheres if it has any
+uint64_t HashSceneView(const SceneView& view);
+
+bool WriteSceneFile(const char* path, const TestScene& scene, uint64_t contentHash);
+
+// Reads only the header, for checking a cache without mapping all of it.
+bool ReadSceneFileHeader(const char* path, SceneFileHeader& header);
+// The checks Open applies to a header read from path, against the file's
+// current size; prints why it fails
+bool CheckSceneFileHeader(const char* path, const SceneFileHeader& header);
+
+// A scene file mapped read-only. The view points straight into the mapping,
+// so nothing is read from disk until the renderer touches it.
+class SceneFile
+{
+public:
+    SceneFile() {}
+    ~SceneFile();
+    SceneFile(const SceneFile&) = delete;
+    SceneFile& operator=(const SceneFile&) = delete;
+
+    // Fails, printing why, on a missing, truncated or incompatible file
+    bool Open(const char* path);
+    void Close();
+
+    const SceneFileHeader& GetHeader() const { return *header; }
+    SceneView GetView() const;
+    // Rehashes the sphere and material sections; touches all their pages
+    bool VerifyContent() const;
+
+private:
+    const void* GetSection(int section) const { return (const char*)data + header->sectionOffset[section]; }
+
+    const void* data = nullptr;
+    size_t size = 0;
+    const SceneFileHeader* header = nullptr;
+    // Built from the mapped spheres, as lights are not part of the file
+    LightTree lightTree;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#endif
+};
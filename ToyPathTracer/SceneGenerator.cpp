@@ -0,0 +1,295 @@
+#include <string.h>
+
+#include "SceneGenerator.h"
+#include "LightTree.h"
+
+// Instances are scaled to this range of the prototype's unit ball
+#define kClusterMinScale 0.25f
+#define kClusterMaxScale 0.4f
+// Radiance of the brightest channel of an emissive sphere
+#define kEmissiveRadiance 20.0f
+
+// Appends materials, handing out the index of an identical one already added
+// instead of storing a copy. Open addressing over the material indices, so a
+// million distinct materials cost no allocation each.
+class MaterialPalette
+{
+public:
+    explicit MaterialPalette(std::vector<Material>& materials) : materials(materials) {}
+
+    int Add(const Material& material)
+    {
+        if ((materials.size() + 1) * 2 > table.size())
+            Grow();
+        size_t mask = table.size() - 1;
+        for (size_t slot = Hash(material) & mask;; slot = (slot + 1) & mask)
+        {
+            int index = table[slot];
+            if (index < 0)
+            {
+                table[slot] = int(materials.size());
+                materials.push_back(material);
+                return table[slot];
+            }
+            if (IsEqual(materials[index], material))
+                return index;
+        }
+    }
+
+private:
+    static size_t Hash(const Material& m)
+    {
+        uint64_t hash = uint64_t(m.type);
+        const float values[] = { m.albedo.x, m.albedo.y, m.albedo.z, m.fuzziness, m.refraction };
+        for (float value : values)
+        {
+            uint32_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            hash = (hash ^ bits) * 0x9E3779B97F4A7C15ULL;
+        }
+        return size_t(hash ^ (hash >> 32));
+    }
+
+    static bool IsEqual(const Material& a, const Material& b)
+    {
+        return a.type == b.type && a.albedo.x == b.albedo.x && a.albedo.y == b.albedo.y && a.albedo.z == b.albedo.z
+            && a.fuzziness == b.fuzziness && a.refraction == b.refraction;
+    }
+
+    void Insert(int index)
+    {
+        size_t mask = table.size() - 1;
+        size_t slot = Hash(materials[index]) & mask;
+        while (table[slot] >= 0)
+            slot = (slot + 1) & mask;
+        table[slot] = index;
+    }
+
+    void Grow()
+    {
+        table.assign(table.empty() ? 64 : table.size() * 2, -1);
+        for (int i = 0; i < int(materials.size()); ++i)
+            Insert(i);
+    }
+
+    std::vector<Material>& materials;
+    std::vector<int> table;
+};
+
+static Material RandomMaterial(const SceneDesc& desc, RandomSequence& rng)
+{
+    float total = desc.diffuse + desc.metal + desc.glass + desc.emissive;
+    float index = rng.nextFloat() * total;
+    if (index < desc.diffuse)
+    {   // diffuse
+        float3 albedo = rng.nextFloat3() * rng.nextFloat3();
+        return { 0, albedo };
+    }
+    else if (index < desc.diffuse + desc.metal)
+    {   // metal
+        float3 albedo = rng.nextFloat3() * 0.5 + 0.5;
+        float fuzz = rng.nextFloat() * 0.5f;
+        return { 1, albedo, fuzz };
+    }
+    else if (index < desc.diffuse + desc.metal + desc.glass || desc.emissive <= 0)
+    {   // glass
+        return { 2, float3(0, 0, 0), 0, 1.5 };
+    }
+    // emissive, warm to cool white
+    float3 color = lerp(float3(1.0f, 0.6f, 0.3f), float3(0.6f, 0.8f, 1.0f), rng.nextFloat());
+    return { kMaterialEmissive, color * kEmissiveRadiance };
+}
+
+static float GaussianFloat(RandomSequence& rng)
+{
+    // Box-Muller, one of the pair is enough here
+    float u = 1.0f - rng.nextFloat();
+    float v = rng.nextFloat();
+    return sqrtf(-2.0f * logf(u)) * cosf(2.0f * float(PI) * v);
+}
+
+// Spheres of equal size filling about an eighth of the unit ball
+static void GeneratePrototype(int count, RandomSequence& rng, const std::vector<int>& palette, std::vector<Sphere>& prototype)
+{
+    float radius = 0.5f / cbrtf(float(count));
+    prototype.clear();
+    prototype.reserve(count);
+    while (int(prototype.size()) < count)
+    {
+        float3 p = rng.nextFloat3() * 2.0f - float3(1, 1, 1);
+        if (dot(p, p) > 1.0f)
+            continue;
+        int material = palette[rng.nextUInt() % uint32_t(palette.size())];
+        prototype.push_back({ material, p * (1.0f - radius), radius });
+    }
+}
+
+void GenerateScene(const SceneDesc& desc, std::vector<Sphere>& spheres, std::vector<Material>& materials)
+{
+    std::vector<Sphere> prototype;
+    std::vector<Instance> instances;
+    GenerateScene(desc, spheres, materials, prototype, instances);
+}
+
+void GenerateScene(const SceneDesc& desc, std::vector<Sphere>& spheres, std::vector<Material>& materials,
+                   std::vector<Sphere>& prototype, std::vector<Instance>& instances)
+{
+    RandomSequence rng(desc.seed);
+    const float smallRadius = 0.2f;
+    bool clustered = desc.clusterSize > 0;
+
+    // Unit cells on a square centered on the origin; the classic scene keeps
+    // its 22x22 grid, larger counts grow the square so density stays the same.
+    // The spheres stay at the height of the original scene: growing the ground
+    // sphere to follow them would cost the float precision of its intersection.
+    // Instanced clusters take a cell each like the spheres they replace.
+    int count = clustered ? int((int64_t(desc.sphereCount) + desc.clusterSize - 1) / desc.clusterSize) : desc.sphereCount;
+    int side = count > 0 ? int(ceilf(sqrtf(float(count)))) + 1 : 22;
+    float extent = side * 0.5f;
+
+    auto isFree = [](const float3& center)
+    {
+        return length(center - float3(4, 0.2, 0)) > 0.9;
+    };
+
+    spheres.clear();
+    materials.clear();
+    prototype.clear();
+    instances.clear();
+    if (count > 0 && clustered)
+    {
+        instances.reserve(count);
+    }
+    else if (count > 0)
+    {
+        spheres.reserve(size_t(count) + 4);
+        if (desc.paletteSize <= 0)
+            materials.reserve(size_t(count) + 4);
+    }
+
+    MaterialPalette materialPalette(materials);
+    std::vector<int> palette;
+    int paletteSize = clustered && desc.paletteSize <= 0 ? kClusterPaletteSize : desc.paletteSize;
+    for (int i = 0; i < paletteSize; ++i)
+        palette.push_back(materialPalette.Add(RandomMaterial(desc, rng)));
+    if (clustered)
+        GeneratePrototype(desc.clusterSize, rng, palette, prototype);
+
+    // Half the clusters keep the prototype's materials, the others are all
+    // one palette material. They sit on the ground turned around the up axis.
+    auto addCluster = [&](float x, float z)
+    {
+        float scale = kClusterMinScale + (kClusterMaxScale - kClusterMinScale) * rng.nextFloat();
+        float3 center(x, scale, z);
+        if (!isFree(center))
+            return;
+        float angle = rng.nextFloat() * 2.0f * float(PI);
+        Instance instance;
+        instance.translation = center;
+        instance.scale = scale;
+        instance.axisX = float3(cosf(angle), 0, -sinf(angle));
+        instance.axisY = float3(0, 1, 0);
+        instance.axisZ = float3(sinf(angle), 0, cosf(angle));
+        instance.prototype = 0;
+        uint32_t variant = rng.nextUInt();
+        instance.materialOverride = variant & 1 ? palette[(variant >> 1) % uint32_t(palette.size())] : -1;
+        instances.push_back(instance);
+    };
+    auto addSphere = [&](float x, float z)
+    {
+        if (clustered)
+        {
+            addCluster(x, z);
+            return;
+        }
+        float3 center(x, smallRadius, z);
+        if (!isFree(center))
+            return;
+        int material;
+        if (palette.empty())
+            material = materialPalette.Add(RandomMaterial(desc, rng));
+        else
+            material = palette[rng.nextUInt() % uint32_t(palette.size())];
+        spheres.push_back({ material, center, smallRadius });
+    };
+    auto placed = [&]() { return clustered ? int(instances.size()) : int(spheres.size()); };
+    auto isFull = [&]() { return count > 0 && placed() >= count; };
+
+    if (desc.layout == SceneLayout::Grid)
+    {
+        int first = -side / 2;
+        for (int i = first; i < first + side && !isFull(); ++i)
+        {
+            for (int j = first; j < first + side && !isFull(); ++j)
+            {
+                float x = i + 0.9f * rng.nextFloat();
+                float z = j + 0.9f * rng.nextFloat();
+                addSphere(x, z);
+            }
+        }
+    }
+    else if (desc.layout == SceneLayout::Uniform)
+    {
+        int target = count > 0 ? count : side * side;
+        while (placed() < target)
+        {
+            float x = (rng.nextFloat() * 2.0f - 1.0f) * extent;
+            float z = (rng.nextFloat() * 2.0f - 1.0f) * extent;
+            addSphere(x, z);
+        }
+    }
+    else
+    {
+        // About a thousand spheres per clump, each clump spread over a few
+        // times its fair share of the square
+        int target = count > 0 ? count : side * side;
+        int clusterCount = target / 1000 + 1;
+        float sigma = extent / sqrtf(float(clusterCount)) * 0.5f;
+        std::vector<float3> clusters;
+        for (int i = 0; i < clusterCount; ++i)
+            clusters.push_back(float3((rng.nextFloat() * 2.0f - 1.0f) * extent, 0, (rng.nextFloat() * 2.0f - 1.0f) * extent));
+        while (placed() < target)
+        {
+            const float3& cluster = clusters[rng.nextUInt() % uint32_t(clusterCount)];
+            float x = minf(maxf(cluster.x + GaussianFloat(rng) * sigma, -extent), extent);
+            float z = minf(maxf(cluster.z + GaussianFloat(rng) * sigma, -extent), extent);
+            addSphere(x, z);
+        }
+    }
+
+    spheres.push_back({ materialPalette.Add({ 0, float3(0.5, 0.5, 0.5) }), float3(0, -1000, 0), 1000 });
+
+    // Feature spheres of a type the mix leaves out turn diffuse, so such a
+    // scene really has no material of that type
+    Material center = { 2, float3(0, 0, 0), 0, 1.5 };
+    if (desc.glass <= 0)
+        center = { 0, float3(0.5, 0.5, 0.5) };
+    spheres.push_back({ materialPalette.Add(center), float3(0, 1, 0), 1 });
+
+    spheres.push_back({ materialPalette.Add({ 0, float3(0.4, 0.2, 0.1) }), float3(-4, 1, 0), 1 });
+
+    Material right = { 1, float3(0.7, 0.6, 0.5), 0 };
+    if (desc.metal <= 0)
+        right = { 0, float3(0.7, 0.6, 0.5) };
+    spheres.push_back({ materialPalette.Add(right), float3(4, 1, 0), 1 });
+}
+
+static const char* s_LayoutNames[] = { "grid", "uniform", "clustered" };
+
+const char* GetSceneLayoutName(SceneLayout layout)
+{
+    return s_LayoutNames[int(layout)];
+}
+
+bool FindSceneLayout(const char* name, SceneLayout& layout)
+{
+    for (int i = 0; i < int(sizeof(s_LayoutNames) / sizeof(s_LayoutNames[0])); ++i)
+    {
+        if (!strcmp(name, s_LayoutNames[i]))
+        {
+            layout = SceneLayout(i);
+            return true;
+        }
+    }
+    return false;
+}
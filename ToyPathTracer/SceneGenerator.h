@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "Maths.h"
+#include "SharedDataStruct.h"
+
+// How the small spheres are spread over the ground
+enum class SceneLayout
+{
+    Grid,       // one sphere per jittered unit cell, like the original test scene
+    Uniform,    // uniformly over the same square, overlaps allowed
+    Clustered,  // gaussian clumps around random centers
+};
+
+// Everything that decides the generated scene. The same description always
+// gives the same spheres and materials, whatever the platform or C runtime.
+struct SceneDesc
+{
+    uint64_t seed = 1;
+    SceneLayout layout = SceneLayout::Grid;
+    // Small spheres to place; 0 keeps the original 22x22 grid
+    int sphereCount = 0;
+    // Relative weights of the small sphere materials. A weight of 0 also
+    // makes the feature sphere of that type diffuse.
+    float diffuse = 0.8f;
+    float metal = 0.15f;
+    float glass = 0.05f;
+    // Weight of small spheres that give off light, none by default
+    float emissive = 0;
+    // Share this many random materials between the small spheres; 0 gives
+    // every sphere its own material like the original scene
+    int paletteSize = 0;
+    // Place the small spheres as instances of one prototype cluster of this
+    // many spheres instead of one by one; sphereCount then counts the spheres
+    // of all instances together. Clustered scenes always use a palette, of
+    // kClusterPaletteSize materials when paletteSize is 0.
+    int clusterSize = 0;
+};
+
+#define kClusterPaletteSize 64
+
+// Fills spheres and materials, the big ground and feature spheres included.
+// Identical materials are only stored once.
+void GenerateScene(const SceneDesc& desc, std::vector<Sphere>& spheres, std::vector<Material>& materials);
+// Same, with the prototype and its instances when desc.clusterSize > 0
+void GenerateScene(const SceneDesc& desc, std::vector<Sphere>& spheres, std::vector<Material>& materials,
+                   std::vector<Sphere>& prototype, std::vector<Instance>& instances);
+
+const char* GetSceneLayoutName(SceneLayout layout);
+bool FindSceneLayout(const char* name, SceneLayout& layout);
@@ -0,0 +1,95 @@
+#include <string.h>
+
+#include "LightTree.h"
+#include "SceneReplicas.h"
+#include "SphereSoA.h"
+
+// Sections are aligned like in scene files, for the SIMD loads
+#define kReplicaAlignment 64
+
+// Places count elements of source at the next aligned offset of buffer, or
+// only reserves the space when buffer is null
+template <typename T>
+static const T* CopyArray(uint8_t* buffer, size_t& size, const T* source, size_t count)
+{
+    size = (size + kReplicaAlignment - 1) & ~size_t(kReplicaAlignment - 1);
+    T* target = buffer ? (T*)(buffer + size) : nullptr;
+    if (buffer && source && count)
+        memcpy(target, source, count * sizeof(T));
+    size += count * sizeof(T);
+    return source ? target : nullptr;
+}
+
+static void CopySoA(uint8_t* buffer, size_t& size, const SphereSoAView& source, SphereSoAView& target)
+{
+    size_t count = source.centerX ? size_t(source.count) + kSphereSoAPadding : 0;
+    target.centerX = CopyArray(buffer, size, source.centerX, count);
+    target.centerY = CopyArray(buffer, size, source.centerY, count);
+    target.centerZ = CopyArray(buffer, size, source.centerZ, count);
+    target.radiusSq = CopyArray(buffer, size, source.radiusSq, count);
+    target.radius = CopyArray(buffer, size, source.radius, count);
+    target.material = CopyArray(buffer, size, source.material, count);
+}
+
+// Lays the arrays of scene out in buffer and points view at the copies, or
+// only adds up their size when buffer is null
+static size_t CopyScene(const SceneView& scene, uint8_t* buffer, SceneView& view)
+{
+    size_t size = 0;
+    view = scene;
+    view.spheres = CopyArray(buffer, size, scene.spheres, scene.sphereCount);
+    view.materials = CopyArray(buffer, size, scene.materials, scene.materialCount);
+    view.nodes = CopyArray(buffer, size, scene.nodes, scene.nodeCount);
+    view.indices = CopyArray(buffer, size, scene.indices, scene.sphereCount);
+    CopySoA(buffer, size, scene.soa, view.soa);
+    view.instances = CopyArray(buffer, size, scene.instances, scene.instanceCount);
+    view.instanceNodes = CopyArray(buffer, size, scene.instanceNodes, scene.instanceNodeCount);
+    view.instanceIndices = CopyArray(buffer, size, scene.instanceIndices, scene.instanceCount);
+    view.prototypeNodes = CopyArray(buffer, size, scene.prototypeNodes, scene.prototypeNodeCount);
+    view.prototypeRoots = CopyArray(buffer, size, scene.prototypeRoots, scene.prototypeCount);
+    CopySoA(buffer, size, scene.prototypeSoa, view.prototypeSoa);
+    view.lights = CopyArray(buffer, size, scene.lights, scene.lightCount);
+    view.lightNodes = CopyArray(buffer, size, scene.lightNodes, scene.lightCount > 0 ? scene.lightCount * 2 - 1 : 0);
+    view.sphereLights = CopyArray(buffer, size, scene.sphereLights, scene.lightCount > 0 ? scene.sphereCount : 0);
+    return size;
+}
+
+void SceneReplicas::Build(ThreadPool& pool, const SceneView& scene)
+{
+    int nodeCount = pool.GetNodeCount();
+    views.assign(nodeCount, scene);
+    if (!pool.IsPinned())
+    {
+        std::vector<std::vector<uint8_t>>().swap(buffers);
+        return;
+    }
+    buffers.resize(nodeCount);
+
+    // The first thread of each node makes its copy
+    std::vector<int> owners(nodeCount, -1);
+    for (int i = pool.GetThreadCount() - 1; i >= 0; --i)
+        owners[pool.GetThreadNode(i)] = i;
+
+    SceneView layout;
+    size_t size = CopyScene(scene, nullptr, layout);
+    pool.RunOnEveryThread([&](int threadIndex)
+    {
+        int node = pool.GetThreadNode(threadIndex);
+        if (owners[node] != threadIndex)
+            return;
+        // Freed and allocated here, so the pages are fresh and touched first by this node
+        std::vector<uint8_t>().swap(buffers[node]);
+        buffers[node].resize(size + kReplicaAlignment);
+        uint8_t* base = buffers[node].data();
+        base += (kReplicaAlignment - uintptr_t(base) % kReplicaAlignment) % kReplicaAlignment;
+        CopyScene(scene, base, views[node]);
+    });
+}
+
+size_t SceneReplicas::GetMemorySize() const
+{
+    size_t size = 0;
+    for (const std::vector<uint8_t>& buffer : buffers)
+        size += buffer.capacity();
+    return size;
+}
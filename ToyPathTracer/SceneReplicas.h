@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "SceneView.h"
+#include "ThreadPool.h"
+
+// A copy of the scene arrays for every NUMA node of a pinned ThreadPool. Each
+// copy is allocated and written by the first thread of its node, so with a
+// first touch policy its pages are local to the threads that trace it and BVH
+// walks never cross the link between sockets. Views of a pool that is not
+// pinned point at the scene itself.
+class SceneReplicas
+{
+public:
+    // Copies scene again; call after anything in it changed
+    void Build(ThreadPool& pool, const SceneView& scene);
+    const SceneView& GetView(int node) const { return views[node]; }
+    int GetNodeCount() const { return int(views.size()); }
+    size_t GetMemorySize() const;
+
+private:
+    std::vector<SceneView> views;
+    std::vector<std::vector<uint8_t>> buffers;
+};
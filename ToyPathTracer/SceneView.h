@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "Maths.h"
+#include "SharedDataStruct.h"
+#include "SphereSoA.h"
+
+struct SphereKernels;
+struct Light;
+struct LightNode;
+
+// Non-owning view of the scene arrays the CPU tracer reads from
+struct SceneView
+{
+    const Sphere* spheres;
+    int sphereCount;
+    const Material* materials;
+    int materialCount;
+    const BVHNode* nodes;
+    int nodeCount;
+    const uint32_t* indices;
+    // BVH ordered copy of the spheres for the SIMD kernels. With no kernels
+    // set HitWorld tests the spheres one by one through indices.
+    SphereSoAView soa;
+    const SphereKernels* kernels;
+    // Bit (1 << type) set for every material type in materials, so the CPU
+    // tracer can pick a kernel without the branches for the other types
+    uint32_t materialTypes;
+
+    // Instances of prototype clusters under a top-level BVH, tested after the
+    // spheres above. The prototype BVHs share prototypeNodes, their roots are
+    // prototypeRoots[Instance::prototype], and their leaves index
+    // prototypeSoa. Only the CPU backend traces them.
+    const Instance* instances;
+    int instanceCount;
+    const BVHNode* instanceNodes;
+    int instanceNodeCount;
+    const uint32_t* instanceIndices;
+    const BVHNode* prototypeNodes;
+    int prototypeNodeCount;
+    const int* prototypeRoots;
+    int prototypeCount;
+    SphereSoAView prototypeSoa;
+
+    // Emissive spheres for next-event estimation under the light tree in
+    // lightNodes, and the light of each sphere or -1, see LightTree. With no
+    // lights the per-pixel tracer only finds emitters by hitting them.
+    const Light* lights;
+    int lightCount;
+    const LightNode* lightNodes;
+    const int* sphereLights;
+};
+
+inline uint32_t GetMaterialTypes(const Material* materials, int count)
+{
+    uint32_t types = 0;
+    for (int i = 0; i < count; ++i)
+        types |= 1u << (materials[i].type & 31);
+    return types;
+}
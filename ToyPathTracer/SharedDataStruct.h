@@ -39,6 +39,36 @@ struct Sphere
 };
 
 ///////////////////////////
+// Interior nodes store the index of their left child in leftFirst, the right
+// child follows it. Leaves have count > 0 and leftFirst indexes the BVH
+// primitive index buffer.
+struct BVHNode
+{
+    float3 boundsMin;
+    int leftFirst;
+    float3 boundsMax;
+    int count;
+};
+
+///////////////////////////
+// One placement of a prototype cluster of spheres: world = translation +
+// scale * (x * axisX + y * axisY + z * axisZ) for an object space point. The
+// axes are orthonormal, so every sphere stays a sphere.
+struct Instance
+{
+    float3 translation;
+    float scale;
+    float3 axisX;
+    int prototype;
+    float3 axisY;
+    // Material of every sphere of the instance, or -1 for the prototype's own
+    int materialOverride;
+    float3 axisZ;
+};
+
+///////////////////////////
+// type 0 is diffuse, 1 metal, 2 glass and 3 emissive, whose albedo is the
+// radiance it gives off
 struct Material
 {
     int type;
@@ -54,4 +84,6 @@ struct ComputeParams
     Camera camera;
     int count;
     float lerpFactor;
+    // See kRussianRouletteDepth
+    int rouletteDepth;
 };
@@ -0,0 +1,379 @@
+#include <chrono>
+#include <errno.h>
+#include <new>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "SharedFrameRing.h"
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+              "the ring counters are shared between processes and must not hide a lock");
+
+// How long a waiting writer or reader sleeps between looks at the counters
+#define kSharedFramePollMicroseconds 100
+
+static const char* s_OverrunNames[] = { "drop", "block" };
+
+const char* GetSharedFrameOverrunName(SharedFrameOverrun overrun)
+{
+    return s_OverrunNames[int(overrun)];
+}
+
+bool FindSharedFrameOverrun(const char* name, SharedFrameOverrun& overrun)
+{
+    for (int i = 0; i < 2; ++i)
+    {
+        if (!strcmp(name, s_OverrunNames[i]))
+        {
+            overrun = SharedFrameOverrun(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint64_t AlignUp(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// POSIX wants one leading slash, Windows a session local name
+static bool GetSystemName(const char* name, char* output, size_t size)
+{
+    if (!name[0] || strchr(name, '/') || strchr(name, '\\'))
+        return false;
+#ifdef _WIN32
+    int length = snprintf(output, size, "Local\\%s", name);
+#else
+    int length = snprintf(output, size, "/%s", name);
+#endif
+    return length > 0 && size_t(length) < size;
+}
+
+static uint32_t GetOwnProcessId()
+{
+#ifdef _WIN32
+    return uint32_t(GetCurrentProcessId());
+#else
+    return uint32_t(getpid());
+#endif
+}
+
+// Only sees processes in the same PID namespace, and a reused PID passes
+static bool IsProcessAlive(uint32_t pid)
+{
+#ifdef _WIN32
+    HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, DWORD(pid));
+    if (!process)
+        return GetLastError() == ERROR_ACCESS_DENIED;
+    bool alive = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+    CloseHandle(process);
+    return alive;
+#else
+    return kill(pid_t(pid), 0) == 0 || errno == EPERM;
+#endif
+}
+
+// The reader closed the ring, or died while it had it
+static bool IsReaderGone(const SharedFrameHeader* header)
+{
+    uint32_t state = header->readerState.load(std::memory_order_relaxed);
+    if (state == kSharedReaderDetached)
+        return true;
+    uint32_t pid = header->readerPid.load(std::memory_order_relaxed);
+    return state == kSharedReaderAttached && pid != 0 && !IsProcessAlive(pid);
+}
+
+static uint8_t* GetSlot(SharedFrameHeader* header, uint64_t index)
+{
+    return (uint8_t*)header + header->slotOffset + (index % header->slotCount) * header->slotSize;
+}
+
+SharedFrameWriter::~SharedFrameWriter()
+{
+    Close();
+}
+
+bool SharedFrameWriter::Create(const char* name_, int width, int height, int slotCount, SharedFrameOverrun overrun)
+{
+    Close();
+    if (width <= 0 || height <= 0 || slotCount <= 0 || !GetSystemName(name_, name, sizeof(name)))
+    {
+        fprintf(stderr, "%s: invalid shared frame ring\n", name_);
+        name[0] = 0;
+        return false;
+    }
+
+    uint64_t stride = uint64_t(width) * 4;
+    uint64_t pixelOffset = AlignUp(sizeof(SharedFrameSlot), 64);
+    uint64_t slotOffset = AlignUp(sizeof(SharedFrameHeader), kSharedFrameAlignment);
+    uint64_t slotSize = AlignUp(pixelOffset + stride * uint64_t(height), kSharedFrameAlignment);
+    uint64_t totalSize = slotOffset + slotSize * uint64_t(slotCount);
+
+    void* data = nullptr;
+#ifdef _WIN32
+    HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, DWORD(totalSize >> 32), DWORD(totalSize), name);
+    // An existing mapping is still open in another process
+    if (mapping && GetLastError() == ERROR_ALREADY_EXISTS)
+    {
+        CloseHandle(mapping);
+        mapping = NULL;
+    }
+    data = mapping ? MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0) : nullptr;
+    if (!data && mapping)
+        CloseHandle(mapping);
+    mappingHandle = data ? mapping : nullptr;
+#else
+    // A ring left by a killed run would keep its old size and counters
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd >= 0)
+    {
+        if (ftruncate(fd, off_t(totalSize)) == 0)
+        {
+            void* mapped = mmap(nullptr, size_t(totalSize), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            data = mapped != MAP_FAILED ? mapped : nullptr;
+        }
+        close(fd);
+        if (!data)
+            shm_unlink(name);
+    }
+#endif
+    if (!data)
+    {
+        fprintf(stderr, "%s: cannot create shared memory of %.1fMB\n", name_, double(totalSize) / (1024.0 * 1024.0));
+        name[0] = 0;
+        return false;
+    }
+
+    header = new (data) SharedFrameHeader();
+    header->version = kSharedFrameVersion;
+    header->headerSize = sizeof(SharedFrameHeader);
+    header->width = uint32_t(width);
+    header->height = uint32_t(height);
+    header->stride = uint32_t(stride);
+    header->slotCount = uint32_t(slotCount);
+    header->overrun = uint32_t(overrun);
+    header->slotOffset = slotOffset;
+    header->slotSize = slotSize;
+    header->pixelOffset = pixelOffset;
+    header->totalSize = totalSize;
+    header->magic.store(kSharedFrameMagic, std::memory_order_release);
+    stats = SharedFrameStats();
+    return true;
+}
+
+void SharedFrameWriter::Close()
+{
+    if (header)
+    {
+        header->closed.store(1, std::memory_order_release);
+#ifdef _WIN32
+        UnmapViewOfFile(header);
+        CloseHandle(mappingHandle);
+        mappingHandle = nullptr;
+#else
+        munmap(header, size_t(header->totalSize));
+        shm_unlink(name);
+#endif
+    }
+    header = nullptr;
+    slot = nullptr;
+    name[0] = 0;
+}
+
+uint8_t* SharedFrameWriter::BeginFrame()
+{
+    // Only this thread moves written
+    uint64_t index = header->written.load(std::memory_order_relaxed);
+    auto begin = std::chrono::high_resolution_clock::now();
+    bool waited = false;
+    // Acquire, so the reader is done with the slot before it is overwritten
+    while (index - header->read.load(std::memory_order_acquire) >= header->slotCount)
+    {
+        if (SharedFrameOverrun(header->overrun) == SharedFrameOverrun::Drop || IsReaderGone(header))
+        {
+            header->dropped.fetch_add(1, std::memory_order_relaxed);
+            ++stats.dropped;
+            slot = nullptr;
+            return nullptr;
+        }
+        waited = true;
+        std::this_thread::sleep_for(std::chrono::microseconds(kSharedFramePollMicroseconds));
+    }
+    if (waited)
+    {
+        ++stats.waits;
+        stats.waitSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - begin).count();
+    }
+    slot = GetSlot(header, index);
+    return slot + header->pixelOffset;
+}
+
+void SharedFrameWriter::EndFrame(int64_t frame)
+{
+    uint64_t index = header->written.load(std::memory_order_relaxed);
+    SharedFrameSlot* info = (SharedFrameSlot*)slot;
+    info->frame = frame;
+    info->index = index;
+    // Release, so the reader sees the whole slot once it sees the count
+    header->written.store(index + 1, std::memory_order_release);
+    slot = nullptr;
+    ++stats.frames;
+}
+
+SharedFrameReader::~SharedFrameReader()
+{
+    Close();
+}
+
+bool SharedFrameReader::Open(const char* name, bool report)
+{
+    Close();
+    char systemName[128];
+    if (!GetSystemName(name, systemName, sizeof(systemName)))
+    {
+        if (report)
+            fprintf(stderr, "%s: invalid shared frame ring\n", name);
+        return false;
+    }
+
+    void* data = nullptr;
+#ifdef _WIN32
+    HANDLE mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, systemName);
+    data = mapping ? MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0) : nullptr;
+    MEMORY_BASIC_INFORMATION info;
+    if (data && VirtualQuery(data, &info, sizeof(info)))
+        size = info.RegionSize;
+    if (!data && mapping)
+        CloseHandle(mapping);
+    mappingHandle = data ? mapping : nullptr;
+#else
+    int fd = shm_open(systemName, O_RDWR, 0);
+    struct stat info;
+    if (fd >= 0 && fstat(fd, &info) == 0 && info.st_size >= off_t(sizeof(SharedFrameHeader)))
+    {
+        void* mapped = mmap(nullptr, size_t(info.st_size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapped != MAP_FAILED)
+        {
+            data = mapped;
+            size = size_t(info.st_size);
+        }
+    }
+    // The mapping keeps the memory alive, even after the writer removed the name
+    if (fd >= 0)
+        close(fd);
+#endif
+    if (!data)
+    {
+        if (report)
+            fprintf(stderr, "%s: no shared frame ring\n", name);
+        Close();
+        return false;
+    }
+
+    header = (SharedFrameHeader*)data;
+    if (size < sizeof(SharedFrameHeader) || header->magic.load(std::memory_order_acquire) != kSharedFrameMagic
+        || header->version != kSharedFrameVersion || header->headerSize != sizeof(SharedFrameHeader) || header->totalSize > size)
+    {
+        if (report)
+            fprintf(stderr, "%s: not a shared frame ring of version %d\n", name, kSharedFrameVersion);
+        Close();
+        return false;
+    }
+
+    // The ring belongs to whichever reader sets its PID; one that detached or
+    // died may be replaced, a live one may not
+    uint32_t owner = header->readerPid.load(std::memory_order_relaxed);
+    if ((owner != 0 && IsProcessAlive(owner))
+        || !header->readerPid.compare_exchange_strong(owner, GetOwnProcessId(), std::memory_order_acq_rel))
+    {
+        if (report)
+            fprintf(stderr, "%s: another reader is attached\n", name);
+        Close();
+        return false;
+    }
+    header->readerState.store(kSharedReaderAttached, std::memory_order_release);
+    attached = true;
+    return true;
+}
+
+void SharedFrameReader::Close()
+{
+    if (attached)
+    {
+        header->readerState.store(kSharedReaderDetached, std::memory_order_release);
+        header->readerPid.store(0, std::memory_order_release);
+    }
+#ifdef _WIN32
+    if (header) UnmapViewOfFile(header);
+    if (mappingHandle) CloseHandle(mappingHandle);
+    mappingHandle = nullptr;
+#else
+    if (header) munmap(header, size);
+#endif
+    header = nullptr;
+    size = 0;
+    attached = false;
+    acquired = false;
+}
+
+bool SharedFrameReader::Acquire(SharedFrame& frame, int timeoutMs)
+{
+    if (acquired)
+        Release();
+    // Only this reader moves read
+    uint64_t index = header->read.load(std::memory_order_relaxed);
+    auto begin = std::chrono::high_resolution_clock::now();
+    for (;;)
+    {
+        // Closed is set after the last frame, so once it reads set, written is final
+        bool closed = header->closed.load(std::memory_order_acquire) != 0;
+        if (header->written.load(std::memory_order_acquire) > index)
+            break;
+        if (closed)
+            return false;
+        auto elapsed = std::chrono::high_resolution_clock::now() - begin;
+        if (std::chrono::duration<double, std::milli>(elapsed).count() >= timeoutMs)
+            return false;
+        std::this_thread::sleep_for(std::chrono::microseconds(kSharedFramePollMicroseconds));
+    }
+
+    const uint8_t* slot = GetSlot(header, index);
+    const SharedFrameSlot* info = (const SharedFrameSlot*)slot;
+    frame.pixels = slot + header->pixelOffset;
+    frame.width = int(header->width);
+    frame.height = int(header->height);
+    frame.stride = int(header->stride);
+    frame.frame = info->frame;
+    frame.index = info->index;
+    acquired = true;
+    return true;
+}
+
+void SharedFrameReader::Release()
+{
+    if (!acquired)
+        return;
+    // Release, so the writer only reuses the slot after this reader is done with it
+    header->read.store(header->read.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    acquired = false;
+}
+
+bool SharedFrameReader::IsFinished() const
+{
+    return header && header->closed.load(std::memory_order_acquire)
+        && header->read.load(std::memory_order_relaxed) == header->written.load(std::memory_order_acquire);
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Tonemapped frames in a named shared memory ring, for encoders and checks that
+// run in their own process. One writer and one reader share two counters: the
+// frames written and the frames the reader released. Slot i % slotCount holds
+// frame i, and the writer only reuses a slot once the reader released it, so
+// the reader maps the pixels straight out of the ring and nothing is copied or
+// locked. This file and SharedFrameRing.cpp are all a reader needs to build.
+#define kSharedFrameMagic 0x52465454u // "TTFR"
+#define kSharedFrameVersion 2
+// Slots start on their own pages
+#define kSharedFrameAlignment 4096
+
+// What the writer does with a frame when every slot is still unread
+enum class SharedFrameOverrun
+{
+    // Skips the frame, so rendering never waits on the reader
+    Drop,
+    // Waits for the reader, unless it detached
+    Block
+};
+
+const char* GetSharedFrameOverrunName(SharedFrameOverrun overrun);
+bool FindSharedFrameOverrun(const char* name, SharedFrameOverrun& overrun);
+
+enum SharedFrameReaderState
+{
+    kSharedReaderNone,
+    kSharedReaderAttached,
+    kSharedReaderDetached
+};
+
+struct SharedFrameHeader
+{
+    // Written last, once the rest of the header is valid
+    std::atomic<uint32_t> magic;
+    uint32_t version;
+    uint32_t headerSize;
+    // Pixels are 8 bit sRGB RGBA, rows top-down, stride bytes apart
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint32_t slotCount;
+    uint32_t overrun;
+    // Slot i starts at slotOffset + i * slotSize with its SharedFrameSlot,
+    // and its pixels follow at pixelOffset from there
+    uint64_t slotOffset;
+    uint64_t slotSize;
+    uint64_t pixelOffset;
+    uint64_t totalSize;
+
+    // Each counter on its own cache line, so the writer and the reader do not
+    // invalidate each other's on every frame
+    alignas(64) std::atomic<uint64_t> written;
+    alignas(64) std::atomic<uint64_t> read;
+    alignas(64) std::atomic<uint64_t> dropped;
+    std::atomic<uint32_t> readerState;
+    // Process of the reader that owns the ring, 0 when none. A reader killed
+    // before Close leaves it set, and once that process is gone the writer
+    // stops waiting and another reader may take over.
+    std::atomic<uint32_t> readerPid;
+    // Set by the writer after its last frame
+    std::atomic<uint32_t> closed;
+};
+
+// Precedes the pixels of every slot
+struct SharedFrameSlot
+{
+    // The render's frame number and the slot's index in the stream
+    int64_t frame;
+    uint64_t index;
+};
+
+// A frame in the ring, valid until Release
+struct SharedFrame
+{
+    const uint8_t* pixels;
+    int width, height, stride;
+    int64_t frame;
+    uint64_t index;
+};
+
+// Frames the writer counted as dropped and how long it blocked
+struct SharedFrameStats
+{
+    int frames = 0;
+    int dropped = 0;
+    int waits = 0;
+    double waitSeconds = 0;
+};
+
+class SharedFrameWriter
+{
+public:
+    SharedFrameWriter() {}
+    ~SharedFrameWriter();
+    SharedFrameWriter(const SharedFrameWriter&) = delete;
+    SharedFrameWriter& operator=(const SharedFrameWriter&) = delete;
+
+    // Replaces any ring left under name. Fails, printing why, when it cannot
+    // be created.
+    bool Create(const char* name, int width, int height, int slotCount, SharedFrameOverrun overrun);
+    // Marks the ring closed and removes its name; mapped readers keep it
+    void Close();
+
+    // The pixels of the next slot, or null when the frame is dropped. Fill
+    // them and call EndFrame before the next BeginFrame.
+    uint8_t* BeginFrame();
+    void EndFrame(int64_t frame);
+    int GetStride() const { return header ? int(header->stride) : 0; }
+    const SharedFrameStats& GetStats() const { return stats; }
+
+private:
+    SharedFrameHeader* header = nullptr;
+    uint8_t* slot = nullptr;
+    SharedFrameStats stats;
+    char name[128] = {};
+#ifdef _WIN32
+    void* mappingHandle = nullptr;
+#endif
+};
+
+class SharedFrameReader
+{
+public:
+    SharedFrameReader() {}
+    ~SharedFrameReader();
+    SharedFrameReader(const SharedFrameReader&) = delete;
+    SharedFrameReader& operator=(const SharedFrameReader&) = delete;
+
+    // Fails when there is no ring under name or another live reader is
+    // attached to it, printing why if report is set
+    bool Open(const char* name, bool report = true);
+    void Close();
+
+    // Waits up to timeoutMs for the next frame; false when none came or the
+    // writer closed the ring. The pixels point into the ring and stay
+    // unchanged until Release.
+    bool Acquire(SharedFrame& frame, int timeoutMs);
+    void Release();
+    // The writer closed the ring and every frame in it was read
+    bool IsFinished() const;
+    uint64_t GetDroppedCount() const { return header ? header->dropped.load(std::memory_order_relaxed) : 0; }
+    int GetWidth() const { return header ? int(header->width) : 0; }
+    int GetHeight() const { return header ? int(header->height) : 0; }
+
+private:
+    SharedFrameHeader* header = nullptr;
+    size_t size = 0;
+    bool attached = false;
+    bool acquired = false;
+#ifdef _WIN32
+    void* mappingHandle = nullptr;
+#endif
+};
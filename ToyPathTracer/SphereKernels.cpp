@@ -0,0 +1,114 @@
+#include <string.h>
+
+#include "MathsSIMD.h"
+#include "SphereKernels.h"
+
+#if defined(SIMD_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Separate multiplies and adds, as in HitSphere, even where the target has FMA
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+int IntersectSpheresScalar(const SphereSoAView& spheres, int first, int count, const float3& origin, const float3& dir, float tMin, float tMax, float& tHit)
+{
+    int hitIndex = -1;
+    for (int i = first; i < first + count; ++i)
+    {
+        float3 oc = origin - float3(spheres.centerX[i], spheres.centerY[i], spheres.centerZ[i]);
+        float b = dot(oc, dir);
+        float c = dot(oc, oc) - spheres.radiusSq[i];
+        float discriminant = b * b - c;
+
+        if (discriminant > 0)
+        {
+            float sqrtd = sqrtf(discriminant);
+            float step = -b - sqrtd;
+            if (step <= tMin)
+            {
+                step = -b + sqrtd;
+            }
+            if (step > tMin && step < tMax)
+            {
+                tMax = step;
+                hitIndex = i;
+            }
+        }
+    }
+    tHit = tMax;
+    return hitIndex;
+}
+
+#if defined(SIMD_X86)
+enum class Isa { SSE41, AVX2, AVX512 };
+
+static bool CpuSupports(Isa isa)
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+    __cpuid(info, 1);
+    bool sse41 = (info[2] & (1 << 19)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (isa == Isa::SSE41)
+        return sse41;
+    if (!osxsave || !avx || maxLeaf < 7)
+        return false;
+    unsigned long long xcr0 = _xgetbv(0);
+    __cpuidex(info, 7, 0);
+    if (isa == Isa::AVX2)
+        return (xcr0 & 0x6) == 0x6 && (info[1] & (1 << 5)) != 0;
+    return (xcr0 & 0xE6) == 0xE6 && (info[1] & (1 << 16)) != 0;
+#else
+    __builtin_cpu_init();
+    if (isa == Isa::SSE41)
+        return __builtin_cpu_supports("sse4.1");
+    if (isa == Isa::AVX2)
+        return __builtin_cpu_supports("avx2");
+    return __builtin_cpu_supports("avx512f");
+#endif
+}
+#endif
+
+static const SphereKernels s_ScalarKernels = { "scalar", 1, IntersectSpheresScalar };
+#if defined(SIMD_X86)
+static const SphereKernels s_SSEKernels = { "sse", 4, IntersectSpheresSSE };
+static const SphereKernels s_AVX2Kernels = { "avx2", 8, IntersectSpheresAVX2 };
+static const SphereKernels s_AVX512Kernels = { "avx512", 16, IntersectSpheresAVX512 };
+#endif
+
+const SphereKernels* FindSphereKernels(const char* name)
+{
+    if (!strcmp(name, s_ScalarKernels.name))
+        return &s_ScalarKernels;
+#if defined(SIMD_X86)
+    if (!strcmp(name, s_SSEKernels.name))
+        return CpuSupports(Isa::SSE41) ? &s_SSEKernels : nullptr;
+    if (!strcmp(name, s_AVX2Kernels.name))
+        return CpuSupports(Isa::AVX2) ? &s_AVX2Kernels : nullptr;
+    if (!strcmp(name, s_AVX512Kernels.name))
+        return CpuSupports(Isa::AVX512) ? &s_AVX512Kernels : nullptr;
+#endif
+    return nullptr;
+}
+
+const SphereKernels& GetSphereKernels()
+{
+    static const SphereKernels* s_Kernels = []
+    {
+        const char* names[] = { "avx512", "avx2", "sse" };
+        for (const char* name : names)
+        {
+            if (const SphereKernels* kernels = FindSphereKernels(name))
+                return kernels;
+        }
+        return &s_ScalarKernels;
+    }();
+    return *s_Kernels;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "Maths.h"
+#include "SphereSoA.h"
+
+// Finds the closest sphere in [first, first + count) hit by the ray in
+// (tMin, tMax). Returns its index and writes the distance to tHit, or returns
+// -1. Every variant performs the same float operations in the same order as
+// HitSphere, with contraction into FMA turned off in their files, so all of
+// them agree with the scalar path bit for bit. A build that enables FMA for
+// every file must also pass -ffp-contract=off, or HitSphere itself fuses.
+typedef int (*IntersectSpheresFunc)(const SphereSoAView& spheres, int first, int count, const float3& origin, const float3& dir, float tMin, float tMax, float& tHit);
+
+struct SphereKernels
+{
+    const char* name;
+    int width;
+    IntersectSpheresFunc intersect;
+};
+
+// Widest variant the running CPU supports
+const SphereKernels& GetSphereKernels();
+// "scalar", "sse", "avx2" or "avx512"; nullptr if unknown or unsupported
+const SphereKernels* FindSphereKernels(const char* name);
+
+int IntersectSpheresScalar(const SphereSoAView& spheres, int first, int count, const float3& origin, const float3& dir, float tMin, float tMax, float& tHit);
+int IntersectSpheresSSE(const SphereSoAView& spheres, int first, int count, const float3& origin, const float3& dir, float tMin, float tMax, float& tHit);
+int IntersectSpheresAVX2(const SphereSoAView& spheres, int first, int count, const float3& origin, const float3& dir, float tMin, float tMax, float& tHit);
+int IntersectSpheresAVX512(const SphereSoAView& spheres, int first, int count, const float3& origin, const float3& dir, float tMin, float tMax, float& tHit);
@@ -0,0 +1,67 @@
+#include "MathsSIMD.h"
+#include "SphereKernels.h"
+
+// Separate multiplies and adds, as in HitSphere, even where the target has FMA;
+// the project builds this file with /fp:precise on MSVC
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+#if defined(SIMD_X86)
+SIMD_TARGET_AVX2 int IntersectSpheresAVX2(const SphereSoAView& spheres, int first, int count, const float3& origin, const float3& dir, float tMin, float tMax, float& tHit)
+{
+    float3x8 rayOrigin(origin), rayDir(dir);
+    __m256 minT = _mm256_set1_ps(tMin);
+    __m256 zero = _mm256_setzero_ps();
+    __m256 signMask = _mm256_set1_ps(-0.0f);
+    __m256 bestT = _mm256_set1_ps(tMax);
+    __m256i bestIndex = _mm256_set1_epi32(-1);
+    __m256i laneIndex = _mm256_add_epi32(_mm256_set1_epi32(first), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    __m256i end = _mm256_set1_epi32(first + count);
+
+    for (int i = first; i < first + count; i += 8)
+    {
+        float3x8 oc = rayOrigin - float3x8::load(spheres.centerX + i, spheres.centerY + i, spheres.centerZ + i);
+        __m256 b = dot(oc, rayDir);
+        __m256 c = _mm256_sub_ps(dot(oc, oc), _mm256_loadu_ps(spheres.radiusSq + i));
+        __m256 discriminant = _mm256_sub_ps(_mm256_mul_ps(b, b), c);
+
+        __m256 sqrtd = _mm256_sqrt_ps(discriminant);
+        __m256 negB = _mm256_xor_ps(b, signMask);
+        __m256 step = _mm256_sub_ps(negB, sqrtd);
+        step = _mm256_blendv_ps(step, _mm256_add_ps(negB, sqrtd), _mm256_cmp_ps(step, minT, _CMP_LE_OQ));
+
+        __m256 mask = _mm256_and_ps(_mm256_cmp_ps(discriminant, zero, _CMP_GT_OQ), _mm256_cmp_ps(step, minT, _CMP_GT_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(step, bestT, _CMP_LT_OQ));
+        mask = _mm256_and_ps(mask, _mm256_castsi256_ps(_mm256_cmpgt_epi32(end, laneIndex)));
+        bestT = _mm256_blendv_ps(bestT, step, mask);
+        bestIndex = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(bestIndex), _mm256_castsi256_ps(laneIndex), mask));
+        laneIndex = _mm256_add_epi32(laneIndex, _mm256_set1_epi32(8));
+    }
+
+    alignas(32) float laneT[8];
+    alignas(32) int laneHit[8];
+    _mm256_store_ps(laneT, bestT);
+    _mm256_store_si256((__m256i*)laneHit, bestIndex);
+    int hitIndex = -1;
+    for (int lane = 0; lane < 8; ++lane)
+    {
+        if (laneHit[lane] < 0)
+            continue;
+        if (laneT[lane] < tMax || (laneT[lane] == tMax && laneHit[lane] < hitIndex))
+        {
+            tMax = laneT[lane];
+            hitIndex = laneHit[lane];
+        }
+    }
+    tHit = tMax;
+    return hitIndex;
+}
+#else
+int IntersectSpheresAVX2(const SphereSoAView& spheres, int first, int count, const float3& origin, const float3& dir, float tMin, float tMax, float& tHit)
+{
+    return IntersectSpheresScalar(spheres, first, count, origin, dir, tMin, tMax, tHit);
+}
+#endif
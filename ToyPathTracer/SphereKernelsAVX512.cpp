@@ -0,0 +1,68 @@
+#include "MathsSIMD.h"
+#include "SphereKernels.h"
+
+// Separate multiplies and adds, as in HitSphere, even where the target has FMA;
+// the project builds this file with /fp:precise on MSVC
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+#if defined(SIMD_X86)
+SIMD_TARGET_AVX512 int IntersectSpheresAVX512(const SphereSoAView& spheres, int first, int count, const float3& origin, const float3& dir, float tMin, float tMax, float& tHit)
+{
+    float3x16 rayOrigin(origin), rayDir(dir);
+    __m512 minT = _mm512_set1_ps(tMin);
+    __m512 zero = _mm512_setzero_ps();
+    __m512i signMask = _mm512_set1_epi32(int(0x80000000));
+    __m512 bestT = _mm512_set1_ps(tMax);
+    __m512i bestIndex = _mm512_set1_epi32(-1);
+    __m512i laneIndex = _mm512_add_epi32(_mm512_set1_epi32(first), _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+    __m512i end = _mm512_set1_epi32(first + count);
+
+    for (int i = first; i < first + count; i += 16)
+    {
+        float3x16 oc = rayOrigin - float3x16::load(spheres.centerX + i, spheres.centerY + i, spheres.centerZ + i);
+        __m512 b = dot(oc, rayDir);
+        __m512 c = _mm512_sub_ps(dot(oc, oc), _mm512_loadu_ps(spheres.radiusSq + i));
+        __m512 discriminant = _mm512_sub_ps(_mm512_mul_ps(b, b), c);
+
+        __m512 sqrtd = _mm512_sqrt_ps(discriminant);
+        __m512 negB = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(b), signMask));
+        __m512 step = _mm512_sub_ps(negB, sqrtd);
+        step = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(step, minT, _CMP_LE_OQ), step, _mm512_add_ps(negB, sqrtd));
+
+        __mmask16 mask = _mm512_cmp_ps_mask(discriminant, zero, _CMP_GT_OQ);
+        mask &= _mm512_cmp_ps_mask(step, minT, _CMP_GT_OQ);
+        mask &= _mm512_cmp_ps_mask(step, bestT, _CMP_LT_OQ);
+        mask &= _mm512_cmplt_epi32_mask(laneIndex, end);
+        bestT = _mm512_mask_blend_ps(mask, bestT, step);
+        bestIndex = _mm512_mask_blend_epi32(mask, bestIndex, laneIndex);
+        laneIndex = _mm512_add_epi32(laneIndex, _mm512_set1_epi32(16));
+    }
+
+    alignas(64) float laneT[16];
+    alignas(64) int laneHit[16];
+    _mm512_store_ps(laneT, bestT);
+    _mm512_store_si512(laneHit, bestIndex);
+    int hitIndex = -1;
+    for (int lane = 0; lane < 16; ++lane)
+    {
+        if (laneHit[lane] < 0)
+            continue;
+        if (laneT[lane] < tMax || (laneT[lane] == tMax && laneHit[lane] < hitIndex))
+        {
+            tMax = laneT[lane];
+            hitIndex = laneHit[lane];
+        }
+    }
+    tHit = tMax;
+    return hitIndex;
+}
+#else
+int IntersectSpheresAVX512(const SphereSoAView& spheres, int first, int count, const float3& origin, const float3& dir, float tMin, float tMax, float& tHit)
+{
+    return IntersectSpheresScalar(spheres, first, count, origin, dir, tMin, tMax, tHit);
+}
+#endif
@@ -0,0 +1,69 @@
+#include "MathsSIMD.h"
+#include "SphereKernels.h"
+
+// Separate multiplies and adds, as in HitSphere, even where the target has FMA;
+// the project builds this file with /fp:precise on MSVC
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+#if defined(SIMD_X86)
+SIMD_TARGET_SSE41 int IntersectSpheresSSE(const SphereSoAView& spheres, int first, int count, const float3& origin, const float3& dir, float tMin, float tMax, float& tHit)
+{
+    float3x4 rayOrigin(origin), rayDir(dir);
+    __m128 minT = _mm_set1_ps(tMin);
+    __m128 zero = _mm_setzero_ps();
+    __m128 signMask = _mm_set1_ps(-0.0f);
+    __m128 bestT = _mm_set1_ps(tMax);
+    __m128i bestIndex = _mm_set1_epi32(-1);
+    __m128i laneIndex = _mm_setr_epi32(first, first + 1, first + 2, first + 3);
+    __m128i end = _mm_set1_epi32(first + count);
+
+    for (int i = first; i < first + count; i += 4)
+    {
+        float3x4 oc = rayOrigin - float3x4::load(spheres.centerX + i, spheres.centerY + i, spheres.centerZ + i);
+        __m128 b = dot(oc, rayDir);
+        __m128 c = _mm_sub_ps(dot(oc, oc), _mm_loadu_ps(spheres.radiusSq + i));
+        __m128 discriminant = _mm_sub_ps(_mm_mul_ps(b, b), c);
+
+        __m128 sqrtd = _mm_sqrt_ps(discriminant);
+        __m128 negB = _mm_xor_ps(b, signMask);
+        __m128 step = _mm_sub_ps(negB, sqrtd);
+        step = _mm_blendv_ps(step, _mm_add_ps(negB, sqrtd), _mm_cmple_ps(step, minT));
+
+        __m128 mask = _mm_and_ps(_mm_cmpgt_ps(discriminant, zero), _mm_cmpgt_ps(step, minT));
+        mask = _mm_and_ps(mask, _mm_cmplt_ps(step, bestT));
+        mask = _mm_and_ps(mask, _mm_castsi128_ps(_mm_cmplt_epi32(laneIndex, end)));
+        bestT = _mm_blendv_ps(bestT, step, mask);
+        bestIndex = _mm_castps_si128(_mm_blendv_ps(_mm_castsi128_ps(bestIndex), _mm_castsi128_ps(laneIndex), mask));
+        laneIndex = _mm_add_epi32(laneIndex, _mm_set1_epi32(4));
+    }
+
+    // Each lane kept its earliest closest hit, pick the closest lane and
+    // break ties towards the lower index like the sequential loop would
+    alignas(16) float laneT[4];
+    alignas(16) int laneHit[4];
+    _mm_store_ps(laneT, bestT);
+    _mm_store_si128((__m128i*)laneHit, bestIndex);
+    int hitIndex = -1;
+    for (int lane = 0; lane < 4; ++lane)
+    {
+        if (laneHit[lane] < 0)
+            continue;
+        if (laneT[lane] < tMax || (laneT[lane] == tMax && laneHit[lane] < hitIndex))
+        {
+            tMax = laneT[lane];
+            hitIndex = laneHit[lane];
+        }
+    }
+    tHit = tMax;
+    return hitIndex;
+}
+#else
+int IntersectSpheresSSE(const SphereSoAView& spheres, int first, int count, const float3& origin, const float3& dir, float tMin, float tMax, float& tHit)
+{
+    return IntersectSpheresScalar(spheres, first, count, origin, dir, tMin, tMax, tHit);
+}
+#endif
@@ -0,0 +1,48 @@
+#include "SphereSoA.h"
+
+void SphereSoA::Build(const Sphere* spheres, const uint32_t* order, int count)
+{
+    size_t size = size_t(count) + kSphereSoAPadding;
+    centerX.assign(size, 0.0f);
+    centerY.assign(size, 0.0f);
+    centerZ.assign(size, 0.0f);
+    // A negative squared radius keeps the discriminant below zero
+    radiusSq.assign(size, -1.0f);
+    radius.assign(size, 1.0f);
+    material.assign(size, 0);
+
+    Update(spheres, order, 0, count);
+}
+
+void SphereSoA::Update(const Sphere* spheres, const uint32_t* order, int first, int count)
+{
+    for (int i = first; i < first + count; ++i)
+    {
+        const Sphere& sphere = spheres[order ? order[i] : i];
+        centerX[i] = sphere.center.x;
+        centerY[i] = sphere.center.y;
+        centerZ[i] = sphere.center.z;
+        radiusSq[i] = sphere.radius * sphere.radius;
+        radius[i] = sphere.radius;
+        material[i] = sphere.material;
+    }
+}
+
+SphereSoAView SphereSoA::GetView() const
+{
+    SphereSoAView view;
+    view.centerX = centerX.data();
+    view.centerY = centerY.data();
+    view.centerZ = centerZ.data();
+    view.radiusSq = radiusSq.data();
+    view.radius = radius.data();
+    view.material = material.data();
+    view.count = radius.empty() ? 0 : int(radius.size()) - kSphereSoAPadding;
+    return view;
+}
+
+size_t SphereSoA::GetMemorySize() const
+{
+    return (centerX.capacity() + centerY.capacity() + centerZ.capacity() + radiusSq.capacity() + radius.capacity()) * sizeof(float)
+        + material.capacity() * sizeof(int);
+}
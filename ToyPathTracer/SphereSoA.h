@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "Maths.h"
+#include "SharedDataStruct.h"
+
+// Every array is padded by this many entries that can never be hit, so the
+// SIMD kernels can load a full register past the end of a leaf
+#define kSphereSoAPadding 16
+
+// Sphere geometry split by component in BVH leaf order. centerX/Y/Z and
+// radiusSq are all the intersection kernels read; radius and material are only
+// touched for the closest hit.
+struct SphereSoAView
+{
+    const float* centerX;
+    const float* centerY;
+    const float* centerZ;
+    const float* radiusSq;
+    const float* radius;
+    const int* material;
+    int count;
+};
+
+class SphereSoA
+{
+public:
+    void Build(const Sphere* spheres, const uint32_t* order, int count);
+    // Rewrites entries [first, first + count) in place, for spheres that
+    // changed without changing the order
+    void Update(const Sphere* spheres, const uint32_t* order, int first, int count);
+    SphereSoAView GetView() const;
+    size_t GetMemorySize() const;
+
+private:
+    std::vector<float> centerX, centerY, centerZ, radiusSq;
+    std::vector<float> radius;
+    std::vector<int> material;
+};
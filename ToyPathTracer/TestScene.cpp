@@ -1,4 +1,52 @@
+#include <assert.h>
+
 #include "TestScene.h"
+#include "Profiler.h"
+#include "SphereKernels.h"
+#include "ThreadPool.h"
+
+#define kMaxDirtyRanges 16
+// Refits may make the sphere BVH this much more costly than it was when built
+// before a new one is built in the background
+#define kRebuildCostRatio 1.5f
+// Spheres per task of a parallel SoA update
+#define kSoAUpdateBlock 4096
+
+void DirtyRanges::Add(int first, int count)
+{
+    if (count <= 0)
+        return;
+    Range range = { first, first + count };
+
+    // Merge with every range it overlaps or touches, keeping the list sorted
+    size_t i = 0;
+    while (i < ranges.size() && ranges[i].end < range.begin)
+        ++i;
+    size_t j = i;
+    while (j < ranges.size() && ranges[j].begin <= range.end)
+    {
+        range.begin = range.begin < ranges[j].begin ? range.begin : ranges[j].begin;
+        range.end = range.end > ranges[j].end ? range.end : ranges[j].end;
+        ++j;
+    }
+    ranges.erase(ranges.begin() + i, ranges.begin() + j);
+    ranges.insert(ranges.begin() + i, range);
+
+    if (ranges.size() > kMaxDirtyRanges)
+    {
+        Range all = { ranges.front().begin, ranges.back().end };
+        ranges.clear();
+        ranges.push_back(all);
+    }
+}
+
+void DirtyRanges::Truncate(int count)
+{
+    while (!ranges.empty() && ranges.back().begin >= count)
+        ranges.pop_back();
+    if (!ranges.empty() && ranges.back().end > count)
+        ranges.back().end = count;
+}
 
 TestScene::TestScene()
 {
@@ -13,51 +61,361 @@ TestScene::TestScene()
 	//materials.push_back({ 2, float3(0, 0, 0), 0, 1.5 });
 	//materials.push_back({ 1, float3(0.8, 0.6, 0.2), 0 });
 
-    int id = 0;
-    for (int i = -11; i < 11; ++i)
+    GenerateScene(SceneDesc(), spheres, materials);
+    Build();
+}
+
+TestScene::TestScene(const SceneDesc& desc)
+{
+    std::vector<Sphere> prototype;
+    GenerateScene(desc, spheres, materials, prototype, instances);
+    if (!prototype.empty())
+        AddPrototype(prototype.data(), int(prototype.size()));
+    Build();
+}
+
+TestScene::TestScene(std::vector<Sphere>&& spheres_, std::vector<Material>&& materials_)
+    : spheres(std::move(spheres_)), materials(std::move(materials_))
+{
+    Build();
+}
+
+TestScene::TestScene(std::vector<Sphere>&& spheres_, std::vector<Material>&& materials_, const std::vector<Sphere>& prototype,
+                     std::vector<Instance>&& instances_)
+    : spheres(std::move(spheres_)), materials(std::move(materials_)), instances(std::move(instances_))
+{
+    if (!prototype.empty())
+        AddPrototype(prototype.data(), int(prototype.size()));
+    Build();
+}
+
+TestScene::~TestScene()
+{
+    if (rebuildThread.joinable())
+        rebuildThread.join();
+}
+
+void TestScene::Build()
+{
+    bvh.Build(spheres.data(), int(spheres.size()));
+    bvhCost = builtCost = bvh.GetCost();
+    sphereSoA.Build(spheres.data(), bvh.GetIndices().data(), int(spheres.size()));
+    lightTree.Build(spheres.data(), int(spheres.size()), materials.data(), GetMaterialTypes(materials.data(), int(materials.size())));
+    BuildInstances();
+
+    changes.spheres.Add(0, int(spheres.size()));
+    changes.materials.Add(0, int(materials.size()));
+    changes.bvh = true;
+}
+
+static float3 Abs(const float3& v)
+{
+    return float3(fabsf(v.x), fabsf(v.y), fabsf(v.z));
+}
+
+void TestScene::BuildInstances()
+{
+    // World box of each instance: its prototype's root box turned and scaled
+    std::vector<float3> boundsMin(instances.size()), boundsMax(instances.size());
+    for (size_t i = 0; i < instances.size(); ++i)
     {
-        for (int j = -11; j < 11; ++j)
-        {
-            auto index = random();
-            float3 center(i + 0.9 * random(), 0.2, j + 0.9 * random());
+        const Instance& instance = instances[i];
+        const BVHNode& root = prototypeNodes[prototypeRoots[instance.prototype]];
+        float3 center = (root.boundsMin + root.boundsMax) * 0.5f;
+        float3 extent = (root.boundsMax - root.boundsMin) * 0.5f;
+        float3 worldCenter = instance.translation
+            + instance.scale * (center.x * instance.axisX + center.y * instance.axisY + center.z * instance.axisZ);
+        float3 worldExtent = instance.scale * (extent.x * Abs(instance.axisX) + extent.y * Abs(instance.axisY) + extent.z * Abs(instance.axisZ));
+        boundsMin[i] = worldCenter - worldExtent;
+        boundsMax[i] = worldCenter + worldExtent;
+    }
+    instanceBVH.Build(boundsMin.data(), boundsMax.data(), int(instances.size()));
+    instancesDirty = false;
+}
+
+SceneView TestScene::GetView() const
+{
+    SceneView view = {};
+    view.spheres = spheres.data();
+    view.sphereCount = int(spheres.size());
+    view.materials = materials.data();
+    view.materialCount = int(materials.size());
+    view.nodes = bvh.GetNodes().data();
+    view.nodeCount = bvh.GetNodeSize();
+    view.indices = bvh.GetIndices().data();
+    view.soa = sphereSoA.GetView();
+    view.kernels = &GetSphereKernels();
+    view.materialTypes = GetMaterialTypes(materials.data(), int(materials.size()));
+    view.instances = instances.data();
+    view.instanceCount = int(instances.size());
+    view.instanceNodes = instanceBVH.GetNodes().data();
+    view.instanceNodeCount = instanceBVH.GetNodeSize();
+    view.instanceIndices = instanceBVH.GetIndices().data();
+    view.prototypeNodes = prototypeNodes.data();
+    view.prototypeNodeCount = int(prototypeNodes.size());
+    view.prototypeRoots = prototypeRoots.data();
+    view.prototypeCount = int(prototypeRoots.size());
+    view.prototypeSoa = prototypeSoA.GetView();
+    view.lights = lightTree.GetLights().data();
+    view.lightCount = lightTree.GetSize();
+    view.lightNodes = lightTree.GetNodes().data();
+    view.sphereLights = lightTree.GetSphereLights().data();
+    return view;
+}
+
+int64_t TestScene::GetInstancedSphereCount() const
+{
+    int64_t count = 0;
+    for (const Instance& instance : instances)
+        count += prototypeSizes[instance.prototype];
+    return count;
+}
 
-            if (length(center - float3(4, 0.2, 0)) > 0.9)
+size_t TestScene::GetMemorySize() const
+{
+    return spheres.capacity() * sizeof(Sphere) + materials.capacity() * sizeof(Material)
+        + bvh.GetMemorySize() + sphereSoA.GetMemorySize()
+        + prototypeSpheres.capacity() * sizeof(Sphere) + prototypeNodes.capacity() * sizeof(BVHNode)
+        + (prototypeRoots.capacity() + prototypeSizes.capacity()) * sizeof(int) + prototypeSoA.GetMemorySize()
+        + instances.capacity() * sizeof(Instance) + instanceBVH.GetMemorySize() + lightTree.GetMemorySize();
+}
+
+int TestScene::AddSphere(const Sphere& sphere)
+{
+    spheres.push_back(sphere);
+    changes.spheres.Add(int(spheres.size()) - 1);
+    geometryDirty = true;
+    return int(spheres.size()) - 1;
+}
+
+void TestScene::SetSphere(int index, const Sphere& sphere)
+{
+    assert(index >= 0 && index < int(spheres.size()));
+    Sphere& current = spheres[index];
+    if (current.center.x != sphere.center.x || current.center.y != sphere.center.y || current.center.z != sphere.center.z
+        || current.radius != sphere.radius)
+        boundsDirty = true;
+    else if (current.material != sphere.material)
+        sphereMaterialDirty = true;
+    else
+        return;
+    current = sphere;
+    changes.spheres.Add(index);
+}
+
+void TestScene::RemoveSphere(int index)
+{
+    assert(index >= 0 && index < int(spheres.size()));
+    int last = int(spheres.size()) - 1;
+    if (index != last)
+    {
+        spheres[index] = spheres[last];
+        changes.spheres.Add(index);
+    }
+    spheres.pop_back();
+    changes.spheres.Truncate(last);
+    geometryDirty = true;
+}
+
+int TestScene::AddMaterial(const Material& material)
+{
+    materials.push_back(material);
+    changes.materials.Add(int(materials.size()) - 1);
+    return int(materials.size()) - 1;
+}
+
+void TestScene::SetMaterial(int index, const Material& material)
+{
+    assert(index >= 0 && index < int(materials.size()));
+    materials[index] = material;
+    changes.materials.Add(index);
+    materialsDirty = true;
+}
+
+bool TestScene::RemoveMaterial(int index)
+{
+    assert(index >= 0 && index < int(materials.size()));
+    for (const Sphere& sphere : spheres)
+    {
+        if (sphere.material == index)
+            return false;
+    }
+    for (const Sphere& sphere : prototypeSpheres)
+    {
+        if (sphere.material == index)
+            return false;
+    }
+    for (const Instance& instance : instances)
+    {
+        if (instance.materialOverride == index)
+            return false;
+    }
+
+    int last = int(materials.size()) - 1;
+    if (index != last)
+    {
+        materials[index] = materials[last];
+        changes.materials.Add(index);
+        for (int i = 0; i < int(spheres.size()); ++i)
+        {
+            if (spheres[i].material == last)
             {
-                if (index < 0.8)
-                {   // diffuse
-                    float3 albedo = randomFloat3() * randomFloat3();
-                    materials.push_back({ 0, albedo });
-                }
-                else if (index < 0.95)
-                {   // metal
-                    float3 albedo = randomFloat3() * 0.5 + 0.5;
-                    float fuzz = random() * 0.5;
-                    materials.push_back({ 1, albedo, fuzz });
-                }
-                else
-                {   // glass
-                    materials.push_back({ 2, float3(0, 0, 0), 0, 1.5 });
-                }
-                spheres.push_back({ id++, center, 0.2 });
+                spheres[i].material = index;
+                changes.spheres.Add(i);
+                sphereMaterialDirty = true;
             }
         }
+        bool prototypeMaterialDirty = false;
+        for (Sphere& sphere : prototypeSpheres)
+        {
+            if (sphere.material == last)
+            {
+                sphere.material = index;
+                prototypeMaterialDirty = true;
+            }
+        }
+        if (prototypeMaterialDirty)
+            prototypeSoA.Build(prototypeSpheres.data(), nullptr, int(prototypeSpheres.size()));
+        for (Instance& instance : instances)
+        {
+            if (instance.materialOverride == last)
+                instance.materialOverride = index;
+        }
     }
+    materials.pop_back();
+    changes.materials.Truncate(last);
+    materialsDirty = true;
+    return true;
+}
+
+int TestScene::AddPrototype(const Sphere* prototype, int count)
+{
+    assert(count > 0);
+    BVH prototypeBVH;
+    prototypeBVH.Build(prototype, count);
+    int nodeBase = int(prototypeNodes.size());
+    int sphereBase = int(prototypeSpheres.size());
+    for (BVHNode node : prototypeBVH.GetNodes())
+    {
+        node.leftFirst += node.count > 0 ? sphereBase : nodeBase;
+        prototypeNodes.push_back(node);
+    }
+    for (uint32_t index : prototypeBVH.GetIndices())
+        prototypeSpheres.push_back(prototype[index]);
+    prototypeSoA.Build(prototypeSpheres.data(), nullptr, int(prototypeSpheres.size()));
+    prototypeRoots.push_back(nodeBase);
+    prototypeSizes.push_back(count);
+    return int(prototypeRoots.size()) - 1;
+}
+
+int TestScene::AddInstance(const Instance& instance)
+{
+    assert(instance.prototype >= 0 && instance.prototype < int(prototypeRoots.size()));
+    instances.push_back(instance);
+    instancesDirty = true;
+    return int(instances.size()) - 1;
+}
 
-    materials.push_back({ 0, float3(0.5, 0.5, 0.5) });
-	spheres.push_back({ id++, float3(0, -1000, 0), 1000 });
-	
-    materials.push_back({ 2, float3(0, 0, 0), 0, 1.5 });
-    spheres.push_back({ id++, float3(0, 1, 0), 1 });
-    
-    materials.push_back({ 0, float3(0.4, 0.2, 0.1) });
-    spheres.push_back({ id++, float3(-4, 1, 0), 1 });
-    
-    materials.push_back({ 1, float3(0.7, 0.6, 0.5), 0 });
-    spheres.push_back({ id++, float3(4, 1, 0), 1 });
+void TestScene::SetInstance(int index, const Instance& instance)
+{
+    assert(index >= 0 && index < int(instances.size()));
+    instances[index] = instance;
+    instancesDirty = true;
+}
+
+void TestScene::StartRebuild()
+{
+    rebuildDone = false;
+    std::vector<Sphere> snapshot = spheres;
+    rebuildThread = std::thread([this, snapshot]()
+    {
+        rebuiltBVH.Build(snapshot.data(), int(snapshot.size()));
+        rebuildDone = true;
+    });
+}
+
+bool TestScene::FinishRebuild(bool wait)
+{
+    if (!rebuildThread.joinable() || (!wait && !rebuildDone))
+        return false;
+    rebuildThread.join();
+    return true;
+}
+
+void TestScene::Commit(ThreadPool* pool)
+{
+    if (geometryDirty)
+    {
+        // Spheres came or went, so a tree still being built for the old ones
+        // is of no use
+        FinishRebuild(true);
+        bvh.Build(spheres.data(), int(spheres.size()));
+        bvhCost = builtCost = bvh.GetCost();
+        changes.bvh = true;
+    }
+    else
+    {
+        // The tree built in the background is for where the spheres were when
+        // it started, so it gets the same refit as the current one
+        bool rebuilt = FinishRebuild(false);
+        if (rebuilt)
+        {
+            std::swap(bvh, rebuiltBVH);
+            ++backgroundRebuilds;
+            changes.bvh = true;
+        }
+        if (rebuilt || boundsDirty)
+        {
+            PROFILE_SCOPE(kZoneRefit);
+            bvh.Refit(spheres.data(), pool);
+            bvhCost = bvh.GetCost();
+            if (rebuilt)
+                builtCost = bvhCost;
+            changes.bvhBounds = true;
+        }
+        if (!rebuilt && boundsDirty && bvhCost > builtCost * kRebuildCostRatio && !rebuildThread.joinable())
+            StartRebuild();
+    }
+
+    // The SoA copy holds sphere materials too, in BVH order, so a new order
+    // rewrites it whole and anything else in place
+    if (geometryDirty || changes.bvh)
+    {
+        sphereSoA.Build(spheres.data(), bvh.GetIndices().data(), int(spheres.size()));
+    }
+    else if (boundsDirty || sphereMaterialDirty)
+    {
+        int count = int(spheres.size());
+        int blocks = (count + kSoAUpdateBlock - 1) / kSoAUpdateBlock;
+        auto update = [&](int block, int)
+        {
+            int first = block * kSoAUpdateBlock;
+            sphereSoA.Update(spheres.data(), bvh.GetIndices().data(), first, count - first < kSoAUpdateBlock ? count - first : kSoAUpdateBlock);
+        };
+        if (pool)
+        {
+            pool->ParallelFor(blocks, update);
+        }
+        else
+        {
+            for (int block = 0; block < blocks; ++block)
+                update(block, 0);
+        }
+    }
+    if (instancesDirty)
+        BuildInstances();
+    if (geometryDirty || boundsDirty || sphereMaterialDirty || materialsDirty)
+        lightTree.Build(spheres.data(), int(spheres.size()), materials.data(), GetMaterialTypes(materials.data(), int(materials.size())));
+    geometryDirty = false;
+    sphereMaterialDirty = false;
+    boundsDirty = false;
+    materialsDirty = false;
 }
 
-void TestScene::GetData(void* dataSpheres, void* dataMaterials)
+void TestScene::ClearChanges()
 {
-	memcpy(dataSpheres, &spheres[0], spheres.size() * sizeof(Sphere));
-	memcpy(dataMaterials, &materials[0], materials.size() * sizeof(Material));
+    changes.spheres.Clear();
+    changes.materials.Clear();
+    changes.bvh = false;
+    changes.bvhBounds = false;
 }
@@ -1,19 +1,150 @@
 #pragma once
 
+#include <atomic>
+#include <thread>
 #include<vector>
 
 #include "Maths.h"
 #include "SharedDataStruct.h"
+#include "SceneView.h"
+#include "BVH.h"
+#include "LightTree.h"
+#include "SphereSoA.h"
+#include "SceneGenerator.h"
+
+class ThreadPool;
+
+// Sorted, disjoint [begin, end) element ranges that were modified. Past
+// kMaxDirtyRanges entries everything collapses into one covering range.
+class DirtyRanges
+{
+public:
+    struct Range
+    {
+        int begin;
+        int end;
+    };
+
+    void Add(int first, int count = 1);
+    // Drops whatever lies at or past count
+    void Truncate(int count);
+    void Clear() { ranges.clear(); }
+    bool IsEmpty() const { return ranges.empty(); }
+    const std::vector<Range>& GetRanges() const { return ranges; }
+
+private:
+    std::vector<Range> ranges;
+};
+
+// Everything that changed since the last ClearChanges, so renderers can copy
+// just those bytes. A new scene starts with everything dirty.
+struct SceneChanges
+{
+    DirtyRanges spheres;
+    DirtyRanges materials;
+    // The BVH nodes and indices were rebuilt and have to be copied whole
+    bool bvh = false;
+    // A refit moved the node bounds; the indices stay the same
+    bool bvhBounds = false;
+
+    bool IsEmpty() const { return spheres.IsEmpty() && materials.IsEmpty() && !bvh && !bvhBounds; }
+};
 
 class TestScene
 {
 public:
     TestScene();
+    explicit TestScene(const SceneDesc& desc);
+    // Takes already generated data, so callers can time the generation and the
+    // acceleration structure build separately
+    TestScene(std::vector<Sphere>&& spheres, std::vector<Material>&& materials);
+    // Same plus instances of one prototype cluster, which becomes prototype 0
+    TestScene(std::vector<Sphere>&& spheres, std::vector<Material>&& materials, const std::vector<Sphere>& prototype,
+              std::vector<Instance>&& instances);
+    ~TestScene();
+    TestScene(const TestScene&) = delete;
+    TestScene& operator=(const TestScene&) = delete;
     int GetSphereSize() { return spheres.size(); }
     int GetMaterialSize() { return materials.size(); }
-    void GetData(void* spheres, void* materials);
+    const std::vector<Sphere>& GetSpheres() const { return spheres; }
+    const std::vector<Material>& GetMaterials() const { return materials; }
+    const BVH& GetBVH() const { return bvh; }
+    int GetInstanceSize() const { return int(instances.size()); }
+    const std::vector<Instance>& GetInstances() const { return instances; }
+    const BVH& GetInstanceBVH() const { return instanceBVH; }
+    // Spheres placed by all the instances together
+    int64_t GetInstancedSphereCount() const;
+    SceneView GetView() const;
+    // Bytes held by the scene data and acceleration structures
+    size_t GetMemorySize() const;
+
+    // Edits. Removing swaps the last element into the freed index. The BVH and
+    // SoA data only follow after Commit, so a batch of edits rebuilds them once.
+    // Adding or removing spheres rebuilds the BVH; spheres that only moved or
+    // changed size, as in an animation, get it refit instead.
+    int AddSphere(const Sphere& sphere);
+    void SetSphere(int index, const Sphere& sphere);
+    void RemoveSphere(int index);
+    int AddMaterial(const Material& material);
+    void SetMaterial(int index, const Material& material);
+    // Fails while a sphere still uses the material
+    bool RemoveMaterial(int index);
+    // Instancing. A prototype is a cluster of spheres with a BVH of its own
+    // that instances place any number of times, so only the instances and the
+    // top-level BVH over them grow with the scene. That BVH follows the
+    // instances after Commit like the sphere one.
+    int AddPrototype(const Sphere* spheres, int count);
+    int AddInstance(const Instance& instance);
+    void SetInstance(int index, const Instance& instance);
+    // Brings the BVHs, SoA data and lights up to date, refitting on pool when given.
+    // Once refits have made the sphere BVH kRebuildCostRatio times as costly
+    // as when it was built, a new one is built from a copy of the spheres on a
+    // background thread, and a later Commit swaps it in and refits it to the
+    // spheres as they are by then. Views taken before a Commit are stale.
+    void Commit(ThreadPool* pool = nullptr);
+    // SAH cost of the sphere BVH as of the last Commit, see BVH::GetCost
+    float GetBVHCost() const { return bvhCost; }
+    // BVHs built in the background and swapped in so far
+    int GetBackgroundRebuildCount() const { return backgroundRebuilds; }
+
+    const SceneChanges& GetChanges() const { return changes; }
+    void ClearChanges();
 
 private:
+    void Build();
+    void BuildInstances();
+    void StartRebuild();
+    // Joins the background rebuild if it is done, or always with wait; true
+    // when its BVH is in rebuiltBVH
+    bool FinishRebuild(bool wait);
+
     std::vector<Sphere> spheres;
     std::vector<Material> materials;
+    BVH bvh;
+    SphereSoA sphereSoA;
+    LightTree lightTree;
+
+    // Every prototype's spheres in the leaf order of its BVH, which is appended
+    // to prototypeNodes with the node and sphere indices offset to match
+    std::vector<Sphere> prototypeSpheres;
+    std::vector<BVHNode> prototypeNodes;
+    std::vector<int> prototypeRoots;
+    std::vector<int> prototypeSizes;
+    SphereSoA prototypeSoA;
+    std::vector<Instance> instances;
+    BVH instanceBVH;
+
+    SceneChanges changes;
+    bool geometryDirty = false;
+    bool sphereMaterialDirty = false;
+    bool instancesDirty = false;
+    bool boundsDirty = false;
+    bool materialsDirty = false;
+
+    float bvhCost = 0;
+    float builtCost = 0;
+    std::thread rebuildThread;
+    std::atomic<bool> rebuildDone{ false };
+    BVH rebuiltBVH;
+    int backgroundRebuilds = 0;
 };
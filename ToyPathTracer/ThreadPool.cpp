@@ -0,0 +1,200 @@
+#include <algorithm>
+
+#include "Numa.h"
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(int threadCount, bool pin)
+{
+    if (threadCount <= 0)
+        threadCount = int(std::thread::hardware_concurrency());
+    if (threadCount <= 0)
+        threadCount = 1;
+
+    std::vector<int> cpus;
+    if (pin)
+    {
+        // Node after node, wrapping around when there are more threads than
+        // processors
+        std::vector<int> order;
+        for (const std::vector<int>& node : GetNumaNodes())
+            order.insert(order.end(), node.begin(), node.end());
+        for (int i = 0; i < threadCount; ++i)
+            cpus.push_back(order[i % order.size()]);
+    }
+    Start(threadCount, cpus);
+}
+
+ThreadPool::ThreadPool(const std::vector<int>& cpus)
+{
+    Start(cpus.empty() ? 1 : int(cpus.size()), cpus);
+}
+
+void ThreadPool::Start(int threadCount, const std::vector<int>& cpus)
+{
+    threadCpus = cpus;
+    threadNodes.assign(threadCount, 0);
+    if (!cpus.empty())
+    {
+        std::vector<std::vector<int>> nodes = GetNumaNodes();
+        std::vector<int> nodeIndices(nodes.size(), -1);
+        nodeCount = 0;
+        for (int i = 0; i < threadCount; ++i)
+        {
+            int node = 0;
+            for (size_t n = 0; n < nodes.size(); ++n)
+            {
+                if (std::find(nodes[n].begin(), nodes[n].end(), cpus[i]) != nodes[n].end())
+                    node = int(n);
+            }
+            if (nodeIndices[node] < 0)
+                nodeIndices[node] = nodeCount++;
+            threadNodes[i] = nodeIndices[node];
+        }
+    }
+
+    queues.reset(new WorkQueue[threadCount]);
+    for (int i = 1; i < threadCount; ++i)
+        workers.emplace_back(&ThreadPool::WorkerMain, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(jobLock);
+        quit = true;
+    }
+    jobStart.notify_all();
+    for (auto& worker : workers)
+        worker.join();
+}
+
+void ThreadPool::ParallelFor(int count, const std::function<void(int, int)>& task)
+{
+    if (count <= 0)
+        return;
+
+    // Workers are idle here, so the queues can be filled without locking
+    for (int i = 0; i < GetThreadCount(); ++i)
+        GetThreadRange(count, i, queues[i].begin, queues[i].end);
+    stealing = true;
+    Run(task);
+}
+
+void ThreadPool::RunOnEveryThread(const std::function<void(int)>& task)
+{
+    for (int i = 0; i < GetThreadCount(); ++i)
+    {
+        queues[i].begin = i;
+        queues[i].end = i + 1;
+    }
+    stealing = false;
+    Run([&](int index, int threadIndex) { task(threadIndex); });
+}
+
+void ThreadPool::GetThreadRange(int count, int threadIndex, int& begin, int& end) const
+{
+    int threads = GetThreadCount();
+    begin = int((long long)count * threadIndex / threads);
+    end = int((long long)count * (threadIndex + 1) / threads);
+}
+
+void ThreadPool::Run(const std::function<void(int, int)>& task)
+{
+    std::vector<int> callerCpus;
+    if (!threadCpus.empty())
+    {
+        callerCpus = GetThreadCpus();
+        PinThread(threadCpus[0]);
+    }
+    {
+        std::lock_guard<std::mutex> lock(jobLock);
+        job = &task;
+        activeWorkers = int(workers.size());
+        ++jobGeneration;
+    }
+    jobStart.notify_all();
+
+    RunTasks(0);
+
+    std::unique_lock<std::mutex> lock(jobLock);
+    jobDone.wait(lock, [this] { return activeWorkers == 0; });
+    job = nullptr;
+    lock.unlock();
+    if (!threadCpus.empty())
+        SetThreadCpus(callerCpus);
+}
+
+void ThreadPool::WorkerMain(int threadIndex)
+{
+    if (!threadCpus.empty())
+        PinThread(threadCpus[threadIndex]);
+
+    unsigned long long seenGeneration = 0;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(jobLock);
+            jobStart.wait(lock, [&] { return quit || jobGeneration != seenGeneration; });
+            if (quit)
+                return;
+            seenGeneration = jobGeneration;
+        }
+
+        RunTasks(threadIndex);
+
+        std::lock_guard<std::mutex> lock(jobLock);
+        if (--activeWorkers == 0)
+            jobDone.notify_one();
+    }
+}
+
+void ThreadPool::RunTasks(int threadIndex)
+{
+    int index;
+    while (PopLocal(threadIndex, index) || (stealing && Steal(threadIndex, index)))
+        (*job)(index, threadIndex);
+}
+
+bool ThreadPool::PopLocal(int threadIndex, int& index)
+{
+    WorkQueue& queue = queues[threadIndex];
+    std::lock_guard<std::mutex> lock(queue.lock);
+    if (queue.begin >= queue.end)
+        return false;
+    index = queue.begin++;
+    return true;
+}
+
+bool ThreadPool::Steal(int threadIndex, int& index)
+{
+    // The first round visits the threads of the same node, the second the others
+    int threads = GetThreadCount();
+    int node = threadNodes[threadIndex];
+    for (int i = 1; i < threads * 2; ++i)
+    {
+        int victimIndex = (threadIndex + i) % threads;
+        bool sameNode = threadNodes[victimIndex] == node;
+        if (victimIndex == threadIndex || sameNode != (i < threads))
+            continue;
+        WorkQueue& victim = queues[victimIndex];
+        int begin, end;
+        {
+            std::lock_guard<std::mutex> lock(victim.lock);
+            int available = victim.end - victim.begin;
+            if (available <= 0)
+                continue;
+            // Take the back half, leaving the victim the part it is about to touch
+            begin = victim.end - (available + 1) / 2;
+            end = victim.end;
+            victim.end = begin;
+        }
+
+        WorkQueue& queue = queues[threadIndex];
+        std::lock_guard<std::mutex> lock(queue.lock);
+        index = begin;
+        queue.begin = begin + 1;
+        queue.end = end;
+        return true;
+    }
+    return false;
+}
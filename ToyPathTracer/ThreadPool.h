@@ -0,0 +1,71 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent worker threads that split a ParallelFor range into one contiguous
+// block per thread. A thread that runs out of work steals half of the remaining
+// block of another thread, so uneven tiles balance out without a shared queue.
+// Pinned pools fill the NUMA nodes one after the other, so the threads of a
+// node are consecutive, and steal from their own node first.
+class ThreadPool
+{
+public:
+    // pin puts every thread on a logical processor of its own. The thread
+    // calling ParallelFor runs on the first only until the call returns, so
+    // it and the threads it starts keep the processors they had.
+    explicit ThreadPool(int threadCount = 0, bool pin = false);
+    // One thread pinned to each of cpus, in that order
+    explicit ThreadPool(const std::vector<int>& cpus);
+    ~ThreadPool();
+
+    int GetThreadCount() const { return int(workers.size()) + 1; }
+    bool IsPinned() const { return !threadCpus.empty(); }
+    // NUMA nodes the threads are on, numbered from 0 in the order they fill
+    // up; always 1 for pools that are not pinned
+    int GetNodeCount() const { return nodeCount; }
+    int GetThreadNode(int threadIndex) const { return threadNodes[threadIndex]; }
+
+    // Runs task(index, threadIndex) for every index in [0, count). The calling
+    // thread takes part as thread 0; returns once every index has run.
+    void ParallelFor(int count, const std::function<void(int, int)>& task);
+    // Runs task(threadIndex) once on every thread
+    void RunOnEveryThread(const std::function<void(int)>& task);
+    // The block of [0, count) a ParallelFor starts threadIndex on
+    void GetThreadRange(int count, int threadIndex, int& begin, int& end) const;
+
+private:
+    struct alignas(64) WorkQueue
+    {
+        std::mutex lock;
+        int begin = 0;
+        int end = 0;
+    };
+
+    void Start(int threadCount, const std::vector<int>& cpus);
+    void Run(const std::function<void(int, int)>& task);
+    void WorkerMain(int threadIndex);
+    void RunTasks(int threadIndex);
+    bool PopLocal(int threadIndex, int& index);
+    bool Steal(int threadIndex, int& index);
+
+    std::vector<std::thread> workers;
+    std::unique_ptr<WorkQueue[]> queues;
+    // Processor of each thread, empty when not pinned
+    std::vector<int> threadCpus;
+    std::vector<int> threadNodes;
+    int nodeCount = 1;
+
+    std::mutex jobLock;
+    std::condition_variable jobStart;
+    std::condition_variable jobDone;
+    const std::function<void(int, int)>* job = nullptr;
+    unsigned long long jobGeneration = 0;
+    int activeWorkers = 0;
+    bool stealing = true;
+    bool quit = false;
+};
@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#define fseek64 _fseeki64
+#define ftell64 _ftelli64
+#else
+#include <unistd.h>
+#define fseek64 fseeko
+#define ftell64 ftello
+#endif
+
+#include "TiledRender.h"
+#include "CpuRenderer.h"
+#include "Profiler.h"
+#include "SceneFile.h"
+
+#define kTiledJournalVersion 1
+
+static_assert(sizeof(float3) == 3 * sizeof(float), "bands are written to the PFM as they are");
+
+// Pushes everything written so far to the disk, so the journal never lists a
+// band whose pixels could still be lost
+static bool SyncFile(FILE* file)
+{
+    if (fflush(file) != 0)
+        return false;
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+// Everything that changes the pixels; a journal written for another key
+// belongs to another render
+static uint64_t ComputeRenderKey(const SceneView& scene, const ComputeParams& params, const TiledRenderDesc& desc)
+{
+    uint64_t hash = HashSceneView(scene);
+    // Zero with --no-nee, which the scene content does not show
+    hash = HashBytes(hash, &scene.lightCount, sizeof(scene.lightCount));
+    hash = HashBytes(hash, &params.camera, sizeof(params.camera));
+    hash = HashBytes(hash, &params.rouletteDepth, sizeof(params.rouletteDepth));
+    hash = HashBytes(hash, &desc.width, sizeof(desc.width));
+    hash = HashBytes(hash, &desc.height, sizeof(desc.height));
+    hash = HashBytes(hash, &desc.frames, sizeof(desc.frames));
+    hash = HashBytes(hash, &desc.adaptive, sizeof(desc.adaptive));
+    hash = HashBytes(hash, &desc.trace.maxDepth, sizeof(desc.trace.maxDepth));
+    hash = HashBytes(hash, &desc.trace.samplesPerPixel, sizeof(desc.trace.samplesPerPixel));
+    hash = HashBytes(hash, &desc.trace.sampler, sizeof(desc.trace.sampler));
+    return hash;
+}
+
+// Reads the band height and finished bands of a journal written for key
+static bool ReadJournal(const char* path, uint64_t key, int& bandHeight, std::vector<char>& done)
+{
+    FILE* file = fopen(path, "r");
+    if (!file)
+        return false;
+
+    char line[128];
+    int version;
+    unsigned long long fileKey;
+    bool ok = fgets(line, sizeof(line), file) && sscanf(line, "tiled %d %llx %d", &version, &fileKey, &bandHeight) == 3
+        && version == kTiledJournalVersion && fileKey == key && bandHeight > 0;
+    while (ok && fgets(line, sizeof(line), file))
+    {
+        // Only whole lines count; one cut short by a kill is skipped
+        int band;
+        char end;
+        if (sscanf(line, "band %d%c", &band, &end) == 2 && end == '\n' && band >= 0 && band < int(done.size()))
+            done[band] = 1;
+    }
+    fclose(file);
+    return ok;
+}
+
+bool RenderTiled(ThreadPool& pool, const SceneView& scene, const ComputeParams& baseParams, const TiledRenderDesc& desc,
+                 TiledRenderStats& stats, const std::function<void(int, int)>& progress)
+{
+    stats = TiledRenderStats();
+    if (desc.width <= 0 || desc.height <= 0 || desc.frames <= 0 || !desc.output)
+        return false;
+
+    // Accumulation, plus the variance buffers when sampling adaptively
+    size_t bytesPerRow = size_t(desc.width) * (sizeof(float3) + (desc.adaptive > 0 ? sizeof(float3) + sizeof(uint32_t) : 0));
+    size_t rows = desc.memoryBudget / bytesPerRow;
+    if (rows == 0)
+    {
+        fprintf(stderr, "A %d pixel scanline needs %llu bytes, more than the memory budget\n",
+                desc.width, (unsigned long long)bytesPerRow);
+        return false;
+    }
+    int bandHeight = rows < size_t(desc.height) ? int(rows) : desc.height;
+    if (bandHeight > kCSGroupSizeY)
+        bandHeight -= bandHeight % kCSGroupSizeY;
+
+    char header[64];
+    int headerSize = snprintf(header, sizeof(header), "PF\n%d %d\n-1.0\n", desc.width, desc.height);
+    uint64_t rowBytes = uint64_t(desc.width) * sizeof(float3);
+    uint64_t fileSize = uint64_t(headerSize) + rowBytes * uint64_t(desc.height);
+
+    // Resume when the journal matches this render and the image is all there;
+    // the band height then comes from the journal, whatever the budget now is
+    uint64_t key = ComputeRenderKey(scene, baseParams, desc);
+    std::string journalPath = std::string(desc.output) + ".journal";
+    std::vector<char> done;
+    FILE* image = fopen(desc.output, "r+b");
+    if (image)
+    {
+        int journalBandHeight = 0;
+        done.assign(desc.height, 0);
+        bool resume = fseek64(image, 0, SEEK_END) == 0 && uint64_t(ftell64(image)) == fileSize
+            && ReadJournal(journalPath.c_str(), key, journalBandHeight, done);
+        if (resume)
+        {
+            bandHeight = journalBandHeight;
+        }
+        else
+        {
+            fclose(image);
+            image = nullptr;
+        }
+    }
+    stats.bandHeight = bandHeight;
+    stats.bandCount = (desc.height + bandHeight - 1) / bandHeight;
+    done.resize(stats.bandCount, 0);
+
+    FILE* journal = nullptr;
+    if (image)
+    {
+        // Start on a fresh line in case the last one was cut short
+        journal = fopen(journalPath.c_str(), "a");
+        if (journal)
+            fputc('\n', journal);
+    }
+    else
+    {
+        // Fresh start: size the whole image up front so every band has its place
+        done.assign(stats.bandCount, 0);
+        image = fopen(desc.output, "w+b");
+        bool ok = image && fwrite(header, 1, headerSize, image) == size_t(headerSize)
+            && fseek64(image, int64_t(fileSize - 1), SEEK_SET) == 0 && fputc(0, image) != EOF && SyncFile(image);
+        journal = ok ? fopen(journalPath.c_str(), "w") : nullptr;
+        if (journal)
+        {
+            fprintf(journal, "tiled %d %016llx %d\n", kTiledJournalVersion, (unsigned long long)key, bandHeight);
+            SyncFile(journal);
+        }
+    }
+    if (!image || !journal)
+    {
+        fprintf(stderr, "Cannot write %s\n", image ? journalPath.c_str() : desc.output);
+        if (image) fclose(image);
+        if (journal) fclose(journal);
+        return false;
+    }
+
+    CpuRenderer renderer(pool, desc.width, bandHeight);
+    renderer.SetAdaptive(desc.adaptive);
+    renderer.SetTraceSettings(desc.trace);
+    ComputeParams params = baseParams;
+    bool ok = true;
+    for (int band = 0; band < stats.bandCount && ok; ++band)
+    {
+        if (done[band])
+        {
+            ++stats.resumedBands;
+            continue;
+        }
+
+        int y0 = band * bandHeight;
+        int rowCount = y0 + bandHeight < desc.height ? bandHeight : desc.height - y0;
+        renderer.SetRegion(desc.width, desc.height, 0, y0, desc.width, rowCount);
+        for (int frame = 0; frame < desc.frames; ++frame)
+        {
+            params.frames = frame;
+            params.lerpFactor = float(frame) / float(frame + 1);
+            ProfilerBeginFrame();
+            renderer.RenderFrame(scene, params);
+            ProfilerEndFrame();
+            stats.rayCount += renderer.GetRayCount();
+        }
+
+        {
+            PROFILE_SCOPE(kZoneWriteBand);
+            // PFM rows go bottom-up like the image, so a band is one contiguous run
+            ok = fseek64(image, int64_t(uint64_t(headerSize) + rowBytes * uint64_t(y0)), SEEK_SET) == 0
+                && fwrite(renderer.GetImage(), size_t(rowBytes), rowCount, image) == size_t(rowCount)
+                && SyncFile(image);
+            ok = ok && fprintf(journal, "band %d\n", band) > 0 && SyncFile(journal);
+        }
+        if (ok && progress)
+            progress(band, stats.bandCount);
+    }
+
+    ok &= fclose(image) == 0;
+    ok &= fclose(journal) == 0;
+    if (!ok)
+        fprintf(stderr, "Failed to write %s\n", desc.output);
+    return ok;
+}
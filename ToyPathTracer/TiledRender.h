@@ -0,0 +1,43 @@
+#pragma once
+
+#include <functional>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Maths.h"
+#include "SharedDataStruct.h"
+#include "SceneView.h"
+#include "ThreadPool.h"
+#include "TraceKernels.h"
+
+// Final render of an image of any size in bounded memory. The frame is cut
+// into bands of whole scanlines that fit the memory budget; each band is
+// accumulated on its own and written straight to its place in a PFM file.
+// A journal next to the output lists finished bands, so running the same
+// render again after it was killed only does the missing ones.
+struct TiledRenderDesc
+{
+    int width = 0;
+    int height = 0;
+    int frames = 1;
+    // Bytes the band accumulation buffers may use
+    size_t memoryBudget = size_t(256) << 20;
+    // Passed on to CpuRenderer::SetAdaptive
+    float adaptive = 0;
+    TraceSettings trace;
+    const char* output = nullptr;
+};
+
+struct TiledRenderStats
+{
+    int bandCount = 0;
+    int bandHeight = 0;
+    // Bands found finished in the journal and skipped
+    int resumedBands = 0;
+    uint64_t rayCount = 0;
+};
+
+// Renders desc.output, calling progress(band, bandCount) after each band is
+// safely on disk. params.frames and lerpFactor are filled in per pass.
+bool RenderTiled(ThreadPool& pool, const SceneView& scene, const ComputeParams& params, const TiledRenderDesc& desc,
+                 TiledRenderStats& stats, const std::function<void(int, int)>& progress);
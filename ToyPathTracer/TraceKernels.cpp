@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "TraceKernels.h"
+
+template <uint32_t MaterialTypes, int MaxDepth, int SamplesPerPixel>
+static float3 TracePixelTypes(const SceneView& scene, const TraceSettings& settings, const ComputeParams& params,
+                              int x, int y, int width, int height, uint32_t* rayCounts, PixelAovs* aovs)
+{
+    const int samples = SamplesPerPixel > 0 ? SamplesPerPixel : settings.samplesPerPixel;
+    float3 color;
+    if (aovs)
+        *aovs = PixelAovs();
+    uint32_t frameSeed = settings.hashFrameSeed ? HashFrameSeed(uint32_t(params.frames)) : uint32_t(params.frames);
+    uint32_t seed = (uint32_t(x) * 1973 + uint32_t(y) * 9277 + frameSeed * 26699) | 1;
+    PathSampler sampler = MakePathSampler(settings.sampler, uint32_t(x), uint32_t(y), seed);
+    for (int i = 0; i < samples; ++i)
+    {
+        StartPathSample(sampler, uint32_t(params.frames) * uint32_t(samples) + uint32_t(i));
+        float u = float(x + RandomFloat01(sampler)) / width;
+        float v = float(y + RandomFloat01(sampler)) / height;
+        SetSamplerDimension(sampler, kSamplerDimensionLens);
+        Ray ray = CameraGetRay(params.camera, u, v, sampler);
+        color += TraceTypes<MaterialTypes, MaxDepth>(scene, ray, settings.maxDepth, params.rouletteDepth, rayCounts, aovs, sampler);
+    }
+    if (aovs)
+    {
+        aovs->albedo *= 1.0f / float(samples);
+        aovs->normal *= 1.0f / float(samples);
+        aovs->depth *= 1.0f / float(samples);
+    }
+    return color * (1.0f / float(samples));
+}
+
+#define TRACE_KERNEL(types, depth, spp) { &TracePixelTypes<types, depth, spp>, types, depth, spp }
+#define TRACE_KERNELS_SPP(types, depth) \
+    TRACE_KERNEL(types, depth, 0), TRACE_KERNEL(types, depth, 1), TRACE_KERNEL(types, depth, SAMPLES_PER_PIXEL)
+#define TRACE_KERNELS(types) \
+    TRACE_KERNELS_SPP(types, 0), TRACE_KERNELS_SPP(types, 4), TRACE_KERNELS_SPP(types, kMaxDepth)
+
+// Every combination of the scattering material types, each with the default
+// depth and sample count, a short preview depth and single sample, and a run
+// time fallback for both. Scenes with emitters use the variants for all types,
+// which come first, the generic kernel among them.
+static const TraceKernel s_TraceKernels[] =
+{
+    TRACE_KERNELS(kMaterialTypeAll),
+    TRACE_KERNELS(kMaterialTypeLambertian),
+    TRACE_KERNELS(kMaterialTypeMetal),
+    TRACE_KERNELS(kMaterialTypeDielectric),
+    TRACE_KERNELS(kMaterialTypeLambertian | kMaterialTypeMetal),
+    TRACE_KERNELS(kMaterialTypeLambertian | kMaterialTypeDielectric),
+    TRACE_KERNELS(kMaterialTypeMetal | kMaterialTypeDielectric),
+    TRACE_KERNELS(kMaterialTypeLambertian | kMaterialTypeMetal | kMaterialTypeDielectric),
+};
+
+const TraceKernel& GetGenericTraceKernel()
+{
+    return s_TraceKernels[0];
+}
+
+const TraceKernel& SelectTraceKernel(uint32_t materialTypes, const TraceSettings& settings)
+{
+    if (materialTypes & ~uint32_t(kMaterialTypeAll))
+        return GetGenericTraceKernel();
+    // A scene without materials has no hits to shade
+    if (materialTypes == 0)
+        materialTypes = kMaterialTypeLambertian;
+
+    const TraceKernel* best = &GetGenericTraceKernel();
+    int bestScore = -1;
+    for (const TraceKernel& kernel : s_TraceKernels)
+    {
+        if (kernel.materialTypes != materialTypes)
+            continue;
+        if ((kernel.maxDepth != 0 && kernel.maxDepth != settings.maxDepth)
+            || (kernel.samplesPerPixel != 0 && kernel.samplesPerPixel != settings.samplesPerPixel))
+            continue;
+        int score = (kernel.maxDepth != 0 ? 2 : 0) + (kernel.samplesPerPixel != 0 ? 1 : 0);
+        if (score > bestScore)
+        {
+            best = &kernel;
+            bestScore = score;
+        }
+    }
+    return *best;
+}
+
+void FormatTraceKernel(const TraceKernel& kernel, char* buffer, size_t size)
+{
+    static const char* s_TypeNames[] = { "diffuse", "metal", "glass", "emissive" };
+    char types[64] = "";
+    if (kernel.materialTypes == kMaterialTypeAll)
+    {
+        snprintf(types, sizeof(types), "all");
+    }
+    else
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            if (kernel.materialTypes & (1u << i))
+                snprintf(types + strlen(types), sizeof(types) - strlen(types), "%s%s", types[0] ? "+" : "", s_TypeNames[i]);
+        }
+    }
+
+    char depth[16] = "*", spp[16] = "*";
+    if (kernel.maxDepth)
+        snprintf(depth, sizeof(depth), "%d", kernel.maxDepth);
+    if (kernel.samplesPerPixel)
+        snprintf(spp, sizeof(spp), "%d", kernel.samplesPerPixel);
+    snprintf(buffer, size, "%s depth %s spp %s", types, depth, spp);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "CpuTracer.h"
+
+// Bounce limit and samples per pixel of the CPU tracer, kMaxDepth and
+// SAMPLES_PER_PIXEL unless overridden at run time, and where its random
+// numbers come from
+struct TraceSettings
+{
+    int maxDepth = kMaxDepth;
+    int samplesPerPixel = SAMPLES_PER_PIXEL;
+    SamplerType sampler = kSamplerRandom;
+    // Seeds the random stream from HashFrameSeed of the frame instead of the
+    // frame itself; sampler indices still follow the frame
+    bool hashFrameSeed = false;
+};
+
+// Seeds that are linear in both the pixel and the frame repeat across pixels
+// once thousands of frames are used; a hash of the frame keeps every frame's
+// pixels on unrelated streams.
+inline uint32_t HashFrameSeed(uint32_t frame)
+{
+    // PCG output permutation of an LCG step
+    uint32_t state = frame * 747796405u + 2891336453u;
+    uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+// Averages the samples of pixel (x, y) of a width x height frame, adding the
+// rays of each bounce to the kMaxDepth bins of rayCounts. Writes the pixel's
+// first hits to aovs unless it is null.
+typedef float3 (*TracePixelFunc)(const SceneView& scene, const TraceSettings& settings, const ComputeParams& params,
+                                 int x, int y, int width, int height, uint32_t* rayCounts, PixelAovs* aovs);
+
+// One precompiled variant of the per-pixel trace loop. A maxDepth or
+// samplesPerPixel of 0 means the variant reads it from TraceSettings.
+struct TraceKernel
+{
+    TracePixelFunc tracePixel;
+    uint32_t materialTypes;
+    int maxDepth;
+    int samplesPerPixel;
+};
+
+// The tightest variant for scenes with the given SceneView::materialTypes:
+// exactly those material types, with the depth and sample count baked in when
+// a variant for them exists. Scenes with unknown material types get the
+// generic kernel.
+const TraceKernel& SelectTraceKernel(uint32_t materialTypes, const TraceSettings& settings);
+// All material types, depth and sample count read at run time
+const TraceKernel& GetGenericTraceKernel();
+
+// Such as "diffuse+metal depth 10 spp 4" or "all depth * spp *"
+void FormatTraceKernel(const TraceKernel& kernel, char* buffer, size_t size);
@@ -0,0 +1,253 @@
+#include "Wavefront.h"
+
+#define kWavefrontChunkSize 1024
+
+WavefrontRenderer::WavefrontRenderer(ThreadPool& pool)
+    : pool(pool)
+{
+    paths.resize(kWavefrontBatchSize);
+    hits.resize(kWavefrontBatchSize);
+    results.resize(kWavefrontBatchSize);
+    alive.resize(kWavefrontBatchSize);
+    active.reserve(kWavefrontBatchSize);
+    sorted.reserve(kWavefrontBatchSize);
+}
+
+// Stable parallel counting sort of input into output by key(id) in
+// [0, keyCount); ids with a negative key are dropped. offsets receives
+// keyCount + 1 bucket boundaries.
+template<typename KeyFunc>
+void WavefrontRenderer::Partition(const std::vector<int>& input, int keyCount, KeyFunc key, std::vector<int>& output, int* offsets)
+{
+    int count = int(input.size());
+    int chunks = (count + kWavefrontChunkSize - 1) / kWavefrontChunkSize;
+    chunkCounts.assign(size_t(chunks) * keyCount, 0);
+    pool.ParallelFor(chunks, [&](int chunk, int)
+    {
+        int end = (chunk + 1) * kWavefrontChunkSize < count ? (chunk + 1) * kWavefrontChunkSize : count;
+        int* counts = &chunkCounts[size_t(chunk) * keyCount];
+        for (int i = chunk * kWavefrontChunkSize; i < end; ++i)
+        {
+            int k = key(input[i]);
+            if (k >= 0)
+                ++counts[k];
+        }
+    });
+
+    // Exclusive prefix sum, bucket major so every bucket stays contiguous
+    int total = 0;
+    for (int k = 0; k < keyCount; ++k)
+    {
+        offsets[k] = total;
+        for (int chunk = 0; chunk < chunks; ++chunk)
+        {
+            int& c = chunkCounts[size_t(chunk) * keyCount + k];
+            int n = c;
+            c = total;
+            total += n;
+        }
+    }
+    offsets[keyCount] = total;
+
+    output.resize(total);
+    pool.ParallelFor(chunks, [&](int chunk, int)
+    {
+        int end = (chunk + 1) * kWavefrontChunkSize < count ? (chunk + 1) * kWavefrontChunkSize : count;
+        int* cursor = &chunkCounts[size_t(chunk) * keyCount];
+        for (int i = chunk * kWavefrontChunkSize; i < end; ++i)
+        {
+            int k = key(input[i]);
+            if (k >= 0)
+                output[cursor[k]++] = input[i];
+        }
+    });
+}
+
+uint64_t WavefrontRenderer::RenderFrame(const SceneView& scene, const ComputeParams& params, int width, int height, float3* image,
+                                         uint64_t* depthRayCounts)
+{
+    for (int depth = 0; depth < kMaxDepth; ++depth)
+        depthRayCounts[depth] = 0;
+
+    int pixelCount = width * height;
+    int batchPixels = kWavefrontBatchSize / SAMPLES_PER_PIXEL;
+    for (int firstPixel = 0; firstPixel < pixelCount; firstPixel += batchPixels)
+    {
+        int count = pixelCount - firstPixel < batchPixels ? pixelCount - firstPixel : batchPixels;
+        Generate(params, width, height, firstPixel, count);
+        // Paths advance in lockstep, so every live path traces one ray of
+        // the same bounce per pass
+        for (int depth = 0; !active.empty(); ++depth)
+        {
+            depthRayCounts[depth] += active.size();
+            Extend(scene);
+            SortByMaterial(scene);
+            Terminate(scene, kQueueMiss);
+            Terminate(scene, kQueueEmissive);
+            Terminate(scene, kQueueAbsorbed);
+            Shade<ScatterLambertian<uint32_t>>(scene, params, kQueueLambertian);
+            Shade<ScatterMetal<uint32_t>>(scene, params, kQueueMetal);
+            Shade<ScatterDielectric<uint32_t>>(scene, params, kQueueDielectric);
+            Compact();
+        }
+        Accumulate(params, firstPixel, count, image);
+    }
+
+    uint64_t rayCount = 0;
+    for (int depth = 0; depth < kMaxDepth; ++depth)
+        rayCount += depthRayCounts[depth];
+    return rayCount;
+}
+
+void WavefrontRenderer::Generate(const ComputeParams& params, int width, int height, int firstPixel, int pixelCount)
+{
+    PROFILE_SCOPE(kZoneGenerate);
+    int pathCount = pixelCount * SAMPLES_PER_PIXEL;
+    active.resize(pathCount);
+    int chunks = (pathCount + kWavefrontChunkSize - 1) / kWavefrontChunkSize;
+    pool.ParallelFor(chunks, [&](int chunk, int)
+    {
+        int end = (chunk + 1) * kWavefrontChunkSize < pathCount ? (chunk + 1) * kWavefrontChunkSize : pathCount;
+        for (int id = chunk * kWavefrontChunkSize; id < end; ++id)
+        {
+            int pixel = firstPixel + id / SAMPLES_PER_PIXEL;
+            int sample = id % SAMPLES_PER_PIXEL;
+            uint32_t x = uint32_t(pixel % width);
+            uint32_t y = uint32_t(pixel / width);
+            // Samples run side by side here, so each gets its own stream
+            // instead of continuing the previous sample's like main() does
+            uint32_t seed = (x * 1973 + y * 9277 + uint32_t(params.frames) * 26699) | 1;
+            seed = (seed ^ (uint32_t(sample) * 0x9E3779B9u)) | 1;
+            RNG(seed);
+
+            PathState& path = paths[id];
+            float u = float(x + RandomFloat01(seed)) / width;
+            float v = float(y + RandomFloat01(seed)) / height;
+            path.ray = CameraGetRay(params.camera, u, v, seed);
+            path.throughput = float3(1, 1, 1);
+            path.seed = seed;
+            path.depth = 0;
+            active[id] = id;
+        }
+    });
+}
+
+void WavefrontRenderer::Extend(const SceneView& scene)
+{
+    PROFILE_SCOPE(kZoneExtend);
+    int count = int(active.size());
+    int chunks = (count + kWavefrontChunkSize - 1) / kWavefrontChunkSize;
+    pool.ParallelFor(chunks, [&](int chunk, int)
+    {
+        int end = (chunk + 1) * kWavefrontChunkSize < count ? (chunk + 1) * kWavefrontChunkSize : count;
+        // One ray at a time, as the per-pixel path does
+        for (int i = chunk * kWavefrontChunkSize; i < end; ++i)
+        {
+            int id = active[i];
+            if (!HitWorld(scene, paths[id].ray, kMinT, kMaxT, hits[id]))
+                hits[id].material = -1;
+        }
+    });
+}
+
+void WavefrontRenderer::SortByMaterial(const SceneView& scene)
+{
+    PROFILE_SCOPE(kZoneSort);
+    Partition(active, kQueueCount, [&](int id)
+    {
+        int material = hits[id].material;
+        if (material < 0)
+            return int(kQueueMiss);
+        int type = scene.materials[material].type;
+        return type >= 0 && type <= kMaterialEmissive ? int(kQueueLambertian) + type : int(kQueueAbsorbed);
+    }, sorted, queueOffsets);
+}
+
+void WavefrontRenderer::Terminate(const SceneView& scene, int queue)
+{
+    int begin = queueOffsets[queue];
+    int count = queueOffsets[queue + 1] - begin;
+    int chunks = (count + kWavefrontChunkSize - 1) / kWavefrontChunkSize;
+    pool.ParallelFor(chunks, [&](int chunk, int)
+    {
+        int end = (chunk + 1) * kWavefrontChunkSize < count ? (chunk + 1) * kWavefrontChunkSize : count;
+        for (int i = begin + chunk * kWavefrontChunkSize; i < begin + end; ++i)
+        {
+            int id = sorted[i];
+            PathState& path = paths[id];
+            if (queue == kQueueMiss)
+                results[id] = path.throughput * BackgroundColor(path.ray);
+            else if (queue == kQueueEmissive)
+                results[id] = path.throughput * scene.materials[hits[id].material].albedo;
+            else
+                results[id] = float3(0, 0, 0);
+            alive[id] = 0;
+        }
+    });
+}
+
+template<WavefrontRenderer::ScatterFunc scatter>
+void WavefrontRenderer::Shade(const SceneView& scene, const ComputeParams& params, int queue)
+{
+    PROFILE_SCOPE(kZoneShade);
+    int begin = queueOffsets[queue];
+    int count = queueOffsets[queue + 1] - begin;
+    int chunks = (count + kWavefrontChunkSize - 1) / kWavefrontChunkSize;
+    pool.ParallelFor(chunks, [&](int chunk, int)
+    {
+        int end = (chunk + 1) * kWavefrontChunkSize < count ? (chunk + 1) * kWavefrontChunkSize : count;
+        for (int i = begin + chunk * kWavefrontChunkSize; i < begin + end; ++i)
+        {
+            int id = sorted[i];
+            PathState& path = paths[id];
+            const HitRecord& record = hits[id];
+            if (!scatter(scene.materials[record.material], record, path.throughput, path.ray, path.seed))
+            {
+                results[id] = float3(0, 0, 0);
+                alive[id] = 0;
+            }
+            else if (++path.depth == kMaxDepth)
+            {
+                // Out of bounces, Trace returns the throughput as is
+                results[id] = path.throughput;
+                alive[id] = 0;
+            }
+            else if (!RussianRoulette(path.throughput, path.depth, params.rouletteDepth, path.seed))
+            {
+                results[id] = float3(0, 0, 0);
+                alive[id] = 0;
+            }
+            else
+            {
+                alive[id] = 1;
+            }
+        }
+    });
+}
+
+void WavefrontRenderer::Compact()
+{
+    PROFILE_SCOPE(kZoneCompact);
+    int offsets[2];
+    Partition(sorted, 1, [&](int id) { return alive[id] ? 0 : -1; }, active, offsets);
+}
+
+void WavefrontRenderer::Accumulate(const ComputeParams& params, int firstPixel, int pixelCount, float3* image)
+{
+    PROFILE_SCOPE(kZoneAccumulate);
+    int chunks = (pixelCount + kWavefrontChunkSize - 1) / kWavefrontChunkSize;
+    pool.ParallelFor(chunks, [&](int chunk, int)
+    {
+        int end = (chunk + 1) * kWavefrontChunkSize < pixelCount ? (chunk + 1) * kWavefrontChunkSize : pixelCount;
+        for (int i = chunk * kWavefrontChunkSize; i < end; ++i)
+        {
+            float3 color;
+            for (int sample = 0; sample < SAMPLES_PER_PIXEL; ++sample)
+                color += results[i * SAMPLES_PER_PIXEL + sample];
+            color *= 1.0f / float(SAMPLES_PER_PIXEL);
+
+            float3& pixel = image[firstPixel + i];
+            pixel = lerp(color, pixel, params.lerpFactor);
+        }
+    });
+}
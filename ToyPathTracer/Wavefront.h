@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "CpuTracer.h"
+#include "ThreadPool.h"
+
+// Paths in flight per batch; a frame is rendered in as many batches as needed
+#define kWavefrontBatchSize (1 << 18)
+
+// Path tracing split into stages over queues of paths instead of one bounce
+// loop per pixel. Each bounce extends every live path through the BVH, sorts
+// the hits by material type, then shades each material type on its own, so
+// the Scatter code a thread runs never changes inside a chunk. Terminated
+// paths are compacted away and cost nothing in later bounces. Emitters end
+// their paths without light sampling, as on the GPU. Extend still walks the
+// BVH one ray at a time, with the SoA kernels only inside each leaf; rays are
+// not traced as packets or reordered for coherence.
+class WavefrontRenderer
+{
+public:
+    explicit WavefrontRenderer(ThreadPool& pool);
+
+    // Accumulates one frame into image like CpuRenderer does and returns the
+    // number of rays traced, filling the kMaxDepth entries of depthRayCounts
+    uint64_t RenderFrame(const SceneView& scene, const ComputeParams& params, int width, int height, float3* image,
+                         uint64_t* depthRayCounts);
+
+private:
+    enum Queue
+    {
+        kQueueMiss,
+        kQueueLambertian,
+        kQueueMetal,
+        kQueueDielectric,
+        kQueueEmissive,
+        kQueueAbsorbed,
+        kQueueCount
+    };
+
+    struct PathState
+    {
+        Ray ray;
+        float3 throughput;
+        uint32_t seed;
+        int depth;
+    };
+
+    void Generate(const ComputeParams& params, int width, int height, int firstPixel, int pixelCount);
+    void Extend(const SceneView& scene);
+    void SortByMaterial(const SceneView& scene);
+    void Terminate(const SceneView& scene, int queue);
+    typedef bool (*ScatterFunc)(const Material&, const HitRecord&, float3&, Ray&, uint32_t&);
+    template<ScatterFunc scatter>
+    void Shade(const SceneView& scene, const ComputeParams& params, int queue);
+    void Compact();
+    void Accumulate(const ComputeParams& params, int firstPixel, int pixelCount, float3* image);
+
+    template<typename KeyFunc>
+    void Partition(const std::vector<int>& input, int keyCount, KeyFunc key, std::vector<int>& output, int* offsets);
+
+    ThreadPool& pool;
+
+    // Indexed by path id, pixel * SAMPLES_PER_PIXEL + sample within the batch
+    std::vector<PathState> paths;
+    std::vector<HitRecord> hits;
+    std::vector<float3> results;
+    std::vector<uint8_t> alive;
+
+    std::vector<int> active;
+    std::vector<int> sorted;
+    int queueOffsets[kQueueCount + 1];
+
+    std::vector<int> chunkCounts;
+};
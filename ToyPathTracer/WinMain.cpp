@@ -8,6 +8,8 @@
 #pragma comment (lib ,"imm32.lib")
 
 #include "Config.h"
+#include "AccumFormat.h"
+#include "Profiler.h"
 #include "TestScene.h"
 
 static HINSTANCE g_HInstance;
@@ -30,28 +32,50 @@ static ID3D11RenderTargetView* g_D3D11RenderTarget = nullptr;
 static ID3D11VertexShader* g_VertexShader;
 static ID3D11PixelShader* g_PixelShader;
 static ID3D11ComputeShader* g_ComputeShader;
-static ID3D11Texture2D* g_BackbufferTexture1;
-static ID3D11Texture2D* g_BackbufferTexture2;
-static ID3D11ShaderResourceView* g_BackbufferSRV1;
-static ID3D11ShaderResourceView* g_BackbufferSRV2;
-static ID3D11UnorderedAccessView* g_BackbufferUAV1;
-static ID3D11UnorderedAccessView* g_BackbufferUAV2;
-static ID3D11SamplerState* g_SamplerLinear;
+// The running mean of every pixel in kAccumFormat, traced into in place and
+// drawn from by the pixel shader
+static ID3D11Buffer* g_AccumBuffer;
+static ID3D11ShaderResourceView* g_AccumSRV;
+static ID3D11UnorderedAccessView* g_AccumUAV;
 static ID3D11RasterizerState* g_RasterState;
 
-static int g_BackbufferIndex = 0;
 static int s_FrameCount = 0;
 
 static ID3D11Buffer* g_DataParams;
 static ID3D11ShaderResourceView* g_SRVParams;
 static ID3D11Buffer* g_DataSpheres;     
 static ID3D11ShaderResourceView* g_SRVSpheres;
+static int g_CapacitySpheres;
 static ID3D11Buffer* g_DataMaterials;
 static ID3D11ShaderResourceView* g_SRVMaterials;
+static int g_CapacityMaterials;
+static ID3D11Buffer* g_DataBVHNodes;
+static ID3D11ShaderResourceView* g_SRVBVHNodes;
+static int g_CapacityBVHNodes;
+static ID3D11Buffer* g_DataBVHIndices;
+static ID3D11ShaderResourceView* g_SRVBVHIndices;
+static int g_CapacityBVHIndices;
 static ID3D11Buffer* g_DataCounter;
 static ID3D11UnorderedAccessView* g_UAVCounter;
 
-static ID3D11Query* g_QueryBegin, * g_QueryEnd, * g_QueryDisjoint;
+// Timing queries and ray counts of the frames the GPU may still be working
+// on, plus one. A frame's slot is read when it comes round again, by which
+// time the GPU is done with it, so the CPU never waits on a query or a readback.
+#define kGpuFrameSlots (kFramesInFlight + 1)
+struct GpuFrameSlot
+{
+    ID3D11Query* queryBegin;
+    ID3D11Query* queryEnd;
+    ID3D11Query* queryDisjoint;
+    ID3D11Buffer* counterReadback;
+    uint64_t uploadBytes;
+    bool pending;
+};
+static GpuFrameSlot g_FrameSlots[kGpuFrameSlots];
+static int g_FrameSlot;
+// Frames whose results were still not there when their slot came round;
+// they are left out of the stats rather than waited for
+static int s_LateFrames;
 
 int APIENTRY wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE, _In_ LPWSTR, _In_ int nCmdShow)
 {
@@ -81,12 +105,20 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE, _In_ LPWSTR,
         }
         else
         {
+            ProfilerBeginFrame();
             RenderFrame(scene);
+            ProfilerEndFrame();
         }
     }
 
     ShutdownD3DDevice();
 
+    if (IsProfilerEnabled())
+    {
+        WriteProfileTrace("profile.json");
+        WriteProfileCsv("profile.csv");
+    }
+
     return (int)msg.wParam;
 }
 
@@ -154,6 +186,15 @@ static HRESULT InitD3DDevice()
     if (FAILED(hr))
         return hr;
 
+    // Present blocks once this many frames are queued, which bounds how far
+    // the GPU can be behind the frame slots below
+    IDXGIDevice1* dxgiDevice1 = nullptr;
+    if (SUCCEEDED(g_D3D11Device->QueryInterface(__uuidof(IDXGIDevice1), reinterpret_cast<void**>(&dxgiDevice1))))
+    {
+        dxgiDevice1->SetMaximumFrameLatency(kFramesInFlight);
+        dxgiDevice1->Release();
+    }
+
     // Get DXGI factory
     IDXGIFactory1* dxgiFactory = nullptr;
     {
@@ -284,46 +325,34 @@ void InitRenderResource(TestScene& scene)
                                        computeShaderBlob->GetBufferSize(),
                                        NULL, &g_ComputeShader);
 
-    D3D11_TEXTURE2D_DESC texDesc = {};
-    texDesc.Width = kBackbufferWidth;
-    texDesc.Height = kBackbufferHeight;
-    texDesc.MipLevels = 1;
-    texDesc.ArraySize = 1;
-    texDesc.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
-    texDesc.SampleDesc.Count = 1;
-    texDesc.SampleDesc.Quality = 0;
-    texDesc.Usage = D3D11_USAGE_DEFAULT;
-    texDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
-    texDesc.CPUAccessFlags = 0;
-    texDesc.MiscFlags = 0;
-    g_D3D11Device->CreateTexture2D(&texDesc, NULL, &g_BackbufferTexture1);
-    g_D3D11Device->CreateTexture2D(&texDesc, NULL, &g_BackbufferTexture2);
+    D3D11_BUFFER_DESC accumDesc = {};
+    accumDesc.Usage = D3D11_USAGE_DEFAULT;
+    accumDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+    accumDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS;
+    accumDesc.ByteWidth = UINT(GetAccumPixelBytes(kAccumFormat)) * kBackbufferWidth * kBackbufferHeight;
+    g_D3D11Device->CreateBuffer(&accumDesc, NULL, &g_AccumBuffer);
 
     D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
-    srvDesc.Format = texDesc.Format;
-    srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
-    srvDesc.Texture2D.MipLevels = 1;
-    srvDesc.Texture2D.MostDetailedMip = 0;
-    g_D3D11Device->CreateShaderResourceView(g_BackbufferTexture1, &srvDesc, &g_BackbufferSRV1);
-    g_D3D11Device->CreateShaderResourceView(g_BackbufferTexture2, &srvDesc, &g_BackbufferSRV2);
-
-    D3D11_SAMPLER_DESC smpDesc = {};
-    smpDesc.Filter = D3D11_FILTER_MIN_MAG_LINEAR_MIP_POINT;
-    smpDesc.AddressU = smpDesc.AddressV = smpDesc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
-    g_D3D11Device->CreateSamplerState(&smpDesc, &g_SamplerLinear);
+    srvDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+    srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFEREX;
+    srvDesc.BufferEx.FirstElement = 0;
+    srvDesc.BufferEx.NumElements = accumDesc.ByteWidth / 4;
+    srvDesc.BufferEx.Flags = D3D11_BUFFEREX_SRV_FLAG_RAW;
+    g_D3D11Device->CreateShaderResourceView(g_AccumBuffer, &srvDesc, &g_AccumSRV);
+
+    D3D11_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+    uavDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+    uavDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+    uavDesc.Buffer.Flags = D3D11_BUFFER_UAV_FLAG_RAW;
+    uavDesc.Buffer.FirstElement = 0;
+    uavDesc.Buffer.NumElements = accumDesc.ByteWidth / 4;
+    g_D3D11Device->CreateUnorderedAccessView(g_AccumBuffer, &uavDesc, &g_AccumUAV);
 
     D3D11_RASTERIZER_DESC rasterDesc = {};
     rasterDesc.FillMode = D3D11_FILL_SOLID;
     rasterDesc.CullMode = D3D11_CULL_NONE;
     g_D3D11Device->CreateRasterizerState(&rasterDesc, &g_RasterState);
 
-    D3D11_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
-    uavDesc.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
-    uavDesc.ViewDimension = D3D11_UAV_DIMENSION_TEXTURE2D;
-    uavDesc.Texture2D.MipSlice = 0;
-    g_D3D11Device->CreateUnorderedAccessView(g_BackbufferTexture1, &uavDesc, &g_BackbufferUAV1);
-    g_D3D11Device->CreateUnorderedAccessView(g_BackbufferTexture2, &uavDesc, &g_BackbufferUAV2);
-
     D3D11_BUFFER_DESC bdesc = {};
     bdesc.Usage = D3D11_USAGE_DEFAULT;
     bdesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
@@ -339,126 +368,263 @@ void InitRenderResource(TestScene& scene)
     srvDesc.Buffer.NumElements = 1;
     g_D3D11Device->CreateShaderResourceView(g_DataParams, &srvDesc, &g_SRVParams);
 
-    bdesc.ByteWidth = scene.GetSphereSize() * sizeof(Sphere);
-    bdesc.StructureByteStride = sizeof(Sphere);
-    g_D3D11Device->CreateBuffer(&bdesc, NULL, &g_DataSpheres);
-    srvDesc.Buffer.NumElements = scene.GetSphereSize();
-    g_D3D11Device->CreateShaderResourceView(g_DataSpheres, &srvDesc, &g_SRVSpheres);
-
-    bdesc.ByteWidth = scene.GetMaterialSize() * sizeof(Material);
-    bdesc.StructureByteStride = sizeof(Material);
-    g_D3D11Device->CreateBuffer(&bdesc, NULL, &g_DataMaterials);
-    srvDesc.Buffer.NumElements = scene.GetMaterialSize();
-    g_D3D11Device->CreateShaderResourceView(g_DataMaterials, &srvDesc, &g_SRVMaterials);
-
+    // Scene buffers are created and filled by the first UploadScene
     bdesc.BindFlags |= D3D11_BIND_UNORDERED_ACCESS;
     bdesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS;
-    bdesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
-    bdesc.ByteWidth = 4;
+    bdesc.ByteWidth = 4 * kMaxDepth;
     g_D3D11Device->CreateBuffer(&bdesc, NULL, &g_DataCounter);
     uavDesc.Format = DXGI_FORMAT_R32_TYPELESS;
     uavDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
     uavDesc.Buffer.Flags = D3D11_BUFFER_UAV_FLAG_RAW;
     uavDesc.Buffer.FirstElement = 0;
-    uavDesc.Buffer.NumElements = 1;
+    uavDesc.Buffer.NumElements = kMaxDepth;
     g_D3D11Device->CreateUnorderedAccessView(g_DataCounter, &uavDesc, &g_UAVCounter);
 
-    D3D11_QUERY_DESC qDesc = {};
-    qDesc.Query = D3D11_QUERY_TIMESTAMP;
-    g_D3D11Device->CreateQuery(&qDesc, &g_QueryBegin);
-    g_D3D11Device->CreateQuery(&qDesc, &g_QueryEnd);
-    qDesc.Query = D3D11_QUERY_TIMESTAMP_DISJOINT;
-    g_D3D11Device->CreateQuery(&qDesc, &g_QueryDisjoint);
+    D3D11_BUFFER_DESC readbackDesc = {};
+    readbackDesc.Usage = D3D11_USAGE_STAGING;
+    readbackDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+    readbackDesc.ByteWidth = 4 * kMaxDepth;
+    D3D11_QUERY_DESC timestampDesc = {}, disjointDesc = {};
+    timestampDesc.Query = D3D11_QUERY_TIMESTAMP;
+    disjointDesc.Query = D3D11_QUERY_TIMESTAMP_DISJOINT;
+    for (GpuFrameSlot& slot : g_FrameSlots)
+    {
+        g_D3D11Device->CreateQuery(&timestampDesc, &slot.queryBegin);
+        g_D3D11Device->CreateQuery(&timestampDesc, &slot.queryEnd);
+        g_D3D11Device->CreateQuery(&disjointDesc, &slot.queryDisjoint);
+        g_D3D11Device->CreateBuffer(&readbackDesc, NULL, &slot.counterReadback);
+        slot.pending = false;
+    }
+}
+
+// Grows a structured buffer and its view to hold count elements. Returns true
+// when they were recreated, in which case all of the contents need uploading.
+static bool ReserveStructuredBuffer(ID3D11Buffer*& buffer, ID3D11ShaderResourceView*& srv, int& capacity, int count, UINT stride)
+{
+    if (buffer && count <= capacity)
+        return false;
+
+    // Exact size the first time, so a static scene wastes nothing
+    int newCapacity = count > 0 ? count : 1;
+    if (buffer && newCapacity < capacity + capacity / 2)
+        newCapacity = capacity + capacity / 2;
+    if (srv) srv->Release();
+    if (buffer) buffer->Release();
+
+    D3D11_BUFFER_DESC bdesc = {};
+    bdesc.Usage = D3D11_USAGE_DEFAULT;
+    bdesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    bdesc.CPUAccessFlags = 0;
+    bdesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+    bdesc.ByteWidth = newCapacity * stride;
+    bdesc.StructureByteStride = stride;
+    g_D3D11Device->CreateBuffer(&bdesc, NULL, &buffer);
+
+    D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+    srvDesc.Format = DXGI_FORMAT_UNKNOWN;
+    srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+    srvDesc.Buffer.FirstElement = 0;
+    srvDesc.Buffer.NumElements = newCapacity;
+    g_D3D11Device->CreateShaderResourceView(buffer, &srvDesc, &srv);
+    capacity = newCapacity;
+    return true;
+}
+
+static uint64_t UploadRange(ID3D11Buffer* buffer, const void* data, UINT stride, int begin, int end)
+{
+    if (begin >= end)
+        return 0;
+    D3D11_BOX box = {};
+    box.left = begin * stride;
+    box.right = end * stride;
+    box.top = 0;
+    box.bottom = 1;
+    box.front = 0;
+    box.back = 1;
+    g_D3D11Ctx->UpdateSubresource(buffer, 0, &box, (const char*)data + box.left, 0, 0);
+    return box.right - box.left;
+}
+
+static uint64_t UploadRanges(ID3D11Buffer* buffer, const void* data, UINT stride, const DirtyRanges& ranges)
+{
+    uint64_t bytes = 0;
+    for (const DirtyRanges::Range& range : ranges.GetRanges())
+        bytes += UploadRange(buffer, data, stride, range.begin, range.end);
+    return bytes;
+}
+
+// Copies the parts of the scene that changed since the last call into the
+// persistent GPU buffers and returns the number of bytes sent.
+static uint64_t UploadScene(TestScene& scene)
+{
+    PROFILE_SCOPE(kZoneUpload);
+    const SceneChanges& changes = scene.GetChanges();
+    if (changes.IsEmpty())
+        return 0;
+
+    uint64_t bytes = 0;
+    const std::vector<Sphere>& spheres = scene.GetSpheres();
+    const std::vector<Material>& materials = scene.GetMaterials();
+    if (ReserveStructuredBuffer(g_DataSpheres, g_SRVSpheres, g_CapacitySpheres, int(spheres.size()), sizeof(Sphere)))
+        bytes += UploadRange(g_DataSpheres, spheres.data(), sizeof(Sphere), 0, int(spheres.size()));
+    else
+        bytes += UploadRanges(g_DataSpheres, spheres.data(), sizeof(Sphere), changes.spheres);
+
+    if (ReserveStructuredBuffer(g_DataMaterials, g_SRVMaterials, g_CapacityMaterials, int(materials.size()), sizeof(Material)))
+        bytes += UploadRange(g_DataMaterials, materials.data(), sizeof(Material), 0, int(materials.size()));
+    else
+        bytes += UploadRanges(g_DataMaterials, materials.data(), sizeof(Material), changes.materials);
+
+    // A rebuilt BVH goes up whole, a refit one only needs its nodes
+    const BVH& bvh = scene.GetBVH();
+    if (changes.bvh || changes.bvhBounds)
+    {
+        ReserveStructuredBuffer(g_DataBVHNodes, g_SRVBVHNodes, g_CapacityBVHNodes, bvh.GetNodeSize(), sizeof(BVHNode));
+        bytes += UploadRange(g_DataBVHNodes, bvh.GetNodes().data(), sizeof(BVHNode), 0, bvh.GetNodeSize());
+    }
+    if (changes.bvh)
+    {
+        ReserveStructuredBuffer(g_DataBVHIndices, g_SRVBVHIndices, g_CapacityBVHIndices, bvh.GetIndexSize(), sizeof(uint32_t));
+        bytes += UploadRange(g_DataBVHIndices, bvh.GetIndices().data(), sizeof(uint32_t), 0, bvh.GetIndexSize());
+    }
+
+    scene.ClearChanges();
+    PROFILE_COUNT(kCounterUploadBytes, bytes);
+    return bytes;
+}
+
+// Adds a finished frame's GPU time and ray counts to the stats, or drops the
+// frame when the GPU has not got to it yet
+static void ReadFrameSlot(GpuFrameSlot& slot)
+{
+    slot.pending = false;
+    D3D10_QUERY_DATA_TIMESTAMP_DISJOINT tsDisjoint;
+    UINT64 tsBegin, tsEnd;
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    // The disjoint query ending last does not guarantee the timestamps
+    // before it are readable on every driver, so all three are asked
+    if (g_D3D11Ctx->GetData(slot.queryDisjoint, &tsDisjoint, sizeof(tsDisjoint), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK
+        || g_D3D11Ctx->GetData(slot.queryBegin, &tsBegin, sizeof(tsBegin), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK
+        || g_D3D11Ctx->GetData(slot.queryEnd, &tsEnd, sizeof(tsEnd), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK
+        || FAILED(g_D3D11Ctx->Map(slot.counterReadback, 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped)))
+    {
+        ++s_LateFrames;
+        return;
+    }
+
+    uint32_t counts[kMaxDepth];
+    for (int depth = 0; depth < kMaxDepth; ++depth)
+        counts[depth] = ((const uint32_t*)mapped.pData)[depth];
+    g_D3D11Ctx->Unmap(slot.counterReadback, 0);
+    if (tsDisjoint.Disjoint)
+        return;
+
+    static uint64_t s_RayCounter;
+    static uint64_t s_DepthRayCounter[kMaxDepth];
+    for (int depth = 0; depth < kMaxDepth; ++depth)
+    {
+        s_DepthRayCounter[depth] += counts[depth];
+        s_RayCounter += counts[depth];
+    }
+
+    static float s_Time;
+    s_Time += float(tsEnd - tsBegin) / float(tsDisjoint.Frequency);
+
+    static uint64_t s_UploadTotal;
+    s_UploadTotal += slot.uploadBytes;
+
+    static float s_Count;
+    if (++s_Count > 150)
+    {
+        float avgTime = s_Time / s_Count;
+        float avgRayCounter = s_RayCounter / s_Count;
+        char s_Buffer[200];
+        sprintf_s(s_Buffer, sizeof(s_Buffer), "%.2fms (%.1f FPS) %.1fMrays/s %.2fMrays/frame frames %i upload %.1fKB/frame\n",
+                  avgTime * 1000.0f,
+                  1.f / avgTime,
+                  avgRayCounter / avgTime * 1.0e-6f,
+                  avgRayCounter * 1.0e-6f,
+                  s_FrameCount,
+                  s_UploadTotal / s_Count / 1024.0f);
+        SetWindowTextA(g_Wnd, s_Buffer);
+
+        // Too long for the title, the bounce breakdown goes to the debugger
+        int length = sprintf_s(s_Buffer, sizeof(s_Buffer), "Mrays/frame per bounce:");
+        for (int depth = 0; depth < kMaxDepth; ++depth)
+        {
+            length += sprintf_s(s_Buffer + length, sizeof(s_Buffer) - length, " %.2f", s_DepthRayCounter[depth] / s_Count * 1.0e-6f);
+            s_DepthRayCounter[depth] = 0;
+        }
+        sprintf_s(s_Buffer + length, sizeof(s_Buffer) - length, ", %d frames late\n", s_LateFrames);
+        OutputDebugStringA(s_Buffer);
+        s_Count = 0;
+        s_Time = 0;
+        s_RayCounter = 0;
+        s_UploadTotal = 0;
+        s_LateFrames = 0;
+    }
 }
 
 static void RenderFrame(TestScene& scene)
 {
+    // Accumulated frames are stale once the scene changed
+    if (!scene.GetChanges().IsEmpty())
+        s_FrameCount = 0;
+
     ComputeParams dataParams;
     dataParams.frames = s_FrameCount;
     dataParams.lerpFactor = float(s_FrameCount) / float(s_FrameCount + 1);
     dataParams.camera = MakeCamera(float3(13, 2, 3), float3(0, 0, 0), float3(0, 1, 0), 20, float(kBackbufferWidth) / float(kBackbufferHeight), 0.1, 10);
     //dataParams.camera = MakeCamera(float3(3, 3, 2), float3(0, 0, -1), float3(0, 1, 0), 20, float(kBackbufferWidth) / float(kBackbufferHeight), 0.5, 5.2);
     dataParams.count = scene.GetSphereSize();
+    dataParams.rouletteDepth = kRussianRouletteDepth;
     g_D3D11Ctx->UpdateSubresource(g_DataParams, 0, NULL, &dataParams, 0, 0);
 
-    void* dataSpheres = malloc(scene.GetSphereSize() * sizeof(Sphere));
-    void* dataMaterials = malloc(scene.GetMaterialSize() * sizeof(Material));
-    scene.GetData(dataSpheres, dataMaterials);
-    g_D3D11Ctx->UpdateSubresource(g_DataSpheres, 0, NULL, dataSpheres, 0, 0);
-    g_D3D11Ctx->UpdateSubresource(g_DataMaterials, 0, NULL, dataMaterials, 0, 0);
-    free(dataSpheres);
-    free(dataMaterials);
+    // Reading the slot issued kGpuFrameSlots frames ago makes room for this one
+    GpuFrameSlot& slot = g_FrameSlots[g_FrameSlot];
+    if (slot.pending)
+        ReadFrameSlot(slot);
+    g_FrameSlot = (g_FrameSlot + 1) % kGpuFrameSlots;
+    slot.uploadBytes = UploadScene(scene);
+    slot.pending = true;
 
-    g_BackbufferIndex = 1 - g_BackbufferIndex;
     g_D3D11Ctx->CSSetShader(g_ComputeShader, NULL, 0);
     ID3D11ShaderResourceView* srvs[] = {
-        g_BackbufferIndex == 0 ? g_BackbufferSRV2 : g_BackbufferSRV1,
         g_SRVParams,
         g_SRVSpheres,
-        g_SRVMaterials
+        g_SRVMaterials,
+        g_SRVBVHNodes,
+        g_SRVBVHIndices
     };
     g_D3D11Ctx->CSSetShaderResources(0, ARRAYSIZE(srvs), srvs);
     ID3D11UnorderedAccessView* uavs[] = {
-        g_BackbufferIndex == 0 ? g_BackbufferUAV1 : g_BackbufferUAV2,
+        g_AccumUAV,
         g_UAVCounter
     };
     g_D3D11Ctx->CSSetUnorderedAccessViews(0, ARRAYSIZE(uavs), uavs, NULL);
-    g_D3D11Ctx->Begin(g_QueryDisjoint);
-    g_D3D11Ctx->End(g_QueryBegin);
+    g_D3D11Ctx->Begin(slot.queryDisjoint);
+    g_D3D11Ctx->End(slot.queryBegin);
     g_D3D11Ctx->Dispatch(kBackbufferWidth / kCSGroupSizeX, kBackbufferHeight / kCSGroupSizeY, 1);
-    g_D3D11Ctx->End(g_QueryEnd);
+    g_D3D11Ctx->End(slot.queryEnd);
     uavs[0] = NULL;
     g_D3D11Ctx->CSSetUnorderedAccessViews(0, ARRAYSIZE(uavs), uavs, NULL);
 
+    // The counts are copied out and cleared on the GPU, so nothing here maps
+    // a buffer the dispatch is still writing
+    g_D3D11Ctx->CopyResource(slot.counterReadback, g_DataCounter);
+    UINT zeroCounts[4] = {};
+    g_D3D11Ctx->ClearUnorderedAccessViewUint(g_UAVCounter, zeroCounts);
+
     g_D3D11Ctx->VSSetShader(g_VertexShader, NULL, 0);
     g_D3D11Ctx->PSSetShader(g_PixelShader, NULL, 0);
-    g_D3D11Ctx->PSSetShaderResources(0, 1, g_BackbufferIndex == 0 ? &g_BackbufferSRV1 : &g_BackbufferSRV2);
-    g_D3D11Ctx->PSSetSamplers(0, 1, &g_SamplerLinear);
+    g_D3D11Ctx->PSSetShaderResources(0, 1, &g_AccumSRV);
     g_D3D11Ctx->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
     g_D3D11Ctx->RSSetState(g_RasterState);
     g_D3D11Ctx->Draw(3, 0);
+    // Free the buffer for the next frame's UAV
+    ID3D11ShaderResourceView* nullSRV = NULL;
+    g_D3D11Ctx->PSSetShaderResources(0, 1, &nullSRV);
     g_D3D11SwapChain->Present(0, 0);
     ++s_FrameCount;
-    g_D3D11Ctx->End(g_QueryDisjoint);
-
-    while (g_D3D11Ctx->GetData(g_QueryDisjoint, NULL, 0, 0) == S_FALSE) { Sleep(0); }
-    D3D10_QUERY_DATA_TIMESTAMP_DISJOINT tsDisjoint;
-    g_D3D11Ctx->GetData(g_QueryDisjoint, &tsDisjoint, sizeof(tsDisjoint), 0);
-    if (!tsDisjoint.Disjoint)
-    {
-        UINT64 tsBegin, tsEnd;
-        // Note: on some GPUs/drivers, even when the disjoint query above already said "yeah I have data",
-        // might still not return "I have data" for timestamp queries before it.
-        while (g_D3D11Ctx->GetData(g_QueryBegin, &tsBegin, sizeof(tsBegin), 0) == S_FALSE) { Sleep(0); }
-        while (g_D3D11Ctx->GetData(g_QueryEnd, &tsEnd, sizeof(tsEnd), 0) == S_FALSE) { Sleep(0); }
-
-        static float s_Time;
-        s_Time += float(tsEnd - tsBegin) / float(tsDisjoint.Frequency);
-
-        static uint64_t s_RayCounter;
-        D3D11_MAPPED_SUBRESOURCE mapped;
-        g_D3D11Ctx->Map(g_DataCounter, 0, D3D11_MAP_READ, 0, &mapped);
-        s_RayCounter += *(const int*)mapped.pData;
-        g_D3D11Ctx->Unmap(g_DataCounter, 0);
-        int zeroCount = 0;
-        g_D3D11Ctx->UpdateSubresource(g_DataCounter, 0, NULL, &zeroCount, 0, 0);
-
-        static float s_Count;
-        if (++s_Count > 150)
-        {
-            float avgTime = s_Time / s_Count;
-            float avgRayCounter = s_RayCounter / s_Count;
-            char s_Buffer[200];
-            sprintf_s(s_Buffer, sizeof(s_Buffer), "%.2fms (%.1f FPS) %.1fMrays/s %.2fMrays/frame frames %i\n",
-                      avgTime * 1000.0f,
-                      1.f / avgTime,
-                      avgRayCounter / avgTime * 1.0e-6f,
-                      avgRayCounter * 1.0e-6f,
-                      s_FrameCount);
-            SetWindowTextA(g_Wnd, s_Buffer);
-            s_Count = 0;
-            s_Time = 0;
-            s_RayCounter = 0;
-        }
-    }
+    g_D3D11Ctx->End(slot.queryDisjoint);
 }